@@ -0,0 +1,209 @@
+/**
+ * @file bench_loop_net.c
+ * @brief In-process broker transport for the benchmarks
+ *
+ * send() runs a minimal broker inline and queues its replies, recv() reads
+ * them back. Blocking goes through OS port events only, so the transport
+ * works unchanged on every kernel the benchmark targets.
+ */
+
+#include "mqtt_bench.h"
+#include "mqtt_os.h"
+#include "mqtt_net.h"
+#include <string.h>
+
+/** @brief Bytes buffered in each direction */
+#define BENCH_LOOP_BUF_SIZE     4096
+
+/** @brief Longest send() waits for the client to drain replies */
+#define BENCH_LOOP_SEND_TIMEOUT_MS  5000
+
+typedef struct {
+    mqtt_mutex_t lock;
+    mqtt_event_t rx_event;             /* Replies queued */
+    mqtt_event_t tx_event;             /* Replies drained */
+    uint8_t in[BENCH_LOOP_BUF_SIZE];   /* Client bytes not yet forming a packet */
+    size_t in_len;
+    uint8_t out[BENCH_LOOP_BUF_SIZE];  /* Broker replies not yet received */
+    size_t out_len;
+} bench_loop_conn_t;
+
+static size_t bench_loop_reply_len(size_t body_len) {
+    return 1 + (body_len < 128 ? 1 : body_len < 16384 ? 2 : 3) + body_len;
+}
+
+static void bench_loop_put(bench_loop_conn_t* conn, uint8_t b0, const uint8_t* hdr, size_t hdr_len,
+                           const uint8_t* body, size_t body_len) {
+    size_t remaining = hdr_len + body_len;
+    uint8_t* p = conn->out + conn->out_len;
+
+    *p++ = b0;
+    do {
+        *p = remaining & 0x7F;
+        remaining >>= 7;
+        if (remaining) *p |= 0x80;
+        p++;
+    } while (remaining);
+    if (hdr_len) memcpy(p, hdr, hdr_len);
+    if (body_len) memcpy(p + hdr_len, body, body_len);
+    conn->out_len = (size_t)(p - conn->out) + hdr_len + body_len;
+}
+
+/*
+ * Answer the first complete packet in conn->in. Returns the bytes consumed,
+ * 0 if the packet is incomplete or, with *full set, its replies do not fit.
+ */
+static size_t bench_loop_broker(bench_loop_conn_t* conn, int* full) {
+    const uint8_t* buf = conn->in;
+    size_t remaining = 0, pos = 1, need = 0;
+    int shift = 0;
+
+    do {
+        if (pos >= conn->in_len) return 0;
+        remaining |= (size_t)(buf[pos] & 0x7F) << shift;
+        shift += 7;
+    } while (buf[pos++] & 0x80);
+    if (pos + remaining > conn->in_len) return 0;
+
+    const uint8_t* body = buf + pos;
+    uint8_t type = buf[0] >> 4;
+    uint8_t qos = (buf[0] >> 1) & 0x03;
+    size_t topic_end = 0, payload_start = 0;
+
+    switch (type) {
+    case 1:  need = 4; break;   /* CONNACK */
+    case 3:                     /* PUBACK and the echo */
+        topic_end = 2 + ((body[0] << 8) | body[1]);
+        payload_start = topic_end + (qos ? 2 : 0);
+        need = (qos == 1 ? 4 : 0) + bench_loop_reply_len(remaining - payload_start + topic_end);
+        break;
+    case 8:  need = 5; break;   /* SUBACK */
+    case 12: need = 2; break;   /* PINGRESP */
+    default: break;
+    }
+    if (conn->out_len + need > BENCH_LOOP_BUF_SIZE) {
+        *full = 1;
+        return 0;
+    }
+
+    switch (type) {
+    case 1: {
+        const uint8_t connack[2] = { 0, 0 };
+        bench_loop_put(conn, 0x20, connack, 2, NULL, 0);
+        break;
+    }
+    case 3:
+        if (qos == 1) bench_loop_put(conn, 0x40, body + topic_end, 2, NULL, 0);
+        bench_loop_put(conn, 0x30, body, topic_end, body + payload_start, remaining - payload_start);
+        break;
+    case 8: {
+        const uint8_t suback[3] = { body[0], body[1], 0 };
+        bench_loop_put(conn, 0x90, suback, 3, NULL, 0);
+        break;
+    }
+    case 12:
+        bench_loop_put(conn, 0xD0, NULL, 0, NULL, 0);
+        break;
+    default:
+        break;
+    }
+    return pos + remaining;
+}
+
+static mqtt_socket_t bench_loop_connect(const char* host, uint16_t port, uint32_t timeout_ms) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    (void)host;
+    (void)port;
+    (void)timeout_ms;
+
+    if (!os->event_create) return NULL;
+
+    bench_loop_conn_t* conn = os->malloc(sizeof(bench_loop_conn_t));
+    if (!conn) return NULL;
+    memset(conn, 0, sizeof(bench_loop_conn_t));
+
+    conn->lock = os->mutex_create();
+    conn->rx_event = os->event_create();
+    conn->tx_event = os->event_create();
+    if (!conn->lock || !conn->rx_event || !conn->tx_event) {
+        if (conn->lock) os->mutex_destroy(conn->lock);
+        if (conn->rx_event) os->event_destroy(conn->rx_event);
+        if (conn->tx_event) os->event_destroy(conn->tx_event);
+        os->free(conn);
+        return NULL;
+    }
+    return (mqtt_socket_t)conn;
+}
+
+static void bench_loop_disconnect(mqtt_socket_t sock) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    bench_loop_conn_t* conn = (bench_loop_conn_t*)sock;
+
+    os->mutex_destroy(conn->lock);
+    os->event_destroy(conn->rx_event);
+    os->event_destroy(conn->tx_event);
+    os->free(conn);
+}
+
+static int bench_loop_send(mqtt_socket_t sock, const uint8_t* buf, size_t len) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    bench_loop_conn_t* conn = (bench_loop_conn_t*)sock;
+    uint64_t deadline = mqtt_os_time_us() + (uint64_t)BENCH_LOOP_SEND_TIMEOUT_MS * 1000;
+
+    os->mutex_lock(conn->lock);
+    if (len > BENCH_LOOP_BUF_SIZE - conn->in_len) {
+        os->mutex_unlock(conn->lock);
+        return -1;
+    }
+    memcpy(conn->in + conn->in_len, buf, len);
+    conn->in_len += len;
+
+    for (;;) {
+        size_t used;
+        int full = 0;
+        while (conn->in_len > 0 && (used = bench_loop_broker(conn, &full)) > 0) {
+            conn->in_len -= used;
+            memmove(conn->in, conn->in + used, conn->in_len);
+        }
+        if (conn->out_len > 0) os->event_set(conn->rx_event);
+        os->mutex_unlock(conn->lock);
+        if (!full) return (int)len;
+
+        /* Wait for the client to drain replies */
+        if (mqtt_os_time_us() >= deadline) return -1;
+        os->event_wait(conn->tx_event, 10);
+        os->mutex_lock(conn->lock);
+    }
+}
+
+static int bench_loop_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t timeout_ms) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    bench_loop_conn_t* conn = (bench_loop_conn_t*)sock;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        os->mutex_lock(conn->lock);
+        size_t n = conn->out_len < len ? conn->out_len : len;
+        if (n > 0) {
+            memcpy(buf, conn->out, n);
+            conn->out_len -= n;
+            memmove(conn->out, conn->out + n, conn->out_len);
+            os->event_set(conn->tx_event);
+        }
+        os->mutex_unlock(conn->lock);
+
+        if (n > 0) return (int)n;
+        if (attempt == 0) os->event_wait(conn->rx_event, timeout_ms);
+    }
+    return 0;
+}
+
+static const mqtt_net_api_t bench_loop_net_api = {
+    .connect = bench_loop_connect,
+    .disconnect = bench_loop_disconnect,
+    .send = bench_loop_send,
+    .recv = bench_loop_recv
+};
+
+void mqtt_bench_loop_init(void) {
+    mqtt_net_init(&bench_loop_net_api);
+}
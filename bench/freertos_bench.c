@@ -0,0 +1,98 @@
+/**
+ * @file freertos_bench.c
+ * @brief Port overhead benchmark on FreeRTOS
+ *
+ * Runs freertos_os.c on the FreeRTOS POSIX/Linux simulator port. CPU time
+ * is the run time of all tasks except idle, measured with the host clock;
+ * stack high-water marks and heap usage come from the kernel (heap_4).
+ * Built with MQTT_OS_STATIC as well, the client and kernel objects leave
+ * the FreeRTOS heap.
+ */
+
+#include "mqtt.h"
+#include "mqtt_bench.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FREERTOS_BENCH_STACK_SIZE   16384
+#define FREERTOS_BENCH_PRIORITY     (tskIDLE_PRIORITY + 2)
+
+void mqtt_freertos_init(void);
+
+uint64_t freertos_bench_host_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t freertos_bench_cpu_time_us(void) {
+    return portGET_RUN_TIME_COUNTER_VALUE() - ulTaskGetIdleRunTimeCounter();
+}
+
+static int32_t freertos_bench_stack_unused(const char* name) {
+    TaskHandle_t task = name ? xTaskGetHandle(name) : NULL;
+    if (name && !task) return -1;
+    return (int32_t)(uxTaskGetStackHighWaterMark(task) * sizeof(StackType_t));
+}
+
+static int32_t freertos_bench_heap_used(void) {
+    return (int32_t)(configTOTAL_HEAP_SIZE - xPortGetFreeHeapSize());
+}
+
+static int32_t freertos_bench_heap_peak(void) {
+    return (int32_t)(configTOTAL_HEAP_SIZE - xPortGetMinimumEverFreeHeapSize());
+}
+
+#ifdef MQTT_OS_STATIC
+static StackType_t freertos_bench_rx_stack[MQTT_BENCH_RX_STACK / sizeof(StackType_t)];
+#endif
+
+static const mqtt_bench_port_t freertos_bench_port = {
+#ifdef MQTT_OS_STATIC
+    .name = "freertos-static",
+#else
+    .name = "freertos",
+#endif
+    .cpu_time_us = freertos_bench_cpu_time_us,
+    .stack_unused = freertos_bench_stack_unused,
+    .heap_used = freertos_bench_heap_used,
+    .heap_peak = freertos_bench_heap_peak,
+#ifdef MQTT_OS_STATIC
+    .rx_stack = freertos_bench_rx_stack
+#endif
+};
+
+static void freertos_bench_task(void* arg) {
+    (void)arg;
+    mqtt_freertos_init();
+    int ret = mqtt_bench_run(&freertos_bench_port);
+    fflush(stdout);
+    exit(ret == 0 ? 0 : 1);
+}
+
+/* Kernel task memory, required by configSUPPORT_STATIC_ALLOCATION */
+void vApplicationGetIdleTaskMemory(StaticTask_t** tcb, StackType_t** stack, uint32_t* depth) {
+    static StaticTask_t idle_tcb;
+    static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+    *tcb = &idle_tcb;
+    *stack = idle_stack;
+    *depth = configMINIMAL_STACK_SIZE;
+}
+
+void vApplicationGetTimerTaskMemory(StaticTask_t** tcb, StackType_t** stack, uint32_t* depth) {
+    static StaticTask_t timer_tcb;
+    static StackType_t timer_stack[configTIMER_TASK_STACK_DEPTH];
+    *tcb = &timer_tcb;
+    *stack = timer_stack;
+    *depth = configTIMER_TASK_STACK_DEPTH;
+}
+
+int main(void) {
+    xTaskCreate(freertos_bench_task, "bench", FREERTOS_BENCH_STACK_SIZE / sizeof(StackType_t),
+                NULL, FREERTOS_BENCH_PRIORITY, NULL);
+    vTaskStartScheduler();
+    return 1;  /* Only reached if the scheduler could not start */
+}
@@ -0,0 +1,147 @@
+/**
+ * @file mqtt_bench.c
+ * @brief Port overhead benchmark body
+ *
+ * Publishes MQTT_BENCH_MESSAGES messages at QoS 0 and QoS 1 through the
+ * in-process broker and waits for every echo, keeping a small window in
+ * flight. Reports CPU time per message round trip, the unused stack of the
+ * receive and calling threads, and the kernel heap taken by the client.
+ * Output is plain integers so it also works with minimal printf.
+ */
+
+#include "mqtt_bench.h"
+#include "mqtt.h"
+#include <stdio.h>
+#include <string.h>
+
+/** @brief Messages published before their echoes are awaited */
+#define BENCH_WINDOW        8
+
+/** @brief Untimed messages run first to settle caches and lazy allocation */
+#define BENCH_WARMUP        100
+
+/** @brief Longest wait for a single echo */
+#define BENCH_ECHO_TIMEOUT_MS   2000
+
+#define BENCH_TOPIC         "bench/echo"
+
+static mqtt_sem_t bench_echoes;
+
+static void bench_on_message(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    (void)topic;
+    (void)payload;
+    (void)len;
+    (void)user_data;
+    mqtt_os_get()->sem_post(bench_echoes);
+}
+
+static int bench_wait_echo(void) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (os->sem_timedwait) return os->sem_timedwait(bench_echoes, BENCH_ECHO_TIMEOUT_MS);
+    return os->sem_wait(bench_echoes);
+}
+
+/* Publish count messages and wait for all echoes; returns -1 on a lost echo */
+static int bench_round_trips(mqtt_client_t* client, uint8_t qos, uint32_t count) {
+    static uint8_t payload[MQTT_BENCH_PAYLOAD];
+    uint32_t outstanding = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (outstanding == BENCH_WINDOW) {
+            if (bench_wait_echo() != 0) return -1;
+            outstanding--;
+        }
+        memcpy(payload, &i, sizeof(i));
+        if (mqtt_client_publish(client, BENCH_TOPIC, payload, sizeof(payload), qos) != 0) return -1;
+        outstanding++;
+    }
+    while (outstanding > 0) {
+        if (bench_wait_echo() != 0) return -1;
+        outstanding--;
+    }
+    return 0;
+}
+
+static int32_t bench_probe(int32_t (*probe)(void)) {
+    return probe ? probe() : -1;
+}
+
+static int32_t bench_stack(const mqtt_bench_port_t* port, const char* name) {
+    return port->stack_unused ? port->stack_unused(name) : -1;
+}
+
+int mqtt_bench_run(const mqtt_bench_port_t* port) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    int ret = 0;
+
+    mqtt_bench_loop_init();
+    bench_echoes = os->sem_create(0);
+    if (!bench_echoes) return -1;
+
+    /* Before the baseline, stdio may allocate its buffer on first use */
+    printf("[%s] %u messages of %u bytes per QoS, window %u\n", port->name,
+           (unsigned)MQTT_BENCH_MESSAGES, (unsigned)MQTT_BENCH_PAYLOAD, (unsigned)BENCH_WINDOW);
+
+    int32_t heap_base = bench_probe(port->heap_used);
+
+    mqtt_config_t config = {
+        .host = "bench",
+        .port = 1883,
+        .client_id = "mqtt_bench",
+        .keepalive = 60,
+        .clean_session = 1,
+        .msg_cb = bench_on_message,
+        .recv_thread = {
+            .stack_size = MQTT_BENCH_RX_STACK,
+            .name = MQTT_BENCH_RX_NAME,
+            .stack = port->rx_stack
+        }
+    };
+
+    mqtt_client_t* client = mqtt_client_create(&config);
+    if (!client) {
+        printf("[%s] client creation failed\n", port->name);
+        os->sem_destroy(bench_echoes);
+        return -1;
+    }
+    int32_t heap_client = bench_probe(port->heap_used);
+    mqtt_client_subscribe(client, BENCH_TOPIC, 0);
+
+    for (uint8_t qos = 0; qos <= 1 && ret == 0; qos++) {
+        if (bench_round_trips(client, qos, BENCH_WARMUP) != 0) {
+            ret = -1;
+            break;
+        }
+
+        uint64_t cpu_start = port->cpu_time_us ? port->cpu_time_us() : 0;
+        uint64_t wall_start = mqtt_os_time_us();
+        ret = bench_round_trips(client, qos, MQTT_BENCH_MESSAGES);
+        uint64_t wall = mqtt_os_time_us() - wall_start;
+        uint64_t cpu = port->cpu_time_us ? port->cpu_time_us() - cpu_start : 0;
+
+        if (ret != 0) {
+            printf("[%s] qos%u: echo lost\n", port->name, qos);
+            break;
+        }
+        printf("[%s] qos%u: cpu %lu ns/msg, wall %lu ns/msg\n", port->name, qos,
+               port->cpu_time_us ? (unsigned long)(cpu * 1000 / MQTT_BENCH_MESSAGES) : 0ul,
+               (unsigned long)(wall * 1000 / MQTT_BENCH_MESSAGES));
+    }
+
+    printf("[%s] stack unused: rx %ld of %u, caller %ld bytes\n", port->name,
+           (long)bench_stack(port, MQTT_BENCH_RX_NAME), (unsigned)MQTT_BENCH_RX_STACK,
+           (long)bench_stack(port, NULL));
+
+    mqtt_client_destroy(client);
+    int32_t heap_after = bench_probe(port->heap_used);
+    os->sem_destroy(bench_echoes);
+
+    if (heap_base >= 0) {
+        printf("[%s] heap: client %ld, peak %ld, after destroy %ld bytes\n", port->name,
+               (long)(heap_client - heap_base), (long)bench_probe(port->heap_peak),
+               (long)(heap_after - heap_base));
+    } else {
+        printf("[%s] heap: not available\n", port->name);
+    }
+    return ret;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file mqtt_bench.h
+ * @brief Port overhead benchmark shared by the RTOS simulator targets
+ *
+ * The benchmark runs the client against an in-process broker transport
+ * built only on the OS API, so the numbers reflect the core and the OS
+ * port rather than a network stack. Each target supplies the probes below
+ * for its kernel and calls mqtt_bench_run() from a thread of that kernel.
+ */
+
+#ifndef MQTT_BENCH_H
+#define MQTT_BENCH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Messages timed per QoS level */
+#ifndef MQTT_BENCH_MESSAGES
+#define MQTT_BENCH_MESSAGES     10000
+#endif
+
+/** @brief Payload size of each message in bytes */
+#ifndef MQTT_BENCH_PAYLOAD
+#define MQTT_BENCH_PAYLOAD      64
+#endif
+
+/** @brief Stack size requested for the receive thread */
+#ifndef MQTT_BENCH_RX_STACK
+#define MQTT_BENCH_RX_STACK     4096
+#endif
+
+/** @brief Receive thread name, used to look it up for stack probing */
+#define MQTT_BENCH_RX_NAME      "mqtt_rx"
+
+/**
+ * @brief Kernel specific probes
+ *
+ * Probes that a kernel cannot answer return -1 and are reported as such.
+ */
+typedef struct {
+    const char* name;                          /**< Port name in the report */
+    uint64_t (*cpu_time_us)(void);             /**< CPU time consumed by all non-idle threads */
+    int32_t (*stack_unused)(const char* name); /**< Unused stack bytes of a thread, NULL for the caller */
+    int32_t (*heap_used)(void);                /**< Kernel heap bytes currently allocated */
+    int32_t (*heap_peak)(void);                /**< Most kernel heap bytes ever allocated */
+    void* rx_stack;                            /**< MQTT_BENCH_RX_STACK bytes for static builds, else NULL */
+} mqtt_bench_port_t;
+
+/**
+ * @brief Register the in-process broker transport
+ *
+ * Every connection gets its own broker that acknowledges CONNECT,
+ * SUBSCRIBE, PINGREQ and QoS 1 PUBLISH and echoes each PUBLISH back at
+ * QoS 0. Requires an OS port providing events.
+ */
+void mqtt_bench_loop_init(void);
+
+/**
+ * @brief Run the benchmark and print its report
+ * @param port Probes of the OS port under test, registered beforehand
+ * @return 0 on success, -1 if the client failed or echoes went missing
+ */
+int mqtt_bench_run(const mqtt_bench_port_t* port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_BENCH_H */
@@ -0,0 +1,43 @@
+/**
+ * @file posix_bench.c
+ * @brief Port overhead benchmark on the POSIX port
+ *
+ * Host baseline for the RTOS simulator benchmarks. Stack high-water marks
+ * are not available for pthreads; heap figures come from glibc mallinfo2()
+ * and include thread caches glibc keeps after the receive thread exits.
+ */
+
+#include "mqtt.h"
+#include "mqtt_bench.h"
+#include <time.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define BENCH_HAVE_MALLINFO2
+#endif
+
+void mqtt_posix_init(void);
+
+static uint64_t posix_bench_cpu_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#ifdef BENCH_HAVE_MALLINFO2
+static int32_t posix_bench_heap_used(void) {
+    return (int32_t)mallinfo2().uordblks;
+}
+#endif
+
+static const mqtt_bench_port_t posix_bench_port = {
+    .name = "posix",
+    .cpu_time_us = posix_bench_cpu_time_us,
+#ifdef BENCH_HAVE_MALLINFO2
+    .heap_used = posix_bench_heap_used
+#endif
+};
+
+int main(void) {
+    mqtt_posix_init();
+    return mqtt_bench_run(&posix_bench_port) == 0 ? 0 : 1;
+}
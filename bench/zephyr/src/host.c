@@ -0,0 +1,21 @@
+/**
+ * @file host.c
+ * @brief Host side helpers for the benchmark on native_sim
+ *
+ * Compiled into the native simulator runner, so it sees the host libc
+ * rather than the Zephyr one.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint64_t bench_host_cpu_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void bench_host_exit(int code) {
+    exit(code);
+}
@@ -0,0 +1,97 @@
+/**
+ * @file main.c
+ * @brief Port overhead benchmark on Zephyr
+ *
+ * Runs zephyr_os.c under native_sim or any other board. On native_sim the
+ * CPU time is the host process time and stack high-water marks are not
+ * reported, as threads execute on host stacks. Elsewhere both come from
+ * the kernel. Heap usage is read from the system heap on every board.
+ */
+
+#include "mqtt.h"
+#include "mqtt_bench.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/sys_heap.h>
+#include <string.h>
+
+void mqtt_zephyr_init(void);
+
+extern struct k_heap _system_heap;
+
+#ifdef CONFIG_ARCH_POSIX
+uint64_t bench_host_cpu_time_us(void);
+void bench_host_exit(int code);
+#endif
+
+#ifdef MQTT_OS_STATIC
+K_THREAD_STACK_DEFINE(zephyr_bench_rx_stack, MQTT_BENCH_RX_STACK);
+#endif
+
+static uint64_t zephyr_bench_cpu_time_us(void) {
+#ifdef CONFIG_ARCH_POSIX
+    return bench_host_cpu_time_us();
+#else
+    k_thread_runtime_stats_t stats;
+    if (k_thread_runtime_stats_all_get(&stats) != 0) return 0;
+    return k_cyc_to_us_floor64(stats.total_cycles);  /* Non-idle cycles */
+#endif
+}
+
+#ifndef CONFIG_ARCH_POSIX
+typedef struct {
+    const char* name;
+    const struct k_thread* found;
+} zephyr_bench_lookup_t;
+
+static void zephyr_bench_find(const struct k_thread* thread, void* user_data) {
+    zephyr_bench_lookup_t* lookup = user_data;
+    const char* name = k_thread_name_get((k_tid_t)thread);
+    if (name && strcmp(name, lookup->name) == 0) lookup->found = thread;
+}
+
+static int32_t zephyr_bench_stack_unused(const char* name) {
+    zephyr_bench_lookup_t lookup = { .name = name, .found = name ? NULL : k_current_get() };
+    size_t unused;
+
+    if (name) k_thread_foreach(zephyr_bench_find, &lookup);
+    if (!lookup.found) return -1;
+    if (k_thread_stack_space_get(lookup.found, &unused) != 0) return -1;
+    return (int32_t)unused;
+}
+#endif
+
+static int32_t zephyr_bench_heap_used(void) {
+    struct sys_memory_stats stats;
+    if (sys_heap_runtime_stats_get(&_system_heap.heap, &stats) != 0) return -1;
+    return (int32_t)stats.allocated_bytes;
+}
+
+static int32_t zephyr_bench_heap_peak(void) {
+    struct sys_memory_stats stats;
+    if (sys_heap_runtime_stats_get(&_system_heap.heap, &stats) != 0) return -1;
+    return (int32_t)stats.max_allocated_bytes;
+}
+
+static const mqtt_bench_port_t zephyr_bench_port = {
+#ifdef MQTT_OS_STATIC
+    .name = "zephyr-static",
+    .rx_stack = zephyr_bench_rx_stack,
+#else
+    .name = "zephyr",
+#endif
+    .cpu_time_us = zephyr_bench_cpu_time_us,
+#ifndef CONFIG_ARCH_POSIX
+    .stack_unused = zephyr_bench_stack_unused,
+#endif
+    .heap_used = zephyr_bench_heap_used,
+    .heap_peak = zephyr_bench_heap_peak
+};
+
+int main(void) {
+    mqtt_zephyr_init();
+    int ret = mqtt_bench_run(&zephyr_bench_port);
+#ifdef CONFIG_ARCH_POSIX
+    bench_host_exit(ret == 0 ? 0 : 1);
+#endif
+    return ret;
+}
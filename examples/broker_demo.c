@@ -0,0 +1,85 @@
+/**
+ * @file broker_demo.c
+ * @brief Edge gateway demo
+ *
+ * Serves local devices on port 1883, prints their readings in-process,
+ * forwards "sensors/#" upstream and passes commands from upstream down to
+ * the devices.
+ */
+
+#include "mqtt.h"
+#include "mqtt_broker.h"
+#include <stdio.h>
+#include <signal.h>
+
+#define MQTT_UPSTREAM_HOST      "test.mosquitto.org"
+#define MQTT_UPSTREAM_PORT      1883
+#define MQTT_CLIENT_ID          "libmqtt_gateway_demo"
+#define MQTT_LISTEN_PORT        1883
+
+void mqtt_posix_init(void);
+void mqtt_posix_net_init(void);
+
+static mqtt_broker_t* broker;
+static volatile int running = 1;
+
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static void on_reading(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    (void)user_data;
+    printf("[local] %s: %.*s\n", topic, (int)len, (const char*)payload);
+}
+
+static void on_command(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    (void)user_data;
+    mqtt_broker_publish(broker, topic, payload, len);
+}
+
+int main(void) {
+    mqtt_posix_init();
+    mqtt_posix_net_init();
+    signal(SIGINT, on_signal);
+
+    mqtt_broker_config_t broker_config = { .port = MQTT_LISTEN_PORT };
+    broker = mqtt_broker_create(&broker_config);
+    if (!broker) {
+        printf("Failed to listen on port %d\n", MQTT_LISTEN_PORT);
+        return 1;
+    }
+
+    mqtt_config_t config = {
+        .host = MQTT_UPSTREAM_HOST,
+        .port = MQTT_UPSTREAM_PORT,
+        .client_id = MQTT_CLIENT_ID,
+        .keepalive = 60,
+        .clean_session = 1
+    };
+    mqtt_client_t* upstream = mqtt_client_create(&config);
+    if (!upstream) {
+        printf("Failed to connect to %s:%d\n", config.host, config.port);
+        mqtt_broker_destroy(broker);
+        return 1;
+    }
+
+    mqtt_broker_subscribe(broker, "sensors/#", on_reading, NULL);
+    mqtt_broker_forward(broker, "sensors/#", upstream, 0);
+    mqtt_client_subscribe_cb(upstream, "commands/#", 0, on_command, NULL);
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+    while (running) {
+        os->sleep_ms(1000);
+    }
+
+    mqtt_broker_stats_t stats;
+    mqtt_broker_get_stats(broker, &stats);
+    printf("%u connects, %u messages, %u deliveries, %u local\n",
+           stats.connects, stats.messages, stats.deliveries, stats.local);
+
+    /* Broker first: its threads may still forward through the client */
+    mqtt_broker_destroy(broker);
+    mqtt_client_destroy(upstream);
+    return 0;
+}
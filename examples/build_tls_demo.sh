@@ -7,6 +7,8 @@ gcc -Wall -O2 -I../include \
     ../src/core/mqtt_os.c \
     ../src/core/mqtt_net.c \
     ../src/core/mqtt_tls.c \
+    ../src/core/mqtt_stats.c \
+    ../src/core/mqtt_atomic.c \
     ../src/port/os/posix_os.c \
     ../src/port/net/posix_net.c \
     ../src/port/tls/openssl_tls.c \
@@ -0,0 +1,43 @@
+/**
+ * @file lwipopts.h
+ * @brief lwIP configuration for lwip_raw_demo on the unix port
+ *
+ * Threaded lwIP with core locking, raw TCP API and the loopback interface
+ * only. Sockets and netconn are disabled: lwip_raw_net.c needs neither.
+ */
+
+#ifndef LWIPOPTS_H
+#define LWIPOPTS_H
+
+#define NO_SYS                          0
+#define LWIP_TCPIP_CORE_LOCKING         1
+#define SYS_LIGHTWEIGHT_PROT            1
+
+#define LWIP_SOCKET                     0
+#define LWIP_NETCONN                    0
+#define LWIP_DNS                        0
+#define LWIP_DHCP                       0
+
+#define LWIP_IPV4                       1
+#define LWIP_TCP                        1
+#define LWIP_HAVE_LOOPIF                1
+#define LWIP_NETIF_LOOPBACK             1
+
+#define TCP_MSS                         1460
+#define TCP_SND_BUF                     (4 * TCP_MSS)
+#define TCP_WND                         (4 * TCP_MSS)
+#define TCP_SND_QUEUELEN                (4 * TCP_SND_BUF / TCP_MSS)
+
+#define MEM_SIZE                        (64 * 1024)
+#define MEMP_NUM_TCP_SEG                64
+#define MEMP_NUM_PBUF                   64
+#define PBUF_POOL_SIZE                  64
+
+#define TCPIP_MBOX_SIZE                 16
+#define TCPIP_THREAD_STACKSIZE          8192
+#define DEFAULT_THREAD_STACKSIZE        8192
+#define DEFAULT_RAW_RECVMBOX_SIZE       16
+#define DEFAULT_TCP_RECVMBOX_SIZE       16
+#define DEFAULT_ACCEPTMBOX_SIZE         4
+
+#endif /* LWIPOPTS_H */
@@ -0,0 +1,210 @@
+/**
+ * @file lwip_raw_demo.c
+ * @brief lwIP raw API transport demo on the loopback interface
+ *
+ * Runs lwIP's unix port in-process with loopif, starts a minimal broker on
+ * 127.0.0.1 written against the raw API, and connects the client to it
+ * through lwip_raw_net.c. The broker acknowledges every QoS 1 PUBLISH and
+ * echoes it back, so both the copy and the zero-copy send paths and the
+ * pbuf receive path are exercised without any network hardware.
+ */
+
+#include "mqtt.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/sys.h"
+#include <stdio.h>
+#include <string.h>
+
+#define DEMO_BROKER_PORT    1883
+#define DEMO_TOPIC          "lwip/echo"
+#define DEMO_SMALL_MSGS     100
+#define DEMO_LARGE_MSGS     20
+#define DEMO_LARGE_SIZE     800   /* Above MQTT_LWIP_ZEROCOPY_MIN */
+
+void mqtt_posix_init(void);
+void mqtt_lwip_raw_init(void);
+
+typedef struct {
+    uint8_t buf[2048];
+    size_t len;
+} broker_conn_t;
+
+static broker_conn_t broker_conn;
+static volatile uint32_t echoes = 0;
+
+static void broker_send(struct tcp_pcb* pcb, uint8_t b0, const uint8_t* hdr, size_t hdr_len,
+                        const uint8_t* body, size_t body_len) {
+    uint8_t fixed[5];
+    size_t remaining = hdr_len + body_len, pos = 1;
+
+    fixed[0] = b0;
+    do {
+        fixed[pos] = remaining & 0x7F;
+        remaining >>= 7;
+        if (remaining) fixed[pos] |= 0x80;
+        pos++;
+    } while (remaining);
+
+    tcp_write(pcb, fixed, (u16_t)pos, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    if (hdr_len) tcp_write(pcb, hdr, (u16_t)hdr_len, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    if (body_len) tcp_write(pcb, body, (u16_t)body_len, TCP_WRITE_FLAG_COPY);
+    tcp_output(pcb);
+}
+
+/* Answer one packet; returns the number of bytes consumed, 0 if incomplete */
+static size_t broker_handle(struct tcp_pcb* pcb, const uint8_t* buf, size_t len) {
+    size_t remaining = 0, pos = 1;
+    int shift = 0;
+
+    do {
+        if (pos >= len) return 0;
+        remaining |= (size_t)(buf[pos] & 0x7F) << shift;
+        shift += 7;
+    } while (buf[pos++] & 0x80);
+    if (pos + remaining > len) return 0;
+
+    const uint8_t* body = buf + pos;
+
+    switch (buf[0] >> 4) {
+    case 1: {  /* CONNECT */
+        const uint8_t connack[2] = { 0, 0 };
+        broker_send(pcb, 0x20, connack, 2, NULL, 0);
+        break;
+    }
+    case 3: {  /* PUBLISH: acknowledge, then echo back at QoS 0 */
+        uint8_t qos = (buf[0] >> 1) & 0x03;
+        size_t topic_end = 2 + ((body[0] << 8) | body[1]);
+        size_t payload_start = topic_end + (qos ? 2 : 0);
+        if (qos == 1) broker_send(pcb, 0x40, body + topic_end, 2, NULL, 0);
+        broker_send(pcb, 0x30, body, topic_end, body + payload_start, remaining - payload_start);
+        break;
+    }
+    case 8: {  /* SUBSCRIBE */
+        const uint8_t suback[3] = { body[0], body[1], 0 };
+        broker_send(pcb, 0x90, suback, 3, NULL, 0);
+        break;
+    }
+    case 12:   /* PINGREQ */
+        broker_send(pcb, 0xD0, NULL, 0, NULL, 0);
+        break;
+    default:
+        break;
+    }
+    return pos + remaining;
+}
+
+static err_t broker_recv(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err) {
+    broker_conn_t* conn = (broker_conn_t*)arg;
+
+    if (!p) {
+        tcp_close(pcb);
+        return ERR_OK;
+    }
+    if (err != ERR_OK || p->tot_len > sizeof(conn->buf) - conn->len) {
+        pbuf_free(p);
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
+    conn->len += pbuf_copy_partial(p, conn->buf + conn->len, p->tot_len, 0);
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+
+    size_t used;
+    while (conn->len > 0 && (used = broker_handle(pcb, conn->buf, conn->len)) > 0) {
+        conn->len -= used;
+        memmove(conn->buf, conn->buf + used, conn->len);
+    }
+    return ERR_OK;
+}
+
+static err_t broker_accept(void* arg, struct tcp_pcb* pcb, err_t err) {
+    (void)arg;
+    if (err != ERR_OK || !pcb) return ERR_VAL;
+
+    /* One client at a time is enough for the demo */
+    broker_conn.len = 0;
+    tcp_arg(pcb, &broker_conn);
+    tcp_recv(pcb, broker_recv);
+    tcp_nagle_disable(pcb);
+    return ERR_OK;
+}
+
+static void broker_start(void) {
+    struct tcp_pcb* pcb = tcp_new();
+    tcp_bind(pcb, IP_ADDR_ANY, DEMO_BROKER_PORT);
+    pcb = tcp_listen(pcb);
+    tcp_accept(pcb, broker_accept);
+}
+
+static void tcpip_ready(void* arg) {
+    sys_sem_signal((sys_sem_t*)arg);
+}
+
+static void on_message(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    (void)topic;
+    (void)payload;
+    (void)len;
+    (void)user_data;
+    echoes++;
+}
+
+int main(void) {
+    sys_sem_t ready;
+
+    /* Brings up lwIP and loopif (127.0.0.1) */
+    sys_sem_new(&ready, 0);
+    tcpip_init(tcpip_ready, &ready);
+    sys_sem_wait(&ready);
+    sys_sem_free(&ready);
+
+    LOCK_TCPIP_CORE();
+    broker_start();
+    UNLOCK_TCPIP_CORE();
+
+    mqtt_posix_init();
+    mqtt_lwip_raw_init();
+
+    mqtt_config_t config = {
+        .host = "127.0.0.1",
+        .port = DEMO_BROKER_PORT,
+        .client_id = "lwip_raw_demo",
+        .keepalive = 60,
+        .clean_session = 1,
+        .msg_cb = on_message
+    };
+
+    mqtt_client_t* client = mqtt_client_create(&config);
+    if (!client) {
+        printf("Failed to connect over loopif\n");
+        return 1;
+    }
+    mqtt_client_subscribe(client, DEMO_TOPIC, 0);
+
+    static uint8_t large[DEMO_LARGE_SIZE];
+    memset(large, 'x', sizeof(large));
+
+    uint32_t published = 0;
+    for (int i = 0; i < DEMO_SMALL_MSGS; i++) {
+        if (mqtt_client_publish(client, DEMO_TOPIC, (const uint8_t*)"ping", 4, 1) == 0) published++;
+    }
+    for (int i = 0; i < DEMO_LARGE_MSGS; i++) {
+        if (mqtt_client_publish(client, DEMO_TOPIC, large, sizeof(large), 1) == 0) published++;
+    }
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+    for (int i = 0; i < 50 && echoes < published; i++) {
+        os->sleep_ms(100);
+    }
+
+    mqtt_stats_t stats;
+    mqtt_client_get_stats(client, &stats);
+    mqtt_client_destroy(client);
+
+    printf("published:      %u\n", published);
+    printf("echoes:         %u\n", echoes);
+    printf("pubacks:        %u\n", stats.puback_latency.count);
+    printf("puback p50:     %u us\n", mqtt_hist_percentile(&stats.puback_latency, 50));
+    return echoes == published ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file rpc_demo.c
+ * @brief Request/response demo
+ *
+ * One client plays both sides: it answers requests on "test/rpc/echo" and
+ * calls that service through mqtt_rpc_call(), polling for timeouts from
+ * the main loop.
+ */
+
+#include "mqtt.h"
+#include "mqtt_rpc.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MQTT_BROKER_HOST        "test.mosquitto.org"
+#define MQTT_BROKER_PORT        1883
+#define MQTT_CLIENT_ID          "libmqtt_rpc_demo"
+
+#define RPC_SERVICE_TOPIC       "test/rpc/echo"
+#define RPC_CALLS               10
+#define RPC_TIMEOUT_MS          2000
+
+void mqtt_posix_init(void);
+void mqtt_posix_net_init(void);
+
+static mqtt_client_t* client;
+static volatile int completed = 0;
+
+static void on_request(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    mqtt_rpc_request_t req;
+    (void)topic;
+    (void)user_data;
+
+    if (mqtt_rpc_parse_request(payload, len, &req) != 0) return;
+    mqtt_rpc_reply(client, &req, req.payload, req.len);
+}
+
+static void on_reply(mqtt_rpc_status_t status, const uint8_t* payload, size_t len, void* user_data) {
+    int call = (int)(intptr_t)user_data;
+
+    if (status == MQTT_RPC_OK) {
+        printf("[RPC] call %d: %.*s\n", call, (int)len, (const char*)payload);
+    } else {
+        printf("[RPC] call %d: %s\n", call, status == MQTT_RPC_TIMEOUT ? "timed out" : "cancelled");
+    }
+    completed++;
+}
+
+int main(void) {
+    mqtt_posix_init();
+    mqtt_posix_net_init();
+
+    mqtt_config_t config = {
+        .host = MQTT_BROKER_HOST,
+        .port = MQTT_BROKER_PORT,
+        .client_id = MQTT_CLIENT_ID,
+        .keepalive = 60,
+        .clean_session = 1
+    };
+
+    client = mqtt_client_create(&config);
+    if (!client) {
+        printf("Failed to connect to %s:%d\n", config.host, config.port);
+        return 1;
+    }
+
+    mqtt_rpc_t* rpc = mqtt_rpc_create(client, NULL);
+    if (!rpc || mqtt_client_subscribe_cb(client, RPC_SERVICE_TOPIC, 0, on_request, NULL) != 0) {
+        printf("Failed to set up RPC\n");
+        mqtt_client_destroy(client);
+        mqtt_rpc_destroy(rpc);
+        return 1;
+    }
+
+    for (int i = 0; i < RPC_CALLS; i++) {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "hello %d", i);
+        if (mqtt_rpc_call(rpc, RPC_SERVICE_TOPIC, (const uint8_t*)msg, len, RPC_TIMEOUT_MS,
+                          on_reply, (void*)(intptr_t)i) != 0) {
+            printf("[RPC] call %d failed\n", i);
+            completed++;
+        }
+    }
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+    while (completed < RPC_CALLS) {
+        mqtt_rpc_poll(rpc);
+        os->sleep_ms(MQTT_RPC_TICK_MS);
+    }
+
+    mqtt_rpc_stats_t stats;
+    mqtt_rpc_get_stats(rpc, &stats);
+    printf("%u replies, %u timeouts, p50 %u us, p99 %u us\n", stats.replies, stats.timeouts,
+           mqtt_hist_percentile(&stats.latency, 50), mqtt_hist_percentile(&stats.latency, 99));
+
+    mqtt_client_destroy(client);
+    mqtt_rpc_destroy(rpc);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file sim_demo.c
+ * @brief Virtual-time simulation demo
+ *
+ * Runs the client against a scripted in-process broker on the simulation
+ * port and fast-forwards a full day of keepalive traffic. The broker stops
+ * answering pings for a while and later breaks the connection, so the run
+ * exercises ping timeouts and reconnects. Output is identical on every run;
+ * only the wall time differs.
+ */
+
+#include "mqtt.h"
+#include "mqtt_sim.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_BROKER_PORT         1883
+#define SIM_LATENCY_MS          20
+#define SIM_KEEPALIVE           60
+#define SIM_DURATION_MS         (24u * 3600u * 1000u)
+#define SIM_PUBLISH_INTERVAL_MS 10000
+
+/* Broker ignores PINGREQ inside this window */
+#define SIM_BLACKHOLE_START_MS  (2u * 3600u * 1000u)
+#define SIM_BLACKHOLE_END_MS    (SIM_BLACKHOLE_START_MS + 120000u)
+
+/* Broker breaks the connection at this time */
+#define SIM_BREAK_AT_MS         (5u * 3600u * 1000u)
+
+static volatile int broker_running = 1;
+static uint32_t broker_pingreqs = 0;
+
+static void broker_send(mqtt_socket_t sock, uint8_t b0, const uint8_t* body, uint8_t body_len) {
+    uint8_t pkt[8];
+    pkt[0] = b0;
+    pkt[1] = body_len;
+    memcpy(pkt + 2, body, body_len);
+    mqtt_net_get()->send(sock, pkt, 2 + body_len);
+}
+
+/* Answer one packet; returns the number of bytes consumed, 0 if incomplete */
+static size_t broker_handle(mqtt_socket_t sock, const uint8_t* buf, size_t len) {
+    size_t remaining = 0, pos = 1;
+    int shift = 0;
+
+    do {
+        if (pos >= len) return 0;
+        remaining |= (size_t)(buf[pos] & 0x7F) << shift;
+        shift += 7;
+    } while (buf[pos++] & 0x80);
+    if (pos + remaining > len) return 0;
+
+    const uint8_t* body = buf + pos;
+    uint64_t now = mqtt_sim_now_ms();
+
+    switch (buf[0] >> 4) {
+    case 1: {  /* CONNECT */
+        const uint8_t connack[2] = { 0, 0 };
+        broker_send(sock, 0x20, connack, 2);
+        break;
+    }
+    case 3:    /* PUBLISH */
+        if (((buf[0] >> 1) & 0x03) == 1) {
+            size_t topic_len = (body[0] << 8) | body[1];
+            broker_send(sock, 0x40, body + 2 + topic_len, 2);
+        }
+        break;
+    case 8: {  /* SUBSCRIBE */
+        const uint8_t suback[3] = { body[0], body[1], 0 };
+        broker_send(sock, 0x90, suback, 3);
+        break;
+    }
+    case 12:   /* PINGREQ */
+        broker_pingreqs++;
+        if (now < SIM_BLACKHOLE_START_MS || now >= SIM_BLACKHOLE_END_MS) {
+            broker_send(sock, 0xD0, NULL, 0);
+        }
+        break;
+    default:
+        break;
+    }
+    return pos + remaining;
+}
+
+static void broker_thread(void* arg) {
+    const mqtt_net_api_t* net = mqtt_net_get();
+    int broken = 0;
+    (void)arg;
+
+    while (broker_running) {
+        mqtt_socket_t sock = mqtt_sim_net_accept(SIM_BROKER_PORT, 1000);
+        if (!sock) continue;
+
+        uint8_t buf[2048];
+        size_t len = 0;
+
+        while (broker_running) {
+            if (!broken && mqtt_sim_now_ms() >= SIM_BREAK_AT_MS) {
+                broken = 1;
+                mqtt_sim_net_break(sock);
+            }
+
+            int ret = net->recv(sock, buf + len, sizeof(buf) - len, 1000);
+            if (ret < 0) break;
+            len += ret;
+
+            size_t used;
+            while (len > 0 && (used = broker_handle(sock, buf, len)) > 0) {
+                len -= used;
+                memmove(buf, buf + used, len);
+            }
+        }
+        net->disconnect(sock);
+    }
+    mqtt_os_get()->thread_exit();
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    double wall_start = wall_seconds();
+
+    mqtt_sim_init();
+    mqtt_sim_net_init();
+    mqtt_sim_net_set_latency(SIM_LATENCY_MS);
+    mqtt_sim_net_listen(SIM_BROKER_PORT);
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+    mqtt_thread_t broker = os->thread_create(broker_thread, NULL, 2048, 5);
+
+    mqtt_config_t config = {
+        .host = "sim",
+        .port = SIM_BROKER_PORT,
+        .client_id = "sim_demo",
+        .keepalive = SIM_KEEPALIVE,
+        .clean_session = 1
+    };
+
+    mqtt_client_t* client = mqtt_client_create(&config);
+    if (!client) {
+        printf("Failed to connect to the simulated broker\n");
+        return 1;
+    }
+    mqtt_client_subscribe(client, "sim/in", 1);
+
+    uint32_t published = 0;
+    while (mqtt_sim_now_ms() < SIM_DURATION_MS) {
+        if (mqtt_client_publish(client, "sim/out", (const uint8_t*)"tick", 4, 1) == 0) {
+            published++;
+        }
+        os->sleep_ms(SIM_PUBLISH_INTERVAL_MS);
+    }
+
+    mqtt_stats_t stats;
+    mqtt_client_get_stats(client, &stats);
+    mqtt_client_destroy(client);
+
+    broker_running = 0;
+    os->thread_destroy(broker);
+
+    printf("virtual time:   %.1f h\n", mqtt_sim_now_ms() / 3600000.0);
+    printf("wall time:      %.3f s\n", wall_seconds() - wall_start);
+    printf("published:      %u\n", published);
+    printf("pubacks:        %u\n", stats.puback_latency.count);
+    printf("pingreqs:       %u\n", broker_pingreqs);
+    printf("ping timeouts:  %u\n", stats.ping_timeouts);
+    printf("reconnects:     %u\n", stats.reconnects);
+    printf("ping rtt p50:   %u us\n", mqtt_hist_percentile(&stats.ping_rtt, 50));
+    printf("puback p99:     %u us\n", mqtt_hist_percentile(&stats.puback_latency, 99));
+    return 0;
+}
@@ -18,6 +18,8 @@
 #include <stddef.h>
 #include "mqtt_os.h"
 #include "mqtt_net.h"
+#include "mqtt_stats.h"
+#include "mqtt_atomic.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,6 +34,17 @@ extern "C" {
 /** @brief Maximum number of subscriptions to track for auto-resubscribe */
 #define MQTT_MAX_SUBSCRIPTIONS 8
 
+/** @brief Maximum number of QoS 1 publishes tracked for PUBACK latency */
+#define MQTT_MAX_INFLIGHT     16
+
+/** @brief Local deliveries awaiting their broker echo at once; further publishes take the broker path */
+#define MQTT_LOCAL_ECHO_SLOTS 16
+
+/** @brief Clients that can exist at once when built with MQTT_OS_STATIC */
+#ifndef MQTT_STATIC_CLIENTS
+#define MQTT_STATIC_CLIENTS   1
+#endif
+
 /**
  * @brief MQTT client connection state
  */
@@ -49,14 +62,47 @@ typedef enum {
  */
 typedef void (*mqtt_msg_callback_t)(const char* topic, const uint8_t* payload, size_t len, void* user_data);
 
+/**
+ * @brief PUBACK callback function type
+ * @param packet_id Packet ID of the acknowledged QoS 1 publish
+ * @param user_data User-defined data passed from config
+ */
+typedef void (*mqtt_puback_callback_t)(uint16_t packet_id, void* user_data);
+
 /**
  * @brief Subscription information (internal use)
  */
 typedef struct {
-    char topic[128];  /**< Topic filter */
-    uint8_t qos;      /**< QoS level */
+    char topic[128];          /**< Topic filter */
+    uint8_t qos;              /**< QoS level */
+    mqtt_msg_callback_t cb;   /**< Callback for matching messages (NULL = config msg_cb) */
+    void* user_data;          /**< User data passed to cb */
 } mqtt_subscription_t;
 
+/**
+ * @brief In-flight QoS 1 publish (internal use)
+ */
+typedef struct {
+    uint16_t packet_id;  /**< Packet ID (0 = free slot) */
+    uint64_t sent_time;  /**< Send timestamp in microseconds */
+} mqtt_inflight_t;
+
+/**
+ * @brief Traffic counters updated without the client mutex (internal use)
+ */
+typedef struct {
+    mqtt_atomic_u32_t tx_packets;        /**< Packets sent */
+    mqtt_atomic_u32_t rx_packets;        /**< Packets received */
+    mqtt_atomic_u64_t tx_bytes;          /**< Bytes sent */
+    mqtt_atomic_u64_t rx_bytes;          /**< Bytes received */
+    mqtt_atomic_u32_t publish_sent;      /**< PUBLISH packets sent */
+    mqtt_atomic_u32_t publish_received;  /**< PUBLISH packets received */
+    mqtt_atomic_u32_t reconnects;        /**< Successful reconnects */
+    mqtt_atomic_u32_t ping_timeouts;     /**< Connections dropped for missing PINGRESP */
+    mqtt_atomic_u32_t local_delivered;   /**< Publishes delivered to local subscriptions */
+    mqtt_atomic_u32_t echoes_suppressed; /**< Broker echoes of those dropped on receipt */
+} mqtt_counters_t;
+
 /**
  * @brief MQTT client configuration
  */
@@ -72,27 +118,49 @@ typedef struct {
     void* tls_config;                /**< TLS configuration pointer */
     mqtt_msg_callback_t msg_cb;      /**< Message received callback */
     void* user_data;                 /**< User-defined data passed to callback */
+    mqtt_thread_attr_t recv_thread;  /**< Receive thread attributes (zero for defaults) */
+    mqtt_puback_callback_t puback_cb; /**< QoS 1 publish acknowledged (optional), gets user_data */
+    uint8_t local_delivery;          /**< Deliver own publishes to own subscriptions directly and drop their echo (1=enabled) */
 } mqtt_config_t;
 
 /**
  * @brief MQTT client handle (opaque structure)
+ *
+ * Locking: tx_mutex serializes socket writes and connection changes and is
+ * held across send(). mutex guards subscriptions, packet IDs, the in-flight
+ * table and stats, and is never held across I/O, so the receive thread can
+ * handle PUBACK and PINGRESP while a publisher is blocked in send(). Lock
+ * order: tx_mutex, then mutex; neither is held while calling callbacks.
  */
 typedef struct {
     mqtt_config_t config;                                /**< Client configuration */
     mqtt_socket_t socket;                                /**< Network socket handle */
     mqtt_state_t state;                                  /**< Connection state */
-    mqtt_mutex_t mutex;                                  /**< Thread safety mutex */
+    mqtt_mutex_t mutex;                                  /**< Subscriptions, packet IDs, in-flight table and stats; never held across I/O */
+    mqtt_mutex_t tx_mutex;                               /**< Socket writes, send_buf and connection state */
     mqtt_thread_t recv_thread;                           /**< Receive thread handle */
     mqtt_sem_t thread_exit_sem;                          /**< Thread exit synchronization semaphore */
+    mqtt_event_t wake_event;                             /**< Wakes the receive thread for shutdown (optional) */
     uint16_t packet_id;                                  /**< Packet ID counter */
-    uint32_t last_ping_time;                             /**< Last ping timestamp */
-    uint32_t ping_sent_time;                             /**< Ping sent timestamp for timeout check */
+    uint16_t connection;                                 /**< Connection counter, tags deferred acks */
+    uint16_t rx_packet_id;                               /**< Packet ID of the QoS 1 message being delivered */
+    uint8_t rx_ack_deferred;                             /**< Its PUBACK was deferred by the callback */
+    uint64_t last_ping_time;                             /**< Last ping timestamp in microseconds */
+    uint64_t ping_sent_time;                             /**< Ping sent timestamp in microseconds */
     uint8_t send_buf[MQTT_MAX_PACKET_SIZE];              /**< Send buffer */
     uint8_t recv_buf[MQTT_RECV_BUF_SIZE];                /**< Receive buffer */
+    size_t recv_len;                                     /**< Bytes buffered in recv_buf */
+    size_t recv_discard;                                 /**< Bytes left to skip of an oversized packet */
     volatile uint8_t running;                            /**< Thread running flag */
     volatile uint8_t waiting_pingresp;                   /**< Waiting for PINGRESP flag */
     mqtt_subscription_t subscriptions[MQTT_MAX_SUBSCRIPTIONS]; /**< Subscription list */
     uint8_t sub_count;                                   /**< Number of subscriptions */
+    mqtt_atomic_u32_t sub_published;                     /**< Subscriptions visible to the receive thread */
+    mqtt_inflight_t inflight[MQTT_MAX_INFLIGHT];         /**< QoS 1 publishes awaiting PUBACK */
+    mqtt_atomic_u32_t local_echo[MQTT_LOCAL_ECHO_SLOTS]; /**< Hashes of local deliveries awaiting their echo */
+    mqtt_atomic_u32_t local_echo_next;                   /**< Where the next local_echo claim starts looking */
+    mqtt_counters_t counters;                            /**< Traffic counters (lock-free) */
+    mqtt_stats_t stats;                                  /**< Latency statistics, counters are in counters */
 } mqtt_client_t;
 
 /**
@@ -102,6 +170,15 @@ typedef struct {
  */
 mqtt_client_t* mqtt_client_create(const mqtt_config_t* config);
 
+/**
+ * @brief Create a client that never connects and is only driven by mqtt_client_feed()
+ * @param config Client configuration (host and port are ignored)
+ * @return Client handle on success, NULL on failure
+ * @note No socket and no receive thread: PUBACKs and other writes are skipped.
+ *       Release it with mqtt_client_destroy()
+ */
+mqtt_client_t* mqtt_client_create_detached(const mqtt_config_t* config);
+
 /**
  * @brief Disconnect and destroy MQTT client instance
  * @param client Client handle
@@ -118,6 +195,35 @@ void mqtt_client_destroy(mqtt_client_t* client);
  */
 int mqtt_client_subscribe(mqtt_client_t* client, const char* topic, uint8_t qos);
 
+/**
+ * @brief Subscribe to a topic with its own message callback
+ * @param client Client handle
+ * @param topic Topic filter (shorter than 128 bytes when cb is set)
+ * @param qos QoS level (0 or 1)
+ * @param cb Callback for messages matching the filter, NULL for the config msg_cb
+ * @param user_data User data passed to cb
+ * @return 0 on success, -1 on failure, including when the filter is already
+ *         subscribed with a different cb or user_data, or cb is set and the
+ *         subscription table is full
+ * @note Messages go to the first subscription with a callback whose filter
+ *       matches, other messages to the config msg_cb. The callback runs on the
+ *       receive thread and stays registered across reconnects.
+ * @note The receive thread reads subscriptions without locking, so a filter's
+ *       cb and user_data are fixed when it is first subscribed and cannot be
+ *       replaced. Subscribing it again with the same cb and user_data, or
+ *       with cb NULL, only updates the QoS.
+ */
+int mqtt_client_subscribe_cb(mqtt_client_t* client, const char* topic, uint8_t qos,
+                             mqtt_msg_callback_t cb, void* user_data);
+
+/**
+ * @brief Match a topic name against a topic filter
+ * @param filter Topic filter, may contain '+' and '#' wildcards
+ * @param topic Topic name
+ * @return 1 if the topic matches, 0 otherwise
+ */
+int mqtt_topic_match(const char* filter, const char* topic);
+
 /**
  * @brief Publish a message
  * @param client Client handle
@@ -129,6 +235,40 @@ int mqtt_client_subscribe(mqtt_client_t* client, const char* topic, uint8_t qos)
  */
 int mqtt_client_publish(mqtt_client_t* client, const char* topic, const uint8_t* payload, size_t len, uint8_t qos);
 
+/**
+ * @brief Publish a message and return its packet ID
+ * @param client Client handle
+ * @param topic Topic name
+ * @param payload Message payload, sent from this buffer without a copy
+ * @param len Payload length
+ * @param qos QoS level (0 or 1)
+ * @param packet_id Output packet ID for QoS 1 (0 for QoS 0), may be NULL
+ * @return 0 on success, -1 on failure
+ * @note The config puback_cb may run for this packet ID before the call
+ *       returns; callers matching acknowledgements must serialize the two
+ */
+int mqtt_client_publish_ex(mqtt_client_t* client, const char* topic, const uint8_t* payload,
+                           size_t len, uint8_t qos, uint16_t* packet_id);
+
+/**
+ * @brief Hold back the PUBACK of the message being delivered
+ * @param client Client handle
+ * @return Ack token for mqtt_client_ack(), 0 if the message needs no ack
+ * @note Only valid inside a message callback run by the receive thread,
+ *       not one run by local delivery. Inbound QoS 1 messages are otherwise
+ *       acknowledged as soon as their callback returns.
+ */
+uint32_t mqtt_client_defer_ack(mqtt_client_t* client);
+
+/**
+ * @brief Send a deferred PUBACK
+ * @param client Client handle
+ * @param token Token from mqtt_client_defer_ack()
+ * @return 0 on success, -1 on failure or if the message arrived on an
+ *         earlier connection (the broker redelivers it instead)
+ */
+int mqtt_client_ack(mqtt_client_t* client, uint32_t token);
+
 /**
  * @brief Check if client is connected
  * @param client Client handle
@@ -136,6 +276,40 @@ int mqtt_client_publish(mqtt_client_t* client, const char* topic, const uint8_t*
  */
 int mqtt_client_is_connected(mqtt_client_t* client);
 
+/**
+ * @brief Feed raw inbound bytes through the packet framer and dispatch
+ * @param client Client handle
+ * @param data Received bytes (any split, packets may span calls)
+ * @param len Number of bytes
+ * @return 0 on success, -1 on malformed input
+ * @note Intended for replaying captured traffic and for testing; must not be
+ *       called while the client's receive thread is running
+ */
+int mqtt_client_feed(mqtt_client_t* client, const uint8_t* data, size_t len);
+
+/**
+ * @brief Drop any partial packet buffered by mqtt_client_feed()
+ * @param client Client handle
+ * @note Call before feeding a new connection's stream or after a framing error
+ */
+void mqtt_client_feed_reset(mqtt_client_t* client);
+
+/**
+ * @brief Get a snapshot of client statistics
+ * @param client Client handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ * @note Histograms accumulate since creation or the last reset; srtt_us and
+ *       rttvar_us track recent ping round trips and react to degradation
+ */
+int mqtt_client_get_stats(mqtt_client_t* client, mqtt_stats_t* stats);
+
+/**
+ * @brief Reset client statistics
+ * @param client Client handle
+ */
+void mqtt_client_reset_stats(mqtt_client_t* client);
+
 #ifdef __cplusplus
 }
 #endif
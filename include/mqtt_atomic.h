@@ -0,0 +1,306 @@
+/**
+ * @file mqtt_atomic.h
+ * @brief Portable atomic operations
+ *
+ * Provides load, store, compare-and-swap and fetch-add on 32-bit, 64-bit
+ * and pointer values with explicit memory ordering. The implementation is
+ * chosen when the library is configured and must be the same for the
+ * library and everything including this header:
+ * - MQTT_ATOMIC_IMPL_C11: C11 <stdatomic.h> (library and users built as C11)
+ * - MQTT_ATOMIC_IMPL_BUILTIN: GCC/Clang __atomic builtins
+ * - MQTT_ATOMIC_IMPL_CRITICAL: OS port critical sections
+ *   (mqtt_os_api_t critical_enter/critical_exit)
+ *
+ * CMake exports the choice (MQTT_ATOMIC option) with the mqtt target. Builds
+ * that define none get the builtins where the compiler has them and critical
+ * sections otherwise, or critical sections if MQTT_ATOMIC_USE_CRITICAL is
+ * defined; C11 is never picked from the including file's language mode.
+ *
+ * 64-bit operations fall back to critical sections on targets where they
+ * are not lock-free (e.g. Cortex-M), so they never pull in libatomic.
+ *
+ * Atomic variables must be declared with the mqtt_atomic_*_t types and
+ * only accessed through these functions.
+ */
+
+#ifndef MQTT_ATOMIC_H
+#define MQTT_ATOMIC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Memory ordering constraints
+ */
+typedef enum {
+    MQTT_ATOMIC_RELAXED = 0,  /**< No ordering, atomicity only */
+    MQTT_ATOMIC_ACQUIRE,      /**< Later accesses stay after this load */
+    MQTT_ATOMIC_RELEASE,      /**< Earlier accesses stay before this store */
+    MQTT_ATOMIC_ACQ_REL,      /**< Both, for read-modify-write operations */
+    MQTT_ATOMIC_SEQ_CST       /**< Single total order */
+} mqtt_memory_order_t;
+
+/**
+ * @brief Enter the port critical section (critical-section fallback only)
+ * @return State to pass to mqtt_atomic_unlock()
+ */
+uint32_t mqtt_atomic_lock(void);
+
+/**
+ * @brief Leave the port critical section
+ * @param state Value returned by mqtt_atomic_lock()
+ */
+void mqtt_atomic_unlock(uint32_t state);
+
+#if !defined(MQTT_ATOMIC_IMPL_C11) && !defined(MQTT_ATOMIC_IMPL_BUILTIN) && !defined(MQTT_ATOMIC_IMPL_CRITICAL)
+#if !defined(MQTT_ATOMIC_USE_CRITICAL) && defined(__GNUC__) && defined(__ATOMIC_RELAXED)
+#define MQTT_ATOMIC_IMPL_BUILTIN 1
+#else
+#define MQTT_ATOMIC_IMPL_CRITICAL 1
+#endif
+#endif
+
+#if defined(MQTT_ATOMIC_IMPL_C11)
+
+#if defined(__cplusplus) || !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L || \
+    defined(__STDC_NO_ATOMICS__)
+#error "MQTT_ATOMIC_IMPL_C11 needs a C11 compiler with <stdatomic.h>"
+#endif
+
+#include <stdatomic.h>
+
+#define MQTT_ATOMIC_C11 1
+#if ATOMIC_LLONG_LOCK_FREE == 2
+#define MQTT_ATOMIC_U64_NATIVE 1
+#endif
+
+typedef _Atomic uint32_t mqtt_atomic_u32_t;
+typedef _Atomic(void*) mqtt_atomic_ptr_t;
+#ifdef MQTT_ATOMIC_U64_NATIVE
+typedef _Atomic uint64_t mqtt_atomic_u64_t;
+#endif
+
+static inline memory_order mqtt_atomic_order(mqtt_memory_order_t order) {
+    static const memory_order map[] = {
+        memory_order_relaxed, memory_order_acquire, memory_order_release,
+        memory_order_acq_rel, memory_order_seq_cst
+    };
+    return map[order];
+}
+
+/* Failure order of a CAS may not be a release order */
+static inline memory_order mqtt_atomic_fail_order(mqtt_memory_order_t order) {
+    if (order == MQTT_ATOMIC_RELEASE) return memory_order_relaxed;
+    if (order == MQTT_ATOMIC_ACQ_REL) return memory_order_acquire;
+    return mqtt_atomic_order(order);
+}
+
+#define MQTT_ATOMIC_LOAD(p, o)          atomic_load_explicit((p), mqtt_atomic_order(o))
+#define MQTT_ATOMIC_STORE(p, v, o)      atomic_store_explicit((p), (v), mqtt_atomic_order(o))
+#define MQTT_ATOMIC_FETCH_ADD(p, v, o)  atomic_fetch_add_explicit((p), (v), mqtt_atomic_order(o))
+#define MQTT_ATOMIC_CAS(p, e, d, o)     atomic_compare_exchange_strong_explicit((p), (e), (d), \
+                                            mqtt_atomic_order(o), mqtt_atomic_fail_order(o))
+
+#elif defined(MQTT_ATOMIC_IMPL_BUILTIN)
+
+#if !defined(__GNUC__) || !defined(__ATOMIC_RELAXED)
+#error "MQTT_ATOMIC_IMPL_BUILTIN needs GCC/Clang __atomic builtins"
+#endif
+
+#define MQTT_ATOMIC_BUILTIN 1
+#if __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define MQTT_ATOMIC_U64_NATIVE 1
+#endif
+
+typedef volatile uint32_t mqtt_atomic_u32_t;
+typedef void* volatile mqtt_atomic_ptr_t;
+#ifdef MQTT_ATOMIC_U64_NATIVE
+typedef volatile uint64_t mqtt_atomic_u64_t;
+#endif
+
+static inline int mqtt_atomic_order(mqtt_memory_order_t order) {
+    static const int map[] = {
+        __ATOMIC_RELAXED, __ATOMIC_ACQUIRE, __ATOMIC_RELEASE, __ATOMIC_ACQ_REL, __ATOMIC_SEQ_CST
+    };
+    return map[order];
+}
+
+static inline int mqtt_atomic_fail_order(mqtt_memory_order_t order) {
+    if (order == MQTT_ATOMIC_RELEASE) return __ATOMIC_RELAXED;
+    if (order == MQTT_ATOMIC_ACQ_REL) return __ATOMIC_ACQUIRE;
+    return mqtt_atomic_order(order);
+}
+
+#define MQTT_ATOMIC_LOAD(p, o)          __atomic_load_n((p), mqtt_atomic_order(o))
+#define MQTT_ATOMIC_STORE(p, v, o)      __atomic_store_n((p), (v), mqtt_atomic_order(o))
+#define MQTT_ATOMIC_FETCH_ADD(p, v, o)  __atomic_fetch_add((p), (v), mqtt_atomic_order(o))
+#define MQTT_ATOMIC_CAS(p, e, d, o)     __atomic_compare_exchange_n((p), (e), (d), 0, \
+                                            mqtt_atomic_order(o), mqtt_atomic_fail_order(o))
+
+#else
+
+/* Critical sections are full barriers, the requested order is implied */
+typedef volatile uint32_t mqtt_atomic_u32_t;
+typedef void* volatile mqtt_atomic_ptr_t;
+
+#endif
+
+#ifndef MQTT_ATOMIC_U64_NATIVE
+/** @brief Some operations run in port critical sections, so the port must provide them */
+#define MQTT_ATOMIC_NEEDS_CRITICAL 1
+#endif
+
+#if defined(MQTT_ATOMIC_C11) || defined(MQTT_ATOMIC_BUILTIN)
+
+static inline uint32_t mqtt_atomic_load_u32(mqtt_atomic_u32_t* p, mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_LOAD(p, order);
+}
+
+static inline void mqtt_atomic_store_u32(mqtt_atomic_u32_t* p, uint32_t value, mqtt_memory_order_t order) {
+    MQTT_ATOMIC_STORE(p, value, order);
+}
+
+static inline uint32_t mqtt_atomic_fetch_add_u32(mqtt_atomic_u32_t* p, uint32_t value,
+                                                 mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_FETCH_ADD(p, value, order);
+}
+
+static inline int mqtt_atomic_cas_u32(mqtt_atomic_u32_t* p, uint32_t* expected, uint32_t desired,
+                                      mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_CAS(p, expected, desired, order);
+}
+
+static inline void* mqtt_atomic_load_ptr(mqtt_atomic_ptr_t* p, mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_LOAD(p, order);
+}
+
+static inline void mqtt_atomic_store_ptr(mqtt_atomic_ptr_t* p, void* value, mqtt_memory_order_t order) {
+    MQTT_ATOMIC_STORE(p, value, order);
+}
+
+static inline int mqtt_atomic_cas_ptr(mqtt_atomic_ptr_t* p, void** expected, void* desired,
+                                      mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_CAS(p, expected, desired, order);
+}
+
+#else
+
+static inline uint32_t mqtt_atomic_load_u32(mqtt_atomic_u32_t* p, mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    uint32_t value = *p;
+    mqtt_atomic_unlock(state);
+    return value;
+}
+
+static inline void mqtt_atomic_store_u32(mqtt_atomic_u32_t* p, uint32_t value, mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    *p = value;
+    mqtt_atomic_unlock(state);
+}
+
+static inline uint32_t mqtt_atomic_fetch_add_u32(mqtt_atomic_u32_t* p, uint32_t value,
+                                                 mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    uint32_t old = *p;
+    *p = old + value;
+    mqtt_atomic_unlock(state);
+    return old;
+}
+
+static inline int mqtt_atomic_cas_u32(mqtt_atomic_u32_t* p, uint32_t* expected, uint32_t desired,
+                                      mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    int ok = (*p == *expected);
+    if (ok) *p = desired;
+    else *expected = *p;
+    mqtt_atomic_unlock(state);
+    return ok;
+}
+
+static inline void* mqtt_atomic_load_ptr(mqtt_atomic_ptr_t* p, mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    void* value = *p;
+    mqtt_atomic_unlock(state);
+    return value;
+}
+
+static inline void mqtt_atomic_store_ptr(mqtt_atomic_ptr_t* p, void* value, mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    *p = value;
+    mqtt_atomic_unlock(state);
+}
+
+static inline int mqtt_atomic_cas_ptr(mqtt_atomic_ptr_t* p, void** expected, void* desired,
+                                      mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    int ok = (*p == *expected);
+    if (ok) *p = desired;
+    else *expected = *p;
+    mqtt_atomic_unlock(state);
+    return ok;
+}
+
+#endif
+
+#ifdef MQTT_ATOMIC_U64_NATIVE
+
+static inline uint64_t mqtt_atomic_load_u64(mqtt_atomic_u64_t* p, mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_LOAD(p, order);
+}
+
+static inline void mqtt_atomic_store_u64(mqtt_atomic_u64_t* p, uint64_t value, mqtt_memory_order_t order) {
+    MQTT_ATOMIC_STORE(p, value, order);
+}
+
+static inline uint64_t mqtt_atomic_fetch_add_u64(mqtt_atomic_u64_t* p, uint64_t value,
+                                                 mqtt_memory_order_t order) {
+    return MQTT_ATOMIC_FETCH_ADD(p, value, order);
+}
+
+#else
+
+typedef volatile uint64_t mqtt_atomic_u64_t;
+
+static inline uint64_t mqtt_atomic_load_u64(mqtt_atomic_u64_t* p, mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    uint64_t value = *p;
+    mqtt_atomic_unlock(state);
+    return value;
+}
+
+static inline void mqtt_atomic_store_u64(mqtt_atomic_u64_t* p, uint64_t value, mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    *p = value;
+    mqtt_atomic_unlock(state);
+}
+
+static inline uint64_t mqtt_atomic_fetch_add_u64(mqtt_atomic_u64_t* p, uint64_t value,
+                                                 mqtt_memory_order_t order) {
+    (void)order;
+    uint32_t state = mqtt_atomic_lock();
+    uint64_t old = *p;
+    *p = old + value;
+    mqtt_atomic_unlock(state);
+    return old;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_ATOMIC_H */
@@ -0,0 +1,128 @@
+/**
+ * @file mqtt_batch.h
+ * @brief Batching of small readings into multi-message envelopes
+ *
+ * Readings published through a batcher accumulate per topic and go out as
+ * one PUBLISH once the envelope reaches its size or count limit, or its
+ * oldest reading reaches the age limit. A reading then costs its length
+ * prefix instead of a fixed header, topic and packet of its own.
+ *
+ * Envelope layout: u8 version, then per reading a length as a variable
+ * byte integer (MQTT remaining length encoding) followed by the bytes.
+ */
+
+#ifndef MQTT_BATCH_H
+#define MQTT_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Envelope format version */
+#define MQTT_BATCH_VERSION          1
+
+/** @brief Topics batched at once when the configuration leaves max_topics at 0 */
+#define MQTT_BATCH_DEFAULT_TOPICS   4
+
+/** @brief Envelope size limit when the configuration leaves max_bytes at 0 */
+#define MQTT_BATCH_DEFAULT_BYTES    512
+
+/** @brief Age limit when the configuration leaves max_age_ms at 0 */
+#define MQTT_BATCH_DEFAULT_AGE_MS   1000
+
+/**
+ * @brief Batcher configuration
+ */
+typedef struct {
+    uint16_t max_topics;   /**< Topics with an open envelope; a new topic flushes the oldest */
+    uint16_t max_bytes;    /**< Envelope size limit, capped by MQTT_MAX_PACKET_SIZE */
+    uint16_t max_count;    /**< Readings per envelope, 0 for no limit */
+    uint32_t max_age_ms;   /**< Longest a reading waits for its envelope to fill */
+    uint8_t qos;           /**< QoS of the envelopes */
+} mqtt_batch_config_t;
+
+/**
+ * @brief Batcher statistics snapshot
+ */
+typedef struct {
+    uint32_t readings;     /**< Readings added */
+    uint32_t envelopes;    /**< Envelopes published */
+    uint32_t dropped;      /**< Readings lost with an envelope whose publish failed */
+    uint64_t bytes;        /**< Envelope payload bytes published */
+} mqtt_batch_stats_t;
+
+/** @brief Batcher instance (opaque) */
+typedef struct mqtt_batch mqtt_batch_t;
+
+/**
+ * @brief Create a batcher publishing through a client
+ * @param client Client handle
+ * @param config Configuration, NULL for defaults
+ * @return Batcher handle on success, NULL on failure
+ */
+mqtt_batch_t* mqtt_batch_create(mqtt_client_t* client, const mqtt_batch_config_t* config);
+
+/**
+ * @brief Flush open envelopes and destroy the batcher
+ * @param batch Batcher handle
+ */
+void mqtt_batch_destroy(mqtt_batch_t* batch);
+
+/**
+ * @brief Add a reading to the envelope of its topic
+ * @param batch Batcher handle
+ * @param topic Topic name
+ * @param data Reading
+ * @param len Reading length
+ * @return 0 on success, -1 if the reading or topic can never fit an
+ *         envelope, or a flush it caused failed
+ */
+int mqtt_batch_add(mqtt_batch_t* batch, const char* topic, const uint8_t* data, size_t len);
+
+/**
+ * @brief Publish envelopes whose oldest reading reached the age limit
+ * @param batch Batcher handle
+ * @return Milliseconds until the next envelope ages out, UINT32_MAX when
+ *         all are empty
+ * @note Call periodically; without it envelopes only leave when full
+ */
+uint32_t mqtt_batch_poll(mqtt_batch_t* batch);
+
+/**
+ * @brief Publish all open envelopes now
+ * @param batch Batcher handle
+ * @return 0 on success, -1 if any publish failed
+ */
+int mqtt_batch_flush(mqtt_batch_t* batch);
+
+/**
+ * @brief Get a snapshot of batcher statistics
+ * @param batch Batcher handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_batch_get_stats(mqtt_batch_t* batch, mqtt_batch_stats_t* stats);
+
+/**
+ * @brief Split a received envelope into readings
+ * @param topic Topic the envelope arrived on, passed through to cb
+ * @param payload Envelope
+ * @param len Envelope length
+ * @param cb Called once per reading, in order
+ * @param user_data User data passed to cb
+ * @return Number of readings, -1 if the envelope is malformed (readings
+ *         before the damage have been delivered)
+ * @note Call from the message callback of the subscribed topic
+ */
+int mqtt_batch_unpack(const char* topic, const uint8_t* payload, size_t len,
+                      mqtt_msg_callback_t cb, void* user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_BATCH_H */
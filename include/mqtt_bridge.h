@@ -0,0 +1,112 @@
+/**
+ * @file mqtt_bridge.h
+ * @brief Broker-to-broker bridge
+ *
+ * A bridge holds one client on each of two brokers and forwards messages
+ * matching its rules from one side to the other, optionally rewriting a
+ * topic prefix. Forwarded payloads go out straight from the receive buffer
+ * of the source client, gathered with the new PUBLISH header through the
+ * network port's sendv() when it has one.
+ *
+ * A message received at QoS 1 and forwarded at QoS 1 is only acknowledged
+ * to the source broker once the destination broker has acknowledged the
+ * forwarded copy, so the source redelivers it if the bridge dies before
+ * the hand-over completed.
+ *
+ * Limitations: forwarded QoS 1 publishes are not retransmitted, and chains
+ * still waiting when either side reconnects are acknowledged once they are
+ * evicted from the pending table. Rules forwarding overlapping topics in
+ * both directions loop unless their prefixes keep the two apart.
+ */
+
+#ifndef MQTT_BRIDGE_H
+#define MQTT_BRIDGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief QoS 1 hand-overs awaiting the destination PUBACK per direction, above common broker inflight windows */
+#define MQTT_BRIDGE_MAX_PENDING   64
+
+/**
+ * @brief Forwarding direction of a rule
+ */
+typedef enum {
+    MQTT_BRIDGE_A_TO_B = 0,  /**< Subscribe on broker A, publish on broker B */
+    MQTT_BRIDGE_B_TO_A       /**< Subscribe on broker B, publish on broker A */
+} mqtt_bridge_direction_t;
+
+/**
+ * @brief Forwarding rule
+ *
+ * A forwarded topic has strip_prefix removed (when it starts with it) and
+ * add_prefix prepended. Strings must stay valid for the bridge lifetime.
+ */
+typedef struct {
+    const char* filter;                /**< Topic filter subscribed on the source broker */
+    uint8_t qos;                       /**< QoS of the subscription and the forwarded publish */
+    mqtt_bridge_direction_t direction; /**< Forwarding direction */
+    const char* strip_prefix;          /**< Prefix removed from source topics, may be NULL */
+    const char* add_prefix;            /**< Prefix added to destination topics, may be NULL */
+} mqtt_bridge_rule_t;
+
+/**
+ * @brief Bridge statistics snapshot
+ */
+typedef struct {
+    uint32_t forwarded;      /**< Messages published on the destination broker */
+    uint32_t dropped;        /**< Messages whose topic or publish failed */
+    uint32_t chained_acks;   /**< Source PUBACKs sent after the destination PUBACK */
+    uint32_t direct_acks;    /**< Source PUBACKs sent early: dropped, or evicted from a full table */
+} mqtt_bridge_stats_t;
+
+/** @brief Bridge instance (opaque) */
+typedef struct mqtt_bridge mqtt_bridge_t;
+
+/**
+ * @brief Connect to both brokers and subscribe the rules
+ * @param config_a Configuration of the client on broker A
+ * @param config_b Configuration of the client on broker B
+ * @param rules Forwarding rules, copied
+ * @param count Number of rules (at most MQTT_MAX_SUBSCRIPTIONS per direction)
+ * @return Bridge handle on success, NULL on failure
+ * @note The bridge owns the msg_cb, puback_cb and user_data of both
+ *       configurations; the values passed in are ignored. Messages a
+ *       persistent session delivers before both sides are connected are
+ *       dropped.
+ */
+mqtt_bridge_t* mqtt_bridge_create(const mqtt_config_t* config_a, const mqtt_config_t* config_b,
+                                  const mqtt_bridge_rule_t* rules, int count);
+
+/**
+ * @brief Disconnect both clients and destroy the bridge
+ * @param bridge Bridge handle
+ */
+void mqtt_bridge_destroy(mqtt_bridge_t* bridge);
+
+/**
+ * @brief Client of one side
+ * @param bridge Bridge handle
+ * @param side 0 for broker A, 1 for broker B
+ * @return Client handle, NULL if side is out of range
+ */
+mqtt_client_t* mqtt_bridge_client(mqtt_bridge_t* bridge, int side);
+
+/**
+ * @brief Get a snapshot of bridge statistics, summed over both directions
+ * @param bridge Bridge handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_bridge_get_stats(mqtt_bridge_t* bridge, mqtt_bridge_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_BRIDGE_H */
@@ -0,0 +1,127 @@
+/**
+ * @file mqtt_broker.h
+ * @brief Embedded MQTT 3.1.1 broker for edge aggregation
+ *
+ * A small broker running inside the gateway process: it accepts local
+ * devices through the network port's listen()/accept(), fans their
+ * publishes out to matching subscriptions with the client's wildcard
+ * matching, and delivers to in-process subscribers and upstream clients
+ * without a network hop. Each connection is served by its own thread.
+ *
+ * Scope: deliveries go out at QoS 0 (SUBACK grants QoS 0), inbound QoS 1
+ * is acknowledged once fanned out, QoS 2 closes the connection. There are
+ * no retained messages, wills, persistent sessions or authentication, so
+ * bind it to an interface only trusted devices reach.
+ */
+
+#ifndef MQTT_BROKER_H
+#define MQTT_BROKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Connections served at once when the configuration leaves max_sessions at 0 */
+#define MQTT_BROKER_DEFAULT_SESSIONS    32
+
+/** @brief Filters per connection when the configuration leaves max_subscriptions at 0 */
+#define MQTT_BROKER_DEFAULT_SUBS        8
+
+/** @brief In-process subscriptions, including upstream forwards */
+#define MQTT_BROKER_MAX_LOCAL_SUBS      8
+
+/** @brief Longest client identifier accepted */
+#define MQTT_BROKER_CLIENT_ID_MAX       64
+
+/**
+ * @brief Broker configuration
+ */
+typedef struct {
+    const char* host;                /**< Local address to listen on, NULL for all interfaces */
+    uint16_t port;                   /**< Listening port (usually 1883) */
+    uint16_t max_sessions;           /**< Connections served at once */
+    uint16_t max_subscriptions;      /**< Topic filters per connection */
+    mqtt_thread_attr_t thread;       /**< Accept and connection thread attributes (zero for defaults) */
+} mqtt_broker_config_t;
+
+/**
+ * @brief Broker statistics snapshot
+ */
+typedef struct {
+    uint32_t sessions;       /**< Connections currently open */
+    uint32_t connects;       /**< Connections accepted with a valid CONNECT */
+    uint32_t rejected;       /**< Connections refused because all sessions were in use */
+    uint32_t messages;       /**< Messages published into the broker */
+    uint32_t deliveries;     /**< Copies sent to connections */
+    uint32_t local;          /**< Copies delivered in-process or forwarded upstream */
+    uint32_t send_failures;  /**< Copies lost to a failed send, closing the connection */
+} mqtt_broker_stats_t;
+
+/** @brief Broker instance (opaque) */
+typedef struct mqtt_broker mqtt_broker_t;
+
+/**
+ * @brief Start listening and serving connections
+ * @param config Configuration
+ * @return Broker handle on success, NULL on failure (also when the network
+ *         port has no listen()/accept())
+ */
+mqtt_broker_t* mqtt_broker_create(const mqtt_broker_config_t* config);
+
+/**
+ * @brief Close all connections and destroy the broker
+ * @param broker Broker handle
+ */
+void mqtt_broker_destroy(mqtt_broker_t* broker);
+
+/**
+ * @brief Publish a message from the gateway process
+ * @param broker Broker handle
+ * @param topic Topic name
+ * @param payload Message payload
+ * @param len Payload length
+ * @return 0 on success, -1 on invalid arguments
+ * @note Delivered to connections and in-process subscribers like a message
+ *       from a device, on the calling thread
+ */
+int mqtt_broker_publish(mqtt_broker_t* broker, const char* topic, const uint8_t* payload, size_t len);
+
+/**
+ * @brief Subscribe in-process
+ * @param broker Broker handle
+ * @param filter Topic filter
+ * @param cb Called for every matching message, on the publishing connection's thread
+ * @param user_data User data passed to cb
+ * @return 0 on success, -1 if MQTT_BROKER_MAX_LOCAL_SUBS are in use
+ */
+int mqtt_broker_subscribe(mqtt_broker_t* broker, const char* filter, mqtt_msg_callback_t cb, void* user_data);
+
+/**
+ * @brief Forward matching messages upstream through a client
+ * @param broker Broker handle
+ * @param filter Topic filter
+ * @param client Client connected to the upstream broker
+ * @param qos QoS of the upstream publishes
+ * @return 0 on success, -1 if MQTT_BROKER_MAX_LOCAL_SUBS are in use
+ * @note Messages coming back down through mqtt_broker_publish() are
+ *       forwarded again if they match, so keep the two topic trees apart
+ */
+int mqtt_broker_forward(mqtt_broker_t* broker, const char* filter, mqtt_client_t* client, uint8_t qos);
+
+/**
+ * @brief Get a snapshot of broker statistics
+ * @param broker Broker handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_broker_get_stats(mqtt_broker_t* broker, mqtt_broker_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_BROKER_H */
@@ -0,0 +1,111 @@
+/**
+ * @file mqtt_capture.h
+ * @brief Wire capture at the network abstraction boundary
+ *
+ * The capture hook wraps the registered mqtt_net_api_t and records every
+ * connect, send, recv and disconnect with a timestamp. Records go to a
+ * caller-supplied sink or to a binary capture file that tools/mqtt_replay.c
+ * can feed back through the client's framer and dispatch.
+ *
+ * Capture file layout (all integers little-endian):
+ *   File header:   "MQCAP" magic, 1 byte version, 2 reserved bytes
+ *   Record header: u64 timestamp_us, u16 connection, u8 type, u8 reserved,
+ *                  u32 data length, followed by the data bytes
+ */
+
+#ifndef MQTT_CAPTURE_H
+#define MQTT_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt_net.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Capture file magic */
+#define MQTT_CAPTURE_MAGIC        "MQCAP"
+
+/** @brief Capture file format version */
+#define MQTT_CAPTURE_VERSION      1
+
+/** @brief Size of the capture file header */
+#define MQTT_CAPTURE_FILE_HDR_LEN 8
+
+/** @brief Size of a record header */
+#define MQTT_CAPTURE_REC_HDR_LEN  16
+
+/**
+ * @brief Capture record type
+ */
+typedef enum {
+    MQTT_CAPTURE_SEND = 0,        /**< Bytes sent to the broker */
+    MQTT_CAPTURE_RECV = 1,        /**< Bytes received from the broker */
+    MQTT_CAPTURE_CONNECT = 2,     /**< Connection established, data is "host:port" */
+    MQTT_CAPTURE_DISCONNECT = 3   /**< Connection closed, no data */
+} mqtt_capture_type_t;
+
+/**
+ * @brief Decoded record header
+ */
+typedef struct {
+    uint64_t timestamp_us;        /**< Capture timestamp */
+    uint16_t connection;          /**< Connection number, increments per connect */
+    uint8_t type;                 /**< mqtt_capture_type_t */
+    uint32_t len;                 /**< Data length */
+} mqtt_capture_record_t;
+
+/**
+ * @brief Capture sink, receives one encoded record (header and data) per call
+ * @param hdr Encoded record header (MQTT_CAPTURE_REC_HDR_LEN bytes)
+ * @param data Record data
+ * @param len Data length
+ * @param ctx Sink context
+ */
+typedef void (*mqtt_capture_sink_t)(const uint8_t* hdr, const uint8_t* data, size_t len, void* ctx);
+
+/**
+ * @brief Start capturing to a sink
+ *
+ * Wraps the currently registered network API; call after mqtt_net_init()
+ * and before creating clients.
+ * @param sink Record sink
+ * @param ctx Sink context
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_capture_start(mqtt_capture_sink_t sink, void* ctx);
+
+/**
+ * @brief Start capturing to a binary capture file
+ * @param path File path
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_capture_start_file(const char* path);
+
+/**
+ * @brief Stop capturing and restore the wrapped network API
+ * @note Clients may keep running; calls already inside the hook complete
+ *       unrecorded, and the sink is not called once this returns
+ */
+void mqtt_capture_stop(void);
+
+/**
+ * @brief Encode a record header
+ * @param hdr Output buffer (MQTT_CAPTURE_REC_HDR_LEN bytes)
+ * @param rec Record header
+ */
+void mqtt_capture_encode(uint8_t* hdr, const mqtt_capture_record_t* rec);
+
+/**
+ * @brief Decode a record header
+ * @param hdr Encoded header (MQTT_CAPTURE_REC_HDR_LEN bytes)
+ * @param rec Output record header
+ */
+void mqtt_capture_decode(const uint8_t* hdr, mqtt_capture_record_t* rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_CAPTURE_H */
@@ -0,0 +1,98 @@
+/**
+ * @file mqtt_codec.h
+ * @brief MQTT 3.1.1 packet encoding shared by the client and the broker (internal use)
+ */
+
+#ifndef MQTT_CODEC_H
+#define MQTT_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Control packet types (fixed header bits 7-4) */
+#define MQTT_CONNECT        1
+#define MQTT_CONNACK        2
+#define MQTT_PUBLISH        3
+#define MQTT_PUBACK         4
+#define MQTT_SUBSCRIBE      8
+#define MQTT_SUBACK         9
+#define MQTT_UNSUBSCRIBE    10
+#define MQTT_UNSUBACK       11
+#define MQTT_PINGREQ        12
+#define MQTT_PINGRESP       13
+#define MQTT_DISCONNECT     14
+
+/** @brief Largest remaining length a fixed header can encode */
+#define MQTT_MAX_REMAINING_LENGTH 268435455
+
+/**
+ * @brief Fields of a received PUBLISH, pointing into the packet
+ */
+typedef struct {
+    const uint8_t* topic;     /**< Topic name, not terminated */
+    uint16_t topic_len;       /**< Topic name length */
+    uint8_t qos;              /**< QoS level */
+    uint8_t retain;           /**< Retain flag */
+    uint16_t packet_id;       /**< Packet ID, 0 for QoS 0 */
+    const uint8_t* payload;   /**< Payload */
+    size_t payload_len;       /**< Payload length */
+} mqtt_publish_view_t;
+
+/**
+ * @brief Encode a remaining length
+ * @param buf Output, at least 4 bytes
+ * @param len Remaining length (at most MQTT_MAX_REMAINING_LENGTH)
+ * @return Number of bytes written
+ */
+int mqtt_encode_remaining_length(uint8_t* buf, size_t len);
+
+/**
+ * @brief Check whether buf holds a complete fixed header
+ * @param buf Buffered input starting at a packet
+ * @param avail Bytes buffered
+ * @param pkt_len Output total packet length when the header is complete
+ * @return 1 when the header is complete, 0 when more bytes are needed,
+ *         -1 when the remaining length encoding is malformed
+ */
+int mqtt_frame_packet(const uint8_t* buf, size_t avail, size_t* pkt_len);
+
+/**
+ * @brief Pack a PUBLISH up to its payload
+ * @param buf Output buffer
+ * @param size Output buffer size
+ * @param topic Topic name
+ * @param payload_len Length of the payload sent after the header
+ * @param qos QoS level
+ * @param packet_id Packet ID, ignored for QoS 0
+ * @return Header length, -1 if it does not fit buf or the packet is too large
+ */
+int mqtt_pack_publish_header(uint8_t* buf, size_t size, const char* topic, size_t payload_len,
+                             uint8_t qos, uint16_t packet_id);
+
+/**
+ * @brief Pack a 4-byte packet carrying only a packet ID (PUBACK, UNSUBACK)
+ * @param buf Output, at least 4 bytes
+ * @param type Packet type
+ * @param packet_id Packet ID
+ * @return 4
+ */
+int mqtt_pack_ack(uint8_t* buf, uint8_t type, uint16_t packet_id);
+
+/**
+ * @brief Parse a complete PUBLISH packet
+ * @param pkt Packet including the fixed header
+ * @param len Packet length
+ * @param view Output fields
+ * @return 0 on success, -1 if the packet is malformed
+ */
+int mqtt_parse_publish(const uint8_t* pkt, size_t len, mqtt_publish_view_t* view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_CODEC_H */
@@ -0,0 +1,125 @@
+/**
+ * @file mqtt_deadband.h
+ * @brief Deadband and rate-limit filter for telemetry publishes
+ *
+ * Readings published through a filter are dropped before they are encoded
+ * unless they differ enough from the last value sent on their topic. Each
+ * topic follows a rule:
+ *
+ * - a reading arriving max_silence_ms or more after the last one sent is
+ *   always sent, as a heartbeat
+ * - otherwise one arriving less than min_interval_ms after it is dropped
+ * - otherwise a numeric reading (an ASCII decimal payload) is sent when it
+ *   moved more than abs_delta, or more than rel_delta times the last value,
+ *   from the last value sent; with both at 0 any change counts
+ * - other payloads are sent when their bytes changed
+ *
+ * Topics live in an open-addressing hash table sized at creation. A topic
+ * can be registered once for a handle that skips the lookup.
+ */
+
+#ifndef MQTT_DEADBAND_H
+#define MQTT_DEADBAND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Topics tracked when the configuration leaves max_topics at 0 */
+#define MQTT_DEADBAND_DEFAULT_TOPICS    64
+
+/**
+ * @brief Filter rule of a topic
+ */
+typedef struct {
+    double abs_delta;          /**< Smallest absolute change sent, 0 to disable */
+    double rel_delta;          /**< Smallest change relative to the last value sent, 0 to disable */
+    uint32_t min_interval_ms;  /**< Shortest time between two sends, 0 for no limit */
+    uint32_t max_silence_ms;   /**< Longest time without a send while readings arrive, 0 for no heartbeat */
+} mqtt_deadband_rule_t;
+
+/**
+ * @brief Filter configuration
+ */
+typedef struct {
+    uint16_t max_topics;           /**< Topics tracked; readings on further topics are always sent */
+    uint8_t qos;                   /**< QoS of the publishes */
+    mqtt_deadband_rule_t rule;     /**< Rule of topics without one of their own */
+} mqtt_deadband_config_t;
+
+/**
+ * @brief Filter statistics snapshot
+ */
+typedef struct {
+    uint32_t forwarded;      /**< Readings published */
+    uint32_t suppressed;     /**< Readings dropped inside the deadband */
+    uint32_t rate_limited;   /**< Readings dropped by min_interval_ms */
+    uint32_t heartbeats;     /**< Forwarded readings sent only because of max_silence_ms */
+    uint32_t untracked;      /**< Readings sent unfiltered because the table was full */
+} mqtt_deadband_stats_t;
+
+/** @brief Filter instance (opaque) */
+typedef struct mqtt_deadband mqtt_deadband_t;
+
+/**
+ * @brief Create a filter publishing through a client
+ * @param client Client handle
+ * @param config Configuration, NULL for defaults (no deadband, every change sent)
+ * @return Filter handle on success, NULL on failure
+ */
+mqtt_deadband_t* mqtt_deadband_create(mqtt_client_t* client, const mqtt_deadband_config_t* config);
+
+/**
+ * @brief Destroy a filter
+ * @param db Filter handle
+ */
+void mqtt_deadband_destroy(mqtt_deadband_t* db);
+
+/**
+ * @brief Track a topic, optionally with its own rule
+ * @param db Filter handle
+ * @param topic Topic name
+ * @param rule Rule for this topic, NULL for the configured one
+ * @return Topic handle (>= 0), -1 if the table is full or the topic too long
+ * @note Registering a tracked topic again replaces its rule and returns
+ *       the same handle
+ */
+int mqtt_deadband_register(mqtt_deadband_t* db, const char* topic, const mqtt_deadband_rule_t* rule);
+
+/**
+ * @brief Publish a reading by topic handle
+ * @param db Filter handle
+ * @param handle Handle from mqtt_deadband_register()
+ * @param payload Reading
+ * @param len Reading length
+ * @return 1 if published, 0 if dropped by the filter, -1 on failure
+ */
+int mqtt_deadband_publish_handle(mqtt_deadband_t* db, int handle, const uint8_t* payload, size_t len);
+
+/**
+ * @brief Publish a reading by topic name, tracking new topics with the configured rule
+ * @param db Filter handle
+ * @param topic Topic name
+ * @param payload Reading
+ * @param len Reading length
+ * @return 1 if published, 0 if dropped by the filter, -1 on failure
+ */
+int mqtt_deadband_publish(mqtt_deadband_t* db, const char* topic, const uint8_t* payload, size_t len);
+
+/**
+ * @brief Get a snapshot of filter statistics
+ * @param db Filter handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_deadband_get_stats(mqtt_deadband_t* db, mqtt_deadband_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_DEADBAND_H */
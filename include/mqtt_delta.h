@@ -0,0 +1,153 @@
+/**
+ * @file mqtt_delta.h
+ * @brief Delta encoding of payloads against the previous value per topic
+ *
+ * An encoder publishes each payload either as a keyframe, the payload
+ * itself, or as a delta against the last payload it sent on the topic. A
+ * decoder on the receiving side keeps the last payload per topic too and
+ * rebuilds the original from either. Counters and status structs that
+ * change in a few bytes then cost a few bytes on the wire.
+ *
+ * Frame layout: u8 version and kind (high and low nibble), u8 sequence
+ * number per topic, then for a keyframe the payload, for a delta the new
+ * length and pairs of (unchanged bytes, changed bytes) counts followed by
+ * the changed bytes XORed with the previous payload. Counts and lengths use
+ * the MQTT remaining length encoding; unchanged bytes at the end are
+ * implied.
+ *
+ * A delta applies only to the payload with the sequence number before it.
+ * The decoder drops deltas after a lost or reordered frame until the next
+ * keyframe, which the encoder sends at least every keyframe_interval frames
+ * of a topic, and whenever a delta would not be smaller.
+ */
+
+#ifndef MQTT_DELTA_H
+#define MQTT_DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Frame format version */
+#define MQTT_DELTA_VERSION              1
+
+/** @brief Frame kinds */
+#define MQTT_DELTA_KEYFRAME             0
+#define MQTT_DELTA_DELTA                1
+
+/** @brief Topics tracked when the configuration leaves max_topics at 0 */
+#define MQTT_DELTA_DEFAULT_TOPICS       32
+
+/** @brief Largest payload when the configuration leaves max_payload at 0 */
+#define MQTT_DELTA_DEFAULT_PAYLOAD      256
+
+/** @brief Frames per keyframe when the configuration leaves keyframe_interval at 0 */
+#define MQTT_DELTA_DEFAULT_INTERVAL     16
+
+/**
+ * @brief Encoder and decoder configuration
+ */
+typedef struct {
+    uint16_t max_topics;          /**< Topics tracked; payloads on further topics are always keyframes */
+    uint16_t max_payload;         /**< Largest payload, capped by MQTT_MAX_PACKET_SIZE */
+    uint16_t keyframe_interval;   /**< Encoder: frames of a topic between keyframes, 1 for keyframes only */
+    uint8_t qos;                  /**< Encoder: QoS of the publishes */
+} mqtt_delta_config_t;
+
+/**
+ * @brief Codec statistics snapshot
+ */
+typedef struct {
+    uint32_t keyframes;     /**< Keyframes sent or received */
+    uint32_t deltas;        /**< Deltas sent or applied */
+    uint64_t raw_bytes;     /**< Payload bytes before encoding or after decoding */
+    uint64_t wire_bytes;    /**< Frame bytes sent or received */
+    uint32_t missed;        /**< Decoder: deltas dropped for want of the payload before them */
+    uint32_t malformed;     /**< Decoder: frames that could not be parsed */
+} mqtt_delta_stats_t;
+
+/** @brief Encoder instance (opaque) */
+typedef struct mqtt_delta mqtt_delta_t;
+
+/** @brief Decoder instance (opaque) */
+typedef struct mqtt_delta_decoder mqtt_delta_decoder_t;
+
+/**
+ * @brief Create an encoder publishing through a client
+ * @param client Client handle
+ * @param config Configuration, NULL for defaults
+ * @return Encoder handle on success, NULL on failure
+ */
+mqtt_delta_t* mqtt_delta_create(mqtt_client_t* client, const mqtt_delta_config_t* config);
+
+/**
+ * @brief Destroy an encoder
+ * @param delta Encoder handle
+ */
+void mqtt_delta_destroy(mqtt_delta_t* delta);
+
+/**
+ * @brief Publish a payload as a keyframe or a delta
+ * @param delta Encoder handle
+ * @param topic Topic name
+ * @param payload Payload
+ * @param len Payload length, at most max_payload
+ * @return 0 on success, -1 on failure
+ * @note After a failed publish the next frame of the topic is a keyframe
+ */
+int mqtt_delta_publish(mqtt_delta_t* delta, const char* topic, const uint8_t* payload, size_t len);
+
+/**
+ * @brief Get a snapshot of encoder statistics
+ * @param delta Encoder handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_delta_get_stats(mqtt_delta_t* delta, mqtt_delta_stats_t* stats);
+
+/**
+ * @brief Create a decoder
+ * @param config Configuration (max_topics and max_payload used), NULL for defaults
+ * @return Decoder handle on success, NULL on failure
+ */
+mqtt_delta_decoder_t* mqtt_delta_decoder_create(const mqtt_delta_config_t* config);
+
+/**
+ * @brief Destroy a decoder
+ * @param decoder Decoder handle
+ */
+void mqtt_delta_decoder_destroy(mqtt_delta_decoder_t* decoder);
+
+/**
+ * @brief Rebuild the payload of a received frame
+ * @param decoder Decoder handle
+ * @param topic Topic the frame arrived on, passed through to cb
+ * @param frame Frame
+ * @param len Frame length
+ * @param cb Called with the rebuilt payload
+ * @param user_data User data passed to cb
+ * @return 1 if delivered, 0 if a delta was dropped for want of its base,
+ *         -1 if the frame is malformed
+ * @note Call from the message callback of the subscribed topic; cb runs
+ *       under the decoder's lock and must not call back into it
+ */
+int mqtt_delta_unpack(mqtt_delta_decoder_t* decoder, const char* topic, const uint8_t* frame, size_t len,
+                      mqtt_msg_callback_t cb, void* user_data);
+
+/**
+ * @brief Get a snapshot of decoder statistics
+ * @param decoder Decoder handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_delta_decoder_get_stats(mqtt_delta_decoder_t* decoder, mqtt_delta_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_DELTA_H */
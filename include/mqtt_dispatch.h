@@ -0,0 +1,114 @@
+/**
+ * @file mqtt_dispatch.h
+ * @brief Inbound dispatch queue for slow consumers
+ *
+ * A dispatcher stands between the receive thread and a consumer callback:
+ * mqtt_dispatch_msg(), used as a subscription's callback, copies each
+ * message into a bounded queue and returns, and a worker thread of the
+ * dispatcher runs the consumer on them in order. The receive thread keeps
+ * reading, and acknowledging, however slow the consumer is.
+ *
+ * When the consumer falls behind, the policy decides what it still sees:
+ *
+ * - MQTT_DISPATCH_CONFLATE: a message to a topic that still has one pending
+ *   replaces it in place, so the consumer only handles the newest value of
+ *   each topic; a message to a new topic arriving when full drops the oldest
+ * - MQTT_DISPATCH_DROP_OLDEST: when full, the oldest pending message makes room
+ * - MQTT_DISPATCH_DROP_NEWEST: when full, the arriving message is dropped
+ *
+ * QoS 1 messages are acknowledged once queued, so a message dropped here is
+ * not redelivered.
+ */
+
+#ifndef MQTT_DISPATCH_H
+#define MQTT_DISPATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Pending messages when the configuration leaves capacity at 0 */
+#define MQTT_DISPATCH_DEFAULT_CAPACITY  32
+
+/** @brief Largest payload when the configuration leaves max_payload at 0 */
+#define MQTT_DISPATCH_DEFAULT_PAYLOAD   256
+
+/**
+ * @brief What gives way when the consumer falls behind
+ */
+typedef enum {
+    MQTT_DISPATCH_CONFLATE = 0,    /**< Newest message per topic replaces the pending one */
+    MQTT_DISPATCH_DROP_OLDEST,     /**< Oldest pending message is dropped when full */
+    MQTT_DISPATCH_DROP_NEWEST      /**< Arriving message is dropped when full */
+} mqtt_dispatch_policy_t;
+
+/**
+ * @brief Dispatcher configuration
+ */
+typedef struct {
+    uint16_t capacity;               /**< Messages pending at once */
+    uint16_t max_payload;            /**< Largest payload queued, capped by MQTT_RECV_BUF_SIZE */
+    mqtt_dispatch_policy_t policy;   /**< Behaviour when the consumer falls behind */
+    mqtt_msg_callback_t cb;          /**< Consumer, run on the dispatcher's thread */
+    void* user_data;                 /**< User data passed to cb */
+    mqtt_thread_attr_t thread;       /**< Worker thread attributes (zero for defaults) */
+} mqtt_dispatch_config_t;
+
+/**
+ * @brief Dispatcher statistics snapshot
+ */
+typedef struct {
+    uint32_t received;     /**< Messages handed to mqtt_dispatch_msg() */
+    uint32_t delivered;    /**< Messages the consumer ran on */
+    uint32_t conflated;    /**< Pending messages replaced by a newer one of their topic */
+    uint32_t dropped;      /**< Pending messages dropped to make room */
+    uint32_t rejected;     /**< Arriving messages dropped, full or too large */
+    uint32_t depth;        /**< Messages pending now */
+    uint32_t max_depth;    /**< Most messages ever pending */
+} mqtt_dispatch_stats_t;
+
+/** @brief Dispatcher instance (opaque) */
+typedef struct mqtt_dispatch mqtt_dispatch_t;
+
+/**
+ * @brief Create a dispatcher and start its worker thread
+ * @param config Configuration (cb required)
+ * @return Dispatcher handle on success, NULL on failure
+ */
+mqtt_dispatch_t* mqtt_dispatch_create(const mqtt_dispatch_config_t* config);
+
+/**
+ * @brief Stop the worker thread and destroy the dispatcher
+ * @param dispatch Dispatcher handle
+ * @note Unsubscribe or destroy the client first; pending messages are discarded
+ */
+void mqtt_dispatch_destroy(mqtt_dispatch_t* dispatch);
+
+/**
+ * @brief Queue a message for the consumer
+ * @param topic Topic name
+ * @param payload Message payload, copied
+ * @param len Payload length
+ * @param user_data Dispatcher handle
+ * @note Matches mqtt_msg_callback_t: pass it with the dispatcher to
+ *       mqtt_client_subscribe_cb(), or as the config msg_cb
+ */
+void mqtt_dispatch_msg(const char* topic, const uint8_t* payload, size_t len, void* user_data);
+
+/**
+ * @brief Get a snapshot of dispatcher statistics
+ * @param dispatch Dispatcher handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_dispatch_get_stats(mqtt_dispatch_t* dispatch, mqtt_dispatch_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_DISPATCH_H */
@@ -0,0 +1,50 @@
+/**
+ * @file mqtt_metrics.h
+ * @brief OpenMetrics (Prometheus) exporter for MQTT client statistics
+ *
+ * Renders the statistics of one or more clients in OpenMetrics text format.
+ * Every sample carries a client_id label so a scraper can tell clients apart.
+ */
+
+#ifndef MQTT_METRICS_H
+#define MQTT_METRICS_H
+
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief OpenMetrics content type for HTTP responses */
+#define MQTT_METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/**
+ * @brief Render client metrics in OpenMetrics text format
+ * @param clients Array of client handles
+ * @param count Number of clients
+ * @param buf Output buffer
+ * @param len Buffer size
+ * @return Number of characters written (excluding terminator), -1 if the
+ *         buffer is too small or a snapshot could not be taken
+ */
+int mqtt_metrics_render(mqtt_client_t* const* clients, size_t count, char* buf, size_t len);
+
+/**
+ * @brief Serve metrics over HTTP (POSIX port only, see posix_metrics_http.c)
+ * @param port TCP port to listen on
+ * @param clients Array of client handles, must stay valid until stopped
+ * @param count Number of clients
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_metrics_http_start(uint16_t port, mqtt_client_t* const* clients, size_t count);
+
+/**
+ * @brief Stop the HTTP metrics listener
+ */
+void mqtt_metrics_http_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_METRICS_H */
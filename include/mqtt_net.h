@@ -19,11 +19,22 @@ extern "C" {
 /** @brief Opaque socket handle */
 typedef void* mqtt_socket_t;
 
+/** @brief Most buffers the core passes to one sendv() call */
+#define MQTT_NET_MAX_IOV 4
+
+/**
+ * @brief One buffer of a gathered send
+ */
+typedef struct {
+    const uint8_t* buf;  /**< Data */
+    size_t len;          /**< Length of data */
+} mqtt_iovec_t;
+
 /**
  * @brief Network abstraction layer API structure
  * 
  * This structure contains function pointers for all network operations.
- * Users must implement all these functions and register them via mqtt_net_init().
+ * Users must implement all functions not marked optional and register them via mqtt_net_init().
  */
 typedef struct {
     /** @brief Connect to remote host
@@ -55,8 +66,55 @@ typedef struct {
      *  @return Number of bytes received, 0 on timeout, negative on error
      */
     int (*recv)(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t timeout_ms);
+    
+    /** @brief Send several buffers as one write (optional)
+     *  @param sock Socket handle
+     *  @param iov Buffers to send in order
+     *  @param count Number of buffers
+     *  @return Number of bytes sent, or negative on error
+     *  @note May be NULL, the core then calls send() once per buffer
+     */
+    int (*sendv)(mqtt_socket_t sock, const mqtt_iovec_t* iov, int count);
+    
+    /** @brief Open a listening socket (optional)
+     *  @param host Local address to bind, NULL for all interfaces
+     *  @param port Port number
+     *  @return Listening socket handle on success, NULL on failure
+     *  @note May be NULL if the port does not accept connections; needed by
+     *        the embedded broker. Closed with disconnect().
+     */
+    mqtt_socket_t (*listen)(const char* host, uint16_t port);
+    
+    /** @brief Accept a connection (optional, with listen)
+     *  @param listener Socket from listen()
+     *  @param timeout_ms Longest wait for a connection in milliseconds
+     *  @return Connected socket handle, NULL on timeout or error
+     */
+    mqtt_socket_t (*accept)(mqtt_socket_t listener, uint32_t timeout_ms);
 } mqtt_net_api_t;
 
+#ifdef MQTT_NET_DIRECT
+
+/* Compile-time binding, see MQTT_OS_DIRECT in mqtt_os.h */
+
+/** @brief API table of the network port bound at compile time */
+extern const mqtt_net_api_t mqtt_net_port_api;
+
+/** @brief Define a network port API table (external in direct mode) */
+#define MQTT_NET_PORT_API(name)  const mqtt_net_api_t mqtt_net_port_api
+
+/** @brief Registration is a no-op, the table is fixed */
+#define mqtt_net_init(api)       ((void)0)
+
+static inline const mqtt_net_api_t* mqtt_net_get(void) {
+    return &mqtt_net_port_api;
+}
+
+#else
+
+/** @brief Define a network port API table (file-local, registered at runtime) */
+#define MQTT_NET_PORT_API(name)  static const mqtt_net_api_t name
+
 /**
  * @brief Initialize network abstraction layer
  * @param api Pointer to network API structure
@@ -69,6 +127,8 @@ void mqtt_net_init(const mqtt_net_api_t* api);
  */
 const mqtt_net_api_t* mqtt_net_get(void);
 
+#endif /* MQTT_NET_DIRECT */
+
 #ifdef __cplusplus
 }
 #endif
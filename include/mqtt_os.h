@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "mqtt_atomic.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,14 +26,82 @@ typedef void* mqtt_sem_t;
 /** @brief Opaque thread handle */
 typedef void* mqtt_thread_t;
 
+/** @brief Opaque event handle */
+typedef void* mqtt_event_t;
+
 /** @brief Thread function prototype */
 typedef void (*mqtt_thread_func_t)(void* arg);
 
+/** @brief Stack size used by RTOS ports when a thread attribute leaves it at 0 */
+#define MQTT_THREAD_DEFAULT_STACK_SIZE  2048
+
+/** @brief Priority used by RTOS ports when a thread attribute leaves it at 0 */
+#define MQTT_THREAD_DEFAULT_PRIORITY    5
+
+/**
+ * @brief Thread scheduling policy
+ */
+typedef enum {
+    MQTT_SCHED_DEFAULT = 0,  /**< Port default (time-sharing on POSIX) */
+    MQTT_SCHED_FIFO,         /**< Real-time, run until blocked or preempted */
+    MQTT_SCHED_RR            /**< Real-time, round robin among equal priorities */
+} mqtt_sched_policy_t;
+
+/**
+ * @brief Thread creation attributes
+ *
+ * Zero fields select the port default. Priorities use the native scale of
+ * the OS. On POSIX the priority only applies with a real-time policy.
+ */
+typedef struct {
+    uint32_t stack_size;         /**< Stack size in bytes */
+    uint32_t priority;           /**< Native thread priority */
+    mqtt_sched_policy_t policy;  /**< Scheduling policy (POSIX and NuttX) */
+    uint32_t affinity;           /**< Bit mask of CPUs the thread may run on (SMP only) */
+    const char* name;            /**< Thread name, must outlive the thread */
+    void* stack;                 /**< Caller stack of stack_size bytes (MQTT_OS_STATIC builds) */
+} mqtt_thread_attr_t;
+
+#ifdef MQTT_OS_STATIC
+
+/*
+ * Static allocation: RTOS ports built with MQTT_OS_STATIC create kernel
+ * objects in fixed pools sized below instead of on the heap. Threads use
+ * the caller's stack (mqtt_thread_attr_t.stack) or one of the pool stacks.
+ */
+
+/** @brief Mutexes available to the port */
+#ifndef MQTT_OS_MAX_MUTEXES
+#define MQTT_OS_MAX_MUTEXES         4
+#endif
+
+/** @brief Semaphores available to the port */
+#ifndef MQTT_OS_MAX_SEMS
+#define MQTT_OS_MAX_SEMS            2
+#endif
+
+/** @brief Events available to the port */
+#ifndef MQTT_OS_MAX_EVENTS
+#define MQTT_OS_MAX_EVENTS          2
+#endif
+
+/** @brief Threads available to the port */
+#ifndef MQTT_OS_MAX_THREADS
+#define MQTT_OS_MAX_THREADS         2
+#endif
+
+/** @brief Size in bytes of each pool stack, larger requests need a caller stack */
+#ifndef MQTT_OS_STATIC_STACK_SIZE
+#define MQTT_OS_STATIC_STACK_SIZE   MQTT_THREAD_DEFAULT_STACK_SIZE
+#endif
+
+#endif /* MQTT_OS_STATIC */
+
 /**
  * @brief OS abstraction layer API structure
  * 
  * This structure contains function pointers for all OS-dependent operations.
- * Users must implement all these functions and register them via mqtt_os_init().
+ * Users must implement all functions not marked optional and register them via mqtt_os_init().
  */
 typedef struct {
     /** @brief Allocate memory */
@@ -95,13 +164,114 @@ typedef struct {
     
     /** @brief Sleep for specified milliseconds */
     void (*sleep_ms)(uint32_t ms);
+    
+    /** @brief Get monotonic time in microseconds (optional)
+     *  @return Microseconds since an arbitrary fixed point, never going backwards
+     *  @note May be NULL, mqtt_os_time_us() then falls back to get_time_ms()
+     */
+    uint64_t (*get_time_us)(void);
+    
+    /** @brief Try to lock a mutex without blocking (optional)
+     *  @param mutex Mutex handle
+     *  @return 0 if the mutex was acquired, -1 if it is held elsewhere
+     */
+    int (*mutex_trylock)(mqtt_mutex_t mutex);
+    
+    /** @brief Wait on a semaphore with timeout (optional)
+     *  @param sem Semaphore handle
+     *  @param timeout_ms Timeout in milliseconds, 0 to poll
+     *  @return 0 if the semaphore was taken, -1 on timeout or failure
+     */
+    int (*sem_timedwait)(mqtt_sem_t sem, uint32_t timeout_ms);
+    
+    /** @brief Create an auto-reset event, initially clear (optional) */
+    mqtt_event_t (*event_create)(void);
+    
+    /** @brief Destroy an event */
+    void (*event_destroy)(mqtt_event_t event);
+    
+    /** @brief Set an event; setting an already set event has no effect */
+    void (*event_set)(mqtt_event_t event);
+    
+    /** @brief Wait for an event to be set, clearing it on return
+     *  @param event Event handle
+     *  @param timeout_ms Timeout in milliseconds, 0 to poll
+     *  @return 0 if the event was set, -1 on timeout or failure
+     */
+    int (*event_wait)(mqtt_event_t event, uint32_t timeout_ms);
+    
+    /** @brief Enter a critical section (optional)
+     *  @return State to restore on exit
+     *  @note Used by mqtt_atomic.h where the toolchain lacks native atomics,
+     *        and then required (MQTT_ATOMIC_NEEDS_CRITICAL); sections are
+     *        short and never nested across blocking calls
+     */
+    uint32_t (*critical_enter)(void);
+    
+    /** @brief Leave a critical section
+     *  @param state Value returned by critical_enter()
+     */
+    void (*critical_exit)(uint32_t state);
+    
+    /** @brief Create a thread with extended attributes (optional)
+     *  @param func Thread function
+     *  @param arg Thread argument
+     *  @param attr Thread attributes
+     *  @return Thread handle, NULL if the thread could not be created
+     *          with the requested attributes
+     */
+    mqtt_thread_t (*thread_create_ex)(mqtt_thread_func_t func, void* arg,
+                                      const mqtt_thread_attr_t* attr);
 } mqtt_os_api_t;
 
+#ifdef MQTT_OS_DIRECT
+
+/*
+ * Compile-time binding: exactly one port is linked and defines its API
+ * table as mqtt_os_port_api. Calls through mqtt_os_get() resolve against
+ * a constant object, so the compiler (with link-time optimization) turns
+ * them into direct, inlinable calls.
+ */
+
+/** @brief API table of the port bound at compile time */
+extern const mqtt_os_api_t mqtt_os_port_api;
+
+/** @brief Define a port API table (external in direct mode) */
+#define MQTT_OS_PORT_API(name)  const mqtt_os_api_t mqtt_os_port_api
+
+/** @brief Port registration only runs one-time setup, the table is fixed */
+#define mqtt_os_init(api)       mqtt_os_bind()
+
+/**
+ * @brief One-time setup of the OS layer for the bound port
+ * @return 0 on success, -1 if the port lacks functions this build requires or
+ *         the lock statistics mutex cannot be created
+ */
+int mqtt_os_bind(void);
+
+static inline const mqtt_os_api_t* mqtt_os_get(void) {
+    return &mqtt_os_port_api;
+}
+
+static inline uint64_t mqtt_os_time_us(void) {
+    if (mqtt_os_port_api.get_time_us) return mqtt_os_port_api.get_time_us();
+    return (uint64_t)mqtt_os_port_api.get_time_ms() * 1000;
+}
+
+#else
+
+/** @brief Define a port API table (file-local, registered at runtime) */
+#define MQTT_OS_PORT_API(name)  static const mqtt_os_api_t name
+
 /**
  * @brief Initialize OS abstraction layer
  * @param api Pointer to OS API structure
+ * @return 0 on success, -1 if the API lacks functions this build requires
+ *         (critical_enter/critical_exit with MQTT_ATOMIC_NEEDS_CRITICAL) or
+ *         the lock statistics mutex cannot be created; it is then not
+ *         registered and clients cannot be created
  */
-void mqtt_os_init(const mqtt_os_api_t* api);
+int mqtt_os_init(const mqtt_os_api_t* api);
 
 /**
  * @brief Get current OS API
@@ -109,6 +279,128 @@ void mqtt_os_init(const mqtt_os_api_t* api);
  */
 const mqtt_os_api_t* mqtt_os_get(void);
 
+/**
+ * @brief Get monotonic time in microseconds from the registered port
+ * @return Port get_time_us(), or get_time_ms() * 1000 if the port lacks it
+ */
+uint64_t mqtt_os_time_us(void);
+
+#endif /* MQTT_OS_DIRECT */
+
+/**
+ * @brief Fixed pool of equally sized objects
+ *
+ * Backs static allocation in the ports. Allocation and release are
+ * lock-free and may be called from any thread; a pool holds at most 32
+ * objects.
+ */
+typedef struct {
+    void* storage;            /**< count * size bytes */
+    size_t size;              /**< Object size in bytes */
+    uint32_t count;           /**< Number of objects */
+    mqtt_atomic_u32_t used;   /**< Bit mask of allocated objects */
+} mqtt_os_pool_t;
+
+/** @brief Define a static pool of n (at most 32) objects of the given type */
+#define MQTT_OS_POOL_DEFINE(name, type, n) \
+    typedef char name##_fits_used_mask[((n) <= 32) ? 1 : -1]; \
+    static type name##_storage[n]; \
+    static mqtt_os_pool_t name = { name##_storage, sizeof(type), (n), 0 }
+
+/**
+ * @brief Take an object from a pool
+ * @param pool Pool
+ * @return Object, or NULL if the pool is exhausted
+ */
+void* mqtt_os_pool_alloc(mqtt_os_pool_t* pool);
+
+/**
+ * @brief Return an object to its pool
+ * @param pool Pool the object was taken from
+ * @param obj Object, NULL is ignored
+ */
+void mqtt_os_pool_free(mqtt_os_pool_t* pool, void* obj);
+
+/*
+ * Object storage for ports: the pool in static builds, the given heap
+ * functions otherwise. The pool argument is not evaluated in heap builds.
+ */
+#ifdef MQTT_OS_STATIC
+#define MQTT_OS_OBJ_ALLOC(pool, alloc, size)  mqtt_os_pool_alloc(&(pool))
+#define MQTT_OS_OBJ_FREE(pool, release, obj)  mqtt_os_pool_free(&(pool), (obj))
+#else
+#define MQTT_OS_OBJ_ALLOC(pool, alloc, size)  alloc(size)
+#define MQTT_OS_OBJ_FREE(pool, release, obj)  release(obj)
+#endif
+
+/** @brief Maximum number of lock call sites tracked by lock statistics */
+#define MQTT_LOCKSTAT_MAX_SITES    16
+
+/** @brief Maximum number of mutexes held at once whose hold time is measured */
+#define MQTT_LOCKSTAT_MAX_MUTEXES  16
+
+/**
+ * @brief Lock statistics for one call site
+ */
+typedef struct {
+    const char* func;        /**< Function that took the lock */
+    int line;                /**< Source line of the lock call */
+    uint32_t acquisitions;   /**< Number of times the lock was taken here */
+    uint32_t contended;      /**< Acquisitions that found the mutex already held */
+    uint64_t wait_total_us;  /**< Total time spent waiting for the mutex */
+    uint32_t wait_max_us;    /**< Longest wait */
+    uint64_t hold_total_us;  /**< Total time the mutex was held from this site */
+    uint32_t hold_max_us;    /**< Longest hold */
+} mqtt_lockstat_site_t;
+
+#ifdef MQTT_LOCK_STATS
+
+/**
+ * @brief Lock a mutex and record wait time and contention for the call site
+ * @param mutex Mutex handle
+ * @param func Calling function name
+ * @param line Calling source line
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_lockstat_lock(mqtt_mutex_t mutex, const char* func, int line);
+
+/**
+ * @brief Unlock a mutex and record hold time for the site that locked it
+ * @param mutex Mutex handle
+ */
+void mqtt_lockstat_unlock(mqtt_mutex_t mutex);
+
+/**
+ * @brief Copy lock statistics
+ * @param sites Output array
+ * @param max Capacity of the output array
+ * @return Number of sites copied
+ */
+int mqtt_lockstat_get(mqtt_lockstat_site_t* sites, int max);
+
+/**
+ * @brief Clear all lock statistics
+ */
+void mqtt_lockstat_reset(void);
+
+/**
+ * @brief Format lock statistics as a text table, longest total hold first
+ * @param buf Output buffer
+ * @param len Buffer size
+ * @return Number of characters written (excluding terminator)
+ */
+int mqtt_lockstat_report(char* buf, size_t len);
+
+#define MQTT_MUTEX_LOCK(m)    mqtt_lockstat_lock((m), __func__, __LINE__)
+#define MQTT_MUTEX_UNLOCK(m)  mqtt_lockstat_unlock(m)
+
+#else
+
+#define MQTT_MUTEX_LOCK(m)    mqtt_os_get()->mutex_lock(m)
+#define MQTT_MUTEX_UNLOCK(m)  mqtt_os_get()->mutex_unlock(m)
+
+#endif /* MQTT_LOCK_STATS */
+
 #ifdef __cplusplus
 }
 #endif
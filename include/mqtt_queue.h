@@ -0,0 +1,199 @@
+/**
+ * @file mqtt_queue.h
+ * @brief Outbound message queue with conflation and priority lanes
+ *
+ * Messages published through a queue are copied into preallocated slots
+ * and sent while the client is connected. When the link is down, or another
+ * thread is busy sending, they wait in the queue instead of failing or
+ * blocking the publisher.
+ *
+ * With the MQTT_QUEUE_CONFLATE policy a message to a topic that still has
+ * an unsent message replaces that message in place, keeping its position.
+ * After an outage the backlog then holds one message per topic, the newest,
+ * instead of every intermediate state.
+ *
+ * Messages wait in one of four priority lanes, chosen by the first route
+ * whose filter matches their topic (telemetry without one). The next message
+ * sent is the oldest of the highest lane that its token buckets allow: the
+ * lane's own and, when the route has one, the route's. A throttled topic
+ * holds back only later messages of its route, and a full queue makes room
+ * for a message by evicting the oldest of a lower lane. PINGREQ and PUBACK
+ * are written by the client itself and never wait behind the queue.
+ *
+ * A message published with a TTL is dropped instead of sent once it is
+ * older: lazily when the scheduler reaches it, eagerly by mqtt_queue_poll()
+ * and whenever the queue is full. A reconnect drain then spends the uplink
+ * on messages that still matter.
+ */
+
+#ifndef MQTT_QUEUE_H
+#define MQTT_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Messages held when the configuration leaves capacity at 0 */
+#define MQTT_QUEUE_DEFAULT_CAPACITY     64
+
+/** @brief Largest payload when the configuration leaves max_payload at 0 */
+#define MQTT_QUEUE_DEFAULT_PAYLOAD      256
+
+/** @brief Routes a queue holds */
+#define MQTT_QUEUE_MAX_ROUTES           8
+
+/**
+ * @brief Priority lanes, highest first
+ */
+typedef enum {
+    MQTT_QUEUE_CONTROL = 0,    /**< Commands and their replies */
+    MQTT_QUEUE_ALARM,          /**< Alarms and events */
+    MQTT_QUEUE_TELEMETRY,      /**< Periodic readings, the lane of unrouted topics */
+    MQTT_QUEUE_BULK,           /**< Logs, debug output, file transfers */
+    MQTT_QUEUE_LANES
+} mqtt_queue_lane_t;
+
+/**
+ * @brief Token bucket limit
+ *
+ * Tokens are bytes, counted as topic, payload and about 6 bytes of framing
+ * per message. A message larger than the burst goes out once the bucket
+ * is full and leaves it in debt.
+ */
+typedef struct {
+    uint32_t rate;     /**< Bytes per second, 0 for no limit */
+    uint32_t burst;    /**< Bucket size in bytes, 0 for one second of rate */
+} mqtt_queue_limit_t;
+
+/**
+ * @brief What happens to a message whose topic already has one queued
+ */
+typedef enum {
+    MQTT_QUEUE_FIFO = 0,    /**< Both are kept and sent in order */
+    MQTT_QUEUE_CONFLATE     /**< The new message replaces the queued one in place */
+} mqtt_queue_policy_t;
+
+/**
+ * @brief Queue configuration
+ */
+typedef struct {
+    uint16_t capacity;            /**< Messages held at once */
+    uint16_t max_payload;         /**< Largest payload accepted, capped by MQTT_MAX_PACKET_SIZE */
+    mqtt_queue_policy_t policy;   /**< Handling of messages to a topic already queued */
+    mqtt_queue_limit_t lanes[MQTT_QUEUE_LANES]; /**< Limit of each lane (zero for none) */
+} mqtt_queue_config_t;
+
+/**
+ * @brief Queue statistics snapshot
+ */
+typedef struct {
+    uint32_t enqueued;    /**< Messages accepted, including conflated ones */
+    uint32_t conflated;   /**< Queued messages replaced by a newer one of their topic */
+    uint32_t sent;        /**< Messages handed to the client */
+    uint32_t rejected;    /**< Messages refused because the queue was full or the message too large */
+    uint32_t evicted;     /**< Queued messages dropped to make room for a higher lane */
+    uint32_t stalls;      /**< Drains stopped by a failed publish, the message stayed queued */
+    uint32_t throttled;   /**< Drains stopped with messages waiting on a token bucket */
+    uint32_t expired;     /**< Messages dropped unsent because their TTL ran out */
+    uint32_t depth;       /**< Messages queued now */
+    uint32_t lane_depth[MQTT_QUEUE_LANES]; /**< Of which in each lane */
+} mqtt_queue_stats_t;
+
+/** @brief Queue instance (opaque) */
+typedef struct mqtt_queue mqtt_queue_t;
+
+/**
+ * @brief Create a queue publishing through a client
+ * @param client Client handle
+ * @param config Configuration, NULL for defaults (FIFO)
+ * @return Queue handle on success, NULL on failure
+ */
+mqtt_queue_t* mqtt_queue_create(mqtt_client_t* client, const mqtt_queue_config_t* config);
+
+/**
+ * @brief Send what the link takes now and destroy the queue
+ * @param queue Queue handle
+ * @note Messages still queued afterwards are discarded
+ */
+void mqtt_queue_destroy(mqtt_queue_t* queue);
+
+/**
+ * @brief Queue a message and send queued messages while connected
+ * @param queue Queue handle
+ * @param topic Topic name
+ * @param payload Message payload, copied
+ * @param len Payload length
+ * @param qos QoS level (0 or 1)
+ * @return 0 if queued or sent, -1 if the queue is full of messages of its
+ *         lane and higher ones, or the message is too large
+ * @note Returns without sending when another thread is draining the queue;
+ *       that thread sends the message
+ */
+int mqtt_queue_publish(mqtt_queue_t* queue, const char* topic, const uint8_t* payload, size_t len, uint8_t qos);
+
+/**
+ * @brief Queue a message that is dropped unsent once older than its TTL
+ * @param queue Queue handle
+ * @param topic Topic name
+ * @param payload Message payload, copied
+ * @param len Payload length
+ * @param qos QoS level (0 or 1)
+ * @param ttl_ms Lifetime in milliseconds, 0 for none
+ * @return 0 if queued or sent, -1 as for mqtt_queue_publish()
+ * @note A conflated message takes the TTL of the one replacing it. The TTL
+ *       only bounds the wait in the queue: MQTT 3.1.1 has no expiry on the
+ *       wire and a message handed to the client is not recalled.
+ */
+int mqtt_queue_publish_ttl(mqtt_queue_t* queue, const char* topic, const uint8_t* payload, size_t len,
+                           uint8_t qos, uint32_t ttl_ms);
+
+/**
+ * @brief Send messages of matching topics through a lane, optionally rate limited
+ * @param queue Queue handle
+ * @param filter Topic filter, may contain wildcards
+ * @param lane Lane of the matching messages
+ * @param limit Token bucket shared by the matching topics, NULL for none
+ * @return 0 on success, -1 if MQTT_QUEUE_MAX_ROUTES are in use
+ * @note Routes are tried in the order they were added; add them before
+ *       publishing, queued messages keep the lane they were given
+ */
+int mqtt_queue_route(mqtt_queue_t* queue, const char* filter, mqtt_queue_lane_t lane,
+                     const mqtt_queue_limit_t* limit);
+
+/**
+ * @brief Send queued messages while connected and the limits allow
+ * @param queue Queue handle
+ * @return Messages still queued, -1 on invalid arguments
+ * @note Call after a reconnect or periodically; publishes only drain
+ *       the backlog when they are made
+ */
+int mqtt_queue_drain(mqtt_queue_t* queue);
+
+/**
+ * @brief Drop expired messages, drain, then tell when rate-limited messages may go
+ * @param queue Queue handle
+ * @return Milliseconds until a token bucket lets the next message go,
+ *         UINT32_MAX when none is waiting on a limit
+ * @note Call periodically when limits or TTLs are used, also while
+ *       disconnected; without it throttled messages only leave with later
+ *       publishes and expired ones only when reached or when space is needed
+ */
+uint32_t mqtt_queue_poll(mqtt_queue_t* queue);
+
+/**
+ * @brief Get a snapshot of queue statistics
+ * @param queue Queue handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_queue_get_stats(mqtt_queue_t* queue, mqtt_queue_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_QUEUE_H */
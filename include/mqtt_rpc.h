@@ -0,0 +1,172 @@
+/**
+ * @file mqtt_rpc.h
+ * @brief Request/response calls over MQTT 3.1.1
+ *
+ * A caller subscribes once to its reply topic and publishes each request
+ * in a small envelope that carries the reply topic and a correlation ID,
+ * since MQTT 3.1.1 has no response topic or correlation data properties.
+ * Outstanding calls live in a fixed table indexed by the correlation ID
+ * and are expired through a timer wheel, so thousands of calls cost O(1)
+ * per reply and per timeout.
+ *
+ * Envelope layout (integers big-endian):
+ *   Request: u8 version, u16 reply topic length, reply topic, u32 ID, payload
+ *   Reply:   u8 version, u32 ID, payload
+ */
+
+#ifndef MQTT_RPC_H
+#define MQTT_RPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Envelope format version */
+#define MQTT_RPC_VERSION          1
+
+/** @brief Request envelope bytes in front of the payload, without the reply topic */
+#define MQTT_RPC_REQUEST_HDR_LEN  7
+
+/** @brief Reply envelope bytes in front of the payload */
+#define MQTT_RPC_REPLY_HDR_LEN    5
+
+/** @brief Outstanding calls when the configuration leaves max_calls at 0 */
+#define MQTT_RPC_DEFAULT_CALLS    1024
+
+/** @brief Timer wheel resolution in milliseconds */
+#define MQTT_RPC_TICK_MS          10
+
+/** @brief Timer wheel buckets, a power of two */
+#define MQTT_RPC_WHEEL_SLOTS      256
+
+/**
+ * @brief Call outcome passed to the callback
+ */
+typedef enum {
+    MQTT_RPC_OK = 0,         /**< Reply received */
+    MQTT_RPC_TIMEOUT,        /**< No reply before the deadline */
+    MQTT_RPC_CANCELLED       /**< RPC instance destroyed first */
+} mqtt_rpc_status_t;
+
+/**
+ * @brief Call completion callback
+ * @param status Call outcome
+ * @param payload Reply payload (NULL unless status is MQTT_RPC_OK)
+ * @param len Reply payload length
+ * @param user_data User data passed to mqtt_rpc_call()
+ */
+typedef void (*mqtt_rpc_callback_t)(mqtt_rpc_status_t status, const uint8_t* payload, size_t len,
+                                    void* user_data);
+
+/**
+ * @brief RPC configuration
+ */
+typedef struct {
+    const char* reply_topic;  /**< Reply topic, NULL for "<client_id>/rpc/reply" */
+    uint32_t max_calls;       /**< Outstanding call capacity, rounded up to a power of two (max 65536) */
+} mqtt_rpc_config_t;
+
+/**
+ * @brief RPC statistics snapshot
+ */
+typedef struct {
+    uint32_t calls;              /**< Requests published */
+    uint32_t replies;            /**< Calls completed by a reply */
+    uint32_t timeouts;           /**< Calls expired without a reply */
+    uint32_t unmatched;          /**< Replies for unknown or expired calls */
+    uint32_t outstanding;        /**< Calls awaiting a reply */
+    mqtt_histogram_t latency;    /**< Request to reply latency */
+} mqtt_rpc_stats_t;
+
+/**
+ * @brief Decoded request, pointing into the received payload
+ */
+typedef struct {
+    const char* reply_topic;     /**< Reply topic (not NUL terminated) */
+    uint16_t reply_topic_len;    /**< Reply topic length */
+    uint32_t id;                 /**< Correlation ID */
+    const uint8_t* payload;      /**< Request payload */
+    size_t len;                  /**< Request payload length */
+} mqtt_rpc_request_t;
+
+/** @brief RPC instance (opaque) */
+typedef struct mqtt_rpc mqtt_rpc_t;
+
+/**
+ * @brief Create an RPC instance and subscribe to its reply topic
+ * @param client Connected client
+ * @param config Configuration, NULL for defaults
+ * @return RPC handle on success, NULL on failure
+ */
+mqtt_rpc_t* mqtt_rpc_create(mqtt_client_t* client, const mqtt_rpc_config_t* config);
+
+/**
+ * @brief Destroy an RPC instance, cancelling outstanding calls
+ * @param rpc RPC handle
+ * @note The client must be destroyed first, its subscription refers to rpc
+ */
+void mqtt_rpc_destroy(mqtt_rpc_t* rpc);
+
+/**
+ * @brief Publish a request and track its reply
+ * @param rpc RPC handle
+ * @param topic Request topic
+ * @param payload Request payload
+ * @param len Payload length
+ * @param timeout_ms Time allowed for the reply
+ * @param cb Completion callback, called exactly once unless this returns -1
+ * @param user_data User data passed to cb
+ * @return 0 on success, -1 if the table is full, the request does not fit a
+ *         packet or the publish failed
+ * @note The request is published at QoS 1. cb runs on the receive thread for
+ *       replies and on the thread calling mqtt_rpc_poll() for timeouts.
+ */
+int mqtt_rpc_call(mqtt_rpc_t* rpc, const char* topic, const uint8_t* payload, size_t len,
+                  uint32_t timeout_ms, mqtt_rpc_callback_t cb, void* user_data);
+
+/**
+ * @brief Expire calls whose deadline has passed
+ * @param rpc RPC handle
+ * @return Milliseconds the caller may wait before polling again, UINT32_MAX
+ *         when nothing is outstanding
+ * @note Call periodically, at least every MQTT_RPC_TICK_MS for exact timeouts
+ */
+uint32_t mqtt_rpc_poll(mqtt_rpc_t* rpc);
+
+/**
+ * @brief Get a snapshot of RPC statistics
+ * @param rpc RPC handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_rpc_get_stats(mqtt_rpc_t* rpc, mqtt_rpc_stats_t* stats);
+
+/**
+ * @brief Decode a request received by a responder
+ * @param data Message payload
+ * @param len Payload length
+ * @param req Output request
+ * @return 0 on success, -1 if the payload is not a request envelope
+ */
+int mqtt_rpc_parse_request(const uint8_t* data, size_t len, mqtt_rpc_request_t* req);
+
+/**
+ * @brief Publish the reply to a decoded request
+ * @param client Client handle
+ * @param req Request from mqtt_rpc_parse_request()
+ * @param payload Reply payload
+ * @param len Payload length
+ * @return 0 on success, -1 on failure
+ */
+int mqtt_rpc_reply(mqtt_client_t* client, const mqtt_rpc_request_t* req,
+                   const uint8_t* payload, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_RPC_H */
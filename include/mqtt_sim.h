@@ -0,0 +1,103 @@
+/**
+ * @file mqtt_sim.h
+ * @brief Deterministic virtual-time simulation port
+ *
+ * The simulation OS port runs every thread cooperatively: exactly one
+ * thread executes at a time and switches happen only when it blocks
+ * (mutex, semaphore, sleep, network wait). When every thread is blocked
+ * the virtual clock jumps straight to the next timeout, so hours of
+ * keepalive, reconnect and timeout behavior complete in milliseconds of
+ * wall time with the same interleaving on every run.
+ *
+ * The in-memory transport connects clients to listeners in the same
+ * process, with optional one-way latency and fault injection, so a test
+ * harness can play the broker from a simulated thread.
+ */
+
+#ifndef MQTT_SIM_H
+#define MQTT_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt_os.h"
+#include "mqtt_net.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Wait without timeout */
+#define MQTT_SIM_FOREVER UINT32_MAX
+
+/**
+ * @brief Register the simulation OS port
+ *
+ * The calling thread becomes the first simulated thread. All other
+ * simulated threads must be created through the OS API.
+ */
+void mqtt_sim_init(void);
+
+/**
+ * @brief Get virtual time
+ * @return Milliseconds since mqtt_sim_init()
+ */
+uint64_t mqtt_sim_now_ms(void);
+
+/**
+ * @brief Block the calling thread on a wait channel
+ * @param channel Any address identifying the event, NULL to only time out
+ * @param timeout_ms Virtual timeout, MQTT_SIM_FOREVER to wait indefinitely
+ * @return 0 when woken, -1 on timeout
+ */
+int mqtt_sim_wait(const void* channel, uint32_t timeout_ms);
+
+/**
+ * @brief Make every thread waiting on a channel runnable
+ * @param channel Wait channel
+ * @note The caller keeps running until it blocks
+ */
+void mqtt_sim_wake(const void* channel);
+
+/**
+ * @brief Register the in-memory network transport
+ */
+void mqtt_sim_net_init(void);
+
+/**
+ * @brief Start accepting in-memory connections on a port
+ * @param port Port number (host names are ignored)
+ * @return 0 on success, -1 if the port is taken or no slot is free
+ */
+int mqtt_sim_net_listen(uint16_t port);
+
+/**
+ * @brief Stop accepting connections on a port
+ * @param port Port number
+ */
+void mqtt_sim_net_unlisten(uint16_t port);
+
+/**
+ * @brief Accept a connection
+ * @param port Listening port
+ * @param timeout_ms Virtual timeout
+ * @return Server-side socket usable with the transport API, NULL on timeout
+ */
+mqtt_socket_t mqtt_sim_net_accept(uint16_t port, uint32_t timeout_ms);
+
+/**
+ * @brief Set one-way delivery latency for data sent from now on
+ * @param latency_ms Latency in virtual milliseconds
+ */
+void mqtt_sim_net_set_latency(uint32_t latency_ms);
+
+/**
+ * @brief Break a connection, both ends see errors from now on
+ * @param sock Either end of the connection
+ */
+void mqtt_sim_net_break(mqtt_socket_t sock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_SIM_H */
@@ -0,0 +1,90 @@
+/**
+ * @file mqtt_stats.h
+ * @brief MQTT client statistics and latency histograms
+ *
+ * Latency samples are kept in fixed power-of-two histograms so recording
+ * a sample costs a few instructions and no memory allocation.
+ */
+
+#ifndef MQTT_STATS_H
+#define MQTT_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Number of histogram buckets (last bucket is open-ended) */
+#define MQTT_HIST_BUCKETS 24
+
+/**
+ * @brief Latency histogram with power-of-two microsecond buckets
+ *
+ * buckets[0] counts samples below 2us, buckets[i] counts samples in
+ * [2^i, 2^(i+1)) us and the last bucket counts everything above.
+ */
+typedef struct {
+    uint32_t count;                        /**< Number of samples */
+    uint32_t min_us;                       /**< Smallest sample */
+    uint32_t max_us;                       /**< Largest sample */
+    uint64_t sum_us;                       /**< Sum of all samples */
+    uint32_t buckets[MQTT_HIST_BUCKETS];   /**< Sample count per bucket */
+} mqtt_histogram_t;
+
+/**
+ * @brief Client statistics snapshot
+ */
+typedef struct {
+    uint32_t tx_packets;              /**< Packets sent */
+    uint32_t rx_packets;              /**< Packets received */
+    uint64_t tx_bytes;                /**< Bytes sent */
+    uint64_t rx_bytes;                /**< Bytes received */
+    uint32_t publish_sent;            /**< PUBLISH packets sent */
+    uint32_t publish_received;        /**< PUBLISH packets received */
+    uint32_t reconnects;              /**< Successful reconnections */
+    uint32_t ping_timeouts;           /**< Connections dropped for missing PINGRESP */
+    uint32_t local_delivered;         /**< Publishes delivered to local subscriptions */
+    uint32_t echoes_suppressed;       /**< Broker echoes of local deliveries dropped */
+    uint32_t inflight;                /**< QoS 1 publishes awaiting PUBACK */
+    uint32_t srtt_us;                 /**< Smoothed ping RTT (RFC 6298) */
+    uint32_t rttvar_us;               /**< Ping RTT variation (RFC 6298) */
+    mqtt_histogram_t ping_rtt;        /**< PINGREQ to PINGRESP round trip */
+    mqtt_histogram_t puback_latency;  /**< QoS 1 PUBLISH to PUBACK latency */
+} mqtt_stats_t;
+
+/**
+ * @brief Record a latency sample
+ * @param hist Histogram
+ * @param value_us Sample in microseconds
+ */
+void mqtt_hist_record(mqtt_histogram_t* hist, uint32_t value_us);
+
+/**
+ * @brief Add the samples of one histogram to another
+ * @param dst Histogram receiving the samples
+ * @param src Histogram to add
+ */
+void mqtt_hist_merge(mqtt_histogram_t* dst, const mqtt_histogram_t* src);
+
+/**
+ * @brief Upper bound of a histogram bucket
+ * @param index Bucket index
+ * @return Largest value counted by the bucket, UINT32_MAX for the last bucket
+ */
+uint32_t mqtt_hist_bucket_upper(int index);
+
+/**
+ * @brief Estimate a percentile from a histogram
+ * @param hist Histogram
+ * @param percent Percentile (0-100)
+ * @return Upper bound of the bucket holding the percentile, clamped to max_us
+ */
+uint32_t mqtt_hist_percentile(const mqtt_histogram_t* hist, uint32_t percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_STATS_H */
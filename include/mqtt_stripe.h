@@ -0,0 +1,115 @@
+/**
+ * @file mqtt_stripe.h
+ * @brief Publisher striped across several broker connections
+ *
+ * A stripe opens N clients from one configuration, each with its own
+ * connection, session and receive thread, and sends every publish through
+ * the client chosen by a hash of its topic. Messages on one topic always
+ * share a connection and keep their order, while different topics spread
+ * over the connections and the broker threads serving them.
+ *
+ * Client IDs are the configured ID with "-0", "-1", ... appended. Each
+ * client reconnects on its own with the usual policy.
+ */
+
+#ifndef MQTT_STRIPE_H
+#define MQTT_STRIPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mqtt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Largest number of connections in a stripe */
+#define MQTT_STRIPE_MAX_CONNECTIONS 16
+
+/** @brief Striped publisher (opaque) */
+typedef struct mqtt_stripe mqtt_stripe_t;
+
+/**
+ * @brief Create a stripe and connect all of its clients
+ * @param config Configuration shared by all clients
+ * @param connections Number of connections (1 to MQTT_STRIPE_MAX_CONNECTIONS)
+ * @return Stripe handle on success, NULL if any client failed to connect
+ * @note Builds with MQTT_OS_STATIC need MQTT_STATIC_CLIENTS >= connections
+ */
+mqtt_stripe_t* mqtt_stripe_create(const mqtt_config_t* config, uint8_t connections);
+
+/**
+ * @brief Disconnect and destroy all clients of a stripe
+ * @param stripe Stripe handle
+ */
+void mqtt_stripe_destroy(mqtt_stripe_t* stripe);
+
+/**
+ * @brief Publish through the connection owning the topic
+ * @param stripe Stripe handle
+ * @param topic Topic name
+ * @param payload Message payload
+ * @param len Payload length
+ * @param qos QoS level (0 or 1)
+ * @return 0 on success, -1 on failure
+ * @note Fails while that connection is down rather than reorder the topic
+ *       through another one
+ */
+int mqtt_stripe_publish(mqtt_stripe_t* stripe, const char* topic, const uint8_t* payload,
+                        size_t len, uint8_t qos);
+
+/**
+ * @brief Subscribe on the first connection of the stripe
+ * @param stripe Stripe handle
+ * @param topic Topic filter
+ * @param qos QoS level (0 or 1)
+ * @return 0 on success, -1 on failure
+ * @note Messages arrive through the msg_cb of the shared configuration;
+ *       subscribing once avoids receiving every message N times
+ */
+int mqtt_stripe_subscribe(mqtt_stripe_t* stripe, const char* topic, uint8_t qos);
+
+/**
+ * @brief Connection a topic is published on
+ * @param stripe Stripe handle
+ * @param topic Topic name
+ * @return Connection index
+ */
+uint8_t mqtt_stripe_index(const mqtt_stripe_t* stripe, const char* topic);
+
+/**
+ * @brief Client of one connection
+ * @param stripe Stripe handle
+ * @param index Connection index
+ * @return Client handle, NULL if index is out of range
+ */
+mqtt_client_t* mqtt_stripe_client(mqtt_stripe_t* stripe, uint8_t index);
+
+/**
+ * @brief Count connected clients
+ * @param stripe Stripe handle
+ * @return Number of clients currently connected
+ */
+int mqtt_stripe_connected(mqtt_stripe_t* stripe);
+
+/**
+ * @brief Get statistics summed over all connections
+ * @param stripe Stripe handle
+ * @param stats Output statistics
+ * @return 0 on success, -1 on failure
+ * @note Histograms are merged; srtt_us and rttvar_us are those of the
+ *       slowest connection
+ */
+int mqtt_stripe_get_stats(mqtt_stripe_t* stripe, mqtt_stats_t* stats);
+
+/**
+ * @brief Reset the statistics of all connections
+ * @param stripe Stripe handle
+ */
+void mqtt_stripe_reset_stats(mqtt_stripe_t* stripe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_STRIPE_H */
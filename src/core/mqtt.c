@@ -4,51 +4,84 @@
  */
 
 #include "mqtt.h"
+#include "mqtt_codec.h"
 #include <string.h>
 
-#define MQTT_CONNECT     1
-#define MQTT_CONNACK     2
-#define MQTT_PUBLISH     3
-#define MQTT_SUBSCRIBE   8
-#define MQTT_SUBACK      9
-#define MQTT_PINGREQ     12
-#define MQTT_PINGRESP    13
-#define MQTT_DISCONNECT  14
-
 #define MQTT_CONNECT_TIMEOUT_MS     5000
 #define MQTT_RECONNECT_DELAY_MS     1000
 #define MQTT_RECV_TIMEOUT_MS        1000
 
+#ifdef MQTT_OS_STATIC
+MQTT_OS_POOL_DEFINE(mqtt_client_pool, mqtt_client_t, MQTT_STATIC_CLIENTS);
+#endif
+
 static void mqtt_recv_thread(void* arg);
 
-/* Helper function to handle uint32_t timestamp wraparound */
-static inline int mqtt_time_elapsed(uint32_t start, uint32_t now, uint32_t threshold) {
-    uint32_t elapsed = now - start;  /* Handles wraparound correctly */
-    return elapsed >= threshold;
+/* Helper function to compare monotonic microsecond timestamps */
+static inline int mqtt_time_elapsed(uint64_t start, uint64_t now, uint64_t threshold) {
+    return now - start >= threshold;
+}
+
+static uint16_t mqtt_next_packet_id(mqtt_client_t* client) {
+    uint16_t id = client->packet_id++;
+    if (client->packet_id == 0) client->packet_id = 1;  /* 0 is not a valid packet ID */
+    return id;
 }
 
-static int encode_remaining_length(uint8_t* buf, size_t len) {
-    int count = 0;
-    do {
-        uint8_t byte = len % 128;
-        len /= 128;
-        if (len > 0) byte |= 0x80;
-        buf[count++] = byte;
-    } while (len > 0);
-    return count;
+/* Send len bytes of send_buf, caller holds tx_mutex (or owns the client exclusively) */
+static int mqtt_send_packet(mqtt_client_t* client, int len) {
+    const mqtt_net_api_t* net = mqtt_net_get();
+    if (!client->socket) return -1;
+    if (net->send(client->socket, client->send_buf, len) != len) return -1;
+    mqtt_atomic_fetch_add_u32(&client->counters.tx_packets, 1, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_fetch_add_u64(&client->counters.tx_bytes, len, MQTT_ATOMIC_RELAXED);
+    return 0;
 }
 
-static int decode_remaining_length(const uint8_t* buf, size_t* len) {
-    int multiplier = 1, count = 0;
-    *len = 0;
-    uint8_t byte;
-    do {
-        if (count >= 4) return -1;
-        byte = buf[count++];
-        *len += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-    return count;
+/* Send the header in send_buf followed by the payload straight from the caller's buffer */
+static int mqtt_send_packet_payload(mqtt_client_t* client, int len, const uint8_t* payload, size_t payload_len) {
+    const mqtt_net_api_t* net = mqtt_net_get();
+    
+    if (payload_len == 0) return mqtt_send_packet(client, len);
+    if (!client->socket) return -1;
+    
+    if (net->sendv) {
+        mqtt_iovec_t iov[2] = { { client->send_buf, (size_t)len }, { payload, payload_len } };
+        if (net->sendv(client->socket, iov, 2) != (int)(len + payload_len)) return -1;
+    } else {
+        if (net->send(client->socket, client->send_buf, len) != len) return -1;
+        if (net->send(client->socket, payload, payload_len) != (int)payload_len) return -1;
+    }
+    mqtt_atomic_fetch_add_u32(&client->counters.tx_packets, 1, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_fetch_add_u64(&client->counters.tx_bytes, len + payload_len, MQTT_ATOMIC_RELAXED);
+    return 0;
+}
+
+static int mqtt_wait_connack(mqtt_client_t* client) {
+    const mqtt_net_api_t* net = mqtt_net_get();
+    
+    int recv_len = net->recv(client->socket, client->recv_buf, MQTT_RECV_BUF_SIZE, MQTT_CONNECT_TIMEOUT_MS);
+    if (recv_len < 4 || (client->recv_buf[0] >> 4) != MQTT_CONNACK || client->recv_buf[3] != 0) {
+        return -1;
+    }
+    
+    /* Keep anything the broker sent right after CONNACK for the framer */
+    client->recv_len = recv_len - 4;
+    client->recv_discard = 0;
+    memmove(client->recv_buf, client->recv_buf + 4, client->recv_len);
+    return 0;
+}
+
+static void mqtt_rtt_update(mqtt_stats_t* stats, uint32_t rtt_us) {
+    if (stats->ping_rtt.count == 0) {
+        stats->srtt_us = rtt_us;
+        stats->rttvar_us = rtt_us / 2;
+    } else {
+        uint32_t delta = stats->srtt_us > rtt_us ? stats->srtt_us - rtt_us : rtt_us - stats->srtt_us;
+        stats->rttvar_us = stats->rttvar_us - stats->rttvar_us / 4 + delta / 4;
+        stats->srtt_us = stats->srtt_us - stats->srtt_us / 8 + rtt_us / 8;
+    }
+    mqtt_hist_record(&stats->ping_rtt, rtt_us);
 }
 
 static int pack_connect(uint8_t* buf, const char* client_id, const char* username,
@@ -69,7 +102,7 @@ static int pack_connect(uint8_t* buf, const char* client_id, const char* usernam
     
     size_t remaining = 10 + payload_len;
     uint8_t rem_buf[4];
-    int rem_len = encode_remaining_length(rem_buf, remaining);
+    int rem_len = mqtt_encode_remaining_length(rem_buf, remaining);
     
     buf[pos++] = MQTT_CONNECT << 4;
     memcpy(buf + pos, rem_buf, rem_len);
@@ -105,43 +138,13 @@ static int pack_connect(uint8_t* buf, const char* client_id, const char* usernam
     return pos;
 }
 
-static int pack_publish(uint8_t* buf, const char* topic, const uint8_t* payload,
-                        size_t payload_len, uint8_t qos, uint16_t packet_id) {
-    int pos = 0;
-    size_t topic_len = strlen(topic);
-    size_t remaining = 2 + topic_len + payload_len;
-    if (qos > 0) remaining += 2;
-    
-    uint8_t rem_buf[4];
-    int rem_len = encode_remaining_length(rem_buf, remaining);
-    
-    buf[pos++] = (MQTT_PUBLISH << 4) | (qos << 1);
-    memcpy(buf + pos, rem_buf, rem_len);
-    pos += rem_len;
-    
-    buf[pos++] = topic_len >> 8;
-    buf[pos++] = topic_len & 0xFF;
-    memcpy(buf + pos, topic, topic_len);
-    pos += topic_len;
-    
-    if (qos > 0) {
-        buf[pos++] = packet_id >> 8;
-        buf[pos++] = packet_id & 0xFF;
-    }
-    
-    memcpy(buf + pos, payload, payload_len);
-    pos += payload_len;
-    
-    return pos;
-}
-
 static int pack_subscribe(uint8_t* buf, const char* topic, uint8_t qos, uint16_t packet_id) {
     int pos = 0;
     size_t topic_len = strlen(topic);
     size_t remaining = 2 + 2 + topic_len + 1;
     
     uint8_t rem_buf[4];
-    int rem_len = encode_remaining_length(rem_buf, remaining);
+    int rem_len = mqtt_encode_remaining_length(rem_buf, remaining);
     
     buf[pos++] = (MQTT_SUBSCRIBE << 4) | 0x02;
     memcpy(buf + pos, rem_buf, rem_len);
@@ -170,12 +173,24 @@ static int pack_disconnect(uint8_t* buf) {
     return 2;
 }
 
+static mqtt_thread_t mqtt_start_recv_thread(mqtt_client_t* client) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    const mqtt_thread_attr_t* attr = &client->config.recv_thread;
+    
+    if (os->thread_create_ex) return os->thread_create_ex(mqtt_recv_thread, client, attr);
+    
+    return os->thread_create(mqtt_recv_thread, client,
+                             attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE,
+                             attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY);
+}
+
 mqtt_client_t* mqtt_client_create(const mqtt_config_t* config) {
     const mqtt_os_api_t* os = mqtt_os_get();
     const mqtt_net_api_t* net = mqtt_net_get();
     if (!os || !net) return NULL;
     
-    mqtt_client_t* client = (mqtt_client_t*)os->malloc(sizeof(mqtt_client_t));
+    mqtt_client_t* client = (mqtt_client_t*)MQTT_OS_OBJ_ALLOC(mqtt_client_pool, os->malloc,
+                                                              sizeof(mqtt_client_t));
     if (!client) return NULL;
     
     memset(client, 0, sizeof(mqtt_client_t));
@@ -187,8 +202,17 @@ mqtt_client_t* mqtt_client_create(const mqtt_config_t* config) {
     client->mutex = os->mutex_create();
     if (!client->mutex) goto err_free_client;
     
+    client->tx_mutex = os->mutex_create();
+    if (!client->tx_mutex) goto err_destroy_mutex;
+    
     client->thread_exit_sem = os->sem_create(0);
-    if (!client->thread_exit_sem) goto err_destroy_mutex;
+    if (!client->thread_exit_sem) goto err_destroy_tx_mutex;
+    
+    /* Without events the reconnect delay is a plain sleep */
+    if (os->event_create) {
+        client->wake_event = os->event_create();
+        if (!client->wake_event) goto err_destroy_sem;
+    }
     
     client->socket = net->connect(client->config.host, client->config.port, MQTT_CONNECT_TIMEOUT_MS);
     if (!client->socket) goto err_destroy_sem;
@@ -196,18 +220,15 @@ mqtt_client_t* mqtt_client_create(const mqtt_config_t* config) {
     int len = pack_connect(client->send_buf, client->config.client_id, client->config.username,
                            client->config.password, client->config.keepalive, client->config.clean_session);
     
-    if (net->send(client->socket, client->send_buf, len) != len) goto err_disconnect;
-    
-    int recv_len = net->recv(client->socket, client->recv_buf, MQTT_RECV_BUF_SIZE, MQTT_CONNECT_TIMEOUT_MS);
-    if (recv_len < 4 || (client->recv_buf[0] >> 4) != MQTT_CONNACK || client->recv_buf[3] != 0) {
-        goto err_disconnect;
-    }
+    if (mqtt_send_packet(client, len) != 0) goto err_disconnect;
+    if (mqtt_wait_connack(client) != 0) goto err_disconnect;
     
     client->state = MQTT_STATE_CONNECTED;
-    client->last_ping_time = os->get_time_ms();
+    client->connection = 1;
+    client->last_ping_time = mqtt_os_time_us();
     client->running = 1;
     
-    client->recv_thread = os->thread_create(mqtt_recv_thread, client, 2048, 5);
+    client->recv_thread = mqtt_start_recv_thread(client);
     if (!client->recv_thread) goto err_disconnect;
     
     return client;
@@ -215,11 +236,42 @@ mqtt_client_t* mqtt_client_create(const mqtt_config_t* config) {
 err_disconnect:
     net->disconnect(client->socket);
 err_destroy_sem:
+    if (client->wake_event) os->event_destroy(client->wake_event);
     os->sem_destroy(client->thread_exit_sem);
+err_destroy_tx_mutex:
+    os->mutex_destroy(client->tx_mutex);
 err_destroy_mutex:
     os->mutex_destroy(client->mutex);
 err_free_client:
-    os->free(client);
+    MQTT_OS_OBJ_FREE(mqtt_client_pool, os->free, client);
+    return NULL;
+}
+
+mqtt_client_t* mqtt_client_create_detached(const mqtt_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!os || !config) return NULL;
+    
+    mqtt_client_t* client = (mqtt_client_t*)MQTT_OS_OBJ_ALLOC(mqtt_client_pool, os->malloc,
+                                                              sizeof(mqtt_client_t));
+    if (!client) return NULL;
+    
+    memset(client, 0, sizeof(mqtt_client_t));
+    memcpy(&client->config, config, sizeof(mqtt_config_t));
+    client->state = MQTT_STATE_DISCONNECTED;
+    client->packet_id = 1;
+    
+    client->mutex = os->mutex_create();
+    if (!client->mutex) goto err_free_client;
+    
+    client->tx_mutex = os->mutex_create();
+    if (!client->tx_mutex) goto err_destroy_mutex;
+    
+    return client;
+
+err_destroy_mutex:
+    os->mutex_destroy(client->mutex);
+err_free_client:
+    MQTT_OS_OBJ_FREE(mqtt_client_pool, os->free, client);
     return NULL;
 }
 
@@ -230,6 +282,7 @@ void mqtt_client_destroy(mqtt_client_t* client) {
     const mqtt_net_api_t* net = mqtt_net_get();
     
     client->running = 0;
+    if (client->wake_event) os->event_set(client->wake_event);
     
     if (client->recv_thread) {
         os->sem_wait(client->thread_exit_sem);
@@ -242,166 +295,556 @@ void mqtt_client_destroy(mqtt_client_t* client) {
         net->disconnect(client->socket);
     }
     
+    if (client->wake_event) os->event_destroy(client->wake_event);
     if (client->thread_exit_sem) os->sem_destroy(client->thread_exit_sem);
+    if (client->tx_mutex) os->mutex_destroy(client->tx_mutex);
     if (client->mutex) os->mutex_destroy(client->mutex);
-    os->free(client);
+    MQTT_OS_OBJ_FREE(mqtt_client_pool, os->free, client);
+}
+
+/* Index of the subscription stored for a filter, -1 if none; caller holds the mutex */
+static int mqtt_find_subscription(mqtt_client_t* client, const char* topic) {
+    for (int i = 0; i < client->sub_count; i++) {
+        if (strcmp(client->subscriptions[i].topic, topic) == 0) return i;
+    }
+    return -1;
 }
 
 int mqtt_client_subscribe(mqtt_client_t* client, const char* topic, uint8_t qos) {
+    return mqtt_client_subscribe_cb(client, topic, qos, NULL, NULL);
+}
+
+int mqtt_client_subscribe_cb(mqtt_client_t* client, const char* topic, uint8_t qos,
+                             mqtt_msg_callback_t cb, void* user_data) {
     if (!client || client->state != MQTT_STATE_CONNECTED) return -1;
+    /* A callback is only reachable through a stored, untruncated filter */
+    if (cb && strlen(topic) >= sizeof(client->subscriptions[0].topic)) return -1;
     
-    const mqtt_os_api_t* os = mqtt_os_get();
-    const mqtt_net_api_t* net = mqtt_net_get();
+    MQTT_MUTEX_LOCK(client->mutex);
     
-    os->mutex_lock(client->mutex);
+    int slot = mqtt_find_subscription(client, topic);
+    /* The receive thread reads callbacks without the mutex, so they never change */
+    if ((slot < 0 && cb && client->sub_count == MQTT_MAX_SUBSCRIPTIONS) ||
+        (slot >= 0 && cb && (client->subscriptions[slot].cb != cb ||
+                             client->subscriptions[slot].user_data != user_data))) {
+        MQTT_MUTEX_UNLOCK(client->mutex);
+        return -1;
+    }
+    uint16_t id = mqtt_next_packet_id(client);
+    
+    MQTT_MUTEX_UNLOCK(client->mutex);
     
-    int len = pack_subscribe(client->send_buf, topic, qos, client->packet_id++);
-    int ret = net->send(client->socket, client->send_buf, len);
+    int ret = -1;
+    MQTT_MUTEX_LOCK(client->tx_mutex);
+    if (client->state == MQTT_STATE_CONNECTED) {
+        ret = mqtt_send_packet(client, pack_subscribe(client->send_buf, topic, qos, id));
+    }
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
+    if (ret != 0) return -1;
+    
+    /* Looked up again, a concurrent subscribe to the topic may have stored it */
+    MQTT_MUTEX_LOCK(client->mutex);
+    slot = mqtt_find_subscription(client, topic);
+    if (slot >= 0) {
+        client->subscriptions[slot].qos = qos;
+    } else if (client->sub_count < MQTT_MAX_SUBSCRIPTIONS) {
+        mqtt_subscription_t* sub = &client->subscriptions[client->sub_count++];
+        strncpy(sub->topic, topic, sizeof(sub->topic) - 1);
+        sub->qos = qos;
+        sub->cb = cb;
+        sub->user_data = user_data;
+        mqtt_atomic_store_u32(&client->sub_published, client->sub_count, MQTT_ATOMIC_RELEASE);
+    }
+    MQTT_MUTEX_UNLOCK(client->mutex);
     
-    if (ret == len && client->sub_count < MQTT_MAX_SUBSCRIPTIONS) {
-        int found = 0;
-        for (int i = 0; i < client->sub_count; i++) {
-            if (strcmp(client->subscriptions[i].topic, topic) == 0) {
-                found = 1;
+    return 0;
+}
+
+int mqtt_topic_match(const char* filter, const char* topic) {
+    /* Wildcards at the first level do not match topics starting with '$' */
+    if (topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) return 0;
+    
+    while (*filter) {
+        if (*filter == '#') return 1;
+        if (*filter == '+') {
+            while (*topic && *topic != '/') topic++;
+            filter++;
+        } else {
+            while (*filter && *filter != '/') {
+                if (*filter++ != *topic++) return 0;
+            }
+            if (*topic && *topic != '/') return 0;
+        }
+        if (*filter == '/') {
+            /* "a/#" also matches "a" */
+            if (!*topic) return filter[1] == '#' && filter[2] == '\0';
+            if (*topic != '/') return 0;
+            filter++;
+            topic++;
+        } else if (*topic) {
+            return 0;
+        }
+    }
+    return *topic == '\0';
+}
+
+/*
+ * Find the callback for a topic: the first matching subscription with its
+ * own callback, else msg_cb. Returns whether any subscription matched.
+ * Published subscriptions are never modified, so the receive thread
+ * reads them without the mutex.
+ */
+static int mqtt_route(mqtt_client_t* client, const char* topic, mqtt_msg_callback_t* cb, void** user_data) {
+    int matched = 0;
+    
+    *cb = client->config.msg_cb;
+    *user_data = client->config.user_data;
+    
+    uint32_t count = mqtt_atomic_load_u32(&client->sub_published, MQTT_ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        const mqtt_subscription_t* sub = &client->subscriptions[i];
+        if (mqtt_topic_match(sub->topic, topic)) {
+            matched = 1;
+            if (sub->cb) {
+                *cb = sub->cb;
+                *user_data = sub->user_data;
                 break;
             }
         }
-        if (!found) {
-            strncpy(client->subscriptions[client->sub_count].topic, topic, sizeof(client->subscriptions[0].topic) - 1);
-            client->subscriptions[client->sub_count].qos = qos;
-            client->sub_count++;
+    }
+    return matched;
+}
+
+/* FNV-1a over topic and payload identifying a local delivery's echo, never 0 */
+static uint32_t mqtt_echo_hash(const char* topic, size_t topic_len, const uint8_t* payload, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < topic_len; i++) hash = (hash ^ (uint8_t)topic[i]) * 16777619u;
+    for (size_t i = 0; i < len; i++) hash = (hash ^ payload[i]) * 16777619u;
+    return hash ? hash : 1;
+}
+
+/*
+ * Claim a free slot for the echo of a local delivery; NULL when every slot
+ * awaits an echo, and the message then takes the broker path instead, as
+ * overwriting a slot would deliver its message a second time
+ */
+static mqtt_atomic_u32_t* mqtt_echo_claim(mqtt_client_t* client, uint32_t hash) {
+    uint32_t start = mqtt_atomic_fetch_add_u32(&client->local_echo_next, 1, MQTT_ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < MQTT_LOCAL_ECHO_SLOTS; i++) {
+        mqtt_atomic_u32_t* slot = &client->local_echo[(start + i) % MQTT_LOCAL_ECHO_SLOTS];
+        uint32_t expected = 0;
+        if (mqtt_atomic_load_u32(slot, MQTT_ATOMIC_RELAXED) == 0 &&
+            mqtt_atomic_cas_u32(slot, &expected, hash, MQTT_ATOMIC_ACQ_REL)) {
+            return slot;
         }
     }
-    
-    os->mutex_unlock(client->mutex);
-    
-    return (ret == len) ? 0 : -1;
+    return NULL;
+}
+
+/* Consume a pending echo with this hash; returns 1 if there was one */
+static int mqtt_echo_take(mqtt_client_t* client, uint32_t hash) {
+    for (int i = 0; i < MQTT_LOCAL_ECHO_SLOTS; i++) {
+        uint32_t expected = hash;
+        if (mqtt_atomic_load_u32(&client->local_echo[i], MQTT_ATOMIC_RELAXED) == hash &&
+            mqtt_atomic_cas_u32(&client->local_echo[i], &expected, 0, MQTT_ATOMIC_ACQ_REL)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Track a QoS 1 publish for PUBACK latency; caller holds the mutex */
+static void mqtt_inflight_add(mqtt_client_t* client, uint16_t packet_id, uint64_t now) {
+    int slot = 0;
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (client->inflight[i].packet_id == 0) {
+            slot = i;
+            break;
+        }
+        /* Table full: reuse the oldest entry, its PUBACK is probably lost */
+        if (client->inflight[i].sent_time < client->inflight[slot].sent_time) {
+            slot = i;
+        }
+    }
+    client->inflight[slot].packet_id = packet_id;
+    client->inflight[slot].sent_time = now;
+}
+
+/* Stop tracking a publish; returns its in-flight entry or NULL, caller holds the mutex */
+static mqtt_inflight_t* mqtt_inflight_take(mqtt_client_t* client, uint16_t packet_id) {
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (client->inflight[i].packet_id == packet_id) {
+            client->inflight[i].packet_id = 0;
+            return &client->inflight[i];
+        }
+    }
+    return NULL;
 }
 
 int mqtt_client_publish(mqtt_client_t* client, const char* topic, const uint8_t* payload,
                         size_t len, uint8_t qos) {
+    return mqtt_client_publish_ex(client, topic, payload, len, qos, NULL);
+}
+
+int mqtt_client_publish_ex(mqtt_client_t* client, const char* topic, const uint8_t* payload,
+                           size_t len, uint8_t qos, uint16_t* packet_id) {
     if (!client || client->state != MQTT_STATE_CONNECTED) return -1;
     
-    const mqtt_os_api_t* os = mqtt_os_get();
-    const mqtt_net_api_t* net = mqtt_net_get();
+    MQTT_MUTEX_LOCK(client->mutex);
+    
+    uint16_t id = (qos > 0) ? mqtt_next_packet_id(client) : 0;
+    if (packet_id) *packet_id = id;
     
-    os->mutex_lock(client->mutex);
+    /* Claimed before sending, the echo may arrive before send() returns */
+    mqtt_msg_callback_t cb = NULL;
+    void* user_data = NULL;
+    mqtt_atomic_u32_t* echo = NULL;
+    if (client->config.local_delivery && mqtt_route(client, topic, &cb, &user_data)) {
+        echo = mqtt_echo_claim(client, mqtt_echo_hash(topic, strlen(topic), payload, len));
+    }
     
-    uint16_t packet_id = (qos > 0) ? client->packet_id++ : 0;
-    int pkt_len = pack_publish(client->send_buf, topic, payload, len, qos, packet_id);
-    int ret = net->send(client->socket, client->send_buf, pkt_len);
+    /* Tracked before sending, the PUBACK may arrive before send() returns */
+    if (qos > 0) mqtt_inflight_add(client, id, mqtt_os_time_us());
     
-    os->mutex_unlock(client->mutex);
+    MQTT_MUTEX_UNLOCK(client->mutex);
     
-    return (ret == pkt_len) ? 0 : -1;
+    /*
+     * Only tx_mutex is held while blocked in send(): the receive thread
+     * handles PUBACKs under the mutex and must keep reading meanwhile
+     */
+    int ret = -1;
+    MQTT_MUTEX_LOCK(client->tx_mutex);
+    if (client->state == MQTT_STATE_CONNECTED) {
+        int hdr_len = mqtt_pack_publish_header(client->send_buf, sizeof(client->send_buf), topic, len, qos, id);
+        if (hdr_len >= 0) ret = mqtt_send_packet_payload(client, hdr_len, payload, len);
+    }
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
+    
+    if (ret == 0) {
+        mqtt_atomic_fetch_add_u32(&client->counters.publish_sent, 1, MQTT_ATOMIC_RELAXED);
+    } else {
+        if (echo) mqtt_atomic_store_u32(echo, 0, MQTT_ATOMIC_RELAXED);
+        if (qos > 0) {
+            MQTT_MUTEX_LOCK(client->mutex);
+            mqtt_inflight_take(client, id);
+            MQTT_MUTEX_UNLOCK(client->mutex);
+        }
+    }
+    
+    /* Outside the locks so the callback may publish */
+    if (ret == 0 && echo) {
+        mqtt_atomic_fetch_add_u32(&client->counters.local_delivered, 1, MQTT_ATOMIC_RELAXED);
+        if (cb) cb(topic, payload, len, user_data);
+    }
+    
+    return ret;
+}
+
+/* PUBACK a message received on the given connection, dropped after a reconnect */
+static int mqtt_send_puback(mqtt_client_t* client, uint16_t connection, uint16_t packet_id) {
+    int ret = -1;
+    
+    MQTT_MUTEX_LOCK(client->tx_mutex);
+    if (client->state == MQTT_STATE_CONNECTED && client->connection == connection) {
+        ret = mqtt_send_packet(client, mqtt_pack_ack(client->send_buf, MQTT_PUBACK, packet_id));
+    }
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
+    
+    return ret;
+}
+
+uint32_t mqtt_client_defer_ack(mqtt_client_t* client) {
+    if (!client || client->rx_packet_id == 0) return 0;
+    
+    client->rx_ack_deferred = 1;
+    return ((uint32_t)client->connection << 16) | client->rx_packet_id;
+}
+
+int mqtt_client_ack(mqtt_client_t* client, uint32_t token) {
+    if (!client || token == 0) return -1;
+    return mqtt_send_puback(client, (uint16_t)(token >> 16), (uint16_t)token);
 }
 
 int mqtt_client_is_connected(mqtt_client_t* client) {
     return client && client->state == MQTT_STATE_CONNECTED;
 }
 
+int mqtt_client_get_stats(mqtt_client_t* client, mqtt_stats_t* stats) {
+    if (!client || !stats) return -1;
+    
+    MQTT_MUTEX_LOCK(client->mutex);
+    memcpy(stats, &client->stats, sizeof(mqtt_stats_t));
+    stats->inflight = 0;
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (client->inflight[i].packet_id != 0) stats->inflight++;
+    }
+    MQTT_MUTEX_UNLOCK(client->mutex);
+    
+    mqtt_counters_t* c = &client->counters;
+    stats->tx_packets = mqtt_atomic_load_u32(&c->tx_packets, MQTT_ATOMIC_RELAXED);
+    stats->rx_packets = mqtt_atomic_load_u32(&c->rx_packets, MQTT_ATOMIC_RELAXED);
+    stats->tx_bytes = mqtt_atomic_load_u64(&c->tx_bytes, MQTT_ATOMIC_RELAXED);
+    stats->rx_bytes = mqtt_atomic_load_u64(&c->rx_bytes, MQTT_ATOMIC_RELAXED);
+    stats->publish_sent = mqtt_atomic_load_u32(&c->publish_sent, MQTT_ATOMIC_RELAXED);
+    stats->publish_received = mqtt_atomic_load_u32(&c->publish_received, MQTT_ATOMIC_RELAXED);
+    stats->reconnects = mqtt_atomic_load_u32(&c->reconnects, MQTT_ATOMIC_RELAXED);
+    stats->ping_timeouts = mqtt_atomic_load_u32(&c->ping_timeouts, MQTT_ATOMIC_RELAXED);
+    stats->local_delivered = mqtt_atomic_load_u32(&c->local_delivered, MQTT_ATOMIC_RELAXED);
+    stats->echoes_suppressed = mqtt_atomic_load_u32(&c->echoes_suppressed, MQTT_ATOMIC_RELAXED);
+    return 0;
+}
+
+void mqtt_client_reset_stats(mqtt_client_t* client) {
+    if (!client) return;
+    
+    MQTT_MUTEX_LOCK(client->mutex);
+    memset(&client->stats, 0, sizeof(mqtt_stats_t));
+    MQTT_MUTEX_UNLOCK(client->mutex);
+    
+    /* Concurrent increments may survive the reset, which is harmless */
+    mqtt_counters_t* c = &client->counters;
+    mqtt_atomic_store_u32(&c->tx_packets, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->rx_packets, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u64(&c->tx_bytes, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u64(&c->rx_bytes, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->publish_sent, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->publish_received, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->reconnects, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->ping_timeouts, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->local_delivered, 0, MQTT_ATOMIC_RELAXED);
+    mqtt_atomic_store_u32(&c->echoes_suppressed, 0, MQTT_ATOMIC_RELAXED);
+}
+
+/* Drop the current connection; the receive thread reconnects */
+static void mqtt_drop_connection(mqtt_client_t* client) {
+    const mqtt_net_api_t* net = mqtt_net_get();
+    
+    MQTT_MUTEX_LOCK(client->tx_mutex);
+    if (client->state == MQTT_STATE_CONNECTED) {
+        client->state = MQTT_STATE_DISCONNECTED;
+        net->disconnect(client->socket);
+        client->socket = NULL;
+    }
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
+}
+
 static int mqtt_try_reconnect(mqtt_client_t* client) {
     const mqtt_net_api_t* net = mqtt_net_get();
-    const mqtt_os_api_t* os = mqtt_os_get();
     int len;
     
     client->socket = net->connect(client->config.host, client->config.port, MQTT_CONNECT_TIMEOUT_MS);
     if (!client->socket) return -1;
     
-    os->mutex_lock(client->mutex);
+    /* Lock order: tx_mutex, then the mutex, which is only taken briefly */
+    MQTT_MUTEX_LOCK(client->tx_mutex);
     
     len = pack_connect(client->send_buf, client->config.client_id, client->config.username,
                        client->config.password, client->config.keepalive, client->config.clean_session);
     
-    if (net->send(client->socket, client->send_buf, len) != len) goto err_cleanup;
-    
-    int recv_len = net->recv(client->socket, client->recv_buf, MQTT_RECV_BUF_SIZE, MQTT_CONNECT_TIMEOUT_MS);
-    if (recv_len < 4 || (client->recv_buf[0] >> 4) != MQTT_CONNACK || client->recv_buf[3] != 0) {
-        goto err_cleanup;
+    if (mqtt_send_packet(client, len) != 0) goto err_cleanup;
+    if (mqtt_wait_connack(client) != 0) goto err_cleanup;
+    
+    for (int i = 0; ; i++) {
+        MQTT_MUTEX_LOCK(client->mutex);
+        len = i < client->sub_count ? pack_subscribe(client->send_buf, client->subscriptions[i].topic,
+                                                     client->subscriptions[i].qos,
+                                                     mqtt_next_packet_id(client)) : 0;
+        MQTT_MUTEX_UNLOCK(client->mutex);
+        if (len == 0) break;
+        if (mqtt_send_packet(client, len) != 0) goto err_cleanup;
     }
     
-    for (int i = 0; i < client->sub_count; i++) {
-        len = pack_subscribe(client->send_buf, client->subscriptions[i].topic,
-                             client->subscriptions[i].qos, client->packet_id++);
-        if (net->send(client->socket, client->send_buf, len) != len) goto err_cleanup;
+    /* PUBACKs for the old connection will never arrive */
+    MQTT_MUTEX_LOCK(client->mutex);
+    memset(client->inflight, 0, sizeof(client->inflight));
+    MQTT_MUTEX_UNLOCK(client->mutex);
+    
+    /* Echoes of publishes sent on the old connection will not arrive */
+    for (int i = 0; i < MQTT_LOCAL_ECHO_SLOTS; i++) {
+        mqtt_atomic_store_u32(&client->local_echo[i], 0, MQTT_ATOMIC_RELAXED);
     }
     
     client->state = MQTT_STATE_CONNECTED;
-    client->last_ping_time = os->get_time_ms();
+    client->connection++;
+    client->last_ping_time = mqtt_os_time_us();
     client->waiting_pingresp = 0;
+    mqtt_atomic_fetch_add_u32(&client->counters.reconnects, 1, MQTT_ATOMIC_RELAXED);
     
-    os->mutex_unlock(client->mutex);
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
     return 0;
 
 err_cleanup:
     net->disconnect(client->socket);
     client->socket = NULL;
-    os->mutex_unlock(client->mutex);
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
     return -1;
 }
 
 static int mqtt_send_ping(mqtt_client_t* client) {
     const mqtt_net_api_t* net = mqtt_net_get();
-    const mqtt_os_api_t* os = mqtt_os_get();
     
-    uint32_t now = os->get_time_ms();
-    uint32_t keepalive_ms = client->config.keepalive * 1000;
+    uint64_t now = mqtt_os_time_us();
+    uint64_t keepalive_us = (uint64_t)client->config.keepalive * 1000000;
     
     if (client->waiting_pingresp) {
-        if (mqtt_time_elapsed(client->ping_sent_time, now, keepalive_ms / 2)) {
-            os->mutex_lock(client->mutex);
+        if (mqtt_time_elapsed(client->ping_sent_time, now, keepalive_us / 2)) {
+            MQTT_MUTEX_LOCK(client->tx_mutex);
             client->state = MQTT_STATE_DISCONNECTED;
             client->waiting_pingresp = 0;
+            mqtt_atomic_fetch_add_u32(&client->counters.ping_timeouts, 1, MQTT_ATOMIC_RELAXED);
             net->disconnect(client->socket);
             client->socket = NULL;
-            os->mutex_unlock(client->mutex);
+            MQTT_MUTEX_UNLOCK(client->tx_mutex);
             return -1;
         }
         return 0;
     }
     
-    if (!mqtt_time_elapsed(client->last_ping_time, now, keepalive_ms / 2)) {
+    if (!mqtt_time_elapsed(client->last_ping_time, now, keepalive_us / 2)) {
         return 0;
     }
     
-    os->mutex_lock(client->mutex);
+    MQTT_MUTEX_LOCK(client->tx_mutex);
     
     int len = pack_pingreq(client->send_buf);
-    if (net->send(client->socket, client->send_buf, len) != len) {
+    if (mqtt_send_packet(client, len) != 0) {
         client->state = MQTT_STATE_DISCONNECTED;
         net->disconnect(client->socket);
         client->socket = NULL;
-        os->mutex_unlock(client->mutex);
+        MQTT_MUTEX_UNLOCK(client->tx_mutex);
         return -1;
     }
     client->ping_sent_time = now;
     client->waiting_pingresp = 1;
     
-    os->mutex_unlock(client->mutex);
+    MQTT_MUTEX_UNLOCK(client->tx_mutex);
     return 0;
 }
 
-static void mqtt_handle_publish(mqtt_client_t* client, int len) {
-    if (!client->config.msg_cb) return;
+static void mqtt_handle_publish(mqtt_client_t* client, const uint8_t* pkt, size_t len) {
+    mqtt_atomic_fetch_add_u32(&client->counters.publish_received, 1, MQTT_ATOMIC_RELAXED);
     
-    size_t remaining;
-    int offset = 1 + decode_remaining_length(client->recv_buf + 1, &remaining);
-    
-    uint16_t topic_len = (client->recv_buf[offset] << 8) | client->recv_buf[offset + 1];
-    offset += 2;
+    mqtt_publish_view_t msg;
+    if (mqtt_parse_publish(pkt, len, &msg) != 0) return;
     
+    /* Acknowledged even when dropped below, or the broker would resend it */
     char topic[128];
-    if (topic_len >= sizeof(topic)) return;
+    if (msg.topic_len < sizeof(topic)) {
+        memcpy(topic, msg.topic, msg.topic_len);
+        topic[msg.topic_len] = '\0';
+        
+        mqtt_msg_callback_t cb;
+        void* user_data;
+        mqtt_route(client, topic, &cb, &user_data);
+        
+        /* Already delivered by mqtt_client_publish_ex() */
+        if (client->config.local_delivery &&
+            mqtt_echo_take(client, mqtt_echo_hash(topic, msg.topic_len, msg.payload, msg.payload_len))) {
+            mqtt_atomic_fetch_add_u32(&client->counters.echoes_suppressed, 1, MQTT_ATOMIC_RELAXED);
+            cb = NULL;
+        }
+        
+        client->rx_packet_id = msg.qos == 1 ? msg.packet_id : 0;
+        client->rx_ack_deferred = 0;
+        if (cb) cb(topic, msg.payload, msg.payload_len, user_data);
+        client->rx_packet_id = 0;
+        if (client->rx_ack_deferred) return;
+    }
     
-    memcpy(topic, client->recv_buf + offset, topic_len);
-    topic[topic_len] = '\0';
-    offset += topic_len;
+    if (msg.qos == 1) mqtt_send_puback(client, client->connection, msg.packet_id);
+}
+
+static void mqtt_handle_puback(mqtt_client_t* client, const uint8_t* pkt, size_t len) {
+    if (len < 4) return;
+    
+    uint16_t packet_id = (pkt[2] << 8) | pkt[3];
+    uint64_t now = mqtt_os_time_us();
     
-    uint8_t qos = (client->recv_buf[0] >> 1) & 0x03;
-    if (qos > 0) offset += 2;
+    MQTT_MUTEX_LOCK(client->mutex);
+    mqtt_inflight_t* sent = mqtt_inflight_take(client, packet_id);
+    if (sent) mqtt_hist_record(&client->stats.puback_latency, (uint32_t)(now - sent->sent_time));
+    MQTT_MUTEX_UNLOCK(client->mutex);
     
-    size_t payload_len = len - offset;
-    client->config.msg_cb(topic, client->recv_buf + offset, payload_len, client->config.user_data);
+    if (client->config.puback_cb) client->config.puback_cb(packet_id, client->config.user_data);
+}
+
+static void mqtt_dispatch_packet(mqtt_client_t* client, const uint8_t* pkt, size_t len) {
+    uint8_t type = pkt[0] >> 4;
+    
+    mqtt_atomic_fetch_add_u32(&client->counters.rx_packets, 1, MQTT_ATOMIC_RELAXED);
+    
+    if (type == MQTT_PINGRESP) {
+        uint64_t now = mqtt_os_time_us();
+        if (client->waiting_pingresp) {
+            MQTT_MUTEX_LOCK(client->mutex);
+            mqtt_rtt_update(&client->stats, (uint32_t)(now - client->ping_sent_time));
+            MQTT_MUTEX_UNLOCK(client->mutex);
+        }
+        client->last_ping_time = now;
+        client->waiting_pingresp = 0;
+    } else if (type == MQTT_PUBACK) {
+        mqtt_handle_puback(client, pkt, len);
+    } else if (type == MQTT_PUBLISH) {
+        mqtt_handle_publish(client, pkt, len);
+    }
+}
+
+/* Split buffered input into packets and dispatch them; returns -1 on malformed input */
+static int mqtt_process_input(mqtt_client_t* client) {
+    size_t pos = 0;
+    
+    if (client->recv_discard > 0) {
+        pos = client->recv_discard < client->recv_len ? client->recv_discard : client->recv_len;
+        client->recv_discard -= pos;
+    }
+    
+    while (pos < client->recv_len) {
+        size_t avail = client->recv_len - pos;
+        size_t pkt_len;
+        int ret = mqtt_frame_packet(client->recv_buf + pos, avail, &pkt_len);
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+        
+        if (pkt_len > avail) {
+            if (pkt_len > MQTT_RECV_BUF_SIZE) {
+                /* Packet can never fit the buffer: skip it as it streams in */
+                client->recv_discard = pkt_len - avail;
+                pos = client->recv_len;
+            }
+            break;
+        }
+        
+        mqtt_dispatch_packet(client, client->recv_buf + pos, pkt_len);
+        pos += pkt_len;
+    }
+    
+    client->recv_len -= pos;
+    memmove(client->recv_buf, client->recv_buf + pos, client->recv_len);
+    return 0;
+}
+
+int mqtt_client_feed(mqtt_client_t* client, const uint8_t* data, size_t len) {
+    if (!client || (!data && len > 0)) return -1;
+    
+    while (len > 0) {
+        size_t chunk = MQTT_RECV_BUF_SIZE - client->recv_len;
+        if (chunk > len) chunk = len;
+        
+        memcpy(client->recv_buf + client->recv_len, data, chunk);
+        client->recv_len += chunk;
+        mqtt_atomic_fetch_add_u64(&client->counters.rx_bytes, chunk, MQTT_ATOMIC_RELAXED);
+        data += chunk;
+        len -= chunk;
+        
+        if (mqtt_process_input(client) != 0) return -1;
+    }
+    return 0;
+}
+
+void mqtt_client_feed_reset(mqtt_client_t* client) {
+    if (!client) return;
+    client->recv_len = 0;
+    client->recv_discard = 0;
 }
 
 static void mqtt_recv_thread(void* arg) {
@@ -412,7 +855,11 @@ static void mqtt_recv_thread(void* arg) {
     while (client->running) {
         if (client->state == MQTT_STATE_DISCONNECTED) {
             if (mqtt_try_reconnect(client) != 0) {
-                os->sleep_ms(MQTT_RECONNECT_DELAY_MS);
+                if (client->wake_event) {
+                    os->event_wait(client->wake_event, MQTT_RECONNECT_DELAY_MS);
+                } else {
+                    os->sleep_ms(MQTT_RECONNECT_DELAY_MS);
+                }
             }
             continue;
         }
@@ -421,30 +868,20 @@ static void mqtt_recv_thread(void* arg) {
             continue;
         }
         
-        int len = net->recv(client->socket, client->recv_buf, MQTT_RECV_BUF_SIZE, MQTT_RECV_TIMEOUT_MS);
+        int len = net->recv(client->socket, client->recv_buf + client->recv_len,
+                            MQTT_RECV_BUF_SIZE - client->recv_len, MQTT_RECV_TIMEOUT_MS);
         
         if (len < 0) {
-            os->mutex_lock(client->mutex);
-            if (client->state == MQTT_STATE_CONNECTED) {
-                client->state = MQTT_STATE_DISCONNECTED;
-                net->disconnect(client->socket);
-                client->socket = NULL;
-            }
-            os->mutex_unlock(client->mutex);
+            mqtt_drop_connection(client);
             continue;
         }
         if (len == 0) continue;
         
-        uint8_t type = client->recv_buf[0] >> 4;
-        
-        if (type == MQTT_PINGRESP) {
-            client->last_ping_time = os->get_time_ms();
-            client->waiting_pingresp = 0;
-            continue;
-        }
+        client->recv_len += len;
+        mqtt_atomic_fetch_add_u64(&client->counters.rx_bytes, len, MQTT_ATOMIC_RELAXED);
         
-        if (type == MQTT_PUBLISH) {
-            mqtt_handle_publish(client, len);
+        if (mqtt_process_input(client) != 0) {
+            mqtt_drop_connection(client);
         }
     }
     
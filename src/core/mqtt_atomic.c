@@ -0,0 +1,17 @@
+/**
+ * @file mqtt_atomic.c
+ * @brief Critical-section fallback for portable atomics
+ */
+
+#include "mqtt_atomic.h"
+#include "mqtt_os.h"
+
+uint32_t mqtt_atomic_lock(void) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    return (os && os->critical_enter) ? os->critical_enter() : 0;
+}
+
+void mqtt_atomic_unlock(uint32_t state) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (os && os->critical_exit) os->critical_exit(state);
+}
@@ -0,0 +1,226 @@
+/**
+ * @file mqtt_batch.c
+ * @brief Multi-message envelope batching implementation
+ */
+
+#include "mqtt_batch.h"
+#include <string.h>
+
+/** @brief PUBLISH bytes besides topic and payload: fixed header, topic length, packet ID */
+#define BATCH_PUBLISH_OVERHEAD  (1 + 4 + 2 + 2)
+
+typedef struct {
+    char topic[sizeof(((mqtt_subscription_t*)0)->topic)];  /* Empty when unused */
+    uint8_t* buf;
+    uint16_t len;          /* Envelope bytes including the version byte */
+    uint16_t limit;        /* Envelope size limit for this topic */
+    uint16_t count;        /* Readings in the envelope */
+    uint64_t first_time;   /* Arrival of the oldest reading in microseconds */
+} batch_slot_t;
+
+struct mqtt_batch {
+    mqtt_client_t* client;
+    mqtt_mutex_t mutex;
+    mqtt_batch_config_t config;
+    batch_slot_t* slots;
+    mqtt_batch_stats_t stats;
+};
+
+static int varint_len(size_t value) {
+    return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
+/* Caller holds batch->mutex */
+static int batch_flush_slot(mqtt_batch_t* batch, batch_slot_t* slot) {
+    if (slot->count == 0) return 0;
+
+    int ret = mqtt_client_publish(batch->client, slot->topic, slot->buf, slot->len, batch->config.qos);
+    if (ret == 0) {
+        batch->stats.envelopes++;
+        batch->stats.bytes += slot->len;
+    } else {
+        batch->stats.dropped += slot->count;
+    }
+    slot->len = 1;
+    slot->count = 0;
+    return ret;
+}
+
+/* Find or claim the slot of a topic; caller holds batch->mutex */
+static batch_slot_t* batch_slot_get(mqtt_batch_t* batch, const char* topic, size_t topic_len) {
+    batch_slot_t* victim = NULL;
+
+    for (int i = 0; i < batch->config.max_topics; i++) {
+        batch_slot_t* slot = &batch->slots[i];
+        if (strcmp(slot->topic, topic) == 0) return slot;
+
+        /* Prefer an empty envelope, then the one holding the oldest reading */
+        if (!victim || (victim->count > 0 &&
+                        (slot->count == 0 || slot->first_time < victim->first_time))) {
+            victim = slot;
+        }
+    }
+
+    batch_flush_slot(batch, victim);
+    memcpy(victim->topic, topic, topic_len + 1);
+    uint32_t limit = MQTT_MAX_PACKET_SIZE - BATCH_PUBLISH_OVERHEAD - (uint32_t)topic_len;
+    victim->limit = (uint16_t)(batch->config.max_bytes < limit ? batch->config.max_bytes : limit);
+    return victim;
+}
+
+mqtt_batch_t* mqtt_batch_create(mqtt_client_t* client, const mqtt_batch_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!client) return NULL;
+
+    mqtt_batch_t* batch = (mqtt_batch_t*)os->malloc(sizeof(mqtt_batch_t));
+    if (!batch) return NULL;
+    memset(batch, 0, sizeof(mqtt_batch_t));
+    batch->client = client;
+    if (config) batch->config = *config;
+    if (!batch->config.max_topics) batch->config.max_topics = MQTT_BATCH_DEFAULT_TOPICS;
+    if (!batch->config.max_bytes) batch->config.max_bytes = MQTT_BATCH_DEFAULT_BYTES;
+    if (!batch->config.max_age_ms) batch->config.max_age_ms = MQTT_BATCH_DEFAULT_AGE_MS;
+
+    /* Slots and their envelope buffers in one block */
+    size_t slots_size = batch->config.max_topics * sizeof(batch_slot_t);
+    batch->slots = (batch_slot_t*)os->malloc(slots_size + (size_t)batch->config.max_topics *
+                                             batch->config.max_bytes);
+    if (!batch->slots) goto err_free_batch;
+    memset(batch->slots, 0, slots_size);
+    for (int i = 0; i < batch->config.max_topics; i++) {
+        batch_slot_t* slot = &batch->slots[i];
+        slot->buf = (uint8_t*)batch->slots + slots_size + (size_t)i * batch->config.max_bytes;
+        slot->buf[0] = MQTT_BATCH_VERSION;
+        slot->len = 1;
+    }
+
+    batch->mutex = os->mutex_create();
+    if (!batch->mutex) goto err_free_slots;
+    return batch;
+
+err_free_slots:
+    os->free(batch->slots);
+err_free_batch:
+    os->free(batch);
+    return NULL;
+}
+
+void mqtt_batch_destroy(mqtt_batch_t* batch) {
+    if (!batch) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    mqtt_batch_flush(batch);
+    os->mutex_destroy(batch->mutex);
+    os->free(batch->slots);
+    os->free(batch);
+}
+
+int mqtt_batch_add(mqtt_batch_t* batch, const char* topic, const uint8_t* data, size_t len) {
+    if (!batch || !topic || (!data && len > 0)) return -1;
+
+    size_t topic_len = strlen(topic);
+    size_t need = varint_len(len) + len;
+    if (topic_len == 0 || topic_len >= sizeof(batch->slots[0].topic)) return -1;
+
+    MQTT_MUTEX_LOCK(batch->mutex);
+
+    batch_slot_t* slot = batch_slot_get(batch, topic, topic_len);
+    if (1 + need > slot->limit) {
+        MQTT_MUTEX_UNLOCK(batch->mutex);
+        return -1;
+    }
+
+    int ret = 0;
+    if (slot->len + need > slot->limit) ret = batch_flush_slot(batch, slot);
+
+    uint8_t* p = slot->buf + slot->len;
+    size_t remaining = len;
+    do {
+        *p = remaining & 0x7F;
+        remaining >>= 7;
+        if (remaining) *p |= 0x80;
+        p++;
+    } while (remaining);
+    if (len > 0) memcpy(p, data, len);
+    slot->len += (uint16_t)need;
+    if (slot->count++ == 0) slot->first_time = mqtt_os_time_us();
+    batch->stats.readings++;
+
+    if (batch->config.max_count && slot->count >= batch->config.max_count) {
+        if (batch_flush_slot(batch, slot) != 0) ret = -1;
+    }
+
+    MQTT_MUTEX_UNLOCK(batch->mutex);
+    return ret;
+}
+
+uint32_t mqtt_batch_poll(mqtt_batch_t* batch) {
+    if (!batch) return UINT32_MAX;
+
+    uint64_t now = mqtt_os_time_us();
+    uint64_t max_age_us = (uint64_t)batch->config.max_age_ms * 1000;
+    uint64_t wait_us = UINT64_MAX;
+
+    MQTT_MUTEX_LOCK(batch->mutex);
+    for (int i = 0; i < batch->config.max_topics; i++) {
+        batch_slot_t* slot = &batch->slots[i];
+        if (slot->count == 0) continue;
+
+        uint64_t age = now - slot->first_time;
+        if (age >= max_age_us) {
+            batch_flush_slot(batch, slot);
+        } else if (max_age_us - age < wait_us) {
+            wait_us = max_age_us - age;
+        }
+    }
+    MQTT_MUTEX_UNLOCK(batch->mutex);
+
+    return wait_us == UINT64_MAX ? UINT32_MAX : (uint32_t)((wait_us + 999) / 1000);
+}
+
+int mqtt_batch_flush(mqtt_batch_t* batch) {
+    if (!batch) return -1;
+
+    int ret = 0;
+    MQTT_MUTEX_LOCK(batch->mutex);
+    for (int i = 0; i < batch->config.max_topics; i++) {
+        if (batch_flush_slot(batch, &batch->slots[i]) != 0) ret = -1;
+    }
+    MQTT_MUTEX_UNLOCK(batch->mutex);
+    return ret;
+}
+
+int mqtt_batch_get_stats(mqtt_batch_t* batch, mqtt_batch_stats_t* stats) {
+    if (!batch || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(batch->mutex);
+    memcpy(stats, &batch->stats, sizeof(mqtt_batch_stats_t));
+    MQTT_MUTEX_UNLOCK(batch->mutex);
+    return 0;
+}
+
+int mqtt_batch_unpack(const char* topic, const uint8_t* payload, size_t len,
+                      mqtt_msg_callback_t cb, void* user_data) {
+    if (!payload || !cb || len < 1 || payload[0] != MQTT_BATCH_VERSION) return -1;
+
+    size_t pos = 1;
+    int count = 0;
+    while (pos < len) {
+        size_t reading_len = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            if (pos >= len || shift > 21) return -1;
+            byte = payload[pos++];
+            reading_len |= (size_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (reading_len > len - pos) return -1;
+
+        cb(topic, payload + pos, reading_len, user_data);
+        pos += reading_len;
+        count++;
+    }
+    return count;
+}
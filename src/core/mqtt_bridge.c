@@ -0,0 +1,296 @@
+/**
+ * @file mqtt_bridge.c
+ * @brief Broker-to-broker bridge implementation
+ */
+
+#include "mqtt_bridge.h"
+#include <string.h>
+
+/** @brief Longest forwarded topic, matching the receive path's topic buffer */
+#define BRIDGE_TOPIC_MAX    (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief Destination PUBACKs kept for publishes that have not returned yet */
+#define BRIDGE_EARLY_ACKS   8
+
+typedef struct {
+    uint16_t packet_id;          /* Destination publish, 0 when unused */
+    uint32_t token;              /* Deferred ack of the source message */
+    uint64_t time;
+} bridge_pending_t;
+
+typedef struct bridge_side bridge_side_t;
+
+struct bridge_side {
+    mqtt_bridge_t* bridge;
+    bridge_side_t* peer;
+    mqtt_bridge_direction_t outbound;  /* Direction of rules subscribed on this side */
+    mqtt_mutex_t mutex;          /* Everything below, and the client pointers of both sides */
+    mqtt_client_t* client;       /* NULL while connecting and once destroying */
+    bridge_pending_t pending[MQTT_BRIDGE_MAX_PENDING];
+    uint16_t early[BRIDGE_EARLY_ACKS];  /* PUBACKs that overtook their pending entry */
+    uint8_t early_next;
+    uint32_t busy;               /* Publishes to client in progress, it outlives them */
+    mqtt_bridge_stats_t stats;   /* Messages forwarded to this side */
+};
+
+struct mqtt_bridge {
+    bridge_side_t sides[2];
+    mqtt_bridge_rule_t* rules;
+    int count;
+};
+
+/*
+ * Lock order: side mutex, then client locks. A side's client pointer is
+ * read under either side's mutex, so it only changes with both held.
+ */
+static void bridge_set_clients(mqtt_bridge_t* bridge, mqtt_client_t* a, mqtt_client_t* b) {
+    MQTT_MUTEX_LOCK(bridge->sides[0].mutex);
+    MQTT_MUTEX_LOCK(bridge->sides[1].mutex);
+    bridge->sides[0].client = a;
+    bridge->sides[1].client = b;
+    MQTT_MUTEX_UNLOCK(bridge->sides[1].mutex);
+    MQTT_MUTEX_UNLOCK(bridge->sides[0].mutex);
+}
+
+/* Whether a receive thread is still publishing to either client */
+static int bridge_busy(mqtt_bridge_t* bridge) {
+    uint32_t busy = 0;
+    for (int i = 0; i < 2; i++) {
+        MQTT_MUTEX_LOCK(bridge->sides[i].mutex);
+        busy += bridge->sides[i].busy;
+        MQTT_MUTEX_UNLOCK(bridge->sides[i].mutex);
+    }
+    return busy != 0;
+}
+
+/* Build the destination topic; returns -1 if it does not fit */
+static int bridge_remap(const mqtt_bridge_rule_t* rule, const char* topic, char* out) {
+    size_t strip_len = rule->strip_prefix ? strlen(rule->strip_prefix) : 0;
+    size_t add_len = rule->add_prefix ? strlen(rule->add_prefix) : 0;
+
+    if (strip_len && strncmp(topic, rule->strip_prefix, strip_len) == 0) topic += strip_len;
+
+    size_t topic_len = strlen(topic);
+    if (add_len + topic_len == 0 || add_len + topic_len > BRIDGE_TOPIC_MAX) return -1;
+
+    if (add_len) memcpy(out, rule->add_prefix, add_len);
+    memcpy(out + add_len, topic, topic_len + 1);
+    return 0;
+}
+
+/* Chain a source ack to a destination PUBACK; caller holds dst->mutex */
+static void bridge_pending_add(bridge_side_t* dst, mqtt_client_t* source, uint16_t packet_id, uint32_t token) {
+    bridge_pending_t* slot = &dst->pending[0];
+
+    /* The PUBACK arrived before the publish returned */
+    for (int i = 0; i < BRIDGE_EARLY_ACKS; i++) {
+        if (dst->early[i] == packet_id) {
+            dst->early[i] = 0;
+            mqtt_client_ack(source, token);
+            dst->stats.chained_acks++;
+            return;
+        }
+    }
+
+    for (int i = 0; i < MQTT_BRIDGE_MAX_PENDING; i++) {
+        if (dst->pending[i].packet_id == 0) {
+            slot = &dst->pending[i];
+            break;
+        }
+        if (dst->pending[i].time < slot->time) slot = &dst->pending[i];
+    }
+
+    /* Table full: the oldest destination PUBACK is most likely lost, release its source */
+    if (slot->packet_id != 0) {
+        mqtt_client_ack(source, slot->token);
+        dst->stats.direct_acks++;
+    }
+
+    slot->packet_id = packet_id;
+    slot->token = token;
+    slot->time = mqtt_os_time_us();
+}
+
+/* Message received on side src, runs on its receive thread */
+static void bridge_on_message(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    bridge_side_t* src = (bridge_side_t*)user_data;
+    bridge_side_t* dst = src->peer;
+    mqtt_bridge_t* bridge = src->bridge;
+    const mqtt_bridge_rule_t* rule = NULL;
+    char out[BRIDGE_TOPIC_MAX + 1];
+
+    for (int i = 0; i < bridge->count; i++) {
+        if (bridge->rules[i].direction == src->outbound &&
+            mqtt_topic_match(bridge->rules[i].filter, topic)) {
+            rule = &bridge->rules[i];
+            break;
+        }
+    }
+    if (!rule) return;
+
+    MQTT_MUTEX_LOCK(dst->mutex);
+
+    mqtt_client_t* source = src->client;
+    mqtt_client_t* client = dst->client;
+    if (!source || !client || bridge_remap(rule, topic, out) != 0) {
+        dst->stats.dropped++;
+        MQTT_MUTEX_UNLOCK(dst->mutex);
+        return;
+    }
+    dst->busy++;
+
+    MQTT_MUTEX_UNLOCK(dst->mutex);
+
+    /*
+     * Published without dst->mutex: the publish may block on a full socket,
+     * and the destination's receive thread takes the mutex for its PUBACKs
+     */
+    uint32_t token = rule->qos ? mqtt_client_defer_ack(source) : 0;
+    uint16_t packet_id;
+    int ret = mqtt_client_publish_ex(client, out, payload, len, rule->qos, &packet_id);
+
+    MQTT_MUTEX_LOCK(dst->mutex);
+
+    dst->busy--;
+    if (ret == 0) {
+        dst->stats.forwarded++;
+        if (token) bridge_pending_add(dst, source, packet_id, token);
+    } else {
+        /* Acked anyway: an unacked message would hold a source inflight slot until reconnect */
+        dst->stats.dropped++;
+        if (token) {
+            mqtt_client_ack(source, token);
+            dst->stats.direct_acks++;
+        }
+    }
+
+    MQTT_MUTEX_UNLOCK(dst->mutex);
+}
+
+/* Publish to side dst acknowledged, runs on its receive thread */
+static void bridge_on_puback(uint16_t packet_id, void* user_data) {
+    bridge_side_t* dst = (bridge_side_t*)user_data;
+
+    MQTT_MUTEX_LOCK(dst->mutex);
+    int i;
+    for (i = 0; i < MQTT_BRIDGE_MAX_PENDING; i++) {
+        if (dst->pending[i].packet_id == packet_id) {
+            dst->pending[i].packet_id = 0;
+            if (dst->peer->client) mqtt_client_ack(dst->peer->client, dst->pending[i].token);
+            dst->stats.chained_acks++;
+            break;
+        }
+    }
+    /* Its publish has not returned yet; bridge_pending_add() picks it up */
+    if (i == MQTT_BRIDGE_MAX_PENDING) dst->early[dst->early_next++ % BRIDGE_EARLY_ACKS] = packet_id;
+    MQTT_MUTEX_UNLOCK(dst->mutex);
+}
+
+mqtt_bridge_t* mqtt_bridge_create(const mqtt_config_t* config_a, const mqtt_config_t* config_b,
+                                  const mqtt_bridge_rule_t* rules, int count) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    int per_direction[2] = { 0, 0 };
+    if (!os || !config_a || !config_b || !rules || count <= 0) return NULL;
+
+    for (int i = 0; i < count; i++) {
+        if (!rules[i].filter || rules[i].qos > 1 ||
+            (rules[i].direction != MQTT_BRIDGE_A_TO_B && rules[i].direction != MQTT_BRIDGE_B_TO_A) ||
+            ++per_direction[rules[i].direction] > MQTT_MAX_SUBSCRIPTIONS) {
+            return NULL;
+        }
+    }
+
+    mqtt_bridge_t* bridge = (mqtt_bridge_t*)os->malloc(sizeof(mqtt_bridge_t));
+    if (!bridge) return NULL;
+    memset(bridge, 0, sizeof(mqtt_bridge_t));
+
+    bridge->rules = (mqtt_bridge_rule_t*)os->malloc(count * sizeof(mqtt_bridge_rule_t));
+    if (!bridge->rules) goto err_free_bridge;
+    memcpy(bridge->rules, rules, count * sizeof(mqtt_bridge_rule_t));
+    bridge->count = count;
+
+    for (int i = 0; i < 2; i++) {
+        bridge_side_t* side = &bridge->sides[i];
+        side->bridge = bridge;
+        side->peer = &bridge->sides[1 - i];
+        side->outbound = i == 0 ? MQTT_BRIDGE_A_TO_B : MQTT_BRIDGE_B_TO_A;
+        side->mutex = os->mutex_create();
+        if (!side->mutex) goto err_free_mutexes;
+    }
+
+    /* Connected before any client pointer is published; early messages are dropped */
+    mqtt_client_t* clients[2];
+    const mqtt_config_t* configs[2] = { config_a, config_b };
+    for (int i = 0; i < 2; i++) {
+        mqtt_config_t config = *configs[i];
+        config.msg_cb = bridge_on_message;
+        config.puback_cb = bridge_on_puback;
+        config.user_data = &bridge->sides[i];
+
+        clients[i] = mqtt_client_create(&config);
+        if (!clients[i]) {
+            if (i == 1) mqtt_client_destroy(clients[0]);
+            goto err_free_mutexes;
+        }
+    }
+    bridge_set_clients(bridge, clients[0], clients[1]);
+
+    for (int i = 0; i < count; i++) {
+        mqtt_client_t* src = clients[rules[i].direction == MQTT_BRIDGE_A_TO_B ? 0 : 1];
+        if (mqtt_client_subscribe(src, rules[i].filter, rules[i].qos) != 0) {
+            mqtt_bridge_destroy(bridge);
+            return NULL;
+        }
+    }
+    return bridge;
+
+err_free_mutexes:
+    for (int i = 0; i < 2; i++) {
+        if (bridge->sides[i].mutex) os->mutex_destroy(bridge->sides[i].mutex);
+    }
+    os->free(bridge->rules);
+err_free_bridge:
+    os->free(bridge);
+    return NULL;
+}
+
+void mqtt_bridge_destroy(mqtt_bridge_t* bridge) {
+    if (!bridge) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+    mqtt_client_t* a = bridge->sides[0].client;
+    mqtt_client_t* b = bridge->sides[1].client;
+
+    /* Stop forwarding first, let publishes in progress finish, then join the receive threads */
+    bridge_set_clients(bridge, NULL, NULL);
+    while (bridge_busy(bridge)) os->sleep_ms(1);
+    mqtt_client_destroy(a);
+    mqtt_client_destroy(b);
+
+    for (int i = 0; i < 2; i++) {
+        os->mutex_destroy(bridge->sides[i].mutex);
+    }
+    os->free(bridge->rules);
+    os->free(bridge);
+}
+
+mqtt_client_t* mqtt_bridge_client(mqtt_bridge_t* bridge, int side) {
+    if (!bridge || side < 0 || side > 1) return NULL;
+    return bridge->sides[side].client;
+}
+
+int mqtt_bridge_get_stats(mqtt_bridge_t* bridge, mqtt_bridge_stats_t* stats) {
+    if (!bridge || !stats) return -1;
+
+    memset(stats, 0, sizeof(mqtt_bridge_stats_t));
+    for (int i = 0; i < 2; i++) {
+        bridge_side_t* side = &bridge->sides[i];
+        MQTT_MUTEX_LOCK(side->mutex);
+        stats->forwarded += side->stats.forwarded;
+        stats->dropped += side->stats.dropped;
+        stats->chained_acks += side->stats.chained_acks;
+        stats->direct_acks += side->stats.direct_acks;
+        MQTT_MUTEX_UNLOCK(side->mutex);
+    }
+    return 0;
+}
@@ -0,0 +1,674 @@
+/**
+ * @file mqtt_broker.c
+ * @brief Embedded MQTT 3.1.1 broker implementation
+ */
+
+#include "mqtt_broker.h"
+#include "mqtt_codec.h"
+#include <string.h>
+
+#ifdef MQTT_OS_STATIC
+#error "The embedded broker creates a thread per connection and needs dynamic allocation"
+#endif
+
+/** @brief Longest topic or filter, matching the client's receive path */
+#define BROKER_TOPIC_MAX        (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief Receive and accept timeout slice, bounds how long shutdown takes */
+#define BROKER_POLL_MS          200
+
+/** @brief Longest wait for CONNECT on a new connection */
+#define BROKER_CONNECT_TIMEOUT_MS  5000
+
+/** @brief Largest PUBLISH header: fixed header, topic and packet ID */
+#define BROKER_PUBLISH_HDR_MAX  (1 + 4 + 2 + BROKER_TOPIC_MAX + 2)
+
+/** @brief Largest SUBACK: fixed header, packet ID, and a return code per filter of
+ *  a full receive buffer, each taking at least 4 bytes as empty filters are refused */
+#define BROKER_SUBACK_MAX       (1 + 4 + 2 + MQTT_RECV_BUF_SIZE / 4)
+
+typedef enum {
+    BROKER_SESSION_FREE = 0,
+    BROKER_SESSION_ACTIVE,       /* Thread running */
+    BROKER_SESSION_EXITED        /* Thread posted exit_sem, not yet joined */
+} broker_session_state_t;
+
+typedef struct {
+    char filter[BROKER_TOPIC_MAX + 1];   /* Empty when unused */
+} broker_sub_t;
+
+typedef struct {
+    mqtt_broker_t* broker;
+    uint8_t state;               /* broker->mutex */
+    volatile uint8_t closing;    /* Asks the thread to close the connection */
+    uint8_t connected;           /* CONNECT received, written by the thread under broker->mutex */
+    uint16_t generation;         /* Tells a reused slot from the connection a sender matched */
+    uint16_t keepalive;
+    mqtt_socket_t socket;        /* tx_mutex once the thread runs */
+    mqtt_mutex_t tx_mutex;
+    mqtt_thread_t thread;
+    mqtt_sem_t exit_sem;
+    char client_id[MQTT_BROKER_CLIENT_ID_MAX + 1];
+    broker_sub_t* subs;          /* broker->mutex */
+    uint32_t* targets;           /* Fan-out scratch: generation << 16 | slot */
+    uint8_t recv_buf[MQTT_RECV_BUF_SIZE];
+    size_t recv_len;
+    size_t recv_discard;
+} broker_session_t;
+
+typedef struct {
+    char filter[BROKER_TOPIC_MAX + 1];
+    mqtt_msg_callback_t cb;
+    void* user_data;
+    mqtt_client_t* client;       /* Forward upstream instead of calling cb */
+    uint8_t qos;
+} broker_local_sub_t;
+
+typedef struct {
+    mqtt_atomic_u32_t connects;
+    mqtt_atomic_u32_t rejected;
+    mqtt_atomic_u32_t messages;
+    mqtt_atomic_u32_t deliveries;
+    mqtt_atomic_u32_t local;
+    mqtt_atomic_u32_t send_failures;
+} broker_counters_t;
+
+struct mqtt_broker {
+    mqtt_broker_config_t config;
+    mqtt_socket_t listener;
+    volatile uint8_t running;
+    mqtt_mutex_t mutex;          /* Session states, connected flags and subscriptions */
+    mqtt_mutex_t publish_mutex;  /* publish_targets */
+    mqtt_thread_t accept_thread;
+    mqtt_sem_t accept_exit_sem;
+    broker_session_t* sessions;
+    uint32_t* publish_targets;   /* Fan-out scratch of mqtt_broker_publish() */
+    broker_local_sub_t local_subs[MQTT_BROKER_MAX_LOCAL_SUBS];
+    mqtt_atomic_u32_t local_published;   /* Local subscriptions are append-only, read without the mutex */
+    broker_counters_t counters;
+};
+
+static void broker_session_thread(void* arg);
+
+static mqtt_thread_t broker_start_thread(mqtt_broker_t* broker, mqtt_thread_func_t func, void* arg) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    const mqtt_thread_attr_t* attr = &broker->config.thread;
+
+    if (os->thread_create_ex) return os->thread_create_ex(func, arg, attr);
+
+    return os->thread_create(func, arg,
+                             attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE,
+                             attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY);
+}
+
+/* '#' only as the last level, wildcards only as whole levels */
+static int broker_filter_valid(const char* filter, size_t len) {
+    if (len == 0 || len > BROKER_TOPIC_MAX) return 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (filter[i] != '+' && filter[i] != '#') continue;
+        if (i > 0 && filter[i - 1] != '/') return 0;
+        if (filter[i] == '#' && i != len - 1) return 0;
+        if (filter[i] == '+' && i + 1 < len && filter[i + 1] != '/') return 0;
+    }
+    return 1;
+}
+
+/* Send one packet, optionally followed by a payload, if the connection is still the matched one */
+static int broker_send(broker_session_t* s, uint16_t generation, const uint8_t* buf, size_t len,
+                       const uint8_t* payload, size_t payload_len) {
+    const mqtt_net_api_t* net = mqtt_net_get();
+    int ret = -1;
+
+    MQTT_MUTEX_LOCK(s->tx_mutex);
+    if (s->socket && s->generation == generation && !s->closing) {
+        if (payload_len == 0) {
+            ret = net->send(s->socket, buf, len) == (int)len ? 0 : -1;
+        } else if (net->sendv) {
+            mqtt_iovec_t iov[2] = { { buf, len }, { payload, payload_len } };
+            ret = net->sendv(s->socket, iov, 2) == (int)(len + payload_len) ? 0 : -1;
+        } else {
+            ret = (net->send(s->socket, buf, len) == (int)len &&
+                   net->send(s->socket, payload, payload_len) == (int)payload_len) ? 0 : -1;
+        }
+        /* A stream with half a packet in it is useless, let the thread close it */
+        if (ret != 0) s->closing = 1;
+    }
+    MQTT_MUTEX_UNLOCK(s->tx_mutex);
+    return ret;
+}
+
+/*
+ * Deliver a message to every matching connection and local subscription.
+ * Matching happens under the mutex, sending outside it so a slow device
+ * only stalls the thread publishing to it.
+ */
+static void broker_fanout(mqtt_broker_t* broker, const char* topic, const uint8_t* payload, size_t len,
+                          uint32_t* targets) {
+    uint8_t hdr[BROKER_PUBLISH_HDR_MAX];
+    int hdr_len = mqtt_pack_publish_header(hdr, sizeof(hdr), topic, len, 0, 0);
+    if (hdr_len < 0) return;
+
+    mqtt_atomic_fetch_add_u32(&broker->counters.messages, 1, MQTT_ATOMIC_RELAXED);
+
+    uint32_t count = 0;
+    MQTT_MUTEX_LOCK(broker->mutex);
+    for (uint16_t i = 0; i < broker->config.max_sessions; i++) {
+        broker_session_t* s = &broker->sessions[i];
+        if (s->state != BROKER_SESSION_ACTIVE || !s->connected) continue;
+
+        for (uint16_t j = 0; j < broker->config.max_subscriptions; j++) {
+            if (s->subs[j].filter[0] && mqtt_topic_match(s->subs[j].filter, topic)) {
+                targets[count++] = ((uint32_t)s->generation << 16) | i;
+                break;
+            }
+        }
+    }
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+
+    for (uint32_t i = 0; i < count; i++) {
+        broker_session_t* s = &broker->sessions[targets[i] & 0xFFFF];
+        if (broker_send(s, (uint16_t)(targets[i] >> 16), hdr, hdr_len, payload, len) == 0) {
+            mqtt_atomic_fetch_add_u32(&broker->counters.deliveries, 1, MQTT_ATOMIC_RELAXED);
+        } else {
+            mqtt_atomic_fetch_add_u32(&broker->counters.send_failures, 1, MQTT_ATOMIC_RELAXED);
+        }
+    }
+
+    uint32_t local = mqtt_atomic_load_u32(&broker->local_published, MQTT_ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < local; i++) {
+        const broker_local_sub_t* sub = &broker->local_subs[i];
+        if (!mqtt_topic_match(sub->filter, topic)) continue;
+
+        if (sub->client) {
+            mqtt_client_publish(sub->client, topic, payload, len, sub->qos);
+        } else {
+            sub->cb(topic, payload, len, sub->user_data);
+        }
+        mqtt_atomic_fetch_add_u32(&broker->counters.local, 1, MQTT_ATOMIC_RELAXED);
+    }
+}
+
+/* Read a length-prefixed string; returns its length or -1 */
+static int broker_read_string(const uint8_t* pkt, size_t len, size_t* pos, const uint8_t** str) {
+    if (*pos + 2 > len) return -1;
+    size_t str_len = (pkt[*pos] << 8) | pkt[*pos + 1];
+    *pos += 2;
+    if (*pos + str_len > len) return -1;
+    *str = pkt + *pos;
+    *pos += str_len;
+    return (int)str_len;
+}
+
+static int broker_handle_connect(broker_session_t* s, const uint8_t* pkt, size_t len, size_t pos) {
+    mqtt_broker_t* broker = s->broker;
+    uint8_t connack[4] = { MQTT_CONNACK << 4, 2, 0, 0 };
+    const uint8_t* str;
+
+    int name_len = broker_read_string(pkt, len, &pos, &str);
+    if (name_len != 4 || memcmp(str, "MQTT", 4) != 0 || pos + 4 > len) return -1;
+
+    if (pkt[pos] != 4) {
+        connack[3] = 1;  /* Unacceptable protocol level */
+        broker_send(s, s->generation, connack, sizeof(connack), NULL, 0);
+        return -1;
+    }
+    s->keepalive = (pkt[pos + 2] << 8) | pkt[pos + 3];
+    pos += 4;
+
+    int id_len = broker_read_string(pkt, len, &pos, &str);
+    if (id_len < 0) return -1;
+    if (id_len > MQTT_BROKER_CLIENT_ID_MAX) {
+        connack[3] = 2;  /* Identifier rejected */
+        broker_send(s, s->generation, connack, sizeof(connack), NULL, 0);
+        return -1;
+    }
+    memcpy(s->client_id, str, id_len);
+    s->client_id[id_len] = '\0';
+
+    /* Will, username and password follow and are ignored */
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    if (id_len > 0) {
+        /* A client ID has one connection: take over from the previous one */
+        for (uint16_t i = 0; i < broker->config.max_sessions; i++) {
+            broker_session_t* other = &broker->sessions[i];
+            if (other != s && other->state == BROKER_SESSION_ACTIVE && other->connected &&
+                strcmp(other->client_id, s->client_id) == 0) {
+                other->closing = 1;
+                other->connected = 0;
+            }
+        }
+    }
+    s->connected = 1;
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+
+    mqtt_atomic_fetch_add_u32(&broker->counters.connects, 1, MQTT_ATOMIC_RELAXED);
+    return broker_send(s, s->generation, connack, sizeof(connack), NULL, 0);
+}
+
+static int broker_handle_publish(broker_session_t* s, const uint8_t* pkt, size_t len) {
+    mqtt_publish_view_t msg;
+    char topic[BROKER_TOPIC_MAX + 1];
+
+    if (mqtt_parse_publish(pkt, len, &msg) != 0 || msg.qos > 1) return -1;
+
+    /* Topic names never hold wildcards; too long ones are dropped but acknowledged */
+    if (msg.topic_len > 0 && msg.topic_len <= BROKER_TOPIC_MAX &&
+        !memchr(msg.topic, '+', msg.topic_len) && !memchr(msg.topic, '#', msg.topic_len)) {
+        memcpy(topic, msg.topic, msg.topic_len);
+        topic[msg.topic_len] = '\0';
+        broker_fanout(s->broker, topic, msg.payload, msg.payload_len, s->targets);
+    }
+
+    if (msg.qos == 1) {
+        uint8_t puback[4];
+        mqtt_pack_ack(puback, MQTT_PUBACK, msg.packet_id);
+        return broker_send(s, s->generation, puback, sizeof(puback), NULL, 0);
+    }
+    return 0;
+}
+
+/* SUBSCRIBE and UNSUBSCRIBE share their layout apart from the QoS byte */
+static int broker_handle_subscribe(broker_session_t* s, const uint8_t* pkt, size_t len, size_t pos,
+                                   int subscribe) {
+    mqtt_broker_t* broker = s->broker;
+    /* Return codes go after room for the longest fixed header, which is
+     * written in front of them once their number is known */
+    uint8_t ack[BROKER_SUBACK_MAX];
+    size_t ack_len = 1 + 4 + 2;
+    const uint8_t* filter;
+
+    if ((pkt[0] & 0x0F) != 0x02 || pos + 2 > len) return -1;
+    ack[5] = pkt[pos];
+    ack[6] = pkt[pos + 1];
+    pos += 2;
+    if (pos == len) return -1;  /* At least one filter */
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    while (pos < len) {
+        /* Empty filters are a protocol violation (MQTT-4.7.3-1) */
+        int filter_len = broker_read_string(pkt, len, &pos, &filter);
+        if (filter_len <= 0 || (subscribe && (pos >= len || pkt[pos++] > 2)) || ack_len >= sizeof(ack)) {
+            MQTT_MUTEX_UNLOCK(broker->mutex);
+            return -1;
+        }
+
+        broker_sub_t* slot = NULL;
+        broker_sub_t* empty = NULL;
+        for (uint16_t i = 0; i < broker->config.max_subscriptions; i++) {
+            broker_sub_t* sub = &s->subs[i];
+            if (!sub->filter[0]) {
+                if (!empty) empty = sub;
+            } else if (strlen(sub->filter) == (size_t)filter_len &&
+                       memcmp(sub->filter, filter, filter_len) == 0) {
+                slot = sub;
+            }
+        }
+
+        if (!subscribe) {
+            if (slot) slot->filter[0] = '\0';
+            continue;
+        }
+
+        if (!slot && empty && broker_filter_valid((const char*)filter, filter_len)) {
+            memcpy(empty->filter, filter, filter_len);
+            empty->filter[filter_len] = '\0';
+            slot = empty;
+        }
+        ack[ack_len++] = slot ? 0x00 : 0x80;  /* Granted QoS 0, or failure */
+    }
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+
+    if (!subscribe) ack_len = 1 + 4 + 2;
+
+    uint8_t remaining[4];
+    int remaining_len = mqtt_encode_remaining_length(remaining, ack_len - 5);
+    size_t start = 4 - (size_t)remaining_len;
+    ack[start] = (subscribe ? MQTT_SUBACK : MQTT_UNSUBACK) << 4;
+    memcpy(ack + start + 1, remaining, (size_t)remaining_len);
+    return broker_send(s, s->generation, ack + start, ack_len - start, NULL, 0);
+}
+
+/* Handle one packet; returns -1 to close the connection */
+static int broker_dispatch_packet(broker_session_t* s, const uint8_t* pkt, size_t len) {
+    uint8_t type = pkt[0] >> 4;
+    size_t pos = 1;
+    while (pkt[pos++] & 0x80) {}
+
+    if (!s->connected) {
+        return type == MQTT_CONNECT ? broker_handle_connect(s, pkt, len, pos) : -1;
+    }
+
+    switch (type) {
+    case MQTT_PUBLISH:
+        return broker_handle_publish(s, pkt, len);
+    case MQTT_SUBSCRIBE:
+        return broker_handle_subscribe(s, pkt, len, pos, 1);
+    case MQTT_UNSUBSCRIBE:
+        return broker_handle_subscribe(s, pkt, len, pos, 0);
+    case MQTT_PINGREQ: {
+        const uint8_t pingresp[2] = { MQTT_PINGRESP << 4, 0 };
+        return broker_send(s, s->generation, pingresp, sizeof(pingresp), NULL, 0);
+    }
+    case MQTT_PUBACK:
+        return 0;  /* Deliveries are QoS 0, nothing to track */
+    default:
+        return -1;  /* DISCONNECT, a second CONNECT or anything unexpected */
+    }
+}
+
+/* Split buffered input into packets, as the client does; returns -1 to close */
+static int broker_process_input(broker_session_t* s) {
+    size_t pos = 0;
+
+    if (s->recv_discard > 0) {
+        pos = s->recv_discard < s->recv_len ? s->recv_discard : s->recv_len;
+        s->recv_discard -= pos;
+    }
+
+    while (pos < s->recv_len) {
+        size_t avail = s->recv_len - pos;
+        size_t pkt_len;
+        int ret = mqtt_frame_packet(s->recv_buf + pos, avail, &pkt_len);
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+
+        if (pkt_len > avail) {
+            if (pkt_len > MQTT_RECV_BUF_SIZE) {
+                /* Only a PUBLISH can be dropped without breaking the session */
+                if ((s->recv_buf[pos] >> 4) != MQTT_PUBLISH || (s->recv_buf[pos] & 0x06)) return -1;
+                s->recv_discard = pkt_len - avail;
+                pos = s->recv_len;
+            }
+            break;
+        }
+
+        if (broker_dispatch_packet(s, s->recv_buf + pos, pkt_len) != 0) return -1;
+        pos += pkt_len;
+    }
+
+    s->recv_len -= pos;
+    memmove(s->recv_buf, s->recv_buf + pos, s->recv_len);
+    return 0;
+}
+
+static void broker_session_thread(void* arg) {
+    broker_session_t* s = (broker_session_t*)arg;
+    mqtt_broker_t* broker = s->broker;
+    const mqtt_net_api_t* net = mqtt_net_get();
+    const mqtt_os_api_t* os = mqtt_os_get();
+    uint64_t last_rx = mqtt_os_time_us();
+
+    while (broker->running && !s->closing) {
+        int len = net->recv(s->socket, s->recv_buf + s->recv_len,
+                            MQTT_RECV_BUF_SIZE - s->recv_len, BROKER_POLL_MS);
+        uint64_t now = mqtt_os_time_us();
+
+        if (len < 0) break;
+        if (len == 0) {
+            /* Keep-alive: one and a half intervals without a packet */
+            uint64_t limit_us = s->connected ? (uint64_t)s->keepalive * 1500000
+                                             : (uint64_t)BROKER_CONNECT_TIMEOUT_MS * 1000;
+            if (limit_us && now - last_rx >= limit_us) break;
+            continue;
+        }
+
+        last_rx = now;
+        s->recv_len += len;
+        if (broker_process_input(s) != 0) break;
+    }
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    s->connected = 0;
+    memset(s->subs, 0, broker->config.max_subscriptions * sizeof(broker_sub_t));
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+
+    MQTT_MUTEX_LOCK(s->tx_mutex);
+    net->disconnect(s->socket);
+    s->socket = NULL;
+    MQTT_MUTEX_UNLOCK(s->tx_mutex);
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    s->state = BROKER_SESSION_EXITED;
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+
+    os->sem_post(s->exit_sem);
+    if (os->thread_exit) {
+        os->thread_exit();
+    }
+}
+
+/* Claim a slot for an accepted connection, joining a finished thread first */
+static broker_session_t* broker_session_claim(mqtt_broker_t* broker) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    broker_session_t* s = NULL;
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    for (uint16_t i = 0; i < broker->config.max_sessions && !s; i++) {
+        if (broker->sessions[i].state != BROKER_SESSION_ACTIVE) s = &broker->sessions[i];
+    }
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+    if (!s) return NULL;
+
+    if (s->state == BROKER_SESSION_EXITED) {
+        os->sem_wait(s->exit_sem);
+        os->thread_destroy(s->thread);
+    }
+
+    /* Synchronization objects are created on first use and kept */
+    if (!s->tx_mutex && !(s->tx_mutex = os->mutex_create())) return NULL;
+    if (!s->exit_sem && !(s->exit_sem = os->sem_create(0))) return NULL;
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    s->state = BROKER_SESSION_FREE;
+    s->closing = 0;
+    s->connected = 0;
+    s->keepalive = 0;
+    s->client_id[0] = '\0';
+    s->recv_len = 0;
+    s->recv_discard = 0;
+    s->generation++;
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+    return s;
+}
+
+static void broker_accept_thread(void* arg) {
+    mqtt_broker_t* broker = (mqtt_broker_t*)arg;
+    const mqtt_net_api_t* net = mqtt_net_get();
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    while (broker->running) {
+        mqtt_socket_t sock = net->accept(broker->listener, BROKER_POLL_MS);
+        if (!sock) continue;
+
+        broker_session_t* s = broker_session_claim(broker);
+        if (!s) {
+            net->disconnect(sock);
+            mqtt_atomic_fetch_add_u32(&broker->counters.rejected, 1, MQTT_ATOMIC_RELAXED);
+            continue;
+        }
+
+        MQTT_MUTEX_LOCK(s->tx_mutex);
+        s->socket = sock;
+        MQTT_MUTEX_UNLOCK(s->tx_mutex);
+        MQTT_MUTEX_LOCK(broker->mutex);
+        s->state = BROKER_SESSION_ACTIVE;
+        MQTT_MUTEX_UNLOCK(broker->mutex);
+
+        s->thread = broker_start_thread(broker, broker_session_thread, s);
+        if (!s->thread) {
+            MQTT_MUTEX_LOCK(broker->mutex);
+            s->state = BROKER_SESSION_FREE;
+            MQTT_MUTEX_UNLOCK(broker->mutex);
+            MQTT_MUTEX_LOCK(s->tx_mutex);
+            s->socket = NULL;
+            MQTT_MUTEX_UNLOCK(s->tx_mutex);
+            net->disconnect(sock);
+        }
+    }
+
+    os->sem_post(broker->accept_exit_sem);
+    if (os->thread_exit) {
+        os->thread_exit();
+    }
+}
+
+mqtt_broker_t* mqtt_broker_create(const mqtt_broker_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    const mqtt_net_api_t* net = mqtt_net_get();
+    if (!os || !net || !net->listen || !net->accept || !config) return NULL;
+
+    mqtt_broker_t* broker = (mqtt_broker_t*)os->malloc(sizeof(mqtt_broker_t));
+    if (!broker) return NULL;
+    memset(broker, 0, sizeof(mqtt_broker_t));
+    broker->config = *config;
+    if (!broker->config.max_sessions) broker->config.max_sessions = MQTT_BROKER_DEFAULT_SESSIONS;
+    if (!broker->config.max_subscriptions) broker->config.max_subscriptions = MQTT_BROKER_DEFAULT_SUBS;
+
+    uint16_t sessions = broker->config.max_sessions;
+    uint16_t subs = broker->config.max_subscriptions;
+
+    /* Sessions, their subscriptions and fan-out scratch in one block */
+    size_t session_size = sizeof(broker_session_t) + subs * sizeof(broker_sub_t) +
+                          sessions * sizeof(uint32_t);
+    uint8_t* block = (uint8_t*)os->malloc(sessions * session_size + sessions * sizeof(uint32_t));
+    if (!block) goto err_free_broker;
+    memset(block, 0, sessions * session_size);
+    broker->sessions = (broker_session_t*)block;
+    block += sessions * sizeof(broker_session_t);
+    for (uint16_t i = 0; i < sessions; i++) {
+        broker_session_t* s = &broker->sessions[i];
+        s->broker = broker;
+        s->subs = (broker_sub_t*)block;
+        block += subs * sizeof(broker_sub_t);
+        s->targets = (uint32_t*)block;
+        block += sessions * sizeof(uint32_t);
+    }
+    broker->publish_targets = (uint32_t*)block;
+
+    broker->mutex = os->mutex_create();
+    if (!broker->mutex) goto err_free_sessions;
+    broker->publish_mutex = os->mutex_create();
+    if (!broker->publish_mutex) goto err_destroy_mutex;
+    broker->accept_exit_sem = os->sem_create(0);
+    if (!broker->accept_exit_sem) goto err_destroy_publish_mutex;
+
+    broker->listener = net->listen(config->host, config->port);
+    if (!broker->listener) goto err_destroy_sem;
+
+    broker->running = 1;
+    broker->accept_thread = broker_start_thread(broker, broker_accept_thread, broker);
+    if (!broker->accept_thread) goto err_close_listener;
+    return broker;
+
+err_close_listener:
+    net->disconnect(broker->listener);
+err_destroy_sem:
+    os->sem_destroy(broker->accept_exit_sem);
+err_destroy_publish_mutex:
+    os->mutex_destroy(broker->publish_mutex);
+err_destroy_mutex:
+    os->mutex_destroy(broker->mutex);
+err_free_sessions:
+    os->free(broker->sessions);
+err_free_broker:
+    os->free(broker);
+    return NULL;
+}
+
+void mqtt_broker_destroy(mqtt_broker_t* broker) {
+    if (!broker) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+    const mqtt_net_api_t* net = mqtt_net_get();
+
+    /* Threads notice within one poll slice */
+    broker->running = 0;
+    os->sem_wait(broker->accept_exit_sem);
+    os->thread_destroy(broker->accept_thread);
+
+    for (uint16_t i = 0; i < broker->config.max_sessions; i++) {
+        broker_session_t* s = &broker->sessions[i];
+        if (s->state != BROKER_SESSION_FREE) {
+            os->sem_wait(s->exit_sem);
+            os->thread_destroy(s->thread);
+        }
+        if (s->tx_mutex) os->mutex_destroy(s->tx_mutex);
+        if (s->exit_sem) os->sem_destroy(s->exit_sem);
+    }
+
+    net->disconnect(broker->listener);
+    os->sem_destroy(broker->accept_exit_sem);
+    os->mutex_destroy(broker->publish_mutex);
+    os->mutex_destroy(broker->mutex);
+    os->free(broker->sessions);
+    os->free(broker);
+}
+
+int mqtt_broker_publish(mqtt_broker_t* broker, const char* topic, const uint8_t* payload, size_t len) {
+    if (!broker || !topic || (!payload && len > 0)) return -1;
+
+    size_t topic_len = strlen(topic);
+    if (topic_len == 0 || topic_len > BROKER_TOPIC_MAX || strpbrk(topic, "+#")) return -1;
+
+    MQTT_MUTEX_LOCK(broker->publish_mutex);
+    broker_fanout(broker, topic, payload, len, broker->publish_targets);
+    MQTT_MUTEX_UNLOCK(broker->publish_mutex);
+    return 0;
+}
+
+/* Append an in-process subscription, published to lock-free readers once filled */
+static int broker_local_add(mqtt_broker_t* broker, const char* filter, mqtt_msg_callback_t cb,
+                            void* user_data, mqtt_client_t* client, uint8_t qos) {
+    if (!filter || !broker_filter_valid(filter, strlen(filter))) return -1;
+
+    MQTT_MUTEX_LOCK(broker->mutex);
+    uint32_t count = mqtt_atomic_load_u32(&broker->local_published, MQTT_ATOMIC_RELAXED);
+    if (count >= MQTT_BROKER_MAX_LOCAL_SUBS) {
+        MQTT_MUTEX_UNLOCK(broker->mutex);
+        return -1;
+    }
+
+    broker_local_sub_t* sub = &broker->local_subs[count];
+    strcpy(sub->filter, filter);
+    sub->cb = cb;
+    sub->user_data = user_data;
+    sub->client = client;
+    sub->qos = qos;
+    mqtt_atomic_store_u32(&broker->local_published, count + 1, MQTT_ATOMIC_RELEASE);
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+    return 0;
+}
+
+int mqtt_broker_subscribe(mqtt_broker_t* broker, const char* filter, mqtt_msg_callback_t cb, void* user_data) {
+    if (!broker || !cb) return -1;
+    return broker_local_add(broker, filter, cb, user_data, NULL, 0);
+}
+
+int mqtt_broker_forward(mqtt_broker_t* broker, const char* filter, mqtt_client_t* client, uint8_t qos) {
+    if (!broker || !client || qos > 1) return -1;
+    return broker_local_add(broker, filter, NULL, NULL, client, qos);
+}
+
+int mqtt_broker_get_stats(mqtt_broker_t* broker, mqtt_broker_stats_t* stats) {
+    if (!broker || !stats) return -1;
+
+    memset(stats, 0, sizeof(mqtt_broker_stats_t));
+    MQTT_MUTEX_LOCK(broker->mutex);
+    for (uint16_t i = 0; i < broker->config.max_sessions; i++) {
+        if (broker->sessions[i].state == BROKER_SESSION_ACTIVE && broker->sessions[i].connected) {
+            stats->sessions++;
+        }
+    }
+    MQTT_MUTEX_UNLOCK(broker->mutex);
+
+    broker_counters_t* c = &broker->counters;
+    stats->connects = mqtt_atomic_load_u32(&c->connects, MQTT_ATOMIC_RELAXED);
+    stats->rejected = mqtt_atomic_load_u32(&c->rejected, MQTT_ATOMIC_RELAXED);
+    stats->messages = mqtt_atomic_load_u32(&c->messages, MQTT_ATOMIC_RELAXED);
+    stats->deliveries = mqtt_atomic_load_u32(&c->deliveries, MQTT_ATOMIC_RELAXED);
+    stats->local = mqtt_atomic_load_u32(&c->local, MQTT_ATOMIC_RELAXED);
+    stats->send_failures = mqtt_atomic_load_u32(&c->send_failures, MQTT_ATOMIC_RELAXED);
+    return 0;
+}
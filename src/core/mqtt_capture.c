@@ -0,0 +1,241 @@
+/**
+ * @file mqtt_capture.c
+ * @brief Wire capture hook implementation
+ */
+
+#include "mqtt_capture.h"
+#include "mqtt_os.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MQTT_NET_DIRECT
+#error "Wire capture interposes on the network API and needs runtime port registration"
+#endif
+
+/** @brief Maximum number of simultaneously captured connections */
+#define MQTT_CAPTURE_MAX_CONN 8
+
+typedef struct {
+    mqtt_socket_t sock;
+    uint16_t id;
+} capture_conn_t;
+
+/*
+ * Client threads may still be inside the hook after mqtt_capture_stop(),
+ * so the wrapped API and the mutex stay valid for good; stop only clears
+ * the sink, under the mutex, and later records are dropped.
+ */
+static mqtt_atomic_ptr_t g_inner = NULL;
+static mqtt_net_api_t g_capture_api;
+static mqtt_capture_sink_t g_sink = NULL;
+static void* g_sink_ctx = NULL;
+static mqtt_mutex_t g_capture_mutex = NULL;
+static capture_conn_t g_conns[MQTT_CAPTURE_MAX_CONN];
+static uint16_t g_next_conn = 1;
+static FILE* g_file = NULL;
+
+static void put_le(uint8_t* buf, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t* buf, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | buf[i];
+    }
+    return value;
+}
+
+void mqtt_capture_encode(uint8_t* hdr, const mqtt_capture_record_t* rec) {
+    put_le(hdr, rec->timestamp_us, 8);
+    put_le(hdr + 8, rec->connection, 2);
+    hdr[10] = rec->type;
+    hdr[11] = 0;
+    put_le(hdr + 12, rec->len, 4);
+}
+
+void mqtt_capture_decode(const uint8_t* hdr, mqtt_capture_record_t* rec) {
+    rec->timestamp_us = get_le(hdr, 8);
+    rec->connection = (uint16_t)get_le(hdr + 8, 2);
+    rec->type = hdr[10];
+    rec->len = (uint32_t)get_le(hdr + 12, 4);
+}
+
+/* Caller holds g_capture_mutex */
+static uint16_t capture_conn_id(mqtt_socket_t sock) {
+    for (int i = 0; i < MQTT_CAPTURE_MAX_CONN; i++) {
+        if (g_conns[i].sock == sock) return g_conns[i].id;
+    }
+    return 0;
+}
+
+static void capture_record(mqtt_socket_t sock, uint8_t type, const uint8_t* data, size_t len) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    uint8_t hdr[MQTT_CAPTURE_REC_HDR_LEN];
+    mqtt_capture_record_t rec;
+
+    rec.timestamp_us = mqtt_os_time_us();
+    rec.type = type;
+    rec.len = (uint32_t)len;
+
+    os->mutex_lock(g_capture_mutex);
+    if (!g_sink) {
+        os->mutex_unlock(g_capture_mutex);
+        return;
+    }
+    if (type == MQTT_CAPTURE_CONNECT) {
+        for (int i = 0; i < MQTT_CAPTURE_MAX_CONN; i++) {
+            if (!g_conns[i].sock) {
+                g_conns[i].sock = sock;
+                g_conns[i].id = g_next_conn++;
+                break;
+            }
+        }
+    }
+    rec.connection = capture_conn_id(sock);
+    if (type == MQTT_CAPTURE_DISCONNECT) {
+        for (int i = 0; i < MQTT_CAPTURE_MAX_CONN; i++) {
+            if (g_conns[i].sock == sock) g_conns[i].sock = NULL;
+        }
+    }
+    mqtt_capture_encode(hdr, &rec);
+    g_sink(hdr, data, len, g_sink_ctx);
+    os->mutex_unlock(g_capture_mutex);
+}
+
+static const mqtt_net_api_t* capture_inner(void) {
+    return (const mqtt_net_api_t*)mqtt_atomic_load_ptr(&g_inner, MQTT_ATOMIC_ACQUIRE);
+}
+
+static mqtt_socket_t capture_connect(const char* host, uint16_t port, uint32_t timeout_ms) {
+    mqtt_socket_t sock = capture_inner()->connect(host, port, timeout_ms);
+    if (sock) {
+        char peer[128];
+        int len = snprintf(peer, sizeof(peer), "%s:%u", host, port);
+        if (len < 0) len = 0;
+        if (len >= (int)sizeof(peer)) len = sizeof(peer) - 1;
+        capture_record(sock, MQTT_CAPTURE_CONNECT, (const uint8_t*)peer, len);
+    }
+    return sock;
+}
+
+static void capture_disconnect(mqtt_socket_t sock) {
+    capture_record(sock, MQTT_CAPTURE_DISCONNECT, NULL, 0);
+    capture_inner()->disconnect(sock);
+}
+
+static int capture_send(mqtt_socket_t sock, const uint8_t* buf, size_t len) {
+    int ret = capture_inner()->send(sock, buf, len);
+    if (ret > 0) capture_record(sock, MQTT_CAPTURE_SEND, buf, ret);
+    return ret;
+}
+
+/* Recorded as one send record per buffer, the replay reads a byte stream */
+static int capture_sendv(mqtt_socket_t sock, const mqtt_iovec_t* iov, int count) {
+    int ret = capture_inner()->sendv(sock, iov, count);
+    size_t left = ret > 0 ? (size_t)ret : 0;
+    for (int i = 0; i < count && left > 0; i++) {
+        size_t len = iov[i].len < left ? iov[i].len : left;
+        if (len > 0) capture_record(sock, MQTT_CAPTURE_SEND, iov[i].buf, len);
+        left -= len;
+    }
+    return ret;
+}
+
+static int capture_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t timeout_ms) {
+    int ret = capture_inner()->recv(sock, buf, len, timeout_ms);
+    if (ret > 0) capture_record(sock, MQTT_CAPTURE_RECV, buf, ret);
+    return ret;
+}
+
+/* The listening socket carries no traffic and is not recorded */
+static mqtt_socket_t capture_listen(const char* host, uint16_t port) {
+    return capture_inner()->listen(host, port);
+}
+
+static mqtt_socket_t capture_accept(mqtt_socket_t listener, uint32_t timeout_ms) {
+    mqtt_socket_t sock = capture_inner()->accept(listener, timeout_ms);
+    if (sock) capture_record(sock, MQTT_CAPTURE_CONNECT, (const uint8_t*)"accept", 6);
+    return sock;
+}
+
+int mqtt_capture_start(mqtt_capture_sink_t sink, void* ctx) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    const mqtt_net_api_t* net = mqtt_net_get();
+    if (!os || !net || !sink || net == &g_capture_api) return -1;
+
+    /* Created once and never destroyed, see g_inner */
+    if (!g_capture_mutex) {
+        g_capture_mutex = os->mutex_create();
+        if (!g_capture_mutex) return -1;
+    }
+
+    /*
+     * Optional functions are wrapped only where the inner API has them.
+     * Threads of an earlier capture may still read the table, so it is
+     * rebuilt only for a different inner API.
+     */
+    if (net != capture_inner()) {
+        memset(&g_capture_api, 0, sizeof(g_capture_api));
+        g_capture_api.connect = capture_connect;
+        g_capture_api.disconnect = capture_disconnect;
+        g_capture_api.send = capture_send;
+        g_capture_api.recv = capture_recv;
+        if (net->sendv) g_capture_api.sendv = capture_sendv;
+        if (net->listen) g_capture_api.listen = capture_listen;
+        if (net->accept) g_capture_api.accept = capture_accept;
+    }
+
+    os->mutex_lock(g_capture_mutex);
+    memset(g_conns, 0, sizeof(g_conns));
+    g_sink = sink;
+    g_sink_ctx = ctx;
+    os->mutex_unlock(g_capture_mutex);
+
+    mqtt_atomic_store_ptr(&g_inner, (void*)net, MQTT_ATOMIC_RELEASE);
+    mqtt_net_init(&g_capture_api);
+    return 0;
+}
+
+static void capture_file_sink(const uint8_t* hdr, const uint8_t* data, size_t len, void* ctx) {
+    FILE* file = (FILE*)ctx;
+    fwrite(hdr, 1, MQTT_CAPTURE_REC_HDR_LEN, file);
+    if (len > 0) fwrite(data, 1, len, file);
+}
+
+int mqtt_capture_start_file(const char* path) {
+    uint8_t hdr[MQTT_CAPTURE_FILE_HDR_LEN] = { 0 };
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return -1;
+
+    memcpy(hdr, MQTT_CAPTURE_MAGIC, 5);
+    hdr[5] = MQTT_CAPTURE_VERSION;
+    if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr) ||
+        mqtt_capture_start(capture_file_sink, file) != 0) {
+        fclose(file);
+        return -1;
+    }
+    g_file = file;
+    return 0;
+}
+
+void mqtt_capture_stop(void) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (mqtt_net_get() != &g_capture_api) return;
+
+    mqtt_net_init(capture_inner());
+
+    /* A record in progress holds the mutex, none starts once the sink is gone */
+    os->mutex_lock(g_capture_mutex);
+    g_sink = NULL;
+    g_sink_ctx = NULL;
+    os->mutex_unlock(g_capture_mutex);
+
+    if (g_file) {
+        fclose(g_file);
+        g_file = NULL;
+    }
+}
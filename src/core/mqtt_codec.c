@@ -0,0 +1,95 @@
+/**
+ * @file mqtt_codec.c
+ * @brief MQTT 3.1.1 packet encoding implementation
+ */
+
+#include "mqtt_codec.h"
+#include <string.h>
+
+int mqtt_encode_remaining_length(uint8_t* buf, size_t len) {
+    int count = 0;
+    do {
+        uint8_t byte = len % 128;
+        len /= 128;
+        if (len > 0) byte |= 0x80;
+        buf[count++] = byte;
+    } while (len > 0);
+    return count;
+}
+
+int mqtt_frame_packet(const uint8_t* buf, size_t avail, size_t* pkt_len) {
+    size_t remaining = 0;
+    size_t multiplier = 1;
+    size_t i;
+    for (i = 1; i < avail && i <= 4; i++) {
+        remaining += (buf[i] & 127) * multiplier;
+        multiplier *= 128;
+        if ((buf[i] & 128) == 0) {
+            *pkt_len = 1 + i + remaining;
+            return 1;
+        }
+    }
+    return i > 4 ? -1 : 0;
+}
+
+int mqtt_pack_publish_header(uint8_t* buf, size_t size, const char* topic, size_t payload_len,
+                             uint8_t qos, uint16_t packet_id) {
+    int pos = 0;
+    size_t topic_len = strlen(topic);
+    if (1 + 4 + 2 + topic_len + 2 > size || topic_len > 0xFFFF) return -1;
+
+    size_t remaining = 2 + topic_len + payload_len;
+    if (qos > 0) remaining += 2;
+    if (remaining > MQTT_MAX_REMAINING_LENGTH) return -1;
+
+    buf[pos++] = (MQTT_PUBLISH << 4) | (qos << 1);
+    pos += mqtt_encode_remaining_length(buf + pos, remaining);
+
+    buf[pos++] = topic_len >> 8;
+    buf[pos++] = topic_len & 0xFF;
+    memcpy(buf + pos, topic, topic_len);
+    pos += topic_len;
+
+    if (qos > 0) {
+        buf[pos++] = packet_id >> 8;
+        buf[pos++] = packet_id & 0xFF;
+    }
+
+    return pos;
+}
+
+int mqtt_pack_ack(uint8_t* buf, uint8_t type, uint16_t packet_id) {
+    buf[0] = type << 4;
+    buf[1] = 2;
+    buf[2] = packet_id >> 8;
+    buf[3] = packet_id & 0xFF;
+    return 4;
+}
+
+int mqtt_parse_publish(const uint8_t* pkt, size_t len, mqtt_publish_view_t* view) {
+    size_t pkt_len;
+    if (mqtt_frame_packet(pkt, len, &pkt_len) != 1 || pkt_len != len) return -1;
+
+    size_t offset = 1;
+    while (pkt[offset++] & 0x80) {}
+
+    if (offset + 2 > len) return -1;
+    view->topic_len = (pkt[offset] << 8) | pkt[offset + 1];
+    offset += 2;
+    if (offset + view->topic_len > len) return -1;
+    view->topic = pkt + offset;
+    offset += view->topic_len;
+
+    view->qos = (pkt[0] >> 1) & 0x03;
+    view->retain = pkt[0] & 0x01;
+    view->packet_id = 0;
+    if (view->qos > 0) {
+        if (offset + 2 > len) return -1;
+        view->packet_id = (pkt[offset] << 8) | pkt[offset + 1];
+        offset += 2;
+    }
+
+    view->payload = pkt + offset;
+    view->payload_len = len - offset;
+    return 0;
+}
@@ -0,0 +1,237 @@
+/**
+ * @file mqtt_deadband.c
+ * @brief Deadband and rate-limit filter implementation
+ */
+
+#include "mqtt_deadband.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Longest topic, bounded like subscription topics */
+#define DEADBAND_TOPIC_MAX      (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief Longest payload parsed as a number */
+#define DEADBAND_NUMBER_MAX     31
+
+typedef struct {
+    char topic[DEADBAND_TOPIC_MAX + 1];  /* Empty when unused */
+    uint32_t hash;
+    mqtt_deadband_rule_t rule;
+    uint8_t sent;                /* A reading was sent, the fields below are valid */
+    uint8_t numeric;             /* It was a number */
+    double value;                /* Its value when numeric */
+    uint32_t payload_hash;       /* Its bytes otherwise */
+    uint64_t sent_time;
+} deadband_entry_t;
+
+struct mqtt_deadband {
+    mqtt_client_t* client;
+    mqtt_mutex_t mutex;
+    mqtt_deadband_config_t config;
+    deadband_entry_t* table;
+    uint32_t mask;               /* Table size - 1, a power of two at least twice max_topics */
+    uint16_t count;
+    mqtt_deadband_stats_t stats;
+};
+
+/* FNV-1a */
+static uint32_t deadband_hash(const uint8_t* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Parse an ASCII decimal payload; returns 0 if it is not a plain number */
+static int deadband_parse(const uint8_t* payload, size_t len, double* value) {
+    char buf[DEADBAND_NUMBER_MAX + 1];
+    char* end;
+
+    /* strtod also takes whitespace, "inf" and "nan", which are not readings */
+    if (len == 0 || len > DEADBAND_NUMBER_MAX) return 0;
+    if (!(payload[0] == '-' || payload[0] == '+' || payload[0] == '.' ||
+          (payload[0] >= '0' && payload[0] <= '9'))) {
+        return 0;
+    }
+
+    memcpy(buf, payload, len);
+    buf[len] = '\0';
+    *value = strtod(buf, &end);
+    return end == buf + len;
+}
+
+/* Find a topic's entry, or the empty one it would take; caller holds db->mutex */
+static deadband_entry_t* deadband_find(mqtt_deadband_t* db, const char* topic, size_t topic_len) {
+    uint32_t hash = deadband_hash((const uint8_t*)topic, topic_len);
+
+    for (uint32_t i = hash & db->mask;; i = (i + 1) & db->mask) {
+        deadband_entry_t* entry = &db->table[i];
+        if (!entry->topic[0]) {
+            entry->hash = hash;
+            return entry;
+        }
+        if (entry->hash == hash && strcmp(entry->topic, topic) == 0) return entry;
+    }
+}
+
+/* Find or add a topic; caller holds db->mutex */
+static deadband_entry_t* deadband_track(mqtt_deadband_t* db, const char* topic) {
+    size_t topic_len = strlen(topic);
+    if (topic_len == 0 || topic_len > DEADBAND_TOPIC_MAX) return NULL;
+
+    deadband_entry_t* entry = deadband_find(db, topic, topic_len);
+    if (!entry->topic[0]) {
+        if (db->count >= db->config.max_topics) return NULL;
+        memcpy(entry->topic, topic, topic_len + 1);
+        entry->rule = db->config.rule;
+        db->count++;
+    }
+    return entry;
+}
+
+/* Decide on a reading and publish it; caller holds db->mutex */
+static int deadband_apply(mqtt_deadband_t* db, deadband_entry_t* entry, const uint8_t* payload, size_t len) {
+    const mqtt_deadband_rule_t* rule = &entry->rule;
+    uint64_t now = mqtt_os_time_us();
+    double value = 0;
+    int numeric = deadband_parse(payload, len, &value);
+    uint32_t payload_hash = numeric ? 0 : deadband_hash(payload, len);
+    int heartbeat = 0;
+
+    if (entry->sent) {
+        uint64_t elapsed = now - entry->sent_time;
+
+        if (rule->max_silence_ms && elapsed >= (uint64_t)rule->max_silence_ms * 1000) {
+            heartbeat = 1;
+        } else if (elapsed < (uint64_t)rule->min_interval_ms * 1000) {
+            db->stats.rate_limited++;
+            return 0;
+        } else {
+            int changed;
+            if (numeric != entry->numeric) {
+                changed = 1;
+            } else if (!numeric) {
+                changed = payload_hash != entry->payload_hash;
+            } else {
+                double delta = value > entry->value ? value - entry->value : entry->value - value;
+                double last = entry->value < 0 ? -entry->value : entry->value;
+                if (rule->abs_delta > 0 || rule->rel_delta > 0) {
+                    changed = (rule->abs_delta > 0 && delta > rule->abs_delta) ||
+                              (rule->rel_delta > 0 && delta > rule->rel_delta * last);
+                } else {
+                    changed = delta != 0;
+                }
+            }
+            if (!changed) {
+                db->stats.suppressed++;
+                return 0;
+            }
+        }
+    }
+
+    /* Left unchanged on failure so the next reading is judged against what was really sent */
+    if (mqtt_client_publish(db->client, entry->topic, payload, len, db->config.qos) != 0) return -1;
+
+    entry->sent = 1;
+    entry->numeric = (uint8_t)numeric;
+    entry->value = value;
+    entry->payload_hash = payload_hash;
+    entry->sent_time = now;
+    db->stats.forwarded++;
+    if (heartbeat) db->stats.heartbeats++;
+    return 1;
+}
+
+mqtt_deadband_t* mqtt_deadband_create(mqtt_client_t* client, const mqtt_deadband_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!client) return NULL;
+
+    mqtt_deadband_t* db = (mqtt_deadband_t*)os->malloc(sizeof(mqtt_deadband_t));
+    if (!db) return NULL;
+    memset(db, 0, sizeof(mqtt_deadband_t));
+    db->client = client;
+    if (config) db->config = *config;
+    if (!db->config.max_topics) db->config.max_topics = MQTT_DEADBAND_DEFAULT_TOPICS;
+
+    /* At most half full keeps probe sequences short */
+    uint32_t size = 1;
+    while (size < 2u * db->config.max_topics) size <<= 1;
+    db->mask = size - 1;
+
+    db->table = (deadband_entry_t*)os->malloc(size * sizeof(deadband_entry_t));
+    if (!db->table) goto err_free_db;
+    memset(db->table, 0, size * sizeof(deadband_entry_t));
+
+    db->mutex = os->mutex_create();
+    if (!db->mutex) goto err_free_table;
+    return db;
+
+err_free_table:
+    os->free(db->table);
+err_free_db:
+    os->free(db);
+    return NULL;
+}
+
+void mqtt_deadband_destroy(mqtt_deadband_t* db) {
+    if (!db) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    os->mutex_destroy(db->mutex);
+    os->free(db->table);
+    os->free(db);
+}
+
+int mqtt_deadband_register(mqtt_deadband_t* db, const char* topic, const mqtt_deadband_rule_t* rule) {
+    if (!db || !topic) return -1;
+
+    MQTT_MUTEX_LOCK(db->mutex);
+    deadband_entry_t* entry = deadband_track(db, topic);
+    if (entry && rule) entry->rule = *rule;
+    MQTT_MUTEX_UNLOCK(db->mutex);
+
+    return entry ? (int)(entry - db->table) : -1;
+}
+
+int mqtt_deadband_publish_handle(mqtt_deadband_t* db, int handle, const uint8_t* payload, size_t len) {
+    if (!db || handle < 0 || (uint32_t)handle > db->mask || (!payload && len > 0)) return -1;
+
+    deadband_entry_t* entry = &db->table[handle];
+
+    MQTT_MUTEX_LOCK(db->mutex);
+    int ret = entry->topic[0] ? deadband_apply(db, entry, payload, len) : -1;
+    MQTT_MUTEX_UNLOCK(db->mutex);
+    return ret;
+}
+
+int mqtt_deadband_publish(mqtt_deadband_t* db, const char* topic, const uint8_t* payload, size_t len) {
+    if (!db || !topic || (!payload && len > 0)) return -1;
+
+    MQTT_MUTEX_LOCK(db->mutex);
+    deadband_entry_t* entry = deadband_track(db, topic);
+    int ret;
+    if (entry) {
+        ret = deadband_apply(db, entry, payload, len);
+    } else {
+        /* Full table or overlong topic: nothing to compare against, send it */
+        ret = mqtt_client_publish(db->client, topic, payload, len, db->config.qos) == 0 ? 1 : -1;
+        if (ret == 1) {
+            db->stats.forwarded++;
+            db->stats.untracked++;
+        }
+    }
+    MQTT_MUTEX_UNLOCK(db->mutex);
+    return ret;
+}
+
+int mqtt_deadband_get_stats(mqtt_deadband_t* db, mqtt_deadband_stats_t* stats) {
+    if (!db || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(db->mutex);
+    memcpy(stats, &db->stats, sizeof(mqtt_deadband_stats_t));
+    MQTT_MUTEX_UNLOCK(db->mutex);
+    return 0;
+}
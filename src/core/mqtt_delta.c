@@ -0,0 +1,403 @@
+/**
+ * @file mqtt_delta.c
+ * @brief Per-topic delta encoding implementation
+ */
+
+#include "mqtt_delta.h"
+#include "mqtt_codec.h"
+#include <string.h>
+
+/** @brief Longest topic, bounded like subscription topics */
+#define DELTA_TOPIC_MAX     (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief Version and kind byte, sequence number byte */
+#define DELTA_HEADER        2
+
+/** @brief Unchanged bytes inside a changed run that are cheaper to resend than to skip */
+#define DELTA_GAP_MAX       2
+
+typedef struct {
+    char topic[DELTA_TOPIC_MAX + 1];  /* Empty when unused */
+    uint32_t hash;
+    uint8_t valid;           /* buf holds the payload of sequence number seq */
+    uint8_t seq;
+    uint16_t since_key;      /* Encoder: deltas sent since the last keyframe */
+    uint16_t len;
+    uint8_t* buf;            /* max_payload bytes, claimed when the topic is first tracked */
+} delta_entry_t;
+
+/* Topic table shared by both sides */
+typedef struct {
+    delta_entry_t* entries;
+    uint32_t mask;           /* Table size - 1, a power of two at least twice max_topics */
+    uint16_t count;
+    uint8_t* payloads;       /* max_topics buffers of max_payload bytes */
+} delta_table_t;
+
+struct mqtt_delta {
+    mqtt_client_t* client;
+    mqtt_mutex_t mutex;
+    mqtt_delta_config_t config;
+    delta_table_t table;
+    uint8_t* frame;          /* DELTA_HEADER + max_payload bytes */
+    mqtt_delta_stats_t stats;
+};
+
+struct mqtt_delta_decoder {
+    mqtt_mutex_t mutex;
+    mqtt_delta_config_t config;
+    delta_table_t table;
+    uint8_t* scratch;        /* max_payload bytes to rebuild into */
+    mqtt_delta_stats_t stats;
+};
+
+static void delta_defaults(mqtt_delta_config_t* config) {
+    if (!config->max_topics) config->max_topics = MQTT_DELTA_DEFAULT_TOPICS;
+    if (!config->max_payload) config->max_payload = MQTT_DELTA_DEFAULT_PAYLOAD;
+    if (config->max_payload > MQTT_MAX_PACKET_SIZE) config->max_payload = MQTT_MAX_PACKET_SIZE;
+    if (!config->keyframe_interval) config->keyframe_interval = MQTT_DELTA_DEFAULT_INTERVAL;
+}
+
+static int delta_table_init(delta_table_t* table, const mqtt_delta_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    /* At most half full keeps probe sequences short */
+    uint32_t size = 1;
+    while (size < 2u * config->max_topics) size <<= 1;
+    table->mask = size - 1;
+    table->count = 0;
+
+    table->entries = (delta_entry_t*)os->malloc(size * sizeof(delta_entry_t));
+    if (!table->entries) return -1;
+    memset(table->entries, 0, size * sizeof(delta_entry_t));
+
+    table->payloads = (uint8_t*)os->malloc((size_t)config->max_topics * config->max_payload);
+    if (!table->payloads) {
+        os->free(table->entries);
+        return -1;
+    }
+    return 0;
+}
+
+static void delta_table_free(delta_table_t* table) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    os->free(table->payloads);
+    os->free(table->entries);
+}
+
+/* FNV-1a */
+static uint32_t delta_hash(const char* topic, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Find or add a topic, NULL when the table is full or the topic too long; caller holds the lock */
+static delta_entry_t* delta_track(delta_table_t* table, const mqtt_delta_config_t* config, const char* topic) {
+    size_t topic_len = strlen(topic);
+    if (topic_len == 0 || topic_len > DELTA_TOPIC_MAX) return NULL;
+
+    uint32_t hash = delta_hash(topic, topic_len);
+    for (uint32_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+        delta_entry_t* entry = &table->entries[i];
+        if (entry->topic[0]) {
+            if (entry->hash == hash && strcmp(entry->topic, topic) == 0) return entry;
+            continue;
+        }
+
+        if (table->count >= config->max_topics) return NULL;
+        memcpy(entry->topic, topic, topic_len + 1);
+        entry->hash = hash;
+        entry->buf = table->payloads + (size_t)table->count * config->max_payload;
+        table->count++;
+        return entry;
+    }
+}
+
+/* XOR of the new payload with the previous one, zero-extended */
+static inline uint8_t delta_xor(const uint8_t* old, size_t old_len, const uint8_t* new_data, size_t i) {
+    return new_data[i] ^ (i < old_len ? old[i] : 0);
+}
+
+/* Encode new_data against old; returns the delta length, -1 if it would not be shorter than limit */
+static int delta_encode(const uint8_t* old, size_t old_len, const uint8_t* new_data, size_t new_len,
+                        uint8_t* out, size_t limit) {
+    size_t pos = 0;
+    size_t i = 0;
+
+    if (limit < 4) return -1;
+    pos += mqtt_encode_remaining_length(out, new_len);
+
+    while (i < new_len) {
+        size_t start = i;
+        while (i < new_len && delta_xor(old, old_len, new_data, i) == 0) i++;
+        if (i == new_len) break;
+
+        /* Short unchanged gaps ride along in the changed run */
+        size_t skip = i - start;
+        size_t run = i;
+        while (i < new_len) {
+            if (delta_xor(old, old_len, new_data, i) != 0) {
+                i++;
+                continue;
+            }
+            size_t gap = i;
+            while (gap < new_len && gap - i <= DELTA_GAP_MAX && delta_xor(old, old_len, new_data, gap) == 0) gap++;
+            if (gap == new_len || gap - i > DELTA_GAP_MAX) break;
+            i = gap;
+        }
+        size_t changed = i - run;
+
+        if (pos + 8 + changed >= limit) return -1;
+        pos += mqtt_encode_remaining_length(out + pos, skip);
+        pos += mqtt_encode_remaining_length(out + pos, changed);
+        for (size_t j = run; j < i; j++) out[pos++] = delta_xor(old, old_len, new_data, j);
+    }
+
+    return pos < limit ? (int)pos : -1;
+}
+
+/* Read a length; returns bytes consumed, -1 if truncated or malformed */
+static int delta_read_length(const uint8_t* p, size_t avail, size_t* value) {
+    size_t multiplier = 1;
+    *value = 0;
+    for (size_t i = 0; i < avail && i < 4; i++) {
+        *value += (p[i] & 0x7F) * multiplier;
+        multiplier *= 128;
+        if (!(p[i] & 0x80)) return (int)i + 1;
+    }
+    return -1;
+}
+
+/* Rebuild into out (max bytes) from old and a delta; returns the length, -1 if malformed */
+static int delta_decode(const uint8_t* old, size_t old_len, const uint8_t* delta, size_t len,
+                        uint8_t* out, size_t max) {
+    size_t new_len;
+    int n = delta_read_length(delta, len, &new_len);
+    if (n < 0 || new_len > max) return -1;
+
+    size_t pos = (size_t)n;
+    size_t copy = old_len < new_len ? old_len : new_len;
+    memcpy(out, old, copy);
+    memset(out + copy, 0, new_len - copy);
+
+    size_t i = 0;
+    while (pos < len) {
+        size_t skip, changed;
+        if ((n = delta_read_length(delta + pos, len - pos, &skip)) < 0) return -1;
+        pos += n;
+        if ((n = delta_read_length(delta + pos, len - pos, &changed)) < 0) return -1;
+        pos += n;
+        if (skip > new_len - i || changed > new_len - i - skip || changed > len - pos) return -1;
+
+        i += skip;
+        for (size_t j = 0; j < changed; j++) out[i++] ^= delta[pos++];
+    }
+    return (int)new_len;
+}
+
+mqtt_delta_t* mqtt_delta_create(mqtt_client_t* client, const mqtt_delta_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!client) return NULL;
+
+    mqtt_delta_t* delta = (mqtt_delta_t*)os->malloc(sizeof(mqtt_delta_t));
+    if (!delta) return NULL;
+    memset(delta, 0, sizeof(mqtt_delta_t));
+    delta->client = client;
+    if (config) delta->config = *config;
+    delta_defaults(&delta->config);
+
+    if (delta_table_init(&delta->table, &delta->config) != 0) goto err_free_delta;
+
+    delta->frame = (uint8_t*)os->malloc(DELTA_HEADER + delta->config.max_payload);
+    if (!delta->frame) goto err_free_table;
+
+    delta->mutex = os->mutex_create();
+    if (!delta->mutex) goto err_free_frame;
+    return delta;
+
+err_free_frame:
+    os->free(delta->frame);
+err_free_table:
+    delta_table_free(&delta->table);
+err_free_delta:
+    os->free(delta);
+    return NULL;
+}
+
+void mqtt_delta_destroy(mqtt_delta_t* delta) {
+    if (!delta) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    os->mutex_destroy(delta->mutex);
+    os->free(delta->frame);
+    delta_table_free(&delta->table);
+    os->free(delta);
+}
+
+int mqtt_delta_publish(mqtt_delta_t* delta, const char* topic, const uint8_t* payload, size_t len) {
+    if (!delta || !topic || (!payload && len > 0) || len > delta->config.max_payload) return -1;
+
+    MQTT_MUTEX_LOCK(delta->mutex);
+
+    delta_entry_t* entry = delta_track(&delta->table, &delta->config, topic);
+    uint8_t seq = entry ? (uint8_t)(entry->seq + 1) : 0;
+    uint8_t kind = MQTT_DELTA_KEYFRAME;
+    size_t frame_len = 0;
+
+    if (entry && entry->valid && entry->since_key + 1u < delta->config.keyframe_interval) {
+        int n = delta_encode(entry->buf, entry->len, payload, len, delta->frame + DELTA_HEADER, len);
+        if (n >= 0) {
+            kind = MQTT_DELTA_DELTA;
+            frame_len = DELTA_HEADER + (size_t)n;
+        }
+    }
+    if (kind == MQTT_DELTA_KEYFRAME) {
+        if (len > 0) memcpy(delta->frame + DELTA_HEADER, payload, len);
+        frame_len = DELTA_HEADER + len;
+    }
+    delta->frame[0] = (MQTT_DELTA_VERSION << 4) | kind;
+    delta->frame[1] = seq;
+
+    int ret = mqtt_client_publish(delta->client, topic, delta->frame, frame_len, delta->config.qos);
+
+    if (ret == 0) {
+        if (entry) {
+            if (len > 0) memcpy(entry->buf, payload, len);
+            entry->len = (uint16_t)len;
+            entry->seq = seq;
+            entry->valid = 1;
+            entry->since_key = kind == MQTT_DELTA_KEYFRAME ? 0 : entry->since_key + 1;
+        }
+        if (kind == MQTT_DELTA_KEYFRAME) {
+            delta->stats.keyframes++;
+        } else {
+            delta->stats.deltas++;
+        }
+        delta->stats.raw_bytes += len;
+        delta->stats.wire_bytes += frame_len;
+    } else if (entry) {
+        /* Whether the frame got out is unknown, start over from a keyframe */
+        entry->valid = 0;
+    }
+
+    MQTT_MUTEX_UNLOCK(delta->mutex);
+    return ret;
+}
+
+int mqtt_delta_get_stats(mqtt_delta_t* delta, mqtt_delta_stats_t* stats) {
+    if (!delta || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(delta->mutex);
+    memcpy(stats, &delta->stats, sizeof(mqtt_delta_stats_t));
+    MQTT_MUTEX_UNLOCK(delta->mutex);
+    return 0;
+}
+
+mqtt_delta_decoder_t* mqtt_delta_decoder_create(const mqtt_delta_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    mqtt_delta_decoder_t* decoder = (mqtt_delta_decoder_t*)os->malloc(sizeof(mqtt_delta_decoder_t));
+    if (!decoder) return NULL;
+    memset(decoder, 0, sizeof(mqtt_delta_decoder_t));
+    if (config) decoder->config = *config;
+    delta_defaults(&decoder->config);
+
+    if (delta_table_init(&decoder->table, &decoder->config) != 0) goto err_free_decoder;
+
+    decoder->scratch = (uint8_t*)os->malloc(decoder->config.max_payload);
+    if (!decoder->scratch) goto err_free_table;
+
+    decoder->mutex = os->mutex_create();
+    if (!decoder->mutex) goto err_free_scratch;
+    return decoder;
+
+err_free_scratch:
+    os->free(decoder->scratch);
+err_free_table:
+    delta_table_free(&decoder->table);
+err_free_decoder:
+    os->free(decoder);
+    return NULL;
+}
+
+void mqtt_delta_decoder_destroy(mqtt_delta_decoder_t* decoder) {
+    if (!decoder) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    os->mutex_destroy(decoder->mutex);
+    os->free(decoder->scratch);
+    delta_table_free(&decoder->table);
+    os->free(decoder);
+}
+
+int mqtt_delta_unpack(mqtt_delta_decoder_t* decoder, const char* topic, const uint8_t* frame, size_t len,
+                      mqtt_msg_callback_t cb, void* user_data) {
+    if (!decoder || !topic || !frame || !cb) return -1;
+
+    int ret = -1;
+
+    MQTT_MUTEX_LOCK(decoder->mutex);
+
+    if (len < DELTA_HEADER || (frame[0] >> 4) != MQTT_DELTA_VERSION) goto out;
+
+    uint8_t kind = frame[0] & 0x0F;
+    uint8_t seq = frame[1];
+    const uint8_t* body = frame + DELTA_HEADER;
+    size_t body_len = len - DELTA_HEADER;
+    delta_entry_t* entry = delta_track(&decoder->table, &decoder->config, topic);
+
+    if (kind == MQTT_DELTA_KEYFRAME) {
+        if (entry && body_len <= decoder->config.max_payload) {
+            if (body_len > 0) memcpy(entry->buf, body, body_len);
+            entry->len = (uint16_t)body_len;
+            entry->seq = seq;
+            entry->valid = 1;
+        } else if (entry) {
+            entry->valid = 0;
+        }
+        decoder->stats.keyframes++;
+        decoder->stats.raw_bytes += body_len;
+        decoder->stats.wire_bytes += len;
+        cb(topic, body, body_len, user_data);
+        ret = 1;
+    } else if (kind == MQTT_DELTA_DELTA) {
+        if (!entry || !entry->valid || (uint8_t)(entry->seq + 1) != seq) {
+            decoder->stats.missed++;
+            ret = 0;
+            goto out;
+        }
+
+        int n = delta_decode(entry->buf, entry->len, body, body_len, decoder->scratch, decoder->config.max_payload);
+        if (n < 0) goto out;
+
+        memcpy(entry->buf, decoder->scratch, (size_t)n);
+        entry->len = (uint16_t)n;
+        entry->seq = seq;
+        decoder->stats.deltas++;
+        decoder->stats.raw_bytes += (size_t)n;
+        decoder->stats.wire_bytes += len;
+        cb(topic, entry->buf, (size_t)n, user_data);
+        ret = 1;
+    }
+
+out:
+    if (ret < 0) decoder->stats.malformed++;
+    MQTT_MUTEX_UNLOCK(decoder->mutex);
+    return ret;
+}
+
+int mqtt_delta_decoder_get_stats(mqtt_delta_decoder_t* decoder, mqtt_delta_stats_t* stats) {
+    if (!decoder || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(decoder->mutex);
+    memcpy(stats, &decoder->stats, sizeof(mqtt_delta_stats_t));
+    MQTT_MUTEX_UNLOCK(decoder->mutex);
+    return 0;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file mqtt_dispatch.c
+ * @brief Inbound dispatch queue implementation
+ */
+
+#include "mqtt_dispatch.h"
+#include <string.h>
+
+/** @brief Longest topic, bounded like subscription topics */
+#define DISPATCH_TOPIC_MAX  (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief End of an entry list */
+#define DISPATCH_NONE       0xFFFF
+
+typedef struct {
+    char topic[DISPATCH_TOPIC_MAX + 1];
+    uint32_t hash;
+    uint16_t next;       /* Next entry of the same bucket, DISPATCH_NONE at the end */
+    uint16_t order;      /* Next pending entry, or next free one */
+    uint16_t len;
+    uint8_t* payload;    /* max_payload bytes of its own */
+} dispatch_entry_t;
+
+struct mqtt_dispatch {
+    mqtt_dispatch_config_t config;
+    mqtt_mutex_t mutex;
+    mqtt_sem_t work_sem;         /* Posted when the queue stops being empty and on shutdown */
+    mqtt_sem_t exit_sem;
+    mqtt_thread_t thread;
+    uint8_t running;             /* Cleared under the mutex to stop the worker */
+    dispatch_entry_t* entries;   /* capacity + 1: one is with the consumer */
+    uint8_t* payloads;
+    uint16_t* buckets;           /* Conflation index by topic hash, NULL unless conflating */
+    uint32_t mask;               /* Bucket count - 1 */
+    uint16_t head;               /* Oldest pending entry */
+    uint16_t tail;               /* Newest pending entry */
+    uint16_t free;
+    uint16_t count;              /* Pending entries */
+    mqtt_dispatch_stats_t stats;
+};
+
+/* FNV-1a */
+static uint32_t dispatch_hash(const char* topic, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Pending entry of a topic, DISPATCH_NONE if there is none; caller holds dispatch->mutex */
+static uint16_t dispatch_lookup(mqtt_dispatch_t* dispatch, const char* topic, uint32_t hash) {
+    for (uint16_t i = dispatch->buckets[hash & dispatch->mask]; i != DISPATCH_NONE; i = dispatch->entries[i].next) {
+        if (dispatch->entries[i].hash == hash && strcmp(dispatch->entries[i].topic, topic) == 0) return i;
+    }
+    return DISPATCH_NONE;
+}
+
+/* Caller holds dispatch->mutex */
+static void dispatch_unlink(mqtt_dispatch_t* dispatch, uint16_t index) {
+    if (!dispatch->buckets) return;
+
+    uint16_t* link = &dispatch->buckets[dispatch->entries[index].hash & dispatch->mask];
+    while (*link != DISPATCH_NONE) {
+        if (*link == index) {
+            *link = dispatch->entries[index].next;
+            return;
+        }
+        link = &dispatch->entries[*link].next;
+    }
+}
+
+/* Take the oldest pending entry out of the queue and the index; caller holds dispatch->mutex */
+static uint16_t dispatch_pop(mqtt_dispatch_t* dispatch) {
+    uint16_t index = dispatch->head;
+
+    dispatch->head = dispatch->entries[index].order;
+    if (--dispatch->count == 0) dispatch->tail = DISPATCH_NONE;
+    dispatch_unlink(dispatch, index);
+    return index;
+}
+
+/* Caller holds dispatch->mutex */
+static void dispatch_free(mqtt_dispatch_t* dispatch, uint16_t index) {
+    dispatch->entries[index].order = dispatch->free;
+    dispatch->free = index;
+}
+
+static void dispatch_thread(void* arg) {
+    mqtt_dispatch_t* dispatch = (mqtt_dispatch_t*)arg;
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    for (;;) {
+        os->sem_wait(dispatch->work_sem);
+
+        MQTT_MUTEX_LOCK(dispatch->mutex);
+        while (dispatch->running && dispatch->count > 0) {
+            /* Out of the index, a newer message of its topic is queued
+             * instead of rewriting the one the consumer is reading */
+            uint16_t index = dispatch_pop(dispatch);
+            dispatch_entry_t* entry = &dispatch->entries[index];
+
+            MQTT_MUTEX_UNLOCK(dispatch->mutex);
+            dispatch->config.cb(entry->topic, entry->payload, entry->len, dispatch->config.user_data);
+            MQTT_MUTEX_LOCK(dispatch->mutex);
+
+            dispatch_free(dispatch, index);
+            dispatch->stats.delivered++;
+        }
+        int running = dispatch->running;
+        MQTT_MUTEX_UNLOCK(dispatch->mutex);
+
+        if (!running) break;
+    }
+
+    os->sem_post(dispatch->exit_sem);
+    if (os->thread_exit) {
+        os->thread_exit();
+    }
+}
+
+mqtt_dispatch_t* mqtt_dispatch_create(const mqtt_dispatch_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!config || !config->cb) return NULL;
+
+    mqtt_dispatch_t* dispatch = (mqtt_dispatch_t*)os->malloc(sizeof(mqtt_dispatch_t));
+    if (!dispatch) return NULL;
+    memset(dispatch, 0, sizeof(mqtt_dispatch_t));
+    dispatch->config = *config;
+    if (!dispatch->config.capacity) dispatch->config.capacity = MQTT_DISPATCH_DEFAULT_CAPACITY;
+    if (dispatch->config.capacity >= DISPATCH_NONE - 1) dispatch->config.capacity = DISPATCH_NONE - 2;
+    if (!dispatch->config.max_payload) dispatch->config.max_payload = MQTT_DISPATCH_DEFAULT_PAYLOAD;
+    if (dispatch->config.max_payload > MQTT_RECV_BUF_SIZE) dispatch->config.max_payload = MQTT_RECV_BUF_SIZE;
+
+    uint16_t slots = dispatch->config.capacity + 1;
+    dispatch->entries = (dispatch_entry_t*)os->malloc(slots * sizeof(dispatch_entry_t));
+    if (!dispatch->entries) goto err_free_dispatch;
+    memset(dispatch->entries, 0, slots * sizeof(dispatch_entry_t));
+
+    dispatch->payloads = (uint8_t*)os->malloc((size_t)slots * dispatch->config.max_payload);
+    if (!dispatch->payloads) goto err_free_entries;
+    for (uint16_t i = 0; i < slots; i++) {
+        dispatch->entries[i].payload = dispatch->payloads + (size_t)i * dispatch->config.max_payload;
+        dispatch->entries[i].order = i + 1 < slots ? i + 1 : DISPATCH_NONE;
+    }
+    dispatch->free = 0;
+    dispatch->head = DISPATCH_NONE;
+    dispatch->tail = DISPATCH_NONE;
+
+    if (dispatch->config.policy == MQTT_DISPATCH_CONFLATE) {
+        uint32_t size = 1;
+        while (size < slots) size <<= 1;
+        dispatch->mask = size - 1;
+
+        dispatch->buckets = (uint16_t*)os->malloc(size * sizeof(uint16_t));
+        if (!dispatch->buckets) goto err_free_payloads;
+        memset(dispatch->buckets, 0xFF, size * sizeof(uint16_t));
+    }
+
+    dispatch->mutex = os->mutex_create();
+    if (!dispatch->mutex) goto err_free_buckets;
+
+    dispatch->work_sem = os->sem_create(0);
+    if (!dispatch->work_sem) goto err_destroy_mutex;
+
+    dispatch->exit_sem = os->sem_create(0);
+    if (!dispatch->exit_sem) goto err_destroy_work_sem;
+
+    dispatch->running = 1;
+    const mqtt_thread_attr_t* attr = &dispatch->config.thread;
+    if (os->thread_create_ex) {
+        dispatch->thread = os->thread_create_ex(dispatch_thread, dispatch, attr);
+    } else {
+        dispatch->thread = os->thread_create(dispatch_thread, dispatch,
+                                             attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE,
+                                             attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY);
+    }
+    if (!dispatch->thread) goto err_destroy_exit_sem;
+    return dispatch;
+
+err_destroy_exit_sem:
+    os->sem_destroy(dispatch->exit_sem);
+err_destroy_work_sem:
+    os->sem_destroy(dispatch->work_sem);
+err_destroy_mutex:
+    os->mutex_destroy(dispatch->mutex);
+err_free_buckets:
+    if (dispatch->buckets) os->free(dispatch->buckets);
+err_free_payloads:
+    os->free(dispatch->payloads);
+err_free_entries:
+    os->free(dispatch->entries);
+err_free_dispatch:
+    os->free(dispatch);
+    return NULL;
+}
+
+void mqtt_dispatch_destroy(mqtt_dispatch_t* dispatch) {
+    if (!dispatch) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    /* The worker finishes the message the consumer is on, then exits */
+    MQTT_MUTEX_LOCK(dispatch->mutex);
+    dispatch->running = 0;
+    MQTT_MUTEX_UNLOCK(dispatch->mutex);
+    os->sem_post(dispatch->work_sem);
+    os->sem_wait(dispatch->exit_sem);
+    os->thread_destroy(dispatch->thread);
+
+    os->sem_destroy(dispatch->exit_sem);
+    os->sem_destroy(dispatch->work_sem);
+    os->mutex_destroy(dispatch->mutex);
+    if (dispatch->buckets) os->free(dispatch->buckets);
+    os->free(dispatch->payloads);
+    os->free(dispatch->entries);
+    os->free(dispatch);
+}
+
+void mqtt_dispatch_msg(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    mqtt_dispatch_t* dispatch = (mqtt_dispatch_t*)user_data;
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!dispatch || !topic || (!payload && len > 0)) return;
+
+    size_t topic_len = strlen(topic);
+    uint32_t hash = dispatch->buckets ? dispatch_hash(topic, topic_len) : 0;
+    uint16_t index = DISPATCH_NONE;
+    int wake = 0;
+
+    MQTT_MUTEX_LOCK(dispatch->mutex);
+    dispatch->stats.received++;
+
+    if (topic_len == 0 || topic_len > DISPATCH_TOPIC_MAX || len > dispatch->config.max_payload) {
+        dispatch->stats.rejected++;
+        MQTT_MUTEX_UNLOCK(dispatch->mutex);
+        return;
+    }
+
+    if (dispatch->buckets) index = dispatch_lookup(dispatch, topic, hash);
+
+    if (index != DISPATCH_NONE) {
+        /* Keeps its place in the queue, the consumer gets the newest value */
+        dispatch->stats.conflated++;
+    } else {
+        if (dispatch->count >= dispatch->config.capacity) {
+            if (dispatch->config.policy == MQTT_DISPATCH_DROP_NEWEST) {
+                dispatch->stats.rejected++;
+                MQTT_MUTEX_UNLOCK(dispatch->mutex);
+                return;
+            }
+            dispatch_free(dispatch, dispatch_pop(dispatch));
+            dispatch->stats.dropped++;
+        }
+
+        index = dispatch->free;
+        dispatch->free = dispatch->entries[index].order;
+
+        dispatch_entry_t* entry = &dispatch->entries[index];
+        memcpy(entry->topic, topic, topic_len + 1);
+        entry->hash = hash;
+        entry->order = DISPATCH_NONE;
+        if (dispatch->tail == DISPATCH_NONE) {
+            dispatch->head = index;
+        } else {
+            dispatch->entries[dispatch->tail].order = index;
+        }
+        dispatch->tail = index;
+        if (dispatch->buckets) {
+            uint16_t* bucket = &dispatch->buckets[hash & dispatch->mask];
+            entry->next = *bucket;
+            *bucket = index;
+        }
+        if (++dispatch->count > dispatch->stats.max_depth) dispatch->stats.max_depth = dispatch->count;
+
+        /* The worker only waits after finding the queue empty under the mutex */
+        wake = dispatch->count == 1;
+    }
+
+    dispatch_entry_t* entry = &dispatch->entries[index];
+    if (len > 0) memcpy(entry->payload, payload, len);
+    entry->len = (uint16_t)len;
+
+    MQTT_MUTEX_UNLOCK(dispatch->mutex);
+
+    if (wake) os->sem_post(dispatch->work_sem);
+}
+
+int mqtt_dispatch_get_stats(mqtt_dispatch_t* dispatch, mqtt_dispatch_stats_t* stats) {
+    if (!dispatch || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(dispatch->mutex);
+    memcpy(stats, &dispatch->stats, sizeof(mqtt_dispatch_stats_t));
+    stats->depth = dispatch->count;
+    MQTT_MUTEX_UNLOCK(dispatch->mutex);
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file mqtt_metrics.c
+ * @brief OpenMetrics exporter implementation
+ */
+
+#include "mqtt_metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t pos;
+    int overflow;
+} metrics_writer_t;
+
+typedef struct {
+    const char* name;
+    const char* type;
+    const char* help;
+    size_t offset;   /* Field offset in mqtt_stats_t */
+    int is_u64;
+} metrics_scalar_t;
+
+#define STATS_U32(field) offsetof(mqtt_stats_t, field), 0
+#define STATS_U64(field) offsetof(mqtt_stats_t, field), 1
+
+static const metrics_scalar_t g_scalars[] = {
+    { "mqtt_tx_packets", "counter", "MQTT packets sent", STATS_U32(tx_packets) },
+    { "mqtt_rx_packets", "counter", "MQTT packets received", STATS_U32(rx_packets) },
+    { "mqtt_tx_bytes", "counter", "Bytes sent", STATS_U64(tx_bytes) },
+    { "mqtt_rx_bytes", "counter", "Bytes received", STATS_U64(rx_bytes) },
+    { "mqtt_publish_sent", "counter", "PUBLISH packets sent", STATS_U32(publish_sent) },
+    { "mqtt_publish_received", "counter", "PUBLISH packets received", STATS_U32(publish_received) },
+    { "mqtt_reconnects", "counter", "Successful reconnections", STATS_U32(reconnects) },
+    { "mqtt_ping_timeouts", "counter", "Connections dropped for missing PINGRESP", STATS_U32(ping_timeouts) },
+    { "mqtt_local_delivered", "counter", "Publishes delivered to local subscriptions", STATS_U32(local_delivered) },
+    { "mqtt_echoes_suppressed", "counter", "Broker echoes of local deliveries dropped", STATS_U32(echoes_suppressed) },
+    { "mqtt_inflight", "gauge", "QoS 1 publishes awaiting PUBACK", STATS_U32(inflight) },
+};
+
+static void metrics_printf(metrics_writer_t* w, const char* fmt, ...) {
+    if (w->overflow) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(w->buf + w->pos, w->len - w->pos, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= w->len - w->pos) {
+        w->overflow = 1;
+        return;
+    }
+    w->pos += n;
+}
+
+/* Label values escape backslash, double quote and newline */
+static void metrics_label(metrics_writer_t* w, const char* client_id) {
+    metrics_printf(w, "{client_id=\"");
+    for (const char* p = client_id ? client_id : ""; *p; p++) {
+        if (*p == '\\') metrics_printf(w, "\\\\");
+        else if (*p == '"') metrics_printf(w, "\\\"");
+        else if (*p == '\n') metrics_printf(w, "\\n");
+        else metrics_printf(w, "%c", *p);
+    }
+    metrics_printf(w, "\"");
+}
+
+/* Print microseconds as seconds without relying on float printf support */
+static void metrics_seconds(metrics_writer_t* w, uint64_t us) {
+    metrics_printf(w, "%lu.%06lu", (unsigned long)(us / 1000000), (unsigned long)(us % 1000000));
+}
+
+static void metrics_header(metrics_writer_t* w, const char* name, const char* type, const char* help) {
+    metrics_printf(w, "# TYPE %s %s\n# HELP %s %s.\n", name, type, name, help);
+}
+
+static void metrics_histogram(metrics_writer_t* w, const char* name, const char* help,
+                              mqtt_client_t* const* clients, const mqtt_stats_t* stats,
+                              size_t count, size_t offset) {
+    metrics_header(w, name, "histogram", help);
+    for (size_t c = 0; c < count; c++) {
+        const mqtt_histogram_t* hist = (const mqtt_histogram_t*)((const uint8_t*)&stats[c] + offset);
+        const char* client_id = clients[c]->config.client_id;
+        uint64_t cumulative = 0;
+
+        for (int i = 0; i < MQTT_HIST_BUCKETS - 1; i++) {
+            cumulative += hist->buckets[i];
+            metrics_printf(w, "%s_bucket", name);
+            metrics_label(w, client_id);
+            metrics_printf(w, ",le=\"");
+            metrics_seconds(w, (uint64_t)mqtt_hist_bucket_upper(i) + 1);
+            metrics_printf(w, "\"} %lu\n", (unsigned long)cumulative);
+        }
+        metrics_printf(w, "%s_bucket", name);
+        metrics_label(w, client_id);
+        metrics_printf(w, ",le=\"+Inf\"} %lu\n", (unsigned long)hist->count);
+
+        metrics_printf(w, "%s_count", name);
+        metrics_label(w, client_id);
+        metrics_printf(w, "} %lu\n", (unsigned long)hist->count);
+
+        metrics_printf(w, "%s_sum", name);
+        metrics_label(w, client_id);
+        metrics_printf(w, "} ");
+        metrics_seconds(w, hist->sum_us);
+        metrics_printf(w, "\n");
+    }
+}
+
+int mqtt_metrics_render(mqtt_client_t* const* clients, size_t count, char* buf, size_t len) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!clients || !buf || len == 0 || !os) return -1;
+
+    mqtt_stats_t* stats = NULL;
+    if (count > 0) {
+        stats = (mqtt_stats_t*)os->malloc(count * sizeof(mqtt_stats_t));
+        if (!stats) return -1;
+        for (size_t c = 0; c < count; c++) {
+            if (mqtt_client_get_stats(clients[c], &stats[c]) != 0) {
+                os->free(stats);
+                return -1;
+            }
+        }
+    }
+
+    metrics_writer_t w = { buf, len, 0, 0 };
+
+    metrics_header(&w, "mqtt_connected", "gauge", "1 if the client is connected to the broker");
+    for (size_t c = 0; c < count; c++) {
+        metrics_printf(&w, "mqtt_connected");
+        metrics_label(&w, clients[c]->config.client_id);
+        metrics_printf(&w, "} %d\n", mqtt_client_is_connected(clients[c]));
+    }
+
+    for (size_t i = 0; i < sizeof(g_scalars) / sizeof(g_scalars[0]); i++) {
+        const metrics_scalar_t* m = &g_scalars[i];
+        int counter = strcmp(m->type, "counter") == 0;
+
+        metrics_header(&w, m->name, m->type, m->help);
+        for (size_t c = 0; c < count; c++) {
+            const uint8_t* field = (const uint8_t*)&stats[c] + m->offset;
+            unsigned long long value = m->is_u64 ? *(const uint64_t*)field : *(const uint32_t*)field;
+            metrics_printf(&w, "%s%s", m->name, counter ? "_total" : "");
+            metrics_label(&w, clients[c]->config.client_id);
+            metrics_printf(&w, "} %llu\n", value);
+        }
+    }
+
+    metrics_header(&w, "mqtt_ping_srtt_seconds", "gauge", "Smoothed PINGREQ to PINGRESP round trip");
+    for (size_t c = 0; c < count; c++) {
+        metrics_printf(&w, "mqtt_ping_srtt_seconds");
+        metrics_label(&w, clients[c]->config.client_id);
+        metrics_printf(&w, "} ");
+        metrics_seconds(&w, stats[c].srtt_us);
+        metrics_printf(&w, "\n");
+    }
+
+    metrics_histogram(&w, "mqtt_ping_rtt_seconds", "PINGREQ to PINGRESP round trip",
+                      clients, stats, count, offsetof(mqtt_stats_t, ping_rtt));
+    metrics_histogram(&w, "mqtt_puback_latency_seconds", "QoS 1 PUBLISH to PUBACK latency",
+                      clients, stats, count, offsetof(mqtt_stats_t, puback_latency));
+
+    metrics_printf(&w, "# EOF\n");
+
+    if (stats) os->free(stats);
+    return w.overflow ? -1 : (int)w.pos;
+}
@@ -4,15 +4,20 @@
  */
 
 #include "mqtt_net.h"
+#include "mqtt_atomic.h"
 
-/* Global network API pointer */
+#ifndef MQTT_NET_DIRECT
 
-static const mqtt_net_api_t* g_net_api = NULL;
+/* Global network API pointer, swapped under running clients by the capture hook */
+
+static mqtt_atomic_ptr_t g_net_api = NULL;
 
 void mqtt_net_init(const mqtt_net_api_t* api) {
-    g_net_api = api;
+    mqtt_atomic_store_ptr(&g_net_api, (void*)api, MQTT_ATOMIC_RELEASE);
 }
 
 const mqtt_net_api_t* mqtt_net_get(void) {
-    return g_net_api;
+    return (const mqtt_net_api_t*)mqtt_atomic_load_ptr(&g_net_api, MQTT_ATOMIC_ACQUIRE);
 }
+
+#endif /* MQTT_NET_DIRECT */
@@ -5,12 +5,247 @@
 
 #include "mqtt_os.h"
 
+#ifdef MQTT_OS_DIRECT
+#define g_os_api (&mqtt_os_port_api)
+#else
 static const mqtt_os_api_t* g_os_api = NULL;
+#endif
 
-void mqtt_os_init(const mqtt_os_api_t* api) {
+#ifdef MQTT_LOCK_STATS
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Hold state of one instrumented mutex, claimed when it is acquired and
+ * released when it is unlocked, so destroyed mutexes never occupy a slot
+ */
+typedef struct {
+    mqtt_mutex_t mutex;
+    int site;
+    uint64_t acquired_us;
+} lockstat_mutex_t;
+
+/* Protects the tables below, itself not instrumented */
+static mqtt_mutex_t g_lockstat_mutex = NULL;
+static mqtt_lockstat_site_t g_lockstat_sites[MQTT_LOCKSTAT_MAX_SITES];
+static int g_lockstat_site_count = 0;
+static lockstat_mutex_t g_lockstat_mutexes[MQTT_LOCKSTAT_MAX_MUTEXES];
+
+static lockstat_mutex_t* lockstat_find_mutex(mqtt_mutex_t mutex, int create) {
+    lockstat_mutex_t* free_slot = NULL;
+    for (int i = 0; i < MQTT_LOCKSTAT_MAX_MUTEXES; i++) {
+        if (g_lockstat_mutexes[i].mutex == mutex) return &g_lockstat_mutexes[i];
+        if (!free_slot && !g_lockstat_mutexes[i].mutex) free_slot = &g_lockstat_mutexes[i];
+    }
+    if (create && free_slot) free_slot->mutex = mutex;
+    return create ? free_slot : NULL;
+}
+
+static int lockstat_find_site(const char* func, int line) {
+    for (int i = 0; i < g_lockstat_site_count; i++) {
+        if (g_lockstat_sites[i].line == line && strcmp(g_lockstat_sites[i].func, func) == 0) return i;
+    }
+    if (g_lockstat_site_count >= MQTT_LOCKSTAT_MAX_SITES) return -1;
+
+    mqtt_lockstat_site_t* site = &g_lockstat_sites[g_lockstat_site_count];
+    memset(site, 0, sizeof(*site));
+    site->func = func;
+    site->line = line;
+    return g_lockstat_site_count++;
+}
+
+int mqtt_lockstat_lock(mqtt_mutex_t mutex, const char* func, int line) {
+    const mqtt_os_api_t* os = g_os_api;
+
+    /* Held by someone else if it has a slot; slots only exist while held */
+    os->mutex_lock(g_lockstat_mutex);
+    int contended = lockstat_find_mutex(mutex, 0) != NULL;
+    os->mutex_unlock(g_lockstat_mutex);
+
+    uint64_t start = mqtt_os_time_us();
+    if (os->mutex_trylock) {
+        /* Exact contention: the lock was busy at the moment we asked for it */
+        contended = os->mutex_trylock(mutex) != 0;
+        if (contended && os->mutex_lock(mutex) != 0) return -1;
+    } else {
+        int ret = os->mutex_lock(mutex);
+        if (ret != 0) return ret;
+    }
+    uint64_t now = mqtt_os_time_us();
+    uint32_t wait_us = (uint32_t)(now - start);
+
+    os->mutex_lock(g_lockstat_mutex);
+    int index = lockstat_find_site(func, line);
+    if (index >= 0) {
+        mqtt_lockstat_site_t* site = &g_lockstat_sites[index];
+        site->acquisitions++;
+        if (contended) site->contended++;
+        site->wait_total_us += wait_us;
+        if (wait_us > site->wait_max_us) site->wait_max_us = wait_us;
+    }
+    /* Table full: the acquisition is counted, its hold time is not */
+    lockstat_mutex_t* entry = lockstat_find_mutex(mutex, 1);
+    if (entry) {
+        entry->site = index;
+        entry->acquired_us = now;
+    }
+    os->mutex_unlock(g_lockstat_mutex);
+    return 0;
+}
+
+void mqtt_lockstat_unlock(mqtt_mutex_t mutex) {
+    const mqtt_os_api_t* os = g_os_api;
+    uint64_t now = mqtt_os_time_us();
+
+    os->mutex_lock(g_lockstat_mutex);
+    lockstat_mutex_t* entry = lockstat_find_mutex(mutex, 0);
+    if (entry) {
+        if (entry->site >= 0) {
+            mqtt_lockstat_site_t* site = &g_lockstat_sites[entry->site];
+            uint32_t hold_us = (uint32_t)(now - entry->acquired_us);
+            site->hold_total_us += hold_us;
+            if (hold_us > site->hold_max_us) site->hold_max_us = hold_us;
+        }
+        entry->mutex = NULL;
+    }
+    os->mutex_unlock(g_lockstat_mutex);
+
+    os->mutex_unlock(mutex);
+}
+
+int mqtt_lockstat_get(mqtt_lockstat_site_t* sites, int max) {
+    const mqtt_os_api_t* os = g_os_api;
+
+    os->mutex_lock(g_lockstat_mutex);
+    int count = g_lockstat_site_count < max ? g_lockstat_site_count : max;
+    memcpy(sites, g_lockstat_sites, count * sizeof(mqtt_lockstat_site_t));
+    os->mutex_unlock(g_lockstat_mutex);
+    return count;
+}
+
+void mqtt_lockstat_reset(void) {
+    const mqtt_os_api_t* os = g_os_api;
+
+    os->mutex_lock(g_lockstat_mutex);
+    for (int i = 0; i < g_lockstat_site_count; i++) {
+        const char* func = g_lockstat_sites[i].func;
+        int line = g_lockstat_sites[i].line;
+        memset(&g_lockstat_sites[i], 0, sizeof(mqtt_lockstat_site_t));
+        g_lockstat_sites[i].func = func;
+        g_lockstat_sites[i].line = line;
+    }
+    os->mutex_unlock(g_lockstat_mutex);
+}
+
+int mqtt_lockstat_report(char* buf, size_t len) {
+    if (!buf || len == 0) return 0;
+
+    mqtt_lockstat_site_t sites[MQTT_LOCKSTAT_MAX_SITES];
+    int count = mqtt_lockstat_get(sites, MQTT_LOCKSTAT_MAX_SITES);
+
+    /* Insertion sort by total hold time, the usual suspect for tail latency */
+    for (int i = 1; i < count; i++) {
+        mqtt_lockstat_site_t tmp = sites[i];
+        int j = i - 1;
+        while (j >= 0 && sites[j].hold_total_us < tmp.hold_total_us) {
+            sites[j + 1] = sites[j];
+            j--;
+        }
+        sites[j + 1] = tmp;
+    }
+
+    size_t pos = 0;
+    int n = snprintf(buf, len, "%-32s %10s %10s %12s %12s %12s %12s\n",
+                     "site", "acquired", "contended", "wait_avg_us", "wait_max_us",
+                     "hold_avg_us", "hold_max_us");
+    if (n < 0) return 0;
+    pos = (size_t)n < len ? (size_t)n : len;
+
+    for (int i = 0; i < count && pos < len; i++) {
+        char name[48];
+        uint32_t acq = sites[i].acquisitions ? sites[i].acquisitions : 1;
+        snprintf(name, sizeof(name), "%s:%d", sites[i].func, sites[i].line);
+        n = snprintf(buf + pos, len - pos, "%-32s %10u %10u %12u %12u %12u %12u\n",
+                     name, (unsigned)sites[i].acquisitions, (unsigned)sites[i].contended,
+                     (unsigned)(sites[i].wait_total_us / acq), (unsigned)sites[i].wait_max_us,
+                     (unsigned)(sites[i].hold_total_us / acq), (unsigned)sites[i].hold_max_us);
+        if (n < 0) break;
+        pos += (size_t)n < len - pos ? (size_t)n : len - pos;
+    }
+    return (int)(pos < len ? pos : len - 1);
+}
+
+#endif /* MQTT_LOCK_STATS */
+
+void* mqtt_os_pool_alloc(mqtt_os_pool_t* pool) {
+    uint32_t used = mqtt_atomic_load_u32(&pool->used, MQTT_ATOMIC_RELAXED);
+
+    for (;;) {
+        uint32_t i = 0;
+        while (i < pool->count && (used & (1u << i))) i++;
+        if (i == pool->count) return NULL;
+        if (mqtt_atomic_cas_u32(&pool->used, &used, used | (1u << i), MQTT_ATOMIC_ACQUIRE)) {
+            return (uint8_t*)pool->storage + i * pool->size;
+        }
+    }
+}
+
+void mqtt_os_pool_free(mqtt_os_pool_t* pool, void* obj) {
+    if (!obj) return;
+
+    uint32_t bit = 1u << (((uint8_t*)obj - (uint8_t*)pool->storage) / pool->size);
+    uint32_t used = mqtt_atomic_load_u32(&pool->used, MQTT_ATOMIC_RELAXED);
+    while (!mqtt_atomic_cas_u32(&pool->used, &used, used & ~bit, MQTT_ATOMIC_RELEASE));
+}
+
+/* Whether the API provides every optional function this build relies on */
+static int mqtt_os_api_complete(const mqtt_os_api_t* api) {
+#ifdef MQTT_ATOMIC_NEEDS_CRITICAL
+    /* Without them the atomics fallback would not be atomic at all */
+    if (!api->critical_enter || !api->critical_exit) return 0;
+#endif
+    (void)api;
+    return 1;
+}
+
+#ifdef MQTT_OS_DIRECT
+
+int mqtt_os_bind(void) {
+    if (!mqtt_os_api_complete(g_os_api)) return -1;
+#ifdef MQTT_LOCK_STATS
+    if (!g_lockstat_mutex) g_lockstat_mutex = g_os_api->mutex_create();
+    if (!g_lockstat_mutex) return -1;
+#endif
+    return 0;
+}
+
+#else
+
+int mqtt_os_init(const mqtt_os_api_t* api) {
+    if (api && !mqtt_os_api_complete(api)) {
+        g_os_api = NULL;
+        return -1;
+    }
+#ifdef MQTT_LOCK_STATS
+    /* Every lock goes through the statistics, which need their own mutex */
+    if (api && !g_lockstat_mutex) g_lockstat_mutex = api->mutex_create();
+    if (api && !g_lockstat_mutex) {
+        g_os_api = NULL;
+        return -1;
+    }
+#endif
     g_os_api = api;
+    return 0;
 }
 
 const mqtt_os_api_t* mqtt_os_get(void) {
     return g_os_api;
 }
+
+uint64_t mqtt_os_time_us(void) {
+    if (g_os_api->get_time_us) return g_os_api->get_time_us();
+    return (uint64_t)g_os_api->get_time_ms() * 1000;
+}
+
+#endif /* MQTT_OS_DIRECT */
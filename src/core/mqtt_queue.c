@@ -0,0 +1,543 @@
+/**
+ * @file mqtt_queue.c
+ * @brief Outbound message queue implementation
+ */
+
+#include "mqtt_queue.h"
+#include <string.h>
+
+/** @brief Longest topic, bounded like subscription topics */
+#define QUEUE_TOPIC_MAX     (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief End of an entry list */
+#define QUEUE_NONE          0xFFFF
+
+/** @brief Entry without a route */
+#define QUEUE_NO_ROUTE      0xFF
+
+/** @brief PUBLISH framing counted against token buckets besides topic and payload */
+#define QUEUE_FRAMING       6
+
+/** @brief Tokens per byte, so that refills in microseconds stay integral */
+#define QUEUE_TOKEN_SCALE   1000000
+
+typedef struct {
+    char topic[QUEUE_TOPIC_MAX + 1];
+    uint32_t hash;
+    uint16_t next;       /* Next entry of the same bucket, QUEUE_NONE at the end */
+    uint16_t order;      /* Next entry of the same lane, or of the free list */
+    uint16_t len;
+    uint8_t qos;
+    uint8_t lane;
+    uint8_t route;       /* Route whose limit applies, QUEUE_NO_ROUTE for none */
+    uint64_t expires;    /* Expiry in microseconds, 0 for never */
+    uint8_t* payload;    /* max_payload bytes of its own */
+} queue_entry_t;
+
+typedef struct {
+    uint16_t head;       /* Oldest entry */
+    uint16_t tail;       /* Newest entry */
+    uint16_t count;
+} queue_lane_t;
+
+typedef struct {
+    uint32_t rate;       /* Bytes per second, 0 for no limit */
+    int64_t tokens;      /* In QUEUE_TOKEN_SCALE per byte, negative while in debt */
+    int64_t max;
+    uint64_t last_time;  /* Last refill in microseconds */
+} queue_bucket_t;
+
+typedef struct {
+    char filter[QUEUE_TOPIC_MAX + 1];
+    uint8_t lane;
+    queue_bucket_t bucket;
+} queue_route_t;
+
+struct mqtt_queue {
+    mqtt_client_t* client;
+    mqtt_mutex_t mutex;
+    mqtt_queue_config_t config;
+    queue_entry_t* entries;
+    uint8_t* payloads;
+    uint16_t* buckets;           /* Conflation index by topic hash, NULL for FIFO */
+    uint32_t mask;               /* Bucket count - 1 */
+    uint16_t free;               /* Free entries, linked through order */
+    uint16_t count;              /* Entries queued or being sent */
+    queue_lane_t lanes[MQTT_QUEUE_LANES];
+    queue_bucket_t limits[MQTT_QUEUE_LANES];
+    queue_route_t routes[MQTT_QUEUE_MAX_ROUTES];
+    uint8_t route_count;
+    uint8_t draining;            /* A thread is sending, others only queue */
+    mqtt_queue_stats_t stats;
+};
+
+/* FNV-1a */
+static uint32_t queue_hash(const char* topic, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void queue_bucket_init(queue_bucket_t* bucket, const mqtt_queue_limit_t* limit) {
+    bucket->rate = limit->rate;
+    bucket->max = (int64_t)(limit->burst ? limit->burst : limit->rate) * QUEUE_TOKEN_SCALE;
+    bucket->tokens = bucket->max;
+    bucket->last_time = mqtt_os_time_us();
+}
+
+static void queue_bucket_refill(queue_bucket_t* bucket, uint64_t now) {
+    uint64_t elapsed = now - bucket->last_time;
+    bucket->last_time = now;
+
+    /* Divided first, a long idle time would overflow the product */
+    if (elapsed >= (uint64_t)(bucket->max - bucket->tokens) / bucket->rate) {
+        bucket->tokens = bucket->max;
+    } else {
+        bucket->tokens += (int64_t)(elapsed * bucket->rate);
+    }
+}
+
+/* Microseconds until the bucket can pay for cost bytes, 0 if it can now */
+static uint64_t queue_bucket_wait(queue_bucket_t* bucket, uint32_t cost, uint64_t now) {
+    if (!bucket->rate) return 0;
+
+    queue_bucket_refill(bucket, now);
+
+    /* Larger than the burst: sent from a full bucket, which goes into debt */
+    int64_t need = (int64_t)cost * QUEUE_TOKEN_SCALE;
+    if (need > bucket->max) need = bucket->max;
+    if (bucket->tokens >= need) return 0;
+    return (uint64_t)(need - bucket->tokens + bucket->rate - 1) / bucket->rate;
+}
+
+static void queue_bucket_charge(queue_bucket_t* bucket, int64_t cost) {
+    if (bucket->rate) bucket->tokens -= cost * QUEUE_TOKEN_SCALE;
+}
+
+static uint32_t queue_cost(const queue_entry_t* entry) {
+    return (uint32_t)strlen(entry->topic) + entry->len + QUEUE_FRAMING;
+}
+
+/* Queued entry of a topic, QUEUE_NONE if there is none; caller holds queue->mutex */
+static uint16_t queue_lookup(mqtt_queue_t* queue, const char* topic, uint32_t hash) {
+    for (uint16_t i = queue->buckets[hash & queue->mask]; i != QUEUE_NONE; i = queue->entries[i].next) {
+        if (queue->entries[i].hash == hash && strcmp(queue->entries[i].topic, topic) == 0) return i;
+    }
+    return QUEUE_NONE;
+}
+
+/* Caller holds queue->mutex */
+static void queue_link(mqtt_queue_t* queue, uint16_t index) {
+    if (!queue->buckets) return;
+
+    uint16_t* bucket = &queue->buckets[queue->entries[index].hash & queue->mask];
+    queue->entries[index].next = *bucket;
+    *bucket = index;
+}
+
+/* Caller holds queue->mutex */
+static void queue_unlink(mqtt_queue_t* queue, uint16_t index) {
+    if (!queue->buckets) return;
+
+    uint16_t* link = &queue->buckets[queue->entries[index].hash & queue->mask];
+    while (*link != QUEUE_NONE) {
+        if (*link == index) {
+            *link = queue->entries[index].next;
+            return;
+        }
+        link = &queue->entries[*link].next;
+    }
+}
+
+/* Caller holds queue->mutex */
+static void queue_lane_push(mqtt_queue_t* queue, uint16_t index) {
+    queue_lane_t* lane = &queue->lanes[queue->entries[index].lane];
+
+    queue->entries[index].order = QUEUE_NONE;
+    if (lane->count++ == 0) {
+        lane->head = index;
+    } else {
+        queue->entries[lane->tail].order = index;
+    }
+    lane->tail = index;
+}
+
+/* Put a message that failed to send back in front; caller holds queue->mutex */
+static void queue_lane_push_front(mqtt_queue_t* queue, uint16_t index) {
+    queue_lane_t* lane = &queue->lanes[queue->entries[index].lane];
+
+    queue->entries[index].order = lane->count++ == 0 ? QUEUE_NONE : lane->head;
+    if (lane->count == 1) lane->tail = index;
+    lane->head = index;
+}
+
+/* Take an entry out of its lane, prev being the one before it; caller holds queue->mutex */
+static void queue_lane_remove(mqtt_queue_t* queue, uint16_t index, uint16_t prev) {
+    queue_entry_t* entry = &queue->entries[index];
+    queue_lane_t* lane = &queue->lanes[entry->lane];
+
+    if (prev == QUEUE_NONE) {
+        lane->head = entry->order;
+    } else {
+        queue->entries[prev].order = entry->order;
+    }
+    if (lane->tail == index) lane->tail = prev;
+    lane->count--;
+}
+
+/* Caller holds queue->mutex */
+static void queue_free(mqtt_queue_t* queue, uint16_t index) {
+    queue->entries[index].order = queue->free;
+    queue->free = index;
+    queue->count--;
+}
+
+/* Drop an expired entry out of its lane, prev being the one before it; caller holds queue->mutex */
+static void queue_expire_entry(mqtt_queue_t* queue, uint16_t index, uint16_t prev) {
+    queue_lane_remove(queue, index, prev);
+    queue_unlink(queue, index);
+    queue_free(queue, index);
+    queue->stats.expired++;
+}
+
+/* Drop every expired message; caller holds queue->mutex */
+static void queue_expire_locked(mqtt_queue_t* queue, uint64_t now) {
+    for (int l = 0; l < MQTT_QUEUE_LANES; l++) {
+        uint16_t prev = QUEUE_NONE;
+        uint16_t i = queue->lanes[l].head;
+
+        while (i != QUEUE_NONE) {
+            uint16_t next = queue->entries[i].order;
+            if (queue->entries[i].expires && queue->entries[i].expires <= now) {
+                queue_expire_entry(queue, i, prev);
+            } else {
+                prev = i;
+            }
+            i = next;
+        }
+    }
+}
+
+/*
+ * Pick the oldest message of the highest lane its buckets allow and take it
+ * out of its lane; returns QUEUE_NONE and the shortest wait in *wait_us when
+ * every queued message is throttled. Expired messages met on the way are
+ * dropped. Caller holds queue->mutex.
+ */
+static uint16_t queue_schedule(mqtt_queue_t* queue, uint64_t now, uint64_t* wait_us) {
+    *wait_us = UINT64_MAX;
+
+    for (int l = 0; l < MQTT_QUEUE_LANES; l++) {
+        uint16_t prev = QUEUE_NONE;
+        uint16_t next;
+
+        for (uint16_t i = queue->lanes[l].head; i != QUEUE_NONE; i = next) {
+            queue_entry_t* entry = &queue->entries[i];
+            next = entry->order;
+
+            if (entry->expires && entry->expires <= now) {
+                queue_expire_entry(queue, i, prev);
+                continue;
+            }
+
+            /* A throttled route holds back its own later messages, not the lane's */
+            uint32_t cost = queue_cost(entry);
+            if (entry->route != QUEUE_NO_ROUTE) {
+                uint64_t wait = queue_bucket_wait(&queue->routes[entry->route].bucket, cost, now);
+                if (wait) {
+                    if (wait < *wait_us) *wait_us = wait;
+                    prev = i;
+                    continue;
+                }
+            }
+
+            uint64_t wait = queue_bucket_wait(&queue->limits[l], cost, now);
+            if (wait) {
+                if (wait < *wait_us) *wait_us = wait;
+                break;
+            }
+
+            queue_lane_remove(queue, i, prev);
+            return i;
+        }
+    }
+    return QUEUE_NONE;
+}
+
+/*
+ * Send while connected and the limits allow; caller holds queue->mutex,
+ * which is released around each publish so other threads keep queueing (and
+ * conflating) while the link is slow. Returns the shortest wait of a
+ * throttled message in microseconds, UINT64_MAX if none.
+ */
+static uint64_t queue_drain_locked(mqtt_queue_t* queue) {
+    uint64_t wait_us = UINT64_MAX;
+
+    if (queue->draining) return wait_us;
+    queue->draining = 1;
+
+    while (queue->count > 0 && mqtt_client_is_connected(queue->client)) {
+        uint16_t index = queue_schedule(queue, mqtt_os_time_us(), &wait_us);
+        if (index == QUEUE_NONE) {
+            queue->stats.throttled++;
+            break;
+        }
+
+        queue_entry_t* entry = &queue->entries[index];
+        queue_route_t* route = entry->route != QUEUE_NO_ROUTE ? &queue->routes[entry->route] : NULL;
+        int64_t cost = queue_cost(entry);
+        queue_bucket_charge(&queue->limits[entry->lane], cost);
+        if (route) queue_bucket_charge(&route->bucket, cost);
+
+        /* Out of its lane and the index, a publish to its topic now queues a
+         * new message instead of rewriting the one being sent */
+        queue_unlink(queue, index);
+        MQTT_MUTEX_UNLOCK(queue->mutex);
+        int ret = mqtt_client_publish(queue->client, entry->topic, entry->payload, entry->len, entry->qos);
+        MQTT_MUTEX_LOCK(queue->mutex);
+
+        if (ret != 0) {
+            queue_bucket_charge(&queue->limits[entry->lane], -cost);
+            if (route) queue_bucket_charge(&route->bucket, -cost);
+            if (queue->buckets && queue_lookup(queue, entry->topic, entry->hash) != QUEUE_NONE) {
+                /* Superseded while it was being sent */
+                queue_free(queue, index);
+                queue->stats.conflated++;
+            } else {
+                /* Messages ahead of it in the lane belong to throttled routes */
+                queue_lane_push_front(queue, index);
+                queue_link(queue, index);
+            }
+            queue->stats.stalls++;
+            break;
+        }
+
+        queue_free(queue, index);
+        queue->stats.sent++;
+    }
+
+    queue->draining = 0;
+    return wait_us;
+}
+
+/*
+ * Free entry for a message of a lane; when full, expired messages go first,
+ * then the oldest of a lower lane. Caller holds queue->mutex.
+ */
+static uint16_t queue_alloc(mqtt_queue_t* queue, uint8_t lane) {
+    if (queue->free == QUEUE_NONE) queue_expire_locked(queue, mqtt_os_time_us());
+
+    if (queue->free == QUEUE_NONE) {
+        for (int l = MQTT_QUEUE_LANES - 1; l > lane; l--) {
+            if (queue->lanes[l].count == 0) continue;
+
+            uint16_t victim = queue->lanes[l].head;
+            queue_lane_remove(queue, victim, QUEUE_NONE);
+            queue_unlink(queue, victim);
+            queue_free(queue, victim);
+            queue->stats.evicted++;
+            break;
+        }
+        if (queue->free == QUEUE_NONE) return QUEUE_NONE;
+    }
+
+    uint16_t index = queue->free;
+    queue->free = queue->entries[index].order;
+    queue->count++;
+    return index;
+}
+
+mqtt_queue_t* mqtt_queue_create(mqtt_client_t* client, const mqtt_queue_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!client) return NULL;
+
+    mqtt_queue_t* queue = (mqtt_queue_t*)os->malloc(sizeof(mqtt_queue_t));
+    if (!queue) return NULL;
+    memset(queue, 0, sizeof(mqtt_queue_t));
+    queue->client = client;
+    if (config) queue->config = *config;
+    if (!queue->config.capacity) queue->config.capacity = MQTT_QUEUE_DEFAULT_CAPACITY;
+    if (queue->config.capacity >= QUEUE_NONE) queue->config.capacity = QUEUE_NONE - 1;
+    if (!queue->config.max_payload) queue->config.max_payload = MQTT_QUEUE_DEFAULT_PAYLOAD;
+    if (queue->config.max_payload > MQTT_MAX_PACKET_SIZE) queue->config.max_payload = MQTT_MAX_PACKET_SIZE;
+
+    uint16_t capacity = queue->config.capacity;
+    queue->entries = (queue_entry_t*)os->malloc(capacity * sizeof(queue_entry_t));
+    if (!queue->entries) goto err_free_queue;
+    memset(queue->entries, 0, capacity * sizeof(queue_entry_t));
+
+    queue->payloads = (uint8_t*)os->malloc((size_t)capacity * queue->config.max_payload);
+    if (!queue->payloads) goto err_free_entries;
+    for (uint16_t i = 0; i < capacity; i++) {
+        queue->entries[i].payload = queue->payloads + (size_t)i * queue->config.max_payload;
+        queue->entries[i].order = i + 1 < capacity ? i + 1 : QUEUE_NONE;
+    }
+    queue->free = 0;
+
+    for (int l = 0; l < MQTT_QUEUE_LANES; l++) {
+        queue->lanes[l].head = QUEUE_NONE;
+        queue->lanes[l].tail = QUEUE_NONE;
+        queue_bucket_init(&queue->limits[l], &queue->config.lanes[l]);
+    }
+
+    if (queue->config.policy == MQTT_QUEUE_CONFLATE) {
+        uint32_t size = 1;
+        while (size < capacity) size <<= 1;
+        queue->mask = size - 1;
+
+        queue->buckets = (uint16_t*)os->malloc(size * sizeof(uint16_t));
+        if (!queue->buckets) goto err_free_payloads;
+        memset(queue->buckets, 0xFF, size * sizeof(uint16_t));
+    }
+
+    queue->mutex = os->mutex_create();
+    if (!queue->mutex) goto err_free_buckets;
+    return queue;
+
+err_free_buckets:
+    if (queue->buckets) os->free(queue->buckets);
+err_free_payloads:
+    os->free(queue->payloads);
+err_free_entries:
+    os->free(queue->entries);
+err_free_queue:
+    os->free(queue);
+    return NULL;
+}
+
+void mqtt_queue_destroy(mqtt_queue_t* queue) {
+    if (!queue) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    mqtt_queue_drain(queue);
+
+    os->mutex_destroy(queue->mutex);
+    if (queue->buckets) os->free(queue->buckets);
+    os->free(queue->payloads);
+    os->free(queue->entries);
+    os->free(queue);
+}
+
+int mqtt_queue_publish(mqtt_queue_t* queue, const char* topic, const uint8_t* payload, size_t len, uint8_t qos) {
+    return mqtt_queue_publish_ttl(queue, topic, payload, len, qos, 0);
+}
+
+int mqtt_queue_publish_ttl(mqtt_queue_t* queue, const char* topic, const uint8_t* payload, size_t len,
+                           uint8_t qos, uint32_t ttl_ms) {
+    if (!queue || !topic || (!payload && len > 0)) return -1;
+
+    size_t topic_len = strlen(topic);
+    if (topic_len == 0 || topic_len > QUEUE_TOPIC_MAX || len > queue->config.max_payload) {
+        MQTT_MUTEX_LOCK(queue->mutex);
+        queue->stats.rejected++;
+        MQTT_MUTEX_UNLOCK(queue->mutex);
+        return -1;
+    }
+
+    uint32_t hash = queue_hash(topic, topic_len);
+    uint64_t expires = ttl_ms ? mqtt_os_time_us() + (uint64_t)ttl_ms * 1000 : 0;
+    int ret = 0;
+
+    MQTT_MUTEX_LOCK(queue->mutex);
+
+    uint16_t index = queue->buckets ? queue_lookup(queue, topic, hash) : QUEUE_NONE;
+    if (index != QUEUE_NONE) {
+        queue->stats.conflated++;
+    } else {
+        uint8_t lane = MQTT_QUEUE_TELEMETRY;
+        uint8_t route = QUEUE_NO_ROUTE;
+        for (uint8_t r = 0; r < queue->route_count; r++) {
+            if (mqtt_topic_match(queue->routes[r].filter, topic)) {
+                lane = queue->routes[r].lane;
+                if (queue->routes[r].bucket.rate) route = r;
+                break;
+            }
+        }
+
+        index = queue_alloc(queue, lane);
+        if (index != QUEUE_NONE) {
+            queue_entry_t* entry = &queue->entries[index];
+            memcpy(entry->topic, topic, topic_len + 1);
+            entry->hash = hash;
+            entry->lane = lane;
+            entry->route = route;
+            queue_lane_push(queue, index);
+            queue_link(queue, index);
+        } else {
+            queue->stats.rejected++;
+            ret = -1;
+        }
+    }
+
+    if (index != QUEUE_NONE) {
+        queue_entry_t* entry = &queue->entries[index];
+        if (len > 0) memcpy(entry->payload, payload, len);
+        entry->len = (uint16_t)len;
+        entry->qos = qos;
+        entry->expires = expires;
+        queue->stats.enqueued++;
+        queue_drain_locked(queue);
+    }
+
+    MQTT_MUTEX_UNLOCK(queue->mutex);
+    return ret;
+}
+
+int mqtt_queue_route(mqtt_queue_t* queue, const char* filter, mqtt_queue_lane_t lane,
+                     const mqtt_queue_limit_t* limit) {
+    if (!queue || !filter || (unsigned)lane >= MQTT_QUEUE_LANES) return -1;
+    if (strlen(filter) > QUEUE_TOPIC_MAX) return -1;
+
+    int ret = -1;
+
+    MQTT_MUTEX_LOCK(queue->mutex);
+    if (queue->route_count < MQTT_QUEUE_MAX_ROUTES) {
+        queue_route_t* route = &queue->routes[queue->route_count++];
+        mqtt_queue_limit_t none = { 0, 0 };
+        strcpy(route->filter, filter);
+        route->lane = (uint8_t)lane;
+        queue_bucket_init(&route->bucket, limit ? limit : &none);
+        ret = 0;
+    }
+    MQTT_MUTEX_UNLOCK(queue->mutex);
+
+    return ret;
+}
+
+int mqtt_queue_drain(mqtt_queue_t* queue) {
+    if (!queue) return -1;
+
+    MQTT_MUTEX_LOCK(queue->mutex);
+    queue_drain_locked(queue);
+    int left = queue->count;
+    MQTT_MUTEX_UNLOCK(queue->mutex);
+    return left;
+}
+
+uint32_t mqtt_queue_poll(mqtt_queue_t* queue) {
+    if (!queue) return UINT32_MAX;
+
+    MQTT_MUTEX_LOCK(queue->mutex);
+    queue_expire_locked(queue, mqtt_os_time_us());
+    uint64_t wait_us = queue_drain_locked(queue);
+    MQTT_MUTEX_UNLOCK(queue->mutex);
+
+    if (wait_us == UINT64_MAX) return UINT32_MAX;
+    uint64_t wait_ms = (wait_us + 999) / 1000;
+    return wait_ms < UINT32_MAX ? (uint32_t)wait_ms : UINT32_MAX - 1;
+}
+
+int mqtt_queue_get_stats(mqtt_queue_t* queue, mqtt_queue_stats_t* stats) {
+    if (!queue || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(queue->mutex);
+    memcpy(stats, &queue->stats, sizeof(mqtt_queue_stats_t));
+    stats->depth = queue->count;
+    for (int l = 0; l < MQTT_QUEUE_LANES; l++) stats->lane_depth[l] = queue->lanes[l].count;
+    MQTT_MUTEX_UNLOCK(queue->mutex);
+    return 0;
+}
@@ -0,0 +1,368 @@
+/**
+ * @file mqtt_rpc.c
+ * @brief Request/response helper implementation
+ */
+
+#include "mqtt_rpc.h"
+#include <string.h>
+
+/** @brief Longest reply topic, bounded by the client's subscription table */
+#define RPC_TOPIC_MAX   (sizeof(((mqtt_subscription_t*)0)->topic) - 1)
+
+/** @brief Largest call table */
+#define RPC_MAX_CALLS   65536u
+
+#define RPC_NONE        (-1)
+
+typedef enum {
+    RPC_CALL_FREE = 0,
+    RPC_CALL_PENDING,     /* Linked into a wheel bucket */
+    RPC_CALL_COMPLETING   /* Unlinked, callback running outside the lock */
+} rpc_call_state_t;
+
+typedef struct {
+    uint32_t id;                 /* Generation << bits | table index */
+    uint32_t deadline;           /* Wheel tick */
+    uint64_t sent_time;
+    mqtt_rpc_callback_t cb;
+    void* user_data;
+    int32_t prev;                /* Bucket links, next also links the free list */
+    int32_t next;
+    uint8_t state;
+} rpc_call_t;
+
+struct mqtt_rpc {
+    mqtt_client_t* client;
+    mqtt_mutex_t mutex;          /* Call table, wheel and stats */
+    mqtt_mutex_t tx_mutex;       /* tx_buf */
+    char reply_topic[RPC_TOPIC_MAX + 1];
+    uint16_t reply_topic_len;
+    uint8_t bits;                /* log2 of the table size */
+    rpc_call_t* calls;
+    int32_t free_head;
+    int32_t wheel[MQTT_RPC_WHEEL_SLOTS];
+    uint32_t wheel_tick;         /* Last tick expired by mqtt_rpc_poll() */
+    uint32_t generation;
+    mqtt_rpc_stats_t stats;
+    uint8_t tx_buf[MQTT_MAX_PACKET_SIZE];
+};
+
+static uint32_t rpc_now_tick(void) {
+    return (uint32_t)(mqtt_os_time_us() / (MQTT_RPC_TICK_MS * 1000));
+}
+
+/* Wire size of a QoS 1 PUBLISH, to reject requests that overflow the send buffer */
+static size_t rpc_publish_size(const char* topic, size_t payload_len) {
+    size_t remaining = 2 + strlen(topic) + 2 + payload_len;
+    return 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4) + remaining;
+}
+
+static void put_u32(uint8_t* buf, uint32_t value) {
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value & 0xFF;
+}
+
+static uint32_t get_u32(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+/* Caller holds rpc->mutex */
+static void rpc_wheel_link(mqtt_rpc_t* rpc, int32_t index) {
+    rpc_call_t* call = &rpc->calls[index];
+    int32_t* head = &rpc->wheel[call->deadline & (MQTT_RPC_WHEEL_SLOTS - 1)];
+
+    call->prev = RPC_NONE;
+    call->next = *head;
+    if (*head != RPC_NONE) rpc->calls[*head].prev = index;
+    *head = index;
+}
+
+/* Caller holds rpc->mutex */
+static void rpc_wheel_unlink(mqtt_rpc_t* rpc, int32_t index) {
+    rpc_call_t* call = &rpc->calls[index];
+
+    if (call->prev != RPC_NONE) {
+        rpc->calls[call->prev].next = call->next;
+    } else {
+        rpc->wheel[call->deadline & (MQTT_RPC_WHEEL_SLOTS - 1)] = call->next;
+    }
+    if (call->next != RPC_NONE) rpc->calls[call->next].prev = call->prev;
+}
+
+/* Caller holds rpc->mutex */
+static void rpc_call_free(mqtt_rpc_t* rpc, int32_t index) {
+    rpc->calls[index].state = RPC_CALL_FREE;
+    rpc->calls[index].next = rpc->free_head;
+    rpc->free_head = index;
+    rpc->stats.outstanding--;
+}
+
+static void rpc_on_reply(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    mqtt_rpc_t* rpc = (mqtt_rpc_t*)user_data;
+    (void)topic;
+
+    if (len < MQTT_RPC_REPLY_HDR_LEN || payload[0] != MQTT_RPC_VERSION) return;
+
+    uint32_t id = get_u32(payload + 1);
+    int32_t index = (int32_t)(id & ((1u << rpc->bits) - 1));
+    rpc_call_t* call = &rpc->calls[index];
+
+    MQTT_MUTEX_LOCK(rpc->mutex);
+    if (call->state != RPC_CALL_PENDING || call->id != id) {
+        rpc->stats.unmatched++;
+        MQTT_MUTEX_UNLOCK(rpc->mutex);
+        return;
+    }
+    rpc_wheel_unlink(rpc, index);
+    mqtt_hist_record(&rpc->stats.latency, (uint32_t)(mqtt_os_time_us() - call->sent_time));
+    rpc->stats.replies++;
+    mqtt_rpc_callback_t cb = call->cb;
+    void* cb_data = call->user_data;
+    rpc_call_free(rpc, index);
+    MQTT_MUTEX_UNLOCK(rpc->mutex);
+
+    cb(MQTT_RPC_OK, payload + MQTT_RPC_REPLY_HDR_LEN, len - MQTT_RPC_REPLY_HDR_LEN, cb_data);
+}
+
+mqtt_rpc_t* mqtt_rpc_create(mqtt_client_t* client, const mqtt_rpc_config_t* config) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    uint32_t max_calls = config && config->max_calls ? config->max_calls : MQTT_RPC_DEFAULT_CALLS;
+    if (!client || max_calls > RPC_MAX_CALLS) return NULL;
+
+    mqtt_rpc_t* rpc = (mqtt_rpc_t*)os->malloc(sizeof(mqtt_rpc_t));
+    if (!rpc) return NULL;
+    memset(rpc, 0, sizeof(mqtt_rpc_t));
+    rpc->client = client;
+
+    size_t topic_len;
+    if (config && config->reply_topic) {
+        topic_len = strlen(config->reply_topic);
+        if (topic_len > RPC_TOPIC_MAX) goto err_free_rpc;
+        memcpy(rpc->reply_topic, config->reply_topic, topic_len);
+    } else {
+        static const char suffix[] = "/rpc/reply";
+        size_t id_len = strlen(client->config.client_id);
+        if (id_len + sizeof(suffix) - 1 > RPC_TOPIC_MAX) goto err_free_rpc;
+        memcpy(rpc->reply_topic, client->config.client_id, id_len);
+        memcpy(rpc->reply_topic + id_len, suffix, sizeof(suffix));
+        topic_len = id_len + sizeof(suffix) - 1;
+    }
+    rpc->reply_topic_len = (uint16_t)topic_len;
+
+    while ((1u << rpc->bits) < max_calls) rpc->bits++;
+    uint32_t size = 1u << rpc->bits;
+    rpc->calls = (rpc_call_t*)os->malloc(size * sizeof(rpc_call_t));
+    if (!rpc->calls) goto err_free_rpc;
+    memset(rpc->calls, 0, size * sizeof(rpc_call_t));
+    for (uint32_t i = 0; i < size; i++) {
+        rpc->calls[i].next = i + 1 < size ? (int32_t)(i + 1) : RPC_NONE;
+    }
+    rpc->free_head = 0;
+    for (int i = 0; i < MQTT_RPC_WHEEL_SLOTS; i++) rpc->wheel[i] = RPC_NONE;
+    rpc->wheel_tick = rpc_now_tick();
+
+    rpc->mutex = os->mutex_create();
+    if (!rpc->mutex) goto err_free_calls;
+    rpc->tx_mutex = os->mutex_create();
+    if (!rpc->tx_mutex) goto err_destroy_mutex;
+
+    /*
+     * QoS 0: a lost reply already ends in the call's timeout, so a PUBACK
+     * per reply would only add traffic on the receive thread
+     */
+    if (mqtt_client_subscribe_cb(client, rpc->reply_topic, 0, rpc_on_reply, rpc) != 0) {
+        goto err_destroy_mutex;
+    }
+    return rpc;
+
+err_destroy_mutex:
+    if (rpc->tx_mutex) os->mutex_destroy(rpc->tx_mutex);
+    os->mutex_destroy(rpc->mutex);
+err_free_calls:
+    os->free(rpc->calls);
+err_free_rpc:
+    os->free(rpc);
+    return NULL;
+}
+
+void mqtt_rpc_destroy(mqtt_rpc_t* rpc) {
+    if (!rpc) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    /* The client is gone, so nothing else touches the table */
+    for (int i = 0; i < MQTT_RPC_WHEEL_SLOTS; i++) {
+        for (int32_t index = rpc->wheel[i]; index != RPC_NONE; index = rpc->calls[index].next) {
+            rpc->calls[index].cb(MQTT_RPC_CANCELLED, NULL, 0, rpc->calls[index].user_data);
+        }
+    }
+
+    os->mutex_destroy(rpc->tx_mutex);
+    os->mutex_destroy(rpc->mutex);
+    os->free(rpc->calls);
+    os->free(rpc);
+}
+
+int mqtt_rpc_call(mqtt_rpc_t* rpc, const char* topic, const uint8_t* payload, size_t len,
+                  uint32_t timeout_ms, mqtt_rpc_callback_t cb, void* user_data) {
+    if (!rpc || !topic || !cb || (!payload && len > 0)) return -1;
+
+    size_t envelope = MQTT_RPC_REQUEST_HDR_LEN + rpc->reply_topic_len;
+    if (rpc_publish_size(topic, envelope + len) > MQTT_MAX_PACKET_SIZE) return -1;
+
+    MQTT_MUTEX_LOCK(rpc->mutex);
+
+    int32_t index = rpc->free_head;
+    if (index == RPC_NONE) {
+        MQTT_MUTEX_UNLOCK(rpc->mutex);
+        return -1;
+    }
+    rpc_call_t* call = &rpc->calls[index];
+    rpc->free_head = call->next;
+    rpc->stats.outstanding++;
+
+    uint32_t id = (++rpc->generation << rpc->bits) | (uint32_t)index;
+    call->id = id;
+    call->cb = cb;
+    call->user_data = user_data;
+    call->sent_time = mqtt_os_time_us();
+    /* Round up so a call never expires early */
+    call->deadline = rpc_now_tick() + (timeout_ms + MQTT_RPC_TICK_MS - 1) / MQTT_RPC_TICK_MS + 1;
+    call->state = RPC_CALL_PENDING;
+    rpc_wheel_link(rpc, index);
+    rpc->stats.calls++;
+
+    MQTT_MUTEX_UNLOCK(rpc->mutex);
+
+    /* Registered first, as the reply may arrive before the publish returns */
+    MQTT_MUTEX_LOCK(rpc->tx_mutex);
+    uint8_t* p = rpc->tx_buf;
+    *p++ = MQTT_RPC_VERSION;
+    *p++ = rpc->reply_topic_len >> 8;
+    *p++ = rpc->reply_topic_len & 0xFF;
+    memcpy(p, rpc->reply_topic, rpc->reply_topic_len);
+    p += rpc->reply_topic_len;
+    put_u32(p, id);
+    p += 4;
+    if (len > 0) memcpy(p, payload, len);
+    int ret = mqtt_client_publish(rpc->client, topic, rpc->tx_buf, envelope + len, 1);
+    MQTT_MUTEX_UNLOCK(rpc->tx_mutex);
+
+    if (ret != 0) {
+        MQTT_MUTEX_LOCK(rpc->mutex);
+        /* Unless mqtt_rpc_poll() already expired it, the call never happened */
+        if (call->state == RPC_CALL_PENDING && call->id == id) {
+            rpc_wheel_unlink(rpc, index);
+            rpc_call_free(rpc, index);
+            rpc->stats.calls--;
+        } else {
+            ret = 0;
+        }
+        MQTT_MUTEX_UNLOCK(rpc->mutex);
+    }
+    return ret;
+}
+
+uint32_t mqtt_rpc_poll(mqtt_rpc_t* rpc) {
+    if (!rpc) return UINT32_MAX;
+
+    uint32_t now = rpc_now_tick();
+    int32_t expired = RPC_NONE;
+
+    MQTT_MUTEX_LOCK(rpc->mutex);
+
+    /* Walk the buckets passed since the last poll, at most one revolution */
+    uint32_t ticks = now - rpc->wheel_tick;
+    if (ticks >= MQTT_RPC_WHEEL_SLOTS) ticks = MQTT_RPC_WHEEL_SLOTS - 1;
+    for (uint32_t t = now - ticks; t != now + 1; t++) {
+        int32_t index = rpc->wheel[t & (MQTT_RPC_WHEEL_SLOTS - 1)];
+        while (index != RPC_NONE) {
+            rpc_call_t* call = &rpc->calls[index];
+            int32_t next = call->next;
+            /* Later revolutions share the bucket */
+            if ((int32_t)(call->deadline - now) <= 0) {
+                rpc_wheel_unlink(rpc, index);
+                call->state = RPC_CALL_COMPLETING;
+                call->next = expired;
+                expired = index;
+                rpc->stats.timeouts++;
+            }
+            index = next;
+        }
+    }
+    rpc->wheel_tick = now;
+
+    MQTT_MUTEX_UNLOCK(rpc->mutex);
+
+    /* Completing entries are not reused or matched until freed below */
+    for (int32_t index = expired; index != RPC_NONE; index = rpc->calls[index].next) {
+        rpc->calls[index].cb(MQTT_RPC_TIMEOUT, NULL, 0, rpc->calls[index].user_data);
+    }
+
+    MQTT_MUTEX_LOCK(rpc->mutex);
+    while (expired != RPC_NONE) {
+        int32_t next = rpc->calls[expired].next;
+        rpc_call_free(rpc, expired);
+        expired = next;
+    }
+
+    uint32_t wait = UINT32_MAX;
+    if (rpc->stats.outstanding > 0) {
+        for (uint32_t t = 1; t < MQTT_RPC_WHEEL_SLOTS; t++) {
+            if (rpc->wheel[(now + t) & (MQTT_RPC_WHEEL_SLOTS - 1)] != RPC_NONE) {
+                wait = t * MQTT_RPC_TICK_MS;
+                break;
+            }
+        }
+        if (wait == UINT32_MAX) wait = MQTT_RPC_WHEEL_SLOTS * MQTT_RPC_TICK_MS;
+    }
+    MQTT_MUTEX_UNLOCK(rpc->mutex);
+    return wait;
+}
+
+int mqtt_rpc_get_stats(mqtt_rpc_t* rpc, mqtt_rpc_stats_t* stats) {
+    if (!rpc || !stats) return -1;
+
+    MQTT_MUTEX_LOCK(rpc->mutex);
+    memcpy(stats, &rpc->stats, sizeof(mqtt_rpc_stats_t));
+    MQTT_MUTEX_UNLOCK(rpc->mutex);
+    return 0;
+}
+
+int mqtt_rpc_parse_request(const uint8_t* data, size_t len, mqtt_rpc_request_t* req) {
+    if (!data || !req || len < MQTT_RPC_REQUEST_HDR_LEN || data[0] != MQTT_RPC_VERSION) return -1;
+
+    uint16_t topic_len = (data[1] << 8) | data[2];
+    if (topic_len == 0 || len < (size_t)MQTT_RPC_REQUEST_HDR_LEN + topic_len) return -1;
+
+    req->reply_topic = (const char*)data + 3;
+    req->reply_topic_len = topic_len;
+    req->id = get_u32(data + 3 + topic_len);
+    req->payload = data + MQTT_RPC_REQUEST_HDR_LEN + topic_len;
+    req->len = len - MQTT_RPC_REQUEST_HDR_LEN - topic_len;
+    return 0;
+}
+
+int mqtt_rpc_reply(mqtt_client_t* client, const mqtt_rpc_request_t* req,
+                   const uint8_t* payload, size_t len) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    char topic[RPC_TOPIC_MAX + 1];
+
+    if (!client || !req || req->reply_topic_len > RPC_TOPIC_MAX || (!payload && len > 0)) return -1;
+    memcpy(topic, req->reply_topic, req->reply_topic_len);
+    topic[req->reply_topic_len] = '\0';
+    if (rpc_publish_size(topic, MQTT_RPC_REPLY_HDR_LEN + len) > MQTT_MAX_PACKET_SIZE) return -1;
+
+    /* Replies usually run on the receive thread, keep the envelope off its stack */
+    uint8_t* buf = (uint8_t*)os->malloc(MQTT_RPC_REPLY_HDR_LEN + len);
+    if (!buf) return -1;
+    buf[0] = MQTT_RPC_VERSION;
+    put_u32(buf + 1, req->id);
+    if (len > 0) memcpy(buf + MQTT_RPC_REPLY_HDR_LEN, payload, len);
+
+    int ret = mqtt_client_publish(client, topic, buf, MQTT_RPC_REPLY_HDR_LEN + len, 1);
+    os->free(buf);
+    return ret;
+}
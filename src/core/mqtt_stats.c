@@ -0,0 +1,58 @@
+/**
+ * @file mqtt_stats.c
+ * @brief MQTT latency histogram implementation
+ */
+
+#include "mqtt_stats.h"
+
+static int hist_bucket_index(uint32_t value_us) {
+    int index = 0;
+    while (value_us > 1 && index < MQTT_HIST_BUCKETS - 1) {
+        value_us >>= 1;
+        index++;
+    }
+    return index;
+}
+
+void mqtt_hist_record(mqtt_histogram_t* hist, uint32_t value_us) {
+    if (hist->count == 0 || value_us < hist->min_us) hist->min_us = value_us;
+    if (value_us > hist->max_us) hist->max_us = value_us;
+    hist->count++;
+    hist->sum_us += value_us;
+    hist->buckets[hist_bucket_index(value_us)]++;
+}
+
+void mqtt_hist_merge(mqtt_histogram_t* dst, const mqtt_histogram_t* src) {
+    if (src->count == 0) return;
+    if (dst->count == 0 || src->min_us < dst->min_us) dst->min_us = src->min_us;
+    if (src->max_us > dst->max_us) dst->max_us = src->max_us;
+    dst->count += src->count;
+    dst->sum_us += src->sum_us;
+    for (int i = 0; i < MQTT_HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+uint32_t mqtt_hist_bucket_upper(int index) {
+    if (index >= MQTT_HIST_BUCKETS - 1) return UINT32_MAX;
+    return (2u << index) - 1;
+}
+
+uint32_t mqtt_hist_percentile(const mqtt_histogram_t* hist, uint32_t percent) {
+    if (hist->count == 0) return 0;
+    if (percent > 100) percent = 100;
+
+    /* Rank of the sample we are looking for, rounded up */
+    uint64_t rank = ((uint64_t)hist->count * percent + 99) / 100;
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < MQTT_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint32_t upper = mqtt_hist_bucket_upper(i);
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
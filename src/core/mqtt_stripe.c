@@ -0,0 +1,144 @@
+/**
+ * @file mqtt_stripe.c
+ * @brief Striped publisher implementation
+ */
+
+#include "mqtt_stripe.h"
+#include <string.h>
+
+/** @brief Room for the "-NN" suffix and terminator */
+#define STRIPE_ID_SUFFIX_LEN    4
+
+struct mqtt_stripe {
+    uint8_t count;
+    mqtt_client_t* clients[MQTT_STRIPE_MAX_CONNECTIONS];
+    char* ids;                   /* count client IDs of id_size bytes, referenced by the clients */
+};
+
+/* FNV-1a, cheap and well spread for short topic strings */
+static uint32_t stripe_hash(const char* topic) {
+    uint32_t hash = 2166136261u;
+    while (*topic) {
+        hash ^= (uint8_t)*topic++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+mqtt_stripe_t* mqtt_stripe_create(const mqtt_config_t* config, uint8_t connections) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    if (!os || !config || !config->client_id ||
+        connections == 0 || connections > MQTT_STRIPE_MAX_CONNECTIONS) {
+        return NULL;
+    }
+
+    mqtt_stripe_t* stripe = (mqtt_stripe_t*)os->malloc(sizeof(mqtt_stripe_t));
+    if (!stripe) return NULL;
+    memset(stripe, 0, sizeof(mqtt_stripe_t));
+
+    size_t id_size = strlen(config->client_id) + STRIPE_ID_SUFFIX_LEN;
+    stripe->ids = (char*)os->malloc(id_size * connections);
+    if (!stripe->ids) {
+        os->free(stripe);
+        return NULL;
+    }
+
+    mqtt_config_t client_config = *config;
+    for (uint8_t i = 0; i < connections; i++) {
+        char* id = stripe->ids + i * id_size;
+        char* p = id + id_size - STRIPE_ID_SUFFIX_LEN;
+        memcpy(id, config->client_id, id_size - STRIPE_ID_SUFFIX_LEN);
+        *p++ = '-';
+        if (i >= 10) *p++ = '0' + i / 10;
+        *p++ = '0' + i % 10;
+        *p = '\0';
+        client_config.client_id = id;
+
+        stripe->clients[i] = mqtt_client_create(&client_config);
+        if (!stripe->clients[i]) {
+            mqtt_stripe_destroy(stripe);
+            return NULL;
+        }
+        stripe->count++;
+    }
+    return stripe;
+}
+
+void mqtt_stripe_destroy(mqtt_stripe_t* stripe) {
+    if (!stripe) return;
+
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    for (uint8_t i = 0; i < stripe->count; i++) {
+        mqtt_client_destroy(stripe->clients[i]);
+    }
+    os->free(stripe->ids);
+    os->free(stripe);
+}
+
+uint8_t mqtt_stripe_index(const mqtt_stripe_t* stripe, const char* topic) {
+    return (uint8_t)(stripe_hash(topic) % stripe->count);
+}
+
+int mqtt_stripe_publish(mqtt_stripe_t* stripe, const char* topic, const uint8_t* payload,
+                        size_t len, uint8_t qos) {
+    if (!stripe || !topic) return -1;
+    return mqtt_client_publish(stripe->clients[mqtt_stripe_index(stripe, topic)], topic, payload, len, qos);
+}
+
+int mqtt_stripe_subscribe(mqtt_stripe_t* stripe, const char* topic, uint8_t qos) {
+    if (!stripe) return -1;
+    return mqtt_client_subscribe(stripe->clients[0], topic, qos);
+}
+
+mqtt_client_t* mqtt_stripe_client(mqtt_stripe_t* stripe, uint8_t index) {
+    if (!stripe || index >= stripe->count) return NULL;
+    return stripe->clients[index];
+}
+
+int mqtt_stripe_connected(mqtt_stripe_t* stripe) {
+    int connected = 0;
+    if (!stripe) return 0;
+
+    for (uint8_t i = 0; i < stripe->count; i++) {
+        connected += mqtt_client_is_connected(stripe->clients[i]);
+    }
+    return connected;
+}
+
+int mqtt_stripe_get_stats(mqtt_stripe_t* stripe, mqtt_stats_t* stats) {
+    mqtt_stats_t one;
+    if (!stripe || !stats) return -1;
+
+    memset(stats, 0, sizeof(mqtt_stats_t));
+    for (uint8_t i = 0; i < stripe->count; i++) {
+        if (mqtt_client_get_stats(stripe->clients[i], &one) != 0) return -1;
+
+        stats->tx_packets += one.tx_packets;
+        stats->rx_packets += one.rx_packets;
+        stats->tx_bytes += one.tx_bytes;
+        stats->rx_bytes += one.rx_bytes;
+        stats->publish_sent += one.publish_sent;
+        stats->publish_received += one.publish_received;
+        stats->reconnects += one.reconnects;
+        stats->ping_timeouts += one.ping_timeouts;
+        stats->local_delivered += one.local_delivered;
+        stats->echoes_suppressed += one.echoes_suppressed;
+        stats->inflight += one.inflight;
+        if (one.srtt_us > stats->srtt_us) {
+            stats->srtt_us = one.srtt_us;
+            stats->rttvar_us = one.rttvar_us;
+        }
+        mqtt_hist_merge(&stats->ping_rtt, &one.ping_rtt);
+        mqtt_hist_merge(&stats->puback_latency, &one.puback_latency);
+    }
+    return 0;
+}
+
+void mqtt_stripe_reset_stats(mqtt_stripe_t* stripe) {
+    if (!stripe) return;
+
+    for (uint8_t i = 0; i < stripe->count; i++) {
+        mqtt_client_reset_stats(stripe->clients[i]);
+    }
+}
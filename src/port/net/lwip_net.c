@@ -86,7 +86,7 @@ static int lwip_net_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t
     return ret;
 }
 
-static const mqtt_net_api_t lwip_net_api = {
+MQTT_NET_PORT_API(lwip_net_api) = {
     .connect = lwip_net_connect,
     .disconnect = lwip_net_disconnect,
     .send = lwip_net_send,
@@ -0,0 +1,298 @@
+/**
+ * @file lwip_raw_net.c
+ * @brief lwIP raw API network abstraction layer implementation
+ *
+ * Alternative to lwip_net.c that bypasses the BSD socket emulation. The
+ * connection lives directly on a tcp_pcb: lwIP callbacks queue received
+ * pbuf chains and wake the waiting thread through an OS port event, and
+ * recv() copies straight out of the pbufs. Receive window updates are
+ * deferred until the data is consumed, so a slow reader throttles the
+ * peer instead of exhausting the pbuf pool.
+ *
+ * Requires LWIP_TCPIP_CORE_LOCKING (raw API calls are made from
+ * application threads under the core lock) and an OS port providing
+ * events.
+ */
+
+#include "mqtt_net.h"
+#include "mqtt_os.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/ip_addr.h"
+#include "lwip/api.h"
+#include <string.h>
+
+#if !LWIP_TCPIP_CORE_LOCKING
+#error "lwip_raw_net.c requires LWIP_TCPIP_CORE_LOCKING"
+#endif
+
+/** @brief Writes of at least this many bytes are queued without copying */
+#ifndef MQTT_LWIP_ZEROCOPY_MIN
+#define MQTT_LWIP_ZEROCOPY_MIN      512
+#endif
+
+/** @brief Longest a send waits for send buffer space or acknowledgement */
+#ifndef MQTT_LWIP_SEND_TIMEOUT_MS
+#define MQTT_LWIP_SEND_TIMEOUT_MS   10000
+#endif
+
+typedef struct {
+    struct tcp_pcb* pcb;     /* NULL once lwIP freed it after an error */
+    struct pbuf* rx;         /* Received data not yet consumed */
+    u16_t rx_offset;         /* Bytes of rx->payload already consumed */
+    mqtt_event_t rx_event;   /* Data, close or error */
+    mqtt_event_t tx_event;   /* Connected, data acknowledged or error */
+    uint32_t written;        /* Bytes handed to tcp_write() */
+    uint32_t acked;          /* Bytes acknowledged by the peer */
+    int connected;
+    int closed;              /* Peer sent FIN */
+    err_t err;               /* Fatal error reported by lwIP */
+} lwip_raw_conn_t;
+
+/* Callbacks run in the tcpip thread with the core lock held */
+
+static err_t lwip_raw_connected_cb(void* arg, struct tcp_pcb* pcb, err_t err) {
+    lwip_raw_conn_t* conn = (lwip_raw_conn_t*)arg;
+    (void)pcb;
+
+    conn->connected = (err == ERR_OK);
+    if (err != ERR_OK) conn->err = err;
+    mqtt_os_get()->event_set(conn->tx_event);
+    return ERR_OK;
+}
+
+static err_t lwip_raw_recv_cb(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err) {
+    lwip_raw_conn_t* conn = (lwip_raw_conn_t*)arg;
+    (void)pcb;
+
+    if (!p) {
+        conn->closed = 1;
+    } else if (err != ERR_OK) {
+        pbuf_free(p);
+        return ERR_OK;
+    } else if (conn->rx) {
+        pbuf_cat(conn->rx, p);
+    } else {
+        conn->rx = p;
+        conn->rx_offset = 0;
+    }
+    mqtt_os_get()->event_set(conn->rx_event);
+    return ERR_OK;
+}
+
+static err_t lwip_raw_sent_cb(void* arg, struct tcp_pcb* pcb, u16_t len) {
+    lwip_raw_conn_t* conn = (lwip_raw_conn_t*)arg;
+    (void)pcb;
+
+    conn->acked += len;
+    mqtt_os_get()->event_set(conn->tx_event);
+    return ERR_OK;
+}
+
+static void lwip_raw_err_cb(void* arg, err_t err) {
+    lwip_raw_conn_t* conn = (lwip_raw_conn_t*)arg;
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    /* The pcb is already freed */
+    conn->pcb = NULL;
+    conn->err = err;
+    os->event_set(conn->rx_event);
+    os->event_set(conn->tx_event);
+}
+
+/* Wait for a callback; returns -1 once the deadline has passed */
+static int lwip_raw_wait(mqtt_event_t event, uint64_t deadline_us) {
+    uint64_t now = mqtt_os_time_us();
+    if (now >= deadline_us) return -1;
+    mqtt_os_get()->event_wait(event, (uint32_t)((deadline_us - now + 999) / 1000));
+    return 0;
+}
+
+/* Detach and close the pcb, core lock held. Aborting drops queued segments. */
+static void lwip_raw_close_pcb(lwip_raw_conn_t* conn, int abort) {
+    struct tcp_pcb* pcb = conn->pcb;
+    if (!pcb) return;
+
+    conn->pcb = NULL;
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+    if (abort || tcp_close(pcb) != ERR_OK) tcp_abort(pcb);
+}
+
+static void lwip_raw_free(lwip_raw_conn_t* conn) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+
+    LOCK_TCPIP_CORE();
+    lwip_raw_close_pcb(conn, !conn->connected);
+    if (conn->rx) pbuf_free(conn->rx);
+    UNLOCK_TCPIP_CORE();
+
+    if (conn->rx_event) os->event_destroy(conn->rx_event);
+    if (conn->tx_event) os->event_destroy(conn->tx_event);
+    os->free(conn);
+}
+
+static int lwip_raw_resolve(const char* host, ip_addr_t* addr) {
+    if (ipaddr_aton(host, addr)) return 0;
+#if LWIP_DNS && LWIP_NETCONN
+    return netconn_gethostbyname(host, addr) == ERR_OK ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+static mqtt_socket_t lwip_raw_connect(const char* host, uint16_t port, uint32_t timeout_ms) {
+    const mqtt_os_api_t* os = mqtt_os_get();
+    uint64_t deadline = mqtt_os_time_us() + (uint64_t)timeout_ms * 1000;
+    ip_addr_t addr;
+
+    if (!os->event_create || lwip_raw_resolve(host, &addr) != 0) return NULL;
+
+    lwip_raw_conn_t* conn = os->malloc(sizeof(lwip_raw_conn_t));
+    if (!conn) return NULL;
+    memset(conn, 0, sizeof(lwip_raw_conn_t));
+
+    conn->rx_event = os->event_create();
+    conn->tx_event = os->event_create();
+    if (!conn->rx_event || !conn->tx_event) {
+        lwip_raw_free(conn);
+        return NULL;
+    }
+
+    LOCK_TCPIP_CORE();
+    conn->pcb = tcp_new_ip_type(IP_GET_TYPE(&addr));
+    err_t err = ERR_MEM;
+    if (conn->pcb) {
+        tcp_arg(conn->pcb, conn);
+        tcp_recv(conn->pcb, lwip_raw_recv_cb);
+        tcp_sent(conn->pcb, lwip_raw_sent_cb);
+        tcp_err(conn->pcb, lwip_raw_err_cb);
+        tcp_nagle_disable(conn->pcb);  /* MQTT packets are small and latency bound */
+        err = tcp_connect(conn->pcb, &addr, port, lwip_raw_connected_cb);
+    }
+    UNLOCK_TCPIP_CORE();
+    if (err != ERR_OK) {
+        lwip_raw_free(conn);
+        return NULL;
+    }
+
+    /* tcp_connect() only sends the SYN, completion arrives via callback */
+    for (;;) {
+        LOCK_TCPIP_CORE();
+        int done = conn->connected || conn->err != ERR_OK;
+        UNLOCK_TCPIP_CORE();
+        if (done) break;
+        if (lwip_raw_wait(conn->tx_event, deadline) != 0) break;
+    }
+
+    if (!conn->connected) {
+        lwip_raw_free(conn);  /* Aborts a still pending SYN */
+        return NULL;
+    }
+    return (mqtt_socket_t)conn;
+}
+
+static void lwip_raw_disconnect(mqtt_socket_t sock) {
+    lwip_raw_free((lwip_raw_conn_t*)sock);
+}
+
+static int lwip_raw_send(mqtt_socket_t sock, const uint8_t* buf, size_t len) {
+    lwip_raw_conn_t* conn = (lwip_raw_conn_t*)sock;
+    uint64_t deadline = mqtt_os_time_us() + (uint64_t)MQTT_LWIP_SEND_TIMEOUT_MS * 1000;
+
+    /*
+     * Large writes are queued by reference and must stay valid until the
+     * peer acknowledges them, so they return only after the ACK. Small
+     * writes are copied into lwIP and return as soon as they are queued.
+     */
+    int zero_copy = len >= MQTT_LWIP_ZEROCOPY_MIN;
+    u8_t flags = zero_copy ? 0 : TCP_WRITE_FLAG_COPY;
+    size_t sent = 0;
+
+    for (;;) {
+        int failed, done;
+
+        LOCK_TCPIP_CORE();
+        failed = !conn->pcb || conn->err != ERR_OK;
+        while (!failed && sent < len) {
+            u16_t n = tcp_sndbuf(conn->pcb);
+            if (n > len - sent) n = (u16_t)(len - sent);
+            if (n == 0) break;
+
+            err_t err = tcp_write(conn->pcb, buf + sent, n,
+                                  flags | (sent + n < len ? TCP_WRITE_FLAG_MORE : 0));
+            if (err == ERR_MEM) break;  /* Segment queue full, wait for ACKs */
+            if (err != ERR_OK) {
+                failed = 1;
+                break;
+            }
+            conn->written += n;
+            sent += n;
+        }
+        if (!failed) tcp_output(conn->pcb);
+        done = sent == len && (!zero_copy || (int32_t)(conn->acked - conn->written) >= 0);
+        UNLOCK_TCPIP_CORE();
+
+        if (failed) return -1;
+        if (done) return (int)len;
+        if (lwip_raw_wait(conn->tx_event, deadline) != 0) {
+            /* Queued segments may still reference buf */
+            if (zero_copy) {
+                LOCK_TCPIP_CORE();
+                lwip_raw_close_pcb(conn, 1);
+                conn->err = ERR_TIMEOUT;
+                UNLOCK_TCPIP_CORE();
+            }
+            return -1;
+        }
+    }
+}
+
+static int lwip_raw_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t timeout_ms) {
+    lwip_raw_conn_t* conn = (lwip_raw_conn_t*)sock;
+    uint64_t deadline = mqtt_os_time_us() + (uint64_t)timeout_ms * 1000;
+
+    if (len > 0xFFFF) len = 0xFFFF;  /* tcp_recved() takes u16_t */
+
+    for (;;) {
+        int copied = 0, finished;
+
+        LOCK_TCPIP_CORE();
+        while (conn->rx && (size_t)copied < len) {
+            struct pbuf* p = conn->rx;
+            u16_t n = p->len - conn->rx_offset;
+            if (n > len - copied) n = (u16_t)(len - copied);
+            memcpy(buf + copied, (const uint8_t*)p->payload + conn->rx_offset, n);
+            copied += n;
+            conn->rx_offset += n;
+
+            if (conn->rx_offset == p->len) {
+                /* Release only the head, the rest of the chain stays queued */
+                conn->rx = p->next;
+                conn->rx_offset = 0;
+                if (conn->rx) pbuf_ref(conn->rx);
+                pbuf_free(p);
+            }
+        }
+        if (copied > 0 && conn->pcb) tcp_recved(conn->pcb, (u16_t)copied);
+        finished = conn->closed || conn->err != ERR_OK;
+        UNLOCK_TCPIP_CORE();
+
+        if (copied > 0) return copied;
+        if (finished) return -1;
+        if (lwip_raw_wait(conn->rx_event, deadline) != 0) return 0;
+    }
+}
+
+MQTT_NET_PORT_API(lwip_raw_net_api) = {
+    .connect = lwip_raw_connect,
+    .disconnect = lwip_raw_disconnect,
+    .send = lwip_raw_send,
+    .recv = lwip_raw_recv
+};
+
+void mqtt_lwip_raw_init(void) {
+    mqtt_net_init(&lwip_raw_net_api);
+}
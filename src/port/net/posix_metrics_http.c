@@ -0,0 +1,135 @@
+/**
+ * @file posix_metrics_http.c
+ * @brief Minimal HTTP listener serving OpenMetrics client statistics (POSIX)
+ *
+ * Answers every request on the listening port with the output of
+ * mqtt_metrics_render(). One request is served at a time, which is plenty
+ * for a Prometheus scraper.
+ */
+
+#include "mqtt_metrics.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define METRICS_HTTP_BUF_SIZE      16384
+#define METRICS_HTTP_BUF_MAX       (1024 * 1024)
+#define METRICS_HTTP_POLL_MS       500
+
+static pthread_t g_http_thread;
+static int g_http_fd = -1;
+static volatile int g_http_running = 0;
+static mqtt_client_t* const* g_http_clients = NULL;
+static size_t g_http_count = 0;
+
+static void http_write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void http_serve(int fd) {
+    char req[1024];
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    /* The request itself is not interpreted, every path returns metrics */
+    if (recv(fd, req, sizeof(req), 0) <= 0) return;
+
+    size_t size = METRICS_HTTP_BUF_SIZE;
+    char* body = NULL;
+    int len = -1;
+    while (size <= METRICS_HTTP_BUF_MAX) {
+        body = malloc(size);
+        if (!body) break;
+        len = mqtt_metrics_render(g_http_clients, g_http_count, body, size);
+        if (len >= 0) break;
+        free(body);
+        body = NULL;
+        size *= 2;
+    }
+
+    char header[256];
+    if (len < 0) {
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+        http_write_all(fd, header, n);
+    } else {
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+                         MQTT_METRICS_CONTENT_TYPE, len);
+        http_write_all(fd, header, n);
+        http_write_all(fd, body, len);
+    }
+    free(body);
+}
+
+static void* http_thread(void* arg) {
+    (void)arg;
+    while (g_http_running) {
+        fd_set readfds;
+        struct timeval tv = { 0, METRICS_HTTP_POLL_MS * 1000 };
+        FD_ZERO(&readfds);
+        FD_SET(g_http_fd, &readfds);
+
+        if (select(g_http_fd + 1, &readfds, NULL, NULL, &tv) <= 0) continue;
+
+        int fd = accept(g_http_fd, NULL, NULL);
+        if (fd < 0) continue;
+        http_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int mqtt_metrics_http_start(uint16_t port, mqtt_client_t* const* clients, size_t count) {
+    if (g_http_running) return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    g_http_fd = fd;
+    g_http_clients = clients;
+    g_http_count = count;
+    g_http_running = 1;
+
+    if (pthread_create(&g_http_thread, NULL, http_thread, NULL) != 0) {
+        g_http_running = 0;
+        close(fd);
+        g_http_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void mqtt_metrics_http_stop(void) {
+    if (!g_http_running) return;
+
+    g_http_running = 0;
+    pthread_join(g_http_thread, NULL);
+    close(g_http_fd);
+    g_http_fd = -1;
+}
@@ -8,6 +8,7 @@
 
 #include "mqtt_net.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -167,6 +168,27 @@ static int posix_send(mqtt_socket_t sock, const uint8_t* buf, size_t len) {
     return ret;
 }
 
+static int posix_sendv(mqtt_socket_t sock, const mqtt_iovec_t* iov, int count) {
+    int fd = (int)(intptr_t)sock;
+    struct iovec vec[MQTT_NET_MAX_IOV];
+    struct msghdr msg;
+    ssize_t ret;
+    
+    if (count > MQTT_NET_MAX_IOV) return -1;
+    for (int i = 0; i < count; i++) {
+        vec[i].iov_base = (void*)iov[i].buf;
+        vec[i].iov_len = iov[i].len;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+    
+    do {
+        ret = sendmsg(fd, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
 static int posix_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t timeout_ms) {
     int fd = (int)(intptr_t)sock;
     fd_set readfds;
@@ -194,11 +216,59 @@ static int posix_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t tim
     return ret;
 }
 
-static const mqtt_net_api_t posix_net_api = {
+static mqtt_socket_t posix_listen(const char* host, uint16_t port) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (host && inet_pton(AF_INET, host, &addr.sin_addr) != 1) return NULL;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return NULL;
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0) {
+        close(sock);
+        return NULL;
+    }
+    return (mqtt_socket_t)(intptr_t)sock;
+}
+
+static mqtt_socket_t posix_accept(mqtt_socket_t listener, uint32_t timeout_ms) {
+    int fd = (int)(intptr_t)listener;
+    fd_set readfds;
+    struct timeval tv;
+    int ret;
+
+    do {
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+        ret = select(fd + 1, &readfds, NULL, NULL, &tv);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0) return NULL;
+
+    int sock = accept(fd, NULL, NULL);
+    /* 0 is a valid descriptor but not a valid handle */
+    if (sock <= 0) return NULL;
+    return (mqtt_socket_t)(intptr_t)sock;
+}
+
+MQTT_NET_PORT_API(posix_net_api) = {
     .connect = posix_connect,
     .disconnect = posix_disconnect,
     .send = posix_send,
-    .recv = posix_recv
+    .recv = posix_recv,
+    .sendv = posix_sendv,
+    .listen = posix_listen,
+    .accept = posix_accept
 };
 
 void mqtt_posix_net_init(void) {
@@ -0,0 +1,234 @@
+/**
+ * @file sim_net.c
+ * @brief In-memory network abstraction layer for the simulation port
+ *
+ * Connections are pairs of in-process byte streams. Data written on one end
+ * becomes readable on the other after the configured virtual latency.
+ * Blocking waits go through the simulation scheduler, so this transport
+ * must be used together with sim_os.c.
+ */
+
+#include "mqtt_sim.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Maximum number of listening ports */
+#define SIM_NET_MAX_LISTENERS  4
+
+/** @brief Maximum number of pending connections per listener */
+#define SIM_NET_BACKLOG        8
+
+typedef struct sim_chunk {
+    struct sim_chunk* next;
+    uint64_t deliver_at;
+    size_t len;
+    size_t offset;
+    uint8_t data[];
+} sim_chunk_t;
+
+typedef struct sim_sock {
+    struct sim_sock* peer;
+    sim_chunk_t* rx_head;
+    sim_chunk_t* rx_tail;
+    int closed;           /* This end was disconnected */
+    int broken;           /* Connection was broken by fault injection */
+    int refs;             /* Ends still referencing the pair */
+} sim_sock_t;
+
+typedef struct {
+    uint16_t port;
+    int active;
+    sim_sock_t* pending[SIM_NET_BACKLOG];
+    int pending_count;
+} sim_listener_t;
+
+static sim_listener_t g_listeners[SIM_NET_MAX_LISTENERS];
+static uint32_t g_latency_ms = 0;
+
+static sim_listener_t* sim_find_listener(uint16_t port) {
+    for (int i = 0; i < SIM_NET_MAX_LISTENERS; i++) {
+        if (g_listeners[i].active && g_listeners[i].port == port) return &g_listeners[i];
+    }
+    return NULL;
+}
+
+static void sim_sock_release(sim_sock_t* sock) {
+    if (--sock->refs > 0) return;
+
+    sim_chunk_t* chunk = sock->rx_head;
+    while (chunk) {
+        sim_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(sock);
+}
+
+int mqtt_sim_net_listen(uint16_t port) {
+    if (sim_find_listener(port)) return -1;
+    for (int i = 0; i < SIM_NET_MAX_LISTENERS; i++) {
+        if (!g_listeners[i].active) {
+            memset(&g_listeners[i], 0, sizeof(sim_listener_t));
+            g_listeners[i].port = port;
+            g_listeners[i].active = 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void mqtt_sim_net_unlisten(uint16_t port) {
+    sim_listener_t* listener = sim_find_listener(port);
+    if (!listener) return;
+
+    /* Refuse connections nobody accepted yet */
+    for (int i = 0; i < listener->pending_count; i++) {
+        sim_sock_t* server = listener->pending[i];
+        server->closed = 1;
+        mqtt_sim_wake(server->peer);
+        sim_sock_release(server->peer);
+        sim_sock_release(server);
+    }
+    listener->active = 0;
+    mqtt_sim_wake(listener);
+}
+
+mqtt_socket_t mqtt_sim_net_accept(uint16_t port, uint32_t timeout_ms) {
+    uint64_t deadline = mqtt_sim_now_ms() + timeout_ms;
+
+    for (;;) {
+        sim_listener_t* listener = sim_find_listener(port);
+        if (!listener) return NULL;
+
+        if (listener->pending_count > 0) {
+            sim_sock_t* server = listener->pending[0];
+            listener->pending_count--;
+            memmove(&listener->pending[0], &listener->pending[1],
+                    listener->pending_count * sizeof(sim_sock_t*));
+            return (mqtt_socket_t)server;
+        }
+
+        uint64_t now = mqtt_sim_now_ms();
+        if (timeout_ms != MQTT_SIM_FOREVER && now >= deadline) return NULL;
+        mqtt_sim_wait(listener, timeout_ms == MQTT_SIM_FOREVER ? MQTT_SIM_FOREVER
+                                                               : (uint32_t)(deadline - now));
+    }
+}
+
+void mqtt_sim_net_set_latency(uint32_t latency_ms) {
+    g_latency_ms = latency_ms;
+}
+
+void mqtt_sim_net_break(mqtt_socket_t sock) {
+    sim_sock_t* s = (sim_sock_t*)sock;
+    s->broken = 1;
+    s->peer->broken = 1;
+    mqtt_sim_wake(s);
+    mqtt_sim_wake(s->peer);
+}
+
+static mqtt_socket_t sim_net_connect(const char* host, uint16_t port, uint32_t timeout_ms) {
+    (void)host;
+    (void)timeout_ms;
+
+    sim_listener_t* listener = sim_find_listener(port);
+    if (!listener || listener->pending_count >= SIM_NET_BACKLOG) return NULL;  /* Refused */
+
+    sim_sock_t* client = (sim_sock_t*)calloc(1, sizeof(sim_sock_t));
+    sim_sock_t* server = (sim_sock_t*)calloc(1, sizeof(sim_sock_t));
+    if (!client || !server) {
+        free(client);
+        free(server);
+        return NULL;
+    }
+
+    /* Each end is referenced by its owner and by its peer */
+    client->peer = server;
+    server->peer = client;
+    client->refs = 2;
+    server->refs = 2;
+
+    listener->pending[listener->pending_count++] = server;
+    mqtt_sim_wake(listener);
+    return (mqtt_socket_t)client;
+}
+
+static void sim_net_disconnect(mqtt_socket_t sock) {
+    sim_sock_t* s = (sim_sock_t*)sock;
+    sim_sock_t* peer = s->peer;
+
+    s->closed = 1;
+    mqtt_sim_wake(peer);
+    sim_sock_release(peer);
+    sim_sock_release(s);
+}
+
+static int sim_net_send(mqtt_socket_t sock, const uint8_t* buf, size_t len) {
+    sim_sock_t* s = (sim_sock_t*)sock;
+    sim_sock_t* peer = s->peer;
+
+    if (s->closed || s->broken || peer->closed) return -1;
+
+    sim_chunk_t* chunk = (sim_chunk_t*)malloc(sizeof(sim_chunk_t) + len);
+    if (!chunk) return -1;
+    chunk->next = NULL;
+    chunk->deliver_at = mqtt_sim_now_ms() + g_latency_ms;
+    chunk->len = len;
+    chunk->offset = 0;
+    memcpy(chunk->data, buf, len);
+
+    if (peer->rx_tail) peer->rx_tail->next = chunk;
+    else peer->rx_head = chunk;
+    peer->rx_tail = chunk;
+
+    mqtt_sim_wake(peer);
+    return (int)len;
+}
+
+static int sim_net_recv(mqtt_socket_t sock, uint8_t* buf, size_t len, uint32_t timeout_ms) {
+    sim_sock_t* s = (sim_sock_t*)sock;
+    uint64_t deadline = mqtt_sim_now_ms() + timeout_ms;
+
+    for (;;) {
+        uint64_t now = mqtt_sim_now_ms();
+        if (s->broken) return -1;
+
+        sim_chunk_t* chunk = s->rx_head;
+        if (chunk && chunk->deliver_at <= now) {
+            size_t copied = 0;
+            while (chunk && chunk->deliver_at <= now && copied < len) {
+                size_t n = chunk->len - chunk->offset;
+                if (n > len - copied) n = len - copied;
+                memcpy(buf + copied, chunk->data + chunk->offset, n);
+                chunk->offset += n;
+                copied += n;
+                if (chunk->offset == chunk->len) {
+                    s->rx_head = chunk->next;
+                    if (!s->rx_head) s->rx_tail = NULL;
+                    free(chunk);
+                    chunk = s->rx_head;
+                }
+            }
+            return (int)copied;
+        }
+
+        /* Orderly close by the peer once its data is drained */
+        if (!chunk && s->peer->closed) return -1;
+        if (now >= deadline) return 0;
+
+        uint64_t wait_until = deadline;
+        if (chunk && chunk->deliver_at < wait_until) wait_until = chunk->deliver_at;
+        mqtt_sim_wait(s, (uint32_t)(wait_until - now));
+    }
+}
+
+MQTT_NET_PORT_API(sim_net_api) = {
+    .connect = sim_net_connect,
+    .disconnect = sim_net_disconnect,
+    .send = sim_net_send,
+    .recv = sim_net_recv
+};
+
+void mqtt_sim_net_init(void) {
+    mqtt_net_init(&sim_net_api);
+}
@@ -4,11 +4,18 @@
  * 
  * AliOS Things is an IoT operating system from Alibaba Cloud.
  * This implementation provides OS abstraction for AliOS Things kernel.
+ *
+ * With MQTT_OS_STATIC, objects are created in fixed pools through the
+ * Rhino static APIs (krhino_*_create) and wrapped in aos handles, so the
+ * aos calls used at runtime stay the same.
  */
 
 #include "mqtt_os.h"
 #include <aos/kernel.h>
 #include <stdlib.h>
+#ifdef MQTT_OS_STATIC
+#include <k_api.h>
+#endif
 
 static void* alios_malloc(size_t size) {
     return aos_malloc(size);
@@ -18,23 +25,96 @@ static void alios_free(void* ptr) {
     aos_free(ptr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+/* The aos handle comes first so the wrappers can be used as aos objects */
+typedef struct {
+    aos_mutex_t handle;
+    kmutex_t obj;
+} alios_mutex_t;
+
+typedef struct {
+    aos_sem_t handle;
+    ksem_t obj;
+} alios_sem_t;
+
+typedef struct {
+    aos_event_t handle;
+    kevent_t obj;
+} alios_event_t;
+
+typedef struct {
+    ktask_t task;
+    cpu_stack_t* pool_stack;  /* NULL when the caller supplied the stack */
+} alios_thread_t;
+
+typedef cpu_stack_t alios_stack_t[MQTT_OS_STATIC_STACK_SIZE / sizeof(cpu_stack_t)];
+
+MQTT_OS_POOL_DEFINE(alios_mutex_pool, alios_mutex_t, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(alios_sem_pool, alios_sem_t, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(alios_event_pool, alios_event_t, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(alios_thread_pool, alios_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(alios_stack_pool, alios_stack_t, MQTT_OS_MAX_THREADS);
+
 static mqtt_mutex_t alios_mutex_create(void) {
-    aos_mutex_t* mutex = malloc(sizeof(aos_mutex_t));
-    aos_mutex_new(mutex);
+    alios_mutex_t* mutex = mqtt_os_pool_alloc(&alios_mutex_pool);
+    if (!mutex) return NULL;
+    if (krhino_mutex_create(&mutex->obj, "mqtt_mutex") != RHINO_SUCCESS) {
+        mqtt_os_pool_free(&alios_mutex_pool, mutex);
+        return NULL;
+    }
+    mutex->handle.hdl = &mutex->obj;
     return (mqtt_mutex_t)mutex;
 }
 
 static void alios_mutex_destroy(mqtt_mutex_t mutex) {
-    aos_mutex_free((aos_mutex_t*)mutex);
-    free(mutex);
+    krhino_mutex_del(&((alios_mutex_t*)mutex)->obj);
+    mqtt_os_pool_free(&alios_mutex_pool, mutex);
 }
 
-static int alios_mutex_lock(mqtt_mutex_t mutex) {
-    return aos_mutex_lock((aos_mutex_t*)mutex, AOS_WAIT_FOREVER) == 0 ? 0 : -1;
+static mqtt_sem_t alios_sem_create(uint32_t init_count) {
+    alios_sem_t* sem = mqtt_os_pool_alloc(&alios_sem_pool);
+    if (!sem) return NULL;
+    if (krhino_sem_create(&sem->obj, "mqtt_sem", init_count) != RHINO_SUCCESS) {
+        mqtt_os_pool_free(&alios_sem_pool, sem);
+        return NULL;
+    }
+    sem->handle.hdl = &sem->obj;
+    return (mqtt_sem_t)sem;
 }
 
-static void alios_mutex_unlock(mqtt_mutex_t mutex) {
-    aos_mutex_unlock((aos_mutex_t*)mutex);
+static void alios_sem_destroy(mqtt_sem_t sem) {
+    krhino_sem_del(&((alios_sem_t*)sem)->obj);
+    mqtt_os_pool_free(&alios_sem_pool, sem);
+}
+
+static mqtt_event_t alios_event_create(void) {
+    alios_event_t* event = mqtt_os_pool_alloc(&alios_event_pool);
+    if (!event) return NULL;
+    if (krhino_event_create(&event->obj, "mqtt_event", 0) != RHINO_SUCCESS) {
+        mqtt_os_pool_free(&alios_event_pool, event);
+        return NULL;
+    }
+    event->handle.hdl = &event->obj;
+    return (mqtt_event_t)event;
+}
+
+static void alios_event_destroy(mqtt_event_t event) {
+    krhino_event_del(&((alios_event_t*)event)->obj);
+    mqtt_os_pool_free(&alios_event_pool, event);
+}
+
+#else
+
+static mqtt_mutex_t alios_mutex_create(void) {
+    aos_mutex_t* mutex = malloc(sizeof(aos_mutex_t));
+    aos_mutex_new(mutex);
+    return (mqtt_mutex_t)mutex;
+}
+
+static void alios_mutex_destroy(mqtt_mutex_t mutex) {
+    aos_mutex_free((aos_mutex_t*)mutex);
+    free(mutex);
 }
 
 static mqtt_sem_t alios_sem_create(uint32_t init_count) {
@@ -48,6 +128,31 @@ static void alios_sem_destroy(mqtt_sem_t sem) {
     free(sem);
 }
 
+static mqtt_event_t alios_event_create(void) {
+    aos_event_t* event = malloc(sizeof(aos_event_t));
+    if (!event) return NULL;
+    if (aos_event_new(event, 0) != 0) {
+        free(event);
+        return NULL;
+    }
+    return (mqtt_event_t)event;
+}
+
+static void alios_event_destroy(mqtt_event_t event) {
+    aos_event_free((aos_event_t*)event);
+    free(event);
+}
+
+#endif /* MQTT_OS_STATIC */
+
+static int alios_mutex_lock(mqtt_mutex_t mutex) {
+    return aos_mutex_lock((aos_mutex_t*)mutex, AOS_WAIT_FOREVER) == 0 ? 0 : -1;
+}
+
+static void alios_mutex_unlock(mqtt_mutex_t mutex) {
+    aos_mutex_unlock((aos_mutex_t*)mutex);
+}
+
 static int alios_sem_wait(mqtt_sem_t sem) {
     return aos_sem_wait((aos_sem_t*)sem, AOS_WAIT_FOREVER) == 0 ? 0 : -1;
 }
@@ -56,13 +161,96 @@ static void alios_sem_post(mqtt_sem_t sem) {
     aos_sem_signal((aos_sem_t*)sem);
 }
 
-static mqtt_thread_t alios_thread_create(mqtt_thread_func_t func, void* arg, 
-                                         uint32_t stack_size, uint32_t priority) {
+static int alios_mutex_trylock(mqtt_mutex_t mutex) {
+    return aos_mutex_lock((aos_mutex_t*)mutex, AOS_NO_WAIT) == 0 ? 0 : -1;
+}
+
+static int alios_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return aos_sem_wait((aos_sem_t*)sem, timeout_ms) == 0 ? 0 : -1;
+}
+
+#define ALIOS_EVENT_FLAG 0x01
+
+static void alios_event_set(mqtt_event_t event) {
+    aos_event_set((aos_event_t*)event, ALIOS_EVENT_FLAG, AOS_EVENT_OR);
+}
+
+static int alios_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    uint32_t actual;
+    return aos_event_get((aos_event_t*)event, ALIOS_EVENT_FLAG, AOS_EVENT_OR_CLEAR,
+                         &actual, timeout_ms) == 0 ? 0 : -1;
+}
+
+/* AliOS exposes no interrupt masking through aos, lock the scheduler instead */
+static uint32_t alios_critical_enter(void) {
+    aos_kernel_sched_suspend();
+    return 0;
+}
+
+static void alios_critical_exit(uint32_t state) {
+    (void)state;
+    aos_kernel_sched_resume();
+}
+
+static mqtt_thread_t alios_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                            const mqtt_thread_attr_t* attr) {
+#ifdef MQTT_OS_STATIC
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    alios_thread_t* thread = mqtt_os_pool_alloc(&alios_thread_pool);
+    if (!thread) return NULL;
+    cpu_stack_t* stack = attr->stack;
+    thread->pool_stack = NULL;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = thread->pool_stack = mqtt_os_pool_alloc(&alios_stack_pool);
+    }
+    /* Rhino counts the stack in cpu_stack_t units */
+    if (!stack ||
+        krhino_task_create(&thread->task, attr->name ? attr->name : "mqtt_task", arg,
+                           attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY, 0,
+                           stack, stack_size / sizeof(cpu_stack_t), (task_entry_t)func, 1) != RHINO_SUCCESS) {
+        mqtt_os_pool_free(&alios_stack_pool, thread->pool_stack);
+        mqtt_os_pool_free(&alios_thread_pool, thread);
+        return NULL;
+    }
+    return (mqtt_thread_t)thread;
+#else
     aos_task_t* task = malloc(sizeof(aos_task_t));
-    aos_task_new_ext(task, "mqtt_task", func, arg, stack_size, priority);
+    if (!task) return NULL;
+    if (aos_task_new_ext(task, attr->name ? attr->name : "mqtt_task", func, arg,
+                         attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE,
+                         attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY) != 0) {
+        free(task);
+        return NULL;
+    }
     return (mqtt_thread_t)task;
+#endif
+}
+
+static mqtt_thread_t alios_thread_create(mqtt_thread_func_t func, void* arg,
+                                         uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return alios_thread_create_ex(func, arg, &attr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+static void alios_thread_destroy(mqtt_thread_t thread) {
+    alios_thread_t* t = (alios_thread_t*)thread;
+
+    /* The task and stack stay in use until thread_exit has deleted the task */
+    while (t->task.task_state != K_DELETED) {
+        aos_msleep(1);
+    }
+    mqtt_os_pool_free(&alios_stack_pool, t->pool_stack);
+    mqtt_os_pool_free(&alios_thread_pool, t);
+}
+
+static void alios_thread_exit(void) {
+    krhino_task_del(krhino_cur_task_get());
+}
+
+#else
+
 static void alios_thread_destroy(mqtt_thread_t thread) {
     /* In AliOS, thread_exit already exited, just free the handle */
     free(thread);
@@ -72,15 +260,21 @@ static void alios_thread_exit(void) {
     aos_task_exit(0);
 }
 
+#endif /* MQTT_OS_STATIC */
+
 static uint32_t alios_get_time_ms(void) {
     return aos_now_ms();
 }
 
+static uint64_t alios_get_time_us(void) {
+    return (uint64_t)aos_now() / 1000;
+}
+
 static void alios_sleep_ms(uint32_t ms) {
     aos_msleep(ms);
 }
 
-static const mqtt_os_api_t alios_os_api = {
+MQTT_OS_PORT_API(alios_os_api) = {
     .malloc = alios_malloc,
     .free = alios_free,
     .mutex_create = alios_mutex_create,
@@ -95,7 +289,17 @@ static const mqtt_os_api_t alios_os_api = {
     .thread_destroy = alios_thread_destroy,
     .thread_exit = alios_thread_exit,
     .get_time_ms = alios_get_time_ms,
-    .sleep_ms = alios_sleep_ms
+    .sleep_ms = alios_sleep_ms,
+    .get_time_us = alios_get_time_us,
+    .mutex_trylock = alios_mutex_trylock,
+    .sem_timedwait = alios_sem_timedwait,
+    .event_create = alios_event_create,
+    .event_destroy = alios_event_destroy,
+    .event_set = alios_event_set,
+    .event_wait = alios_event_wait,
+    .critical_enter = alios_critical_enter,
+    .critical_exit = alios_critical_exit,
+    .thread_create_ex = alios_thread_create_ex
 };
 
 void mqtt_alios_init(void) {
@@ -4,12 +4,66 @@
  * 
  * CMSIS-RTOS2 is a standard API for ARM Cortex-M devices.
  * This implementation provides OS abstraction for CMSIS-RTOS2 compliant kernels.
+ *
+ * With MQTT_OS_STATIC, control blocks and stacks are passed to the kernel
+ * through cb_mem/stack_mem from fixed pools. The control block sizes are
+ * kernel specific and default to those of Keil RTX5.
  */
 
 #include "mqtt_os.h"
 #include "cmsis_os2.h"
 #include <stdlib.h>
 
+#ifdef MQTT_OS_STATIC
+
+#ifndef MQTT_CMSIS_MUTEX_CB_SIZE
+#define MQTT_CMSIS_MUTEX_CB_SIZE    osRtxMutexCbSize
+#endif
+
+#ifndef MQTT_CMSIS_SEM_CB_SIZE
+#define MQTT_CMSIS_SEM_CB_SIZE      osRtxSemaphoreCbSize
+#endif
+
+#ifndef MQTT_CMSIS_THREAD_CB_SIZE
+#define MQTT_CMSIS_THREAD_CB_SIZE   osRtxThreadCbSize
+#endif
+
+#define CMSIS_CB_WORDS(size)  (((size) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+/* The id is kept next to its control block, kernels need not return cb_mem */
+typedef struct {
+    osMutexId_t id;
+    uint64_t cb[CMSIS_CB_WORDS(MQTT_CMSIS_MUTEX_CB_SIZE)];
+} cmsis_mutex_t;
+
+typedef struct {
+    osSemaphoreId_t id;
+    uint64_t cb[CMSIS_CB_WORDS(MQTT_CMSIS_SEM_CB_SIZE)];
+} cmsis_sem_t;
+
+typedef struct {
+    osThreadId_t id;
+    void* pool_stack;  /* NULL when the caller supplied the stack */
+    uint64_t cb[CMSIS_CB_WORDS(MQTT_CMSIS_THREAD_CB_SIZE)];
+} cmsis_thread_t;
+
+typedef uint64_t cmsis_stack_t[CMSIS_CB_WORDS(MQTT_OS_STATIC_STACK_SIZE)];
+
+MQTT_OS_POOL_DEFINE(cmsis_mutex_pool, cmsis_mutex_t, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(cmsis_sem_pool, cmsis_sem_t, MQTT_OS_MAX_SEMS + MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(cmsis_thread_pool, cmsis_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(cmsis_stack_pool, cmsis_stack_t, MQTT_OS_MAX_THREADS);
+
+#define CMSIS_MUTEX(m)  (((cmsis_mutex_t*)(m))->id)
+#define CMSIS_SEM(s)    (((cmsis_sem_t*)(s))->id)
+
+#else
+
+#define CMSIS_MUTEX(m)  ((osMutexId_t)(m))
+#define CMSIS_SEM(s)    ((osSemaphoreId_t)(s))
+
+#endif /* MQTT_OS_STATIC */
+
 static void* cmsis_malloc(size_t size) {
     return malloc(size);
 }
@@ -19,50 +73,165 @@ static void cmsis_free(void* ptr) {
 }
 
 static mqtt_mutex_t cmsis_mutex_create(void) {
+#ifdef MQTT_OS_STATIC
+    cmsis_mutex_t* mutex = mqtt_os_pool_alloc(&cmsis_mutex_pool);
+    if (!mutex) return NULL;
+    osMutexAttr_t attr = { .cb_mem = mutex->cb, .cb_size = sizeof(mutex->cb) };
+    if (!(mutex->id = osMutexNew(&attr))) {
+        mqtt_os_pool_free(&cmsis_mutex_pool, mutex);
+        return NULL;
+    }
+    return (mqtt_mutex_t)mutex;
+#else
     return (mqtt_mutex_t)osMutexNew(NULL);
+#endif
 }
 
 static void cmsis_mutex_destroy(mqtt_mutex_t mutex) {
-    osMutexDelete((osMutexId_t)mutex);
+    osMutexDelete(CMSIS_MUTEX(mutex));
+#ifdef MQTT_OS_STATIC
+    mqtt_os_pool_free(&cmsis_mutex_pool, mutex);
+#endif
 }
 
 static int cmsis_mutex_lock(mqtt_mutex_t mutex) {
-    return osMutexAcquire((osMutexId_t)mutex, osWaitForever) == osOK ? 0 : -1;
+    return osMutexAcquire(CMSIS_MUTEX(mutex), osWaitForever) == osOK ? 0 : -1;
 }
 
 static void cmsis_mutex_unlock(mqtt_mutex_t mutex) {
-    osMutexRelease((osMutexId_t)mutex);
+    osMutexRelease(CMSIS_MUTEX(mutex));
+}
+
+/* Semaphores back both semaphores and events */
+static void* cmsis_sem_new(uint32_t max_count, uint32_t init_count) {
+#ifdef MQTT_OS_STATIC
+    cmsis_sem_t* sem = mqtt_os_pool_alloc(&cmsis_sem_pool);
+    if (!sem) return NULL;
+    osSemaphoreAttr_t attr = { .cb_mem = sem->cb, .cb_size = sizeof(sem->cb) };
+    if (!(sem->id = osSemaphoreNew(max_count, init_count, &attr))) {
+        mqtt_os_pool_free(&cmsis_sem_pool, sem);
+        return NULL;
+    }
+    return sem;
+#else
+    return osSemaphoreNew(max_count, init_count, NULL);
+#endif
+}
+
+static void cmsis_sem_delete(void* sem) {
+    osSemaphoreDelete(CMSIS_SEM(sem));
+#ifdef MQTT_OS_STATIC
+    mqtt_os_pool_free(&cmsis_sem_pool, sem);
+#endif
 }
 
 static mqtt_sem_t cmsis_sem_create(uint32_t init_count) {
-    return (mqtt_sem_t)osSemaphoreNew(0xFFFF, init_count, NULL);
+    return (mqtt_sem_t)cmsis_sem_new(0xFFFF, init_count);
 }
 
 static void cmsis_sem_destroy(mqtt_sem_t sem) {
-    osSemaphoreDelete((osSemaphoreId_t)sem);
+    cmsis_sem_delete(sem);
 }
 
 static int cmsis_sem_wait(mqtt_sem_t sem) {
-    return osSemaphoreAcquire((osSemaphoreId_t)sem, osWaitForever) == osOK ? 0 : -1;
+    return osSemaphoreAcquire(CMSIS_SEM(sem), osWaitForever) == osOK ? 0 : -1;
 }
 
 static void cmsis_sem_post(mqtt_sem_t sem) {
-    osSemaphoreRelease((osSemaphoreId_t)sem);
+    osSemaphoreRelease(CMSIS_SEM(sem));
 }
 
-static mqtt_thread_t cmsis_thread_create(mqtt_thread_func_t func, void* arg, 
-                                         uint32_t stack_size, uint32_t priority) {
-    osThreadAttr_t attr = {
-        .name = "mqtt_thread",
-        .stack_size = stack_size,
-        .priority = (osPriority_t)priority
+static int cmsis_mutex_trylock(mqtt_mutex_t mutex) {
+    return osMutexAcquire(CMSIS_MUTEX(mutex), 0) == osOK ? 0 : -1;
+}
+
+static uint32_t cmsis_ms_to_ticks(uint32_t ms) {
+    return (uint32_t)(((uint64_t)ms * osKernelGetTickFreq() + 999) / 1000);
+}
+
+static int cmsis_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return osSemaphoreAcquire(CMSIS_SEM(sem), cmsis_ms_to_ticks(timeout_ms)) == osOK ? 0 : -1;
+}
+
+/* A semaphore limited to one token is an auto-reset event */
+static mqtt_event_t cmsis_event_create(void) {
+    return (mqtt_event_t)cmsis_sem_new(1, 0);
+}
+
+static void cmsis_event_destroy(mqtt_event_t event) {
+    cmsis_sem_delete(event);
+}
+
+static void cmsis_event_set(mqtt_event_t event) {
+    osSemaphoreRelease(CMSIS_SEM(event));
+}
+
+static int cmsis_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    return osSemaphoreAcquire(CMSIS_SEM(event), cmsis_ms_to_ticks(timeout_ms)) == osOK ? 0 : -1;
+}
+
+/* CMSIS-RTOS2 has no interrupt masking API, lock the kernel instead */
+static uint32_t cmsis_critical_enter(void) {
+    return (uint32_t)osKernelLock();
+}
+
+static void cmsis_critical_exit(uint32_t state) {
+    osKernelRestoreLock((int32_t)state);
+}
+
+static mqtt_thread_t cmsis_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                            const mqtt_thread_attr_t* attr) {
+    osThreadAttr_t thread_attr = {
+        .name = attr->name ? attr->name : "mqtt_thread",
+        .stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE,
+        .priority = (osPriority_t)(attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY)
     };
-    return (mqtt_thread_t)osThreadNew((osThreadFunc_t)func, arg, &attr);
+#ifdef osThreadProcessor
+    thread_attr.affinity_mask = attr->affinity;
+#endif
+#ifdef MQTT_OS_STATIC
+    cmsis_thread_t* thread = mqtt_os_pool_alloc(&cmsis_thread_pool);
+    if (!thread) return NULL;
+    thread->pool_stack = NULL;
+    thread_attr.stack_mem = attr->stack;
+    if (!thread_attr.stack_mem) {
+        if (thread_attr.stack_size > MQTT_OS_STATIC_STACK_SIZE ||
+            !(thread->pool_stack = mqtt_os_pool_alloc(&cmsis_stack_pool))) {
+            mqtt_os_pool_free(&cmsis_thread_pool, thread);
+            return NULL;
+        }
+        thread_attr.stack_mem = thread->pool_stack;
+    }
+    thread_attr.cb_mem = thread->cb;
+    thread_attr.cb_size = sizeof(thread->cb);
+    thread_attr.attr_bits = osThreadJoinable;  /* Memory is reclaimed after osThreadJoin() */
+    if (!(thread->id = osThreadNew((osThreadFunc_t)func, arg, &thread_attr))) {
+        mqtt_os_pool_free(&cmsis_stack_pool, thread->pool_stack);
+        mqtt_os_pool_free(&cmsis_thread_pool, thread);
+        return NULL;
+    }
+    return (mqtt_thread_t)thread;
+#else
+    return (mqtt_thread_t)osThreadNew((osThreadFunc_t)func, arg, &thread_attr);
+#endif
+}
+
+static mqtt_thread_t cmsis_thread_create(mqtt_thread_func_t func, void* arg,
+                                         uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return cmsis_thread_create_ex(func, arg, &attr);
 }
 
 static void cmsis_thread_destroy(mqtt_thread_t thread) {
+#ifdef MQTT_OS_STATIC
+    cmsis_thread_t* t = (cmsis_thread_t*)thread;
+    osThreadJoin(t->id);
+    mqtt_os_pool_free(&cmsis_stack_pool, t->pool_stack);
+    mqtt_os_pool_free(&cmsis_thread_pool, t);
+#else
     /* CMSIS osThreadExit already exited, no-op */
     (void)thread;
+#endif
 }
 
 static void cmsis_thread_exit(void) {
@@ -73,11 +242,24 @@ static uint32_t cmsis_get_time_ms(void) {
     return osKernelGetTickCount() * 1000 / osKernelGetTickFreq();
 }
 
+static uint64_t cmsis_get_time_us(void) {
+    /* Extend the 32-bit tick counter across wraparound */
+    static uint32_t last_tick = 0;
+    static uint64_t wraps = 0;
+    int32_t lock = osKernelLock();
+    uint32_t tick = osKernelGetTickCount();
+    if (tick < last_tick) wraps++;
+    last_tick = tick;
+    uint64_t ticks = (wraps << 32) | tick;
+    osKernelRestoreLock(lock);
+    return ticks * 1000000 / osKernelGetTickFreq();
+}
+
 static void cmsis_sleep_ms(uint32_t ms) {
     osDelay(ms * osKernelGetTickFreq() / 1000);
 }
 
-static const mqtt_os_api_t cmsis_os_api = {
+MQTT_OS_PORT_API(cmsis_os_api) = {
     .malloc = cmsis_malloc,
     .free = cmsis_free,
     .mutex_create = cmsis_mutex_create,
@@ -92,7 +274,17 @@ static const mqtt_os_api_t cmsis_os_api = {
     .thread_destroy = cmsis_thread_destroy,
     .thread_exit = cmsis_thread_exit,
     .get_time_ms = cmsis_get_time_ms,
-    .sleep_ms = cmsis_sleep_ms
+    .sleep_ms = cmsis_sleep_ms,
+    .get_time_us = cmsis_get_time_us,
+    .mutex_trylock = cmsis_mutex_trylock,
+    .sem_timedwait = cmsis_sem_timedwait,
+    .event_create = cmsis_event_create,
+    .event_destroy = cmsis_event_destroy,
+    .event_set = cmsis_event_set,
+    .event_wait = cmsis_event_wait,
+    .critical_enter = cmsis_critical_enter,
+    .critical_exit = cmsis_critical_exit,
+    .thread_create_ex = cmsis_thread_create_ex
 };
 
 void mqtt_cmsis_rtos2_init(void) {
@@ -1,6 +1,11 @@
 /**
  * @file freertos_os.c
  * @brief FreeRTOS OS abstraction layer implementation
+ *
+ * With MQTT_OS_STATIC, kernel objects are created with the *Static() APIs
+ * in fixed pools (requires configSUPPORT_STATIC_ALLOCATION). Threads then
+ * suspend themselves on exit and are deleted by thread_destroy(), so their
+ * storage is never reused while the idle task still references it.
  */
 
 #include "mqtt.h"
@@ -18,12 +23,38 @@ static void freertos_free(void* ptr) {
     vPortFree(ptr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+typedef StackType_t freertos_stack_t[MQTT_OS_STATIC_STACK_SIZE / sizeof(StackType_t)];
+
+typedef struct {
+    StaticTask_t tcb;
+    StackType_t* pool_stack;  /* NULL when the caller supplied the stack */
+} freertos_thread_t;
+
+MQTT_OS_POOL_DEFINE(freertos_mutex_pool, StaticSemaphore_t, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(freertos_sem_pool, StaticSemaphore_t, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(freertos_event_pool, StaticSemaphore_t, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(freertos_thread_pool, freertos_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(freertos_stack_pool, freertos_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t freertos_mutex_create(void) {
+#ifdef MQTT_OS_STATIC
+    /* Static handles are the address of their buffer */
+    StaticSemaphore_t* buf = mqtt_os_pool_alloc(&freertos_mutex_pool);
+    return buf ? (mqtt_mutex_t)xSemaphoreCreateMutexStatic(buf) : NULL;
+#else
     return (mqtt_mutex_t)xSemaphoreCreateMutex();
+#endif
 }
 
 static void freertos_mutex_destroy(mqtt_mutex_t mutex) {
     vSemaphoreDelete((SemaphoreHandle_t)mutex);
+#ifdef MQTT_OS_STATIC
+    mqtt_os_pool_free(&freertos_mutex_pool, mutex);
+#endif
 }
 
 static int freertos_mutex_lock(mqtt_mutex_t mutex) {
@@ -35,11 +66,19 @@ static void freertos_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t freertos_sem_create(uint32_t init_count) {
+#ifdef MQTT_OS_STATIC
+    StaticSemaphore_t* buf = mqtt_os_pool_alloc(&freertos_sem_pool);
+    return buf ? (mqtt_sem_t)xSemaphoreCreateCountingStatic(0xFFFF, init_count, buf) : NULL;
+#else
     return (mqtt_sem_t)xSemaphoreCreateCounting(0xFFFF, init_count);
+#endif
 }
 
 static void freertos_sem_destroy(mqtt_sem_t sem) {
     vSemaphoreDelete((SemaphoreHandle_t)sem);
+#ifdef MQTT_OS_STATIC
+    mqtt_os_pool_free(&freertos_sem_pool, sem);
+#endif
 }
 
 static int freertos_sem_wait(mqtt_sem_t sem) {
@@ -50,13 +89,130 @@ static void freertos_sem_post(mqtt_sem_t sem) {
     xSemaphoreGive((SemaphoreHandle_t)sem);
 }
 
-static mqtt_thread_t freertos_thread_create(mqtt_thread_func_t func, void* arg, 
+static int freertos_mutex_trylock(mqtt_mutex_t mutex) {
+    return xSemaphoreTake((SemaphoreHandle_t)mutex, 0) == pdTRUE ? 0 : -1;
+}
+
+static int freertos_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return xSemaphoreTake((SemaphoreHandle_t)sem, pdMS_TO_TICKS(timeout_ms)) == pdTRUE ? 0 : -1;
+}
+
+/* A binary semaphore is an auto-reset event: giving it twice has no effect */
+static mqtt_event_t freertos_event_create(void) {
+#ifdef MQTT_OS_STATIC
+    StaticSemaphore_t* buf = mqtt_os_pool_alloc(&freertos_event_pool);
+    return buf ? (mqtt_event_t)xSemaphoreCreateBinaryStatic(buf) : NULL;
+#else
+    return (mqtt_event_t)xSemaphoreCreateBinary();
+#endif
+}
+
+static void freertos_event_destroy(mqtt_event_t event) {
+    vSemaphoreDelete((SemaphoreHandle_t)event);
+#ifdef MQTT_OS_STATIC
+    mqtt_os_pool_free(&freertos_event_pool, event);
+#endif
+}
+
+static void freertos_event_set(mqtt_event_t event) {
+    xSemaphoreGive((SemaphoreHandle_t)event);
+}
+
+static int freertos_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    return xSemaphoreTake((SemaphoreHandle_t)event, pdMS_TO_TICKS(timeout_ms)) == pdTRUE ? 0 : -1;
+}
+
+static uint32_t freertos_critical_enter(void) {
+    taskENTER_CRITICAL();
+    return 0;
+}
+
+static void freertos_critical_exit(uint32_t state) {
+    (void)state;
+    taskEXIT_CRITICAL();
+}
+
+#ifdef MQTT_OS_STATIC
+
+static mqtt_thread_t freertos_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                               const mqtt_thread_attr_t* attr) {
+    const char* name = attr->name ? attr->name : "mqtt";
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    UBaseType_t priority = attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY;
+    StackType_t* stack = (StackType_t*)attr->stack;
+
+    freertos_thread_t* thread = mqtt_os_pool_alloc(&freertos_thread_pool);
+    if (!thread) return NULL;
+    thread->pool_stack = NULL;
+    if (!stack) {
+        if (stack_size > MQTT_OS_STATIC_STACK_SIZE ||
+            !(thread->pool_stack = mqtt_os_pool_alloc(&freertos_stack_pool))) {
+            mqtt_os_pool_free(&freertos_thread_pool, thread);
+            return NULL;
+        }
+        stack = thread->pool_stack;
+    }
+
+    TaskHandle_t handle = xTaskCreateStatic((TaskFunction_t)func, name,
+                                            stack_size / sizeof(StackType_t), arg, priority,
+                                            stack, &thread->tcb);
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+    if (attr->affinity) vTaskCoreAffinitySet(handle, (UBaseType_t)attr->affinity);
+#endif
+    (void)handle;
+    return (mqtt_thread_t)thread;
+}
+
+#else
+
+static mqtt_thread_t freertos_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                               const mqtt_thread_attr_t* attr) {
+    TaskHandle_t handle = NULL;
+    const char* name = attr->name ? attr->name : "mqtt";
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    configSTACK_DEPTH_TYPE depth = stack_size / sizeof(StackType_t);  /* Stack depth is in words */
+    UBaseType_t priority = attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY;
+    BaseType_t ret;
+
+#if (configNUMBER_OF_CORES > 1) && (configUSE_CORE_AFFINITY == 1)
+    if (attr->affinity) {
+        ret = xTaskCreateAffinitySet((TaskFunction_t)func, name, depth, arg, priority,
+                                     (UBaseType_t)attr->affinity, &handle);
+    } else
+#endif
+    {
+        ret = xTaskCreate((TaskFunction_t)func, name, depth, arg, priority, &handle);
+    }
+    return ret == pdPASS ? (mqtt_thread_t)handle : NULL;
+}
+
+#endif /* MQTT_OS_STATIC */
+
+static mqtt_thread_t freertos_thread_create(mqtt_thread_func_t func, void* arg,
                                             uint32_t stack_size, uint32_t priority) {
-    TaskHandle_t handle;
-    xTaskCreate((TaskFunction_t)func, "mqtt", stack_size / 4, arg, priority, &handle);
-    return (mqtt_thread_t)handle;
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return freertos_thread_create_ex(func, arg, &attr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+static void freertos_thread_destroy(mqtt_thread_t thread) {
+    freertos_thread_t* t = (freertos_thread_t*)thread;
+    TaskHandle_t handle = (TaskHandle_t)&t->tcb;
+
+    /* Deleting another task releases it at once, unlike self-deletion */
+    while (eTaskGetState(handle) != eSuspended) vTaskDelay(1);
+    vTaskDelete(handle);
+    mqtt_os_pool_free(&freertos_stack_pool, t->pool_stack);
+    mqtt_os_pool_free(&freertos_thread_pool, t);
+}
+
+static void freertos_thread_exit(void) {
+    vTaskSuspend(NULL);
+}
+
+#else
+
 static void freertos_thread_destroy(mqtt_thread_t thread) {
     /* FreeRTOS: thread_exit (vTaskDelete(NULL)) already deleted itself, no-op */
     (void)thread;
@@ -66,15 +222,31 @@ static void freertos_thread_exit(void) {
     vTaskDelete(NULL);
 }
 
+#endif /* MQTT_OS_STATIC */
+
 static uint32_t freertos_get_time_ms(void) {
     return xTaskGetTickCount() * portTICK_PERIOD_MS;
 }
 
+static uint64_t freertos_get_time_us(void) {
+#ifdef MQTT_FREERTOS_TIME_US
+    /* Board-provided high resolution counter, e.g. the DWT cycle counter */
+    return MQTT_FREERTOS_TIME_US();
+#else
+    /* The timeout state pairs the tick count with its overflow count */
+    TimeOut_t now;
+    vTaskSetTimeOutState(&now);
+    uint64_t ticks = ((uint64_t)now.xOverflowCount << (sizeof(TickType_t) * 8)) |
+                     (uint64_t)now.xTimeOnEntering;
+    return ticks * 1000000 / configTICK_RATE_HZ;
+#endif
+}
+
 static void freertos_sleep_ms(uint32_t ms) {
     vTaskDelay(pdMS_TO_TICKS(ms));
 }
 
-static const mqtt_os_api_t freertos_os_api = {
+MQTT_OS_PORT_API(freertos_os_api) = {
     .malloc = freertos_malloc,
     .free = freertos_free,
     .mutex_create = freertos_mutex_create,
@@ -89,7 +261,17 @@ static const mqtt_os_api_t freertos_os_api = {
     .thread_destroy = freertos_thread_destroy,
     .thread_exit = freertos_thread_exit,
     .get_time_ms = freertos_get_time_ms,
-    .sleep_ms = freertos_sleep_ms
+    .sleep_ms = freertos_sleep_ms,
+    .get_time_us = freertos_get_time_us,
+    .mutex_trylock = freertos_mutex_trylock,
+    .sem_timedwait = freertos_sem_timedwait,
+    .event_create = freertos_event_create,
+    .event_destroy = freertos_event_destroy,
+    .event_set = freertos_event_set,
+    .event_wait = freertos_event_wait,
+    .critical_enter = freertos_critical_enter,
+    .critical_exit = freertos_critical_exit,
+    .thread_create_ex = freertos_thread_create_ex
 };
 
 void mqtt_freertos_init(void) {
@@ -4,12 +4,19 @@
  * 
  * LiteOS is a lightweight IoT operating system from Huawei.
  * This implementation provides OS abstraction for LiteOS kernel.
+ *
+ * LiteOS keeps mutex, semaphore and task control blocks in statically
+ * sized kernel tables. With MQTT_OS_STATIC the ID holders and event
+ * control blocks come from fixed pools as well; task stacks are always
+ * taken from the kernel memory pool and attr->stack is not supported.
  */
 
 #include "mqtt_os.h"
 #include "los_task.h"
 #include "los_sem.h"
 #include "los_mux.h"
+#include "los_event.h"
+#include "los_hwi.h"
 #include "los_memory.h"
 #include "los_sys.h"
 #include <stdlib.h>
@@ -22,15 +29,28 @@ static void liteos_free(void* ptr) {
     LOS_MemFree(m_aucSysMem0, ptr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+MQTT_OS_POOL_DEFINE(liteos_mutex_pool, UINT32, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(liteos_sem_pool, UINT32, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(liteos_event_pool, EVENT_CB_S, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(liteos_thread_pool, UINT32, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t liteos_mutex_create(void) {
-    UINT32* mutex_id = malloc(sizeof(UINT32));
-    LOS_MuxCreate(mutex_id);
+    UINT32* mutex_id = MQTT_OS_OBJ_ALLOC(liteos_mutex_pool, malloc, sizeof(UINT32));
+    if (!mutex_id) return NULL;
+    if (LOS_MuxCreate(mutex_id) != LOS_OK) {
+        MQTT_OS_OBJ_FREE(liteos_mutex_pool, free, mutex_id);
+        return NULL;
+    }
     return (mqtt_mutex_t)mutex_id;
 }
 
 static void liteos_mutex_destroy(mqtt_mutex_t mutex) {
     LOS_MuxDelete(*(UINT32*)mutex);
-    free(mutex);
+    MQTT_OS_OBJ_FREE(liteos_mutex_pool, free, mutex);
 }
 
 static int liteos_mutex_lock(mqtt_mutex_t mutex) {
@@ -42,14 +62,18 @@ static void liteos_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t liteos_sem_create(uint32_t init_count) {
-    UINT32* sem_id = malloc(sizeof(UINT32));
-    LOS_SemCreate(init_count, sem_id);
+    UINT32* sem_id = MQTT_OS_OBJ_ALLOC(liteos_sem_pool, malloc, sizeof(UINT32));
+    if (!sem_id) return NULL;
+    if (LOS_SemCreate(init_count, sem_id) != LOS_OK) {
+        MQTT_OS_OBJ_FREE(liteos_sem_pool, free, sem_id);
+        return NULL;
+    }
     return (mqtt_sem_t)sem_id;
 }
 
 static void liteos_sem_destroy(mqtt_sem_t sem) {
     LOS_SemDelete(*(UINT32*)sem);
-    free(sem);
+    MQTT_OS_OBJ_FREE(liteos_sem_pool, free, sem);
 }
 
 static int liteos_sem_wait(mqtt_sem_t sem) {
@@ -60,22 +84,79 @@ static void liteos_sem_post(mqtt_sem_t sem) {
     LOS_SemPost(*(UINT32*)sem);
 }
 
-static mqtt_thread_t liteos_thread_create(mqtt_thread_func_t func, void* arg, 
-                                          uint32_t stack_size, uint32_t priority) {
-    UINT32* task_id = malloc(sizeof(UINT32));
+static int liteos_mutex_trylock(mqtt_mutex_t mutex) {
+    return LOS_MuxPend(*(UINT32*)mutex, LOS_NO_WAIT) == LOS_OK ? 0 : -1;
+}
+
+static int liteos_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return LOS_SemPend(*(UINT32*)sem, LOS_MS2Tick(timeout_ms)) == LOS_OK ? 0 : -1;
+}
+
+#define LITEOS_EVENT_FLAG 0x01
+
+static mqtt_event_t liteos_event_create(void) {
+    EVENT_CB_S* event = MQTT_OS_OBJ_ALLOC(liteos_event_pool, malloc, sizeof(EVENT_CB_S));
+    if (!event) return NULL;
+    if (LOS_EventInit(event) != LOS_OK) {
+        MQTT_OS_OBJ_FREE(liteos_event_pool, free, event);
+        return NULL;
+    }
+    return (mqtt_event_t)event;
+}
+
+static void liteos_event_destroy(mqtt_event_t event) {
+    LOS_EventDestroy((EVENT_CB_S*)event);
+    MQTT_OS_OBJ_FREE(liteos_event_pool, free, event);
+}
+
+static void liteos_event_set(mqtt_event_t event) {
+    LOS_EventWrite((EVENT_CB_S*)event, LITEOS_EVENT_FLAG);
+}
+
+static int liteos_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    UINT32 ret = LOS_EventRead((EVENT_CB_S*)event, LITEOS_EVENT_FLAG,
+                               LOS_WAITMODE_OR | LOS_WAITMODE_CLR, LOS_MS2Tick(timeout_ms));
+    return ret == LITEOS_EVENT_FLAG ? 0 : -1;
+}
+
+static uint32_t liteos_critical_enter(void) {
+    return (uint32_t)LOS_IntLock();
+}
+
+static void liteos_critical_exit(uint32_t state) {
+    LOS_IntRestore(state);
+}
+
+static mqtt_thread_t liteos_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                             const mqtt_thread_attr_t* attr) {
+    UINT32* task_id = MQTT_OS_OBJ_ALLOC(liteos_thread_pool, malloc, sizeof(UINT32));
+    if (!task_id) return NULL;
+
     TSK_INIT_PARAM_S task_param = {0};
     task_param.pfnTaskEntry = (TSK_ENTRY_FUNC)func;
-    task_param.uwStackSize = stack_size;
-    task_param.pcName = "mqtt_task";
-    task_param.usTaskPrio = priority;
+    task_param.uwStackSize = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    task_param.pcName = (CHAR*)(attr->name ? attr->name : "mqtt_task");
+    task_param.usTaskPrio = attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY;
     task_param.uwArg = (UINT32)arg;
-    LOS_TaskCreate(task_id, &task_param);
+#ifdef LOSCFG_KERNEL_SMP
+    task_param.usCpuAffiMask = (UINT16)attr->affinity;
+#endif
+    if (LOS_TaskCreate(task_id, &task_param) != LOS_OK) {
+        MQTT_OS_OBJ_FREE(liteos_thread_pool, free, task_id);
+        return NULL;
+    }
     return (mqtt_thread_t)task_id;
 }
 
+static mqtt_thread_t liteos_thread_create(mqtt_thread_func_t func, void* arg,
+                                          uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return liteos_thread_create_ex(func, arg, &attr);
+}
+
 static void liteos_thread_destroy(mqtt_thread_t thread) {
     /* LiteOS thread_exit already deleted, just free handle */
-    free(thread);
+    MQTT_OS_OBJ_FREE(liteos_thread_pool, free, thread);
 }
 
 static void liteos_thread_exit(void) {
@@ -86,11 +167,16 @@ static uint32_t liteos_get_time_ms(void) {
     return LOS_TickCountGet() * 1000 / LOSCFG_BASE_CORE_TICK_PER_SECOND;
 }
 
+static uint64_t liteos_get_time_us(void) {
+    /* Derived from the hardware cycle counter, finer than the tick */
+    return LOS_CurrNanosec() / 1000;
+}
+
 static void liteos_sleep_ms(uint32_t ms) {
     LOS_TaskDelay(LOS_MS2Tick(ms));
 }
 
-static const mqtt_os_api_t liteos_os_api = {
+MQTT_OS_PORT_API(liteos_os_api) = {
     .malloc = liteos_malloc,
     .free = liteos_free,
     .mutex_create = liteos_mutex_create,
@@ -105,7 +191,17 @@ static const mqtt_os_api_t liteos_os_api = {
     .thread_destroy = liteos_thread_destroy,
     .thread_exit = liteos_thread_exit,
     .get_time_ms = liteos_get_time_ms,
-    .sleep_ms = liteos_sleep_ms
+    .sleep_ms = liteos_sleep_ms,
+    .get_time_us = liteos_get_time_us,
+    .mutex_trylock = liteos_mutex_trylock,
+    .sem_timedwait = liteos_sem_timedwait,
+    .event_create = liteos_event_create,
+    .event_destroy = liteos_event_destroy,
+    .event_set = liteos_event_set,
+    .event_wait = liteos_event_wait,
+    .critical_enter = liteos_critical_enter,
+    .critical_exit = liteos_critical_exit,
+    .thread_create_ex = liteos_thread_create_ex
 };
 
 void mqtt_liteos_init(void) {
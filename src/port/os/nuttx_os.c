@@ -4,12 +4,19 @@
  * 
  * NuttX is an Apache real-time operating system.
  * This implementation provides OS abstraction for NuttX kernel.
+ *
+ * With MQTT_OS_STATIC, synchronization objects and thread stacks come from
+ * fixed pools instead of malloc(). The TCB itself is always allocated by
+ * the kernel.
  */
 
 #include "mqtt_os.h"
 #include <nuttx/config.h>
+#include <nuttx/irq.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <time.h>
 #include <unistd.h>
@@ -22,15 +29,38 @@ static void nuttx_free(void* ptr) {
     free(ptr);
 }
 
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int set;
+} nuttx_event_t;
+
+typedef struct {
+    pthread_t tid;
+    void* pool_stack;  /* Stack taken from the pool, if any */
+} nuttx_thread_t;
+
+#ifdef MQTT_OS_STATIC
+
+typedef uint64_t nuttx_stack_t[MQTT_OS_STATIC_STACK_SIZE / sizeof(uint64_t)];
+
+MQTT_OS_POOL_DEFINE(nuttx_mutex_pool, pthread_mutex_t, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(nuttx_sem_pool, sem_t, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(nuttx_event_pool, nuttx_event_t, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(nuttx_thread_pool, nuttx_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(nuttx_stack_pool, nuttx_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t nuttx_mutex_create(void) {
-    pthread_mutex_t* mutex = malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(mutex, NULL);
+    pthread_mutex_t* mutex = MQTT_OS_OBJ_ALLOC(nuttx_mutex_pool, malloc, sizeof(pthread_mutex_t));
+    if (mutex) pthread_mutex_init(mutex, NULL);
     return (mqtt_mutex_t)mutex;
 }
 
 static void nuttx_mutex_destroy(mqtt_mutex_t mutex) {
     pthread_mutex_destroy((pthread_mutex_t*)mutex);
-    free(mutex);
+    MQTT_OS_OBJ_FREE(nuttx_mutex_pool, free, mutex);
 }
 
 static int nuttx_mutex_lock(mqtt_mutex_t mutex) {
@@ -42,14 +72,14 @@ static void nuttx_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t nuttx_sem_create(uint32_t init_count) {
-    sem_t* sem = malloc(sizeof(sem_t));
-    sem_init(sem, 0, init_count);
+    sem_t* sem = MQTT_OS_OBJ_ALLOC(nuttx_sem_pool, malloc, sizeof(sem_t));
+    if (sem) sem_init(sem, 0, init_count);
     return (mqtt_sem_t)sem;
 }
 
 static void nuttx_sem_destroy(mqtt_sem_t sem) {
     sem_destroy((sem_t*)sem);
-    free(sem);
+    MQTT_OS_OBJ_FREE(nuttx_sem_pool, free, sem);
 }
 
 static int nuttx_sem_wait(mqtt_sem_t sem) {
@@ -60,21 +90,155 @@ static void nuttx_sem_post(mqtt_sem_t sem) {
     sem_post((sem_t*)sem);
 }
 
-static mqtt_thread_t nuttx_thread_create(mqtt_thread_func_t func, void* arg, 
-                                         uint32_t stack_size, uint32_t priority) {
-    pthread_t* thread = malloc(sizeof(pthread_t));
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setstacksize(&attr, stack_size);
-    pthread_create(thread, &attr, (void*(*)(void*))func, arg);
-    pthread_attr_destroy(&attr);
+static int nuttx_mutex_trylock(mqtt_mutex_t mutex) {
+    return pthread_mutex_trylock((pthread_mutex_t*)mutex) == 0 ? 0 : -1;
+}
+
+static void nuttx_deadline(clockid_t clock, uint32_t timeout_ms, struct timespec* ts) {
+    clock_gettime(clock, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int nuttx_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    struct timespec ts;
+    nuttx_deadline(CLOCK_MONOTONIC, timeout_ms, &ts);
+    return sem_clockwait((sem_t*)sem, CLOCK_MONOTONIC, &ts) == 0 ? 0 : -1;
+}
+
+static mqtt_event_t nuttx_event_create(void) {
+    nuttx_event_t* event = MQTT_OS_OBJ_ALLOC(nuttx_event_pool, malloc, sizeof(nuttx_event_t));
+    if (!event) return NULL;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&event->mutex, NULL);
+    pthread_cond_init(&event->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    event->set = 0;
+    return (mqtt_event_t)event;
+}
+
+static void nuttx_event_destroy(mqtt_event_t event) {
+    nuttx_event_t* ev = (nuttx_event_t*)event;
+    pthread_cond_destroy(&ev->cond);
+    pthread_mutex_destroy(&ev->mutex);
+    MQTT_OS_OBJ_FREE(nuttx_event_pool, free, ev);
+}
+
+static void nuttx_event_set(mqtt_event_t event) {
+    nuttx_event_t* ev = (nuttx_event_t*)event;
+    pthread_mutex_lock(&ev->mutex);
+    ev->set = 1;
+    pthread_cond_signal(&ev->cond);
+    pthread_mutex_unlock(&ev->mutex);
+}
+
+static int nuttx_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    nuttx_event_t* ev = (nuttx_event_t*)event;
+    struct timespec ts;
+
+    nuttx_deadline(CLOCK_MONOTONIC, timeout_ms, &ts);
+    pthread_mutex_lock(&ev->mutex);
+    while (!ev->set) {
+        if (pthread_cond_timedwait(&ev->cond, &ev->mutex, &ts) == ETIMEDOUT) break;
+    }
+    int ret = ev->set ? 0 : -1;
+    ev->set = 0;
+    pthread_mutex_unlock(&ev->mutex);
+    return ret;
+}
+
+static uint32_t nuttx_critical_enter(void) {
+    return (uint32_t)enter_critical_section();
+}
+
+static void nuttx_critical_exit(uint32_t state) {
+    leave_critical_section((irqstate_t)state);
+}
+
+static mqtt_thread_t nuttx_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                            const mqtt_thread_attr_t* attr) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    nuttx_thread_t* thread = MQTT_OS_OBJ_ALLOC(nuttx_thread_pool, malloc, sizeof(nuttx_thread_t));
+    if (!thread) return NULL;
+    thread->pool_stack = NULL;
+
+    pthread_attr_t pattr;
+    pthread_attr_init(&pattr);
+#ifdef MQTT_OS_STATIC
+    void* stack = attr->stack;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = thread->pool_stack = mqtt_os_pool_alloc(&nuttx_stack_pool);
+    }
+    if (!stack) {
+        pthread_attr_destroy(&pattr);
+        mqtt_os_pool_free(&nuttx_thread_pool, thread);
+        return NULL;
+    }
+    pthread_attr_setstack(&pattr, stack, stack_size);
+#else
+    pthread_attr_setstacksize(&pattr, stack_size);
+#endif
+
+    /* NuttX priorities apply to every policy */
+    if (attr->policy != MQTT_SCHED_DEFAULT || attr->priority) {
+        int policy = attr->policy == MQTT_SCHED_RR ? SCHED_RR : SCHED_FIFO;
+        struct sched_param param = {
+            .sched_priority = attr->priority ? (int)attr->priority : SCHED_PRIORITY_DEFAULT
+        };
+        pthread_attr_setinheritsched(&pattr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&pattr, policy);
+        pthread_attr_setschedparam(&pattr, &param);
+    }
+
+#ifdef CONFIG_SMP
+    if (attr->affinity) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < CONFIG_SMP_NCPUS; cpu++) {
+            if (attr->affinity & (1u << cpu)) CPU_SET(cpu, &cpus);
+        }
+        pthread_attr_setaffinity_np(&pattr, sizeof(cpus), &cpus);
+    }
+#endif
+
+    int ret = pthread_create(&thread->tid, &pattr, (void*(*)(void*))func, arg);
+    pthread_attr_destroy(&pattr);
+    if (ret != 0) {
+#ifdef MQTT_OS_STATIC
+        mqtt_os_pool_free(&nuttx_stack_pool, thread->pool_stack);
+#endif
+        MQTT_OS_OBJ_FREE(nuttx_thread_pool, free, thread);
+        return NULL;
+    }
+
+#if CONFIG_TASK_NAME_SIZE > 0
+    if (attr->name) pthread_setname_np(thread->tid, attr->name);
+#endif
     return (mqtt_thread_t)thread;
 }
 
+static mqtt_thread_t nuttx_thread_create(mqtt_thread_func_t func, void* arg,
+                                         uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return nuttx_thread_create_ex(func, arg, &attr);
+}
+
 static void nuttx_thread_destroy(mqtt_thread_t thread) {
+    nuttx_thread_t* t = (nuttx_thread_t*)thread;
+
     /* NuttX pthread_exit already exited, just join and free */
-    pthread_join(*(pthread_t*)thread, NULL);
-    free(thread);
+    pthread_join(t->tid, NULL);
+#ifdef MQTT_OS_STATIC
+    mqtt_os_pool_free(&nuttx_stack_pool, t->pool_stack);
+#endif
+    MQTT_OS_OBJ_FREE(nuttx_thread_pool, free, t);
 }
 
 static void nuttx_thread_exit(void) {
@@ -87,11 +251,17 @@ static uint32_t nuttx_get_time_ms(void) {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+static uint64_t nuttx_get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void nuttx_sleep_ms(uint32_t ms) {
     usleep(ms * 1000);
 }
 
-static const mqtt_os_api_t nuttx_os_api = {
+MQTT_OS_PORT_API(nuttx_os_api) = {
     .malloc = nuttx_malloc,
     .free = nuttx_free,
     .mutex_create = nuttx_mutex_create,
@@ -106,7 +276,17 @@ static const mqtt_os_api_t nuttx_os_api = {
     .thread_destroy = nuttx_thread_destroy,
     .thread_exit = nuttx_thread_exit,
     .get_time_ms = nuttx_get_time_ms,
-    .sleep_ms = nuttx_sleep_ms
+    .sleep_ms = nuttx_sleep_ms,
+    .get_time_us = nuttx_get_time_us,
+    .mutex_trylock = nuttx_mutex_trylock,
+    .sem_timedwait = nuttx_sem_timedwait,
+    .event_create = nuttx_event_create,
+    .event_destroy = nuttx_event_destroy,
+    .event_set = nuttx_event_set,
+    .event_wait = nuttx_event_wait,
+    .critical_enter = nuttx_critical_enter,
+    .critical_exit = nuttx_critical_exit,
+    .thread_create_ex = nuttx_thread_create_ex
 };
 
 void mqtt_nuttx_init(void) {
@@ -6,11 +6,18 @@
  * (Linux, macOS, Unix) using pthread and standard C library.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* sem_clockwait */
+#endif
+
 #include "mqtt_os.h"
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -60,13 +67,159 @@ static void posix_sem_post(mqtt_sem_t sem) {
     sem_post((sem_t*)sem);
 }
 
-static mqtt_thread_t posix_thread_create(mqtt_thread_func_t func, void* arg, 
-                                         uint32_t stack_size, uint32_t priority) {
+static int posix_mutex_trylock(mqtt_mutex_t mutex) {
+    return pthread_mutex_trylock((pthread_mutex_t*)mutex) == 0 ? 0 : -1;
+}
+
+static void posix_deadline(clockid_t clock, uint32_t timeout_ms, struct timespec* ts) {
+    clock_gettime(clock, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int posix_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    struct timespec ts;
+    int ret;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    /* Immune to wall clock changes */
+    posix_deadline(CLOCK_MONOTONIC, timeout_ms, &ts);
+    while ((ret = sem_clockwait((sem_t*)sem, CLOCK_MONOTONIC, &ts)) != 0 && errno == EINTR);
+#else
+    posix_deadline(CLOCK_REALTIME, timeout_ms, &ts);
+    while ((ret = sem_timedwait((sem_t*)sem, &ts)) != 0 && errno == EINTR);
+#endif
+    return ret == 0 ? 0 : -1;
+}
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int set;
+} posix_event_t;
+
+static mqtt_event_t posix_event_create(void) {
+    posix_event_t* event = malloc(sizeof(posix_event_t));
+    if (!event) return NULL;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&event->mutex, NULL);
+    pthread_cond_init(&event->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    event->set = 0;
+    return (mqtt_event_t)event;
+}
+
+static void posix_event_destroy(mqtt_event_t event) {
+    posix_event_t* ev = (posix_event_t*)event;
+    pthread_cond_destroy(&ev->cond);
+    pthread_mutex_destroy(&ev->mutex);
+    free(ev);
+}
+
+static void posix_event_set(mqtt_event_t event) {
+    posix_event_t* ev = (posix_event_t*)event;
+    pthread_mutex_lock(&ev->mutex);
+    ev->set = 1;
+    pthread_cond_signal(&ev->cond);
+    pthread_mutex_unlock(&ev->mutex);
+}
+
+static int posix_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    posix_event_t* ev = (posix_event_t*)event;
+    struct timespec ts;
+
+    posix_deadline(CLOCK_MONOTONIC, timeout_ms, &ts);
+    pthread_mutex_lock(&ev->mutex);
+    while (!ev->set) {
+        if (pthread_cond_timedwait(&ev->cond, &ev->mutex, &ts) == ETIMEDOUT) break;
+    }
+    int ret = ev->set ? 0 : -1;
+    ev->set = 0;
+    pthread_mutex_unlock(&ev->mutex);
+    return ret;
+}
+
+static pthread_mutex_t posix_critical_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t posix_critical_enter(void) {
+    pthread_mutex_lock(&posix_critical_mutex);
+    return 0;
+}
+
+static void posix_critical_exit(uint32_t state) {
+    (void)state;
+    pthread_mutex_unlock(&posix_critical_mutex);
+}
+
+static mqtt_thread_t posix_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                            const mqtt_thread_attr_t* attr) {
     pthread_t* thread = malloc(sizeof(pthread_t));
-    pthread_create(thread, NULL, (void*(*)(void*))func, arg);
+    if (!thread) return NULL;
+
+    pthread_attr_t pattr;
+    pthread_attr_init(&pattr);
+
+    if (attr->stack_size) {
+        size_t size = attr->stack_size < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : attr->stack_size;
+        pthread_attr_setstacksize(&pattr, size);
+    }
+
+    if (attr->policy != MQTT_SCHED_DEFAULT) {
+        int policy = attr->policy == MQTT_SCHED_FIFO ? SCHED_FIFO : SCHED_RR;
+        struct sched_param param = { .sched_priority = (int)attr->priority };
+        if (param.sched_priority < sched_get_priority_min(policy)) {
+            param.sched_priority = sched_get_priority_min(policy);
+        }
+        if (param.sched_priority > sched_get_priority_max(policy)) {
+            param.sched_priority = sched_get_priority_max(policy);
+        }
+        pthread_attr_setinheritsched(&pattr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&pattr, policy);
+        pthread_attr_setschedparam(&pattr, &param);
+    }
+
+#ifdef __linux__
+    if (attr->affinity) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < 32; cpu++) {
+            if (attr->affinity & (1u << cpu)) CPU_SET(cpu, &cpus);
+        }
+        pthread_attr_setaffinity_np(&pattr, sizeof(cpus), &cpus);
+    }
+#endif
+
+    /* Fails with EPERM when real-time scheduling is not permitted */
+    int ret = pthread_create(thread, &pattr, (void*(*)(void*))func, arg);
+    pthread_attr_destroy(&pattr);
+    if (ret != 0) {
+        free(thread);
+        return NULL;
+    }
+
+#ifdef __linux__
+    if (attr->name) {
+        char name[16];  /* Linux limit including terminator */
+        strncpy(name, attr->name, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        pthread_setname_np(*thread, name);
+    }
+#endif
     return (mqtt_thread_t)thread;
 }
 
+static mqtt_thread_t posix_thread_create(mqtt_thread_func_t func, void* arg,
+                                         uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return posix_thread_create_ex(func, arg, &attr);
+}
+
 static void posix_thread_destroy(mqtt_thread_t thread) {
     /* POSIX pthread_exit already exited, just join and free */
     pthread_join(*(pthread_t*)thread, NULL);
@@ -78,16 +231,22 @@ static void posix_thread_exit(void) {
 }
 
 static uint32_t posix_get_time_ms(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static uint64_t posix_get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 static void posix_sleep_ms(uint32_t ms) {
     usleep(ms * 1000);
 }
 
-static const mqtt_os_api_t posix_os_api = {
+MQTT_OS_PORT_API(posix_os_api) = {
     .malloc = posix_malloc,
     .free = posix_free,
     .mutex_create = posix_mutex_create,
@@ -102,7 +261,17 @@ static const mqtt_os_api_t posix_os_api = {
     .thread_destroy = posix_thread_destroy,
     .thread_exit = posix_thread_exit,
     .get_time_ms = posix_get_time_ms,
-    .sleep_ms = posix_sleep_ms
+    .sleep_ms = posix_sleep_ms,
+    .get_time_us = posix_get_time_us,
+    .mutex_trylock = posix_mutex_trylock,
+    .sem_timedwait = posix_sem_timedwait,
+    .event_create = posix_event_create,
+    .event_destroy = posix_event_destroy,
+    .event_set = posix_event_set,
+    .event_wait = posix_event_wait,
+    .critical_enter = posix_critical_enter,
+    .critical_exit = posix_critical_exit,
+    .thread_create_ex = posix_thread_create_ex
 };
 
 void mqtt_posix_init(void) {
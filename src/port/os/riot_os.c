@@ -4,6 +4,9 @@
  * 
  * RIOT is an IoT-friendly real-time operating system.
  * This implementation provides OS abstraction for RIOT kernel.
+ *
+ * With MQTT_OS_STATIC, mutexes, semaphores and thread stacks come from
+ * fixed pools instead of malloc().
  */
 
 #include "mqtt_os.h"
@@ -11,6 +14,7 @@
 #include "mutex.h"
 #include "sema.h"
 #include "xtimer.h"
+#include "irq.h"
 #include <stdlib.h>
 
 static void* riot_malloc(size_t size) {
@@ -21,14 +25,31 @@ static void riot_free(void* ptr) {
     free(ptr);
 }
 
+typedef struct {
+    kernel_pid_t pid;
+    char* stack;       /* Owned stack, NULL when the caller supplied it */
+} riot_thread_t;
+
+#ifdef MQTT_OS_STATIC
+
+typedef char riot_stack_t[MQTT_OS_STATIC_STACK_SIZE] __attribute__((aligned(8)));
+
+MQTT_OS_POOL_DEFINE(riot_mutex_pool, mutex_t, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(riot_sem_pool, sema_t, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(riot_event_pool, sema_t, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(riot_thread_pool, riot_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(riot_stack_pool, riot_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t riot_mutex_create(void) {
-    mutex_t* mutex = malloc(sizeof(mutex_t));
-    mutex_init(mutex);
+    mutex_t* mutex = MQTT_OS_OBJ_ALLOC(riot_mutex_pool, malloc, sizeof(mutex_t));
+    if (mutex) mutex_init(mutex);
     return (mqtt_mutex_t)mutex;
 }
 
 static void riot_mutex_destroy(mqtt_mutex_t mutex) {
-    free(mutex);
+    MQTT_OS_OBJ_FREE(riot_mutex_pool, free, mutex);
 }
 
 static int riot_mutex_lock(mqtt_mutex_t mutex) {
@@ -41,14 +62,14 @@ static void riot_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t riot_sem_create(uint32_t init_count) {
-    sema_t* sem = malloc(sizeof(sema_t));
-    sema_create(sem, init_count);
+    sema_t* sem = MQTT_OS_OBJ_ALLOC(riot_sem_pool, malloc, sizeof(sema_t));
+    if (sem) sema_create(sem, init_count);
     return (mqtt_sem_t)sem;
 }
 
 static void riot_sem_destroy(mqtt_sem_t sem) {
     sema_destroy((sema_t*)sem);
-    free(sem);
+    MQTT_OS_OBJ_FREE(riot_sem_pool, free, sem);
 }
 
 static int riot_sem_wait(mqtt_sem_t sem) {
@@ -60,17 +81,91 @@ static void riot_sem_post(mqtt_sem_t sem) {
     sema_post((sema_t*)sem);
 }
 
-static mqtt_thread_t riot_thread_create(mqtt_thread_func_t func, void* arg, 
+static int riot_mutex_trylock(mqtt_mutex_t mutex) {
+    return mutex_trylock((mutex_t*)mutex) ? 0 : -1;
+}
+
+static int riot_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return sema_wait_timed((sema_t*)sem, (uint64_t)timeout_ms * 1000) == 0 ? 0 : -1;
+}
+
+/* A semaphore that is only posted while empty behaves as an auto-reset event */
+static mqtt_event_t riot_event_create(void) {
+    sema_t* event = MQTT_OS_OBJ_ALLOC(riot_event_pool, malloc, sizeof(sema_t));
+    if (event) sema_create(event, 0);
+    return (mqtt_event_t)event;
+}
+
+static void riot_event_destroy(mqtt_event_t event) {
+    sema_destroy((sema_t*)event);
+    MQTT_OS_OBJ_FREE(riot_event_pool, free, event);
+}
+
+static void riot_event_set(mqtt_event_t event) {
+    unsigned state = irq_disable();
+    if (sema_get_value((sema_t*)event) == 0) sema_post((sema_t*)event);
+    irq_restore(state);
+}
+
+static int riot_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    return sema_wait_timed((sema_t*)event, (uint64_t)timeout_ms * 1000) == 0 ? 0 : -1;
+}
+
+static uint32_t riot_critical_enter(void) {
+    return irq_disable();
+}
+
+static void riot_critical_exit(uint32_t state) {
+    irq_restore(state);
+}
+
+static mqtt_thread_t riot_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                           const mqtt_thread_attr_t* attr) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    riot_thread_t* t = MQTT_OS_OBJ_ALLOC(riot_thread_pool, malloc, sizeof(riot_thread_t));
+    if (!t) return NULL;
+
+#ifdef MQTT_OS_STATIC
+    char* stack = attr->stack;
+    t->stack = NULL;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = t->stack = mqtt_os_pool_alloc(&riot_stack_pool);
+    }
+#else
+    char* stack = t->stack = malloc(stack_size);
+#endif
+    if (!stack) {
+        MQTT_OS_OBJ_FREE(riot_thread_pool, free, t);
+        return NULL;
+    }
+
+    t->pid = thread_create(stack, stack_size,
+                           attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY,
+                           THREAD_CREATE_STACKTEST, (thread_task_func_t)func, arg,
+                           attr->name ? attr->name : "mqtt_thread");
+    if (t->pid < 0) {
+        MQTT_OS_OBJ_FREE(riot_stack_pool, free, t->stack);
+        MQTT_OS_OBJ_FREE(riot_thread_pool, free, t);
+        return NULL;
+    }
+    return (mqtt_thread_t)t;
+}
+
+static mqtt_thread_t riot_thread_create(mqtt_thread_func_t func, void* arg,
                                         uint32_t stack_size, uint32_t priority) {
-    char* stack = malloc(stack_size);
-    kernel_pid_t* pid = malloc(sizeof(kernel_pid_t));
-    *pid = thread_create(stack, stack_size, priority, THREAD_CREATE_STACKTEST,
-                         (thread_task_func_t)func, arg, "mqtt_thread");
-    return (mqtt_thread_t)pid;
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return riot_thread_create_ex(func, arg, &attr);
 }
 
 static void riot_thread_destroy(mqtt_thread_t thread) {
-    free(thread);
+    riot_thread_t* t = (riot_thread_t*)thread;
+
+    /* The stack stays in use until thread_exit has removed the thread */
+    while (thread_get(t->pid) != NULL) {
+        xtimer_usleep(1000);
+    }
+    MQTT_OS_OBJ_FREE(riot_stack_pool, free, t->stack);
+    MQTT_OS_OBJ_FREE(riot_thread_pool, free, t);
 }
 
 static void riot_thread_exit(void) {
@@ -81,11 +176,15 @@ static uint32_t riot_get_time_ms(void) {
     return xtimer_now_usec() / 1000;
 }
 
+static uint64_t riot_get_time_us(void) {
+    return xtimer_now_usec64();
+}
+
 static void riot_sleep_ms(uint32_t ms) {
     xtimer_usleep(ms * 1000);
 }
 
-static const mqtt_os_api_t riot_os_api = {
+MQTT_OS_PORT_API(riot_os_api) = {
     .malloc = riot_malloc,
     .free = riot_free,
     .mutex_create = riot_mutex_create,
@@ -100,7 +199,17 @@ static const mqtt_os_api_t riot_os_api = {
     .thread_destroy = riot_thread_destroy,
     .thread_exit = riot_thread_exit,
     .get_time_ms = riot_get_time_ms,
-    .sleep_ms = riot_sleep_ms
+    .sleep_ms = riot_sleep_ms,
+    .get_time_us = riot_get_time_us,
+    .mutex_trylock = riot_mutex_trylock,
+    .sem_timedwait = riot_sem_timedwait,
+    .event_create = riot_event_create,
+    .event_destroy = riot_event_destroy,
+    .event_set = riot_event_set,
+    .event_wait = riot_event_wait,
+    .critical_enter = riot_critical_enter,
+    .critical_exit = riot_critical_exit,
+    .thread_create_ex = riot_thread_create_ex
 };
 
 void mqtt_riot_init(void) {
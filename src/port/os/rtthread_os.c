@@ -4,10 +4,16 @@
  * 
  * RT-Thread is an open source real-time operating system from China.
  * This implementation provides OS abstraction for RT-Thread kernel.
+ *
+ * With MQTT_OS_STATIC, objects are initialized in place (rt_*_init) in
+ * fixed pools instead of being created on the RT-Thread heap.
  */
 
 #include "mqtt_os.h"
 #include <rtthread.h>
+#ifdef RT_USING_CPUTIME
+#include <drivers/cputime.h>
+#endif
 
 static void* rtthread_malloc(size_t size) {
     return rt_malloc(size);
@@ -17,12 +23,40 @@ static void rtthread_free(void* ptr) {
     rt_free(ptr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+typedef rt_uint8_t rtthread_stack_t[MQTT_OS_STATIC_STACK_SIZE];
+
+typedef struct {
+    struct rt_thread thread;
+    void* pool_stack;  /* NULL when the caller supplied the stack */
+} rtthread_thread_t;
+
+MQTT_OS_POOL_DEFINE(rtthread_mutex_pool, struct rt_mutex, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(rtthread_sem_pool, struct rt_semaphore, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(rtthread_event_pool, struct rt_event, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(rtthread_thread_pool, rtthread_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(rtthread_stack_pool, rtthread_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t rtthread_mutex_create(void) {
+#ifdef MQTT_OS_STATIC
+    rt_mutex_t mutex = mqtt_os_pool_alloc(&rtthread_mutex_pool);
+    if (mutex) rt_mutex_init(mutex, "mqtt_mutex", RT_IPC_FLAG_FIFO);
+    return (mqtt_mutex_t)mutex;
+#else
     return (mqtt_mutex_t)rt_mutex_create("mqtt_mutex", RT_IPC_FLAG_FIFO);
+#endif
 }
 
 static void rtthread_mutex_destroy(mqtt_mutex_t mutex) {
+#ifdef MQTT_OS_STATIC
+    rt_mutex_detach((rt_mutex_t)mutex);
+    mqtt_os_pool_free(&rtthread_mutex_pool, mutex);
+#else
     rt_mutex_delete((rt_mutex_t)mutex);
+#endif
 }
 
 static int rtthread_mutex_lock(mqtt_mutex_t mutex) {
@@ -34,11 +68,22 @@ static void rtthread_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t rtthread_sem_create(uint32_t init_count) {
+#ifdef MQTT_OS_STATIC
+    rt_sem_t sem = mqtt_os_pool_alloc(&rtthread_sem_pool);
+    if (sem) rt_sem_init(sem, "mqtt_sem", init_count, RT_IPC_FLAG_FIFO);
+    return (mqtt_sem_t)sem;
+#else
     return (mqtt_sem_t)rt_sem_create("mqtt_sem", init_count, RT_IPC_FLAG_FIFO);
+#endif
 }
 
 static void rtthread_sem_destroy(mqtt_sem_t sem) {
+#ifdef MQTT_OS_STATIC
+    rt_sem_detach((rt_sem_t)sem);
+    mqtt_os_pool_free(&rtthread_sem_pool, sem);
+#else
     rt_sem_delete((rt_sem_t)sem);
+#endif
 }
 
 static int rtthread_sem_wait(mqtt_sem_t sem) {
@@ -49,16 +94,136 @@ static void rtthread_sem_post(mqtt_sem_t sem) {
     rt_sem_release((rt_sem_t)sem);
 }
 
-static mqtt_thread_t rtthread_thread_create(mqtt_thread_func_t func, void* arg, 
-                                            uint32_t stack_size, uint32_t priority) {
-    rt_thread_t thread = rt_thread_create("mqtt_thread", (void (*)(void*))func, arg,
-                                          stack_size, priority, 10);
+static int rtthread_mutex_trylock(mqtt_mutex_t mutex) {
+    return rt_mutex_take((rt_mutex_t)mutex, 0) == RT_EOK ? 0 : -1;
+}
+
+static int rtthread_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return rt_sem_take((rt_sem_t)sem, rt_tick_from_millisecond(timeout_ms)) == RT_EOK ? 0 : -1;
+}
+
+#define RTTHREAD_EVENT_FLAG 0x01
+
+static mqtt_event_t rtthread_event_create(void) {
+#ifdef MQTT_OS_STATIC
+    rt_event_t event = mqtt_os_pool_alloc(&rtthread_event_pool);
+    if (event) rt_event_init(event, "mqtt_evt", RT_IPC_FLAG_FIFO);
+    return (mqtt_event_t)event;
+#else
+    return (mqtt_event_t)rt_event_create("mqtt_evt", RT_IPC_FLAG_FIFO);
+#endif
+}
+
+static void rtthread_event_destroy(mqtt_event_t event) {
+#ifdef MQTT_OS_STATIC
+    rt_event_detach((rt_event_t)event);
+    mqtt_os_pool_free(&rtthread_event_pool, event);
+#else
+    rt_event_delete((rt_event_t)event);
+#endif
+}
+
+static void rtthread_event_set(mqtt_event_t event) {
+    rt_event_send((rt_event_t)event, RTTHREAD_EVENT_FLAG);
+}
+
+static int rtthread_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    return rt_event_recv((rt_event_t)event, RTTHREAD_EVENT_FLAG,
+                         RT_EVENT_FLAG_OR | RT_EVENT_FLAG_CLEAR,
+                         rt_tick_from_millisecond(timeout_ms), RT_NULL) == RT_EOK ? 0 : -1;
+}
+
+static uint32_t rtthread_critical_enter(void) {
+    return (uint32_t)rt_hw_interrupt_disable();
+}
+
+static void rtthread_critical_exit(uint32_t state) {
+    rt_hw_interrupt_enable((rt_base_t)state);
+}
+
+#ifdef MQTT_OS_STATIC
+
+static rt_thread_t rtthread_thread_init(mqtt_thread_func_t func, void* arg,
+                                        const mqtt_thread_attr_t* attr, rtthread_thread_t** out) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    void* stack = attr->stack;
+
+    rtthread_thread_t* t = mqtt_os_pool_alloc(&rtthread_thread_pool);
+    if (!t) return RT_NULL;
+    t->pool_stack = RT_NULL;
+    if (!stack) {
+        if (stack_size > MQTT_OS_STATIC_STACK_SIZE ||
+            !(t->pool_stack = mqtt_os_pool_alloc(&rtthread_stack_pool))) {
+            mqtt_os_pool_free(&rtthread_thread_pool, t);
+            return RT_NULL;
+        }
+        stack = t->pool_stack;
+    }
+
+    if (rt_thread_init(&t->thread, attr->name ? attr->name : "mqtt_thread",
+                       (void (*)(void*))func, arg, stack, stack_size,
+                       attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY, 10) != RT_EOK) {
+        mqtt_os_pool_free(&rtthread_stack_pool, t->pool_stack);
+        mqtt_os_pool_free(&rtthread_thread_pool, t);
+        return RT_NULL;
+    }
+    *out = t;
+    return &t->thread;
+}
+
+#endif /* MQTT_OS_STATIC */
+
+static mqtt_thread_t rtthread_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                               const mqtt_thread_attr_t* attr) {
+#ifdef MQTT_OS_STATIC
+    rtthread_thread_t* handle = RT_NULL;
+    rt_thread_t thread = rtthread_thread_init(func, arg, attr, &handle);
+#else
+    rt_thread_t thread = rt_thread_create(attr->name ? attr->name : "mqtt_thread",
+                                          (void (*)(void*))func, arg,
+                                          attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE,
+                                          attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY, 10);
+    rt_thread_t handle = thread;
+#endif
     if (thread) {
+#ifdef RT_USING_SMP
+        /* RT-Thread binds to a single CPU: take the lowest one in the mask */
+        if (attr->affinity) {
+            rt_ubase_t cpu = 0;
+            while (!(attr->affinity & (1u << cpu))) cpu++;
+            rt_thread_control(thread, RT_THREAD_CTRL_BIND_CPU, (void*)cpu);
+        }
+#endif
         rt_thread_startup(thread);
     }
-    return (mqtt_thread_t)thread;
+    return (mqtt_thread_t)handle;
+}
+
+static mqtt_thread_t rtthread_thread_create(mqtt_thread_func_t func, void* arg,
+                                            uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return rtthread_thread_create_ex(func, arg, &attr);
 }
 
+#ifdef MQTT_OS_STATIC
+
+static void rtthread_thread_destroy(mqtt_thread_t thread) {
+    rtthread_thread_t* t = (rtthread_thread_t*)thread;
+
+    /* The kernel detaches a static thread once its entry has returned */
+    while (rt_object_get_type((rt_object_t)&t->thread) == RT_Object_Class_Thread) {
+        rt_thread_mdelay(1);
+    }
+    mqtt_os_pool_free(&rtthread_stack_pool, t->pool_stack);
+    mqtt_os_pool_free(&rtthread_thread_pool, t);
+}
+
+static void rtthread_thread_exit(void) {
+    /* Return from the entry function, the kernel exit path detaches the thread */
+}
+
+#else
+
 static void rtthread_thread_destroy(mqtt_thread_t thread) {
     /* In RT-Thread, thread_exit already deleted itself, make this a no-op */
     (void)thread;
@@ -68,15 +233,34 @@ static void rtthread_thread_exit(void) {
     rt_thread_delete(rt_thread_self());
 }
 
+#endif /* MQTT_OS_STATIC */
+
 static uint32_t rtthread_get_time_ms(void) {
     return rt_tick_get() * 1000 / RT_TICK_PER_SECOND;
 }
 
+static uint64_t rtthread_get_time_us(void) {
+#ifdef RT_USING_CPUTIME
+    return clock_cpu_microsecond(clock_cpu_gettime());
+#else
+    /* Extend the 32-bit tick counter across wraparound */
+    static rt_tick_t last_tick = 0;
+    static uint64_t wraps = 0;
+    rt_base_t level = rt_hw_interrupt_disable();
+    rt_tick_t tick = rt_tick_get();
+    if (tick < last_tick) wraps++;
+    last_tick = tick;
+    uint64_t ticks = (wraps << 32) | tick;
+    rt_hw_interrupt_enable(level);
+    return ticks * 1000000 / RT_TICK_PER_SECOND;
+#endif
+}
+
 static void rtthread_sleep_ms(uint32_t ms) {
     rt_thread_mdelay(ms);
 }
 
-static const mqtt_os_api_t rtthread_os_api = {
+MQTT_OS_PORT_API(rtthread_os_api) = {
     .malloc = rtthread_malloc,
     .free = rtthread_free,
     .mutex_create = rtthread_mutex_create,
@@ -91,7 +275,17 @@ static const mqtt_os_api_t rtthread_os_api = {
     .thread_destroy = rtthread_thread_destroy,
     .thread_exit = rtthread_thread_exit,
     .get_time_ms = rtthread_get_time_ms,
-    .sleep_ms = rtthread_sleep_ms
+    .sleep_ms = rtthread_sleep_ms,
+    .get_time_us = rtthread_get_time_us,
+    .mutex_trylock = rtthread_mutex_trylock,
+    .sem_timedwait = rtthread_sem_timedwait,
+    .event_create = rtthread_event_create,
+    .event_destroy = rtthread_event_destroy,
+    .event_set = rtthread_event_set,
+    .event_wait = rtthread_event_wait,
+    .critical_enter = rtthread_critical_enter,
+    .critical_exit = rtthread_critical_exit,
+    .thread_create_ex = rtthread_thread_create_ex
 };
 
 void mqtt_rtthread_init(void) {
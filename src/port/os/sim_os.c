@@ -0,0 +1,413 @@
+/**
+ * @file sim_os.c
+ * @brief Deterministic virtual-time OS abstraction layer (simulation)
+ *
+ * Every simulated thread is backed by a pthread, but only the thread
+ * holding the baton (g_current) runs. A thread gives the baton away only
+ * when it blocks; the next runnable thread is taken in FIFO order, and
+ * when none is runnable the virtual clock advances to the earliest
+ * timeout. Scheduling therefore depends only on program behavior, never
+ * on host timing.
+ */
+
+#include "mqtt_sim.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+typedef enum {
+    SIM_RUNNABLE = 0,
+    SIM_WAITING,
+    SIM_DONE
+} sim_state_t;
+
+typedef struct sim_thread {
+    pthread_t pthread;
+    pthread_cond_t cond;
+    sim_state_t state;
+    const void* channel;          /* Wait channel while SIM_WAITING */
+    uint64_t wake_at;             /* Virtual timeout, UINT64_MAX for none */
+    int timed_out;
+    mqtt_thread_func_t func;
+    void* arg;
+    struct sim_thread* next_all;  /* All threads in creation order */
+    struct sim_thread* next_run;  /* Run queue link */
+} sim_thread_t;
+
+typedef struct {
+    sim_thread_t* owner;
+} sim_mutex_t;
+
+typedef struct {
+    uint32_t count;
+} sim_sem_t;
+
+typedef struct {
+    int set;
+} sim_event_t;
+
+static pthread_mutex_t g_big = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t g_self_key;
+static sim_thread_t* g_current = NULL;
+static sim_thread_t* g_threads = NULL;
+static sim_thread_t* g_runq_head = NULL;
+static sim_thread_t* g_runq_tail = NULL;
+static uint64_t g_now_ms = 0;
+
+static sim_thread_t* sim_self(void) {
+    sim_thread_t* self = (sim_thread_t*)pthread_getspecific(g_self_key);
+    if (!self) {
+        fprintf(stderr, "sim_os: called from a thread not created by the simulation\n");
+        abort();
+    }
+    return self;
+}
+
+/* Caller holds g_big */
+static void sim_enqueue(sim_thread_t* t) {
+    t->state = SIM_RUNNABLE;
+    t->next_run = NULL;
+    if (g_runq_tail) g_runq_tail->next_run = t;
+    else g_runq_head = t;
+    g_runq_tail = t;
+}
+
+/* Caller holds g_big. Take the next runnable thread, advancing time if needed. */
+static sim_thread_t* sim_pick_next(void) {
+    sim_thread_t* next = g_runq_head;
+    if (next) {
+        g_runq_head = next->next_run;
+        if (!g_runq_head) g_runq_tail = NULL;
+        return next;
+    }
+
+    /* Nothing runnable: jump to the earliest timeout, ties go to the oldest thread */
+    for (sim_thread_t* t = g_threads; t; t = t->next_all) {
+        if (t->state == SIM_WAITING && t->wake_at != UINT64_MAX &&
+            (!next || t->wake_at < next->wake_at)) {
+            next = t;
+        }
+    }
+    if (!next) {
+        fprintf(stderr, "sim_os: deadlock, every thread is blocked without timeout\n");
+        abort();
+    }
+    if (next->wake_at > g_now_ms) g_now_ms = next->wake_at;
+    next->state = SIM_RUNNABLE;
+    next->channel = NULL;
+    next->timed_out = 1;
+    return next;
+}
+
+/* Caller holds g_big. Hand the baton over and wait until it comes back. */
+static void sim_switch(sim_thread_t* self) {
+    sim_thread_t* next = sim_pick_next();
+    g_current = next;
+    if (next == self) return;
+
+    pthread_cond_signal(&next->cond);
+    if (self->state == SIM_DONE) return;
+    while (g_current != self) {
+        pthread_cond_wait(&self->cond, &g_big);
+    }
+}
+
+int mqtt_sim_wait(const void* channel, uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_big);
+    sim_thread_t* self = sim_self();
+    self->state = SIM_WAITING;
+    self->channel = channel;
+    self->wake_at = timeout_ms == MQTT_SIM_FOREVER ? UINT64_MAX : g_now_ms + timeout_ms;
+    self->timed_out = 0;
+    sim_switch(self);
+    int ret = self->timed_out ? -1 : 0;
+    pthread_mutex_unlock(&g_big);
+    return ret;
+}
+
+/* Caller holds g_big */
+static void sim_wake_locked(const void* channel) {
+    for (sim_thread_t* t = g_threads; t; t = t->next_all) {
+        if (t->state == SIM_WAITING && t->channel == channel) {
+            t->channel = NULL;
+            t->timed_out = 0;
+            sim_enqueue(t);
+        }
+    }
+}
+
+void mqtt_sim_wake(const void* channel) {
+    if (!channel) return;
+
+    pthread_mutex_lock(&g_big);
+    sim_wake_locked(channel);
+    pthread_mutex_unlock(&g_big);
+}
+
+uint64_t mqtt_sim_now_ms(void) {
+    pthread_mutex_lock(&g_big);
+    uint64_t now = g_now_ms;
+    pthread_mutex_unlock(&g_big);
+    return now;
+}
+
+static void* sim_malloc(size_t size) {
+    return malloc(size);
+}
+
+static void sim_free(void* ptr) {
+    free(ptr);
+}
+
+static mqtt_mutex_t sim_mutex_create(void) {
+    return (mqtt_mutex_t)calloc(1, sizeof(sim_mutex_t));
+}
+
+static void sim_mutex_destroy(mqtt_mutex_t mutex) {
+    free(mutex);
+}
+
+static int sim_mutex_lock(mqtt_mutex_t mutex) {
+    sim_mutex_t* m = (sim_mutex_t*)mutex;
+    while (m->owner) {
+        mqtt_sim_wait(m, MQTT_SIM_FOREVER);
+    }
+    m->owner = sim_self();
+    return 0;
+}
+
+static void sim_mutex_unlock(mqtt_mutex_t mutex) {
+    sim_mutex_t* m = (sim_mutex_t*)mutex;
+    m->owner = NULL;
+    mqtt_sim_wake(m);
+}
+
+static mqtt_sem_t sim_sem_create(uint32_t init_count) {
+    sim_sem_t* sem = (sim_sem_t*)calloc(1, sizeof(sim_sem_t));
+    if (sem) sem->count = init_count;
+    return (mqtt_sem_t)sem;
+}
+
+static void sim_sem_destroy(mqtt_sem_t sem) {
+    free(sem);
+}
+
+static int sim_sem_wait(mqtt_sem_t sem) {
+    sim_sem_t* s = (sim_sem_t*)sem;
+    while (s->count == 0) {
+        mqtt_sim_wait(s, MQTT_SIM_FOREVER);
+    }
+    s->count--;
+    return 0;
+}
+
+static void sim_sem_post(mqtt_sem_t sem) {
+    sim_sem_t* s = (sim_sem_t*)sem;
+    s->count++;
+    mqtt_sim_wake(s);
+}
+
+static void sim_thread_finish(sim_thread_t* self) {
+    pthread_mutex_lock(&g_big);
+    self->state = SIM_DONE;
+    sim_wake_locked(self);
+    sim_switch(self);
+    pthread_mutex_unlock(&g_big);
+    pthread_exit(NULL);
+}
+
+static void* sim_thread_entry(void* arg) {
+    sim_thread_t* self = (sim_thread_t*)arg;
+
+    pthread_setspecific(g_self_key, self);
+    pthread_mutex_lock(&g_big);
+    while (g_current != self) {
+        pthread_cond_wait(&self->cond, &g_big);
+    }
+    pthread_mutex_unlock(&g_big);
+
+    self->func(self->arg);
+    sim_thread_finish(self);
+    return NULL;
+}
+
+static int sim_mutex_trylock(mqtt_mutex_t mutex) {
+    sim_mutex_t* m = (sim_mutex_t*)mutex;
+    if (m->owner) return -1;
+    m->owner = sim_self();
+    return 0;
+}
+
+static int sim_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    sim_sem_t* s = (sim_sem_t*)sem;
+    uint64_t deadline = mqtt_sim_now_ms() + timeout_ms;
+
+    while (s->count == 0) {
+        uint64_t now = mqtt_sim_now_ms();
+        if (now >= deadline) return -1;
+        mqtt_sim_wait(s, (uint32_t)(deadline - now));
+    }
+    s->count--;
+    return 0;
+}
+
+static mqtt_event_t sim_event_create(void) {
+    return (mqtt_event_t)calloc(1, sizeof(sim_event_t));
+}
+
+static void sim_event_destroy(mqtt_event_t event) {
+    free(event);
+}
+
+static void sim_event_set(mqtt_event_t event) {
+    sim_event_t* ev = (sim_event_t*)event;
+    ev->set = 1;
+    mqtt_sim_wake(ev);
+}
+
+static int sim_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    sim_event_t* ev = (sim_event_t*)event;
+    uint64_t deadline = mqtt_sim_now_ms() + timeout_ms;
+
+    while (!ev->set) {
+        uint64_t now = mqtt_sim_now_ms();
+        if (now >= deadline) return -1;
+        mqtt_sim_wait(ev, (uint32_t)(deadline - now));
+    }
+    ev->set = 0;
+    return 0;
+}
+
+/* Only one simulated thread runs at a time, so sections need no locking */
+static uint32_t sim_critical_enter(void) {
+    return 0;
+}
+
+static void sim_critical_exit(uint32_t state) {
+    (void)state;
+}
+
+/* Attributes have no meaning under the cooperative scheduler */
+static mqtt_thread_t sim_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                          const mqtt_thread_attr_t* attr) {
+    (void)attr;
+
+    sim_thread_t* t = (sim_thread_t*)calloc(1, sizeof(sim_thread_t));
+    if (!t) return NULL;
+    t->func = func;
+    t->arg = arg;
+    pthread_cond_init(&t->cond, NULL);
+
+    pthread_mutex_lock(&g_big);
+    if (pthread_create(&t->pthread, NULL, sim_thread_entry, t) != 0) {
+        pthread_mutex_unlock(&g_big);
+        pthread_cond_destroy(&t->cond);
+        free(t);
+        return NULL;
+    }
+    sim_thread_t** tail = &g_threads;
+    while (*tail) tail = &(*tail)->next_all;
+    *tail = t;
+    sim_enqueue(t);
+    pthread_mutex_unlock(&g_big);
+    return (mqtt_thread_t)t;
+}
+
+static mqtt_thread_t sim_thread_create(mqtt_thread_func_t func, void* arg,
+                                       uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return sim_thread_create_ex(func, arg, &attr);
+}
+
+static void sim_thread_destroy(mqtt_thread_t thread) {
+    sim_thread_t* t = (sim_thread_t*)thread;
+
+    /* Let the thread run to completion in virtual time before joining it */
+    while (t->state != SIM_DONE) {
+        mqtt_sim_wait(t, MQTT_SIM_FOREVER);
+    }
+    pthread_join(t->pthread, NULL);
+
+    pthread_mutex_lock(&g_big);
+    for (sim_thread_t** p = &g_threads; *p; p = &(*p)->next_all) {
+        if (*p == t) {
+            *p = t->next_all;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_big);
+
+    pthread_cond_destroy(&t->cond);
+    free(t);
+}
+
+static void sim_thread_exit(void) {
+    sim_thread_finish(sim_self());
+}
+
+static uint32_t sim_get_time_ms(void) {
+    return (uint32_t)mqtt_sim_now_ms();
+}
+
+static uint64_t sim_get_time_us(void) {
+    return mqtt_sim_now_ms() * 1000;
+}
+
+static void sim_sleep_ms(uint32_t ms) {
+    if (ms == 0) {
+        /* Yield: go to the back of the run queue */
+        pthread_mutex_lock(&g_big);
+        sim_thread_t* self = sim_self();
+        sim_enqueue(self);
+        sim_switch(self);
+        pthread_mutex_unlock(&g_big);
+        return;
+    }
+    mqtt_sim_wait(NULL, ms);
+}
+
+MQTT_OS_PORT_API(sim_os_api) = {
+    .malloc = sim_malloc,
+    .free = sim_free,
+    .mutex_create = sim_mutex_create,
+    .mutex_destroy = sim_mutex_destroy,
+    .mutex_lock = sim_mutex_lock,
+    .mutex_unlock = sim_mutex_unlock,
+    .sem_create = sim_sem_create,
+    .sem_destroy = sim_sem_destroy,
+    .sem_wait = sim_sem_wait,
+    .sem_post = sim_sem_post,
+    .thread_create = sim_thread_create,
+    .thread_destroy = sim_thread_destroy,
+    .thread_exit = sim_thread_exit,
+    .get_time_ms = sim_get_time_ms,
+    .sleep_ms = sim_sleep_ms,
+    .get_time_us = sim_get_time_us,
+    .mutex_trylock = sim_mutex_trylock,
+    .sem_timedwait = sim_sem_timedwait,
+    .event_create = sim_event_create,
+    .event_destroy = sim_event_destroy,
+    .event_set = sim_event_set,
+    .event_wait = sim_event_wait,
+    .critical_enter = sim_critical_enter,
+    .critical_exit = sim_critical_exit,
+    .thread_create_ex = sim_thread_create_ex
+};
+
+void mqtt_sim_init(void) {
+    sim_thread_t* main_thread = (sim_thread_t*)calloc(1, sizeof(sim_thread_t));
+    if (!main_thread) abort();
+
+    pthread_key_create(&g_self_key, NULL);
+    main_thread->pthread = pthread_self();
+    pthread_cond_init(&main_thread->cond, NULL);
+    pthread_setspecific(g_self_key, main_thread);
+
+    pthread_mutex_lock(&g_big);
+    g_threads = main_thread;
+    g_current = main_thread;
+    g_now_ms = 0;
+    pthread_mutex_unlock(&g_big);
+
+    mqtt_os_init(&sim_os_api);
+}
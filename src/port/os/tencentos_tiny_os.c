@@ -4,6 +4,9 @@
  * 
  * TencentOS-tiny is a lightweight IoT operating system from Tencent.
  * This implementation provides OS abstraction for TencentOS-tiny kernel.
+ *
+ * With MQTT_OS_STATIC, kernel objects and task stacks come from fixed
+ * pools instead of the tos_mmheap.
  */
 
 #include "mqtt_os.h"
@@ -17,15 +20,32 @@ static void tencentos_free(void* ptr) {
     tos_mmheap_free(ptr);
 }
 
+typedef struct {
+    k_task_t task;
+    void* stack;       /* Owned stack, NULL when the caller supplied it */
+} tencentos_thread_t;
+
+#ifdef MQTT_OS_STATIC
+
+typedef k_stack_t tencentos_stack_t[MQTT_OS_STATIC_STACK_SIZE / sizeof(k_stack_t)];
+
+MQTT_OS_POOL_DEFINE(tencentos_mutex_pool, k_mutex_t, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(tencentos_sem_pool, k_sem_t, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(tencentos_event_pool, k_event_t, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(tencentos_thread_pool, tencentos_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(tencentos_stack_pool, tencentos_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t tencentos_mutex_create(void) {
-    k_mutex_t* mutex = tos_mmheap_alloc(sizeof(k_mutex_t));
-    tos_mutex_create(mutex);
+    k_mutex_t* mutex = MQTT_OS_OBJ_ALLOC(tencentos_mutex_pool, tos_mmheap_alloc, sizeof(k_mutex_t));
+    if (mutex) tos_mutex_create(mutex);
     return (mqtt_mutex_t)mutex;
 }
 
 static void tencentos_mutex_destroy(mqtt_mutex_t mutex) {
     tos_mutex_destroy((k_mutex_t*)mutex);
-    tos_mmheap_free(mutex);
+    MQTT_OS_OBJ_FREE(tencentos_mutex_pool, tos_mmheap_free, mutex);
 }
 
 static int tencentos_mutex_lock(mqtt_mutex_t mutex) {
@@ -37,14 +57,14 @@ static void tencentos_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t tencentos_sem_create(uint32_t init_count) {
-    k_sem_t* sem = tos_mmheap_alloc(sizeof(k_sem_t));
-    tos_sem_create(sem, init_count);
+    k_sem_t* sem = MQTT_OS_OBJ_ALLOC(tencentos_sem_pool, tos_mmheap_alloc, sizeof(k_sem_t));
+    if (sem) tos_sem_create(sem, init_count);
     return (mqtt_sem_t)sem;
 }
 
 static void tencentos_sem_destroy(mqtt_sem_t sem) {
     tos_sem_destroy((k_sem_t*)sem);
-    tos_mmheap_free(sem);
+    MQTT_OS_OBJ_FREE(tencentos_sem_pool, tos_mmheap_free, sem);
 }
 
 static int tencentos_sem_wait(mqtt_sem_t sem) {
@@ -55,17 +75,92 @@ static void tencentos_sem_post(mqtt_sem_t sem) {
     tos_sem_post((k_sem_t*)sem);
 }
 
-static mqtt_thread_t tencentos_thread_create(mqtt_thread_func_t func, void* arg, 
+static int tencentos_mutex_trylock(mqtt_mutex_t mutex) {
+    return tos_mutex_pend_timed((k_mutex_t*)mutex, TOS_TIME_NOWAIT) == K_ERR_NONE ? 0 : -1;
+}
+
+static int tencentos_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return tos_sem_pend((k_sem_t*)sem, tos_millisec2tick(timeout_ms)) == K_ERR_NONE ? 0 : -1;
+}
+
+#define TENCENTOS_EVENT_FLAG ((k_event_flag_t)0x01)
+
+static mqtt_event_t tencentos_event_create(void) {
+    k_event_t* event = MQTT_OS_OBJ_ALLOC(tencentos_event_pool, tos_mmheap_alloc, sizeof(k_event_t));
+    if (!event) return NULL;
+    if (tos_event_create(event, 0) != K_ERR_NONE) {
+        MQTT_OS_OBJ_FREE(tencentos_event_pool, tos_mmheap_free, event);
+        return NULL;
+    }
+    return (mqtt_event_t)event;
+}
+
+static void tencentos_event_destroy(mqtt_event_t event) {
+    tos_event_destroy((k_event_t*)event);
+    MQTT_OS_OBJ_FREE(tencentos_event_pool, tos_mmheap_free, event);
+}
+
+static void tencentos_event_set(mqtt_event_t event) {
+    tos_event_post_keep((k_event_t*)event, TENCENTOS_EVENT_FLAG);
+}
+
+static int tencentos_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    k_event_flag_t match;
+    return tos_event_pend((k_event_t*)event, TENCENTOS_EVENT_FLAG, &match,
+                          tos_millisec2tick(timeout_ms),
+                          TOS_OPT_EVENT_PEND_ANY | TOS_OPT_EVENT_PEND_CLR) == K_ERR_NONE ? 0 : -1;
+}
+
+static uint32_t tencentos_critical_enter(void) {
+    return (uint32_t)tos_cpu_cpsr_save();
+}
+
+static void tencentos_critical_exit(uint32_t state) {
+    tos_cpu_cpsr_restore((cpu_cpsr_t)state);
+}
+
+static mqtt_thread_t tencentos_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                                const mqtt_thread_attr_t* attr) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    tencentos_thread_t* t = MQTT_OS_OBJ_ALLOC(tencentos_thread_pool, tos_mmheap_alloc,
+                                              sizeof(tencentos_thread_t));
+    if (!t) return NULL;
+
+#ifdef MQTT_OS_STATIC
+    k_stack_t* stack = attr->stack;
+    t->stack = NULL;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = t->stack = mqtt_os_pool_alloc(&tencentos_stack_pool);
+    }
+#else
+    k_stack_t* stack = t->stack = tos_mmheap_alloc(stack_size);
+#endif
+    if (!stack ||
+        tos_task_create(&t->task, (char*)(attr->name ? attr->name : "mqtt_task"), (k_task_entry_t)func,
+                        arg, attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY,
+                        stack, stack_size, 0) != K_ERR_NONE) {
+        if (t->stack) MQTT_OS_OBJ_FREE(tencentos_stack_pool, tos_mmheap_free, t->stack);
+        MQTT_OS_OBJ_FREE(tencentos_thread_pool, tos_mmheap_free, t);
+        return NULL;
+    }
+    return (mqtt_thread_t)t;
+}
+
+static mqtt_thread_t tencentos_thread_create(mqtt_thread_func_t func, void* arg,
                                              uint32_t stack_size, uint32_t priority) {
-    k_task_t* task = tos_mmheap_alloc(sizeof(k_task_t));
-    k_stack_t* stack = tos_mmheap_alloc(stack_size);
-    tos_task_create(task, "mqtt_task", (k_task_entry_t)func, arg, priority, stack, stack_size, 0);
-    return (mqtt_thread_t)task;
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return tencentos_thread_create_ex(func, arg, &attr);
 }
 
 static void tencentos_thread_destroy(mqtt_thread_t thread) {
-    /* TencentOS thread_exit already destroyed, no-op */
-    (void)thread;
+    tencentos_thread_t* t = (tencentos_thread_t*)thread;
+
+    /* The task and stack stay in use until thread_exit has destroyed the task */
+    while (t->task.state != K_TASK_STATE_DELETED) {
+        tos_task_delay(1);
+    }
+    if (t->stack) MQTT_OS_OBJ_FREE(tencentos_stack_pool, tos_mmheap_free, t->stack);
+    MQTT_OS_OBJ_FREE(tencentos_thread_pool, tos_mmheap_free, t);
 }
 
 static void tencentos_thread_exit(void) {
@@ -76,11 +171,15 @@ static uint32_t tencentos_get_time_ms(void) {
     return tos_systick_get() * 1000 / TOS_CFG_CPU_TICK_PER_SECOND;
 }
 
+static uint64_t tencentos_get_time_us(void) {
+    return (uint64_t)tos_systick_get() * 1000000 / TOS_CFG_CPU_TICK_PER_SECOND;
+}
+
 static void tencentos_sleep_ms(uint32_t ms) {
     tos_task_delay(tos_millisec2tick(ms));
 }
 
-static const mqtt_os_api_t tencentos_os_api = {
+MQTT_OS_PORT_API(tencentos_os_api) = {
     .malloc = tencentos_malloc,
     .free = tencentos_free,
     .mutex_create = tencentos_mutex_create,
@@ -95,7 +194,17 @@ static const mqtt_os_api_t tencentos_os_api = {
     .thread_destroy = tencentos_thread_destroy,
     .thread_exit = tencentos_thread_exit,
     .get_time_ms = tencentos_get_time_ms,
-    .sleep_ms = tencentos_sleep_ms
+    .sleep_ms = tencentos_sleep_ms,
+    .get_time_us = tencentos_get_time_us,
+    .mutex_trylock = tencentos_mutex_trylock,
+    .sem_timedwait = tencentos_sem_timedwait,
+    .event_create = tencentos_event_create,
+    .event_destroy = tencentos_event_destroy,
+    .event_set = tencentos_event_set,
+    .event_wait = tencentos_event_wait,
+    .critical_enter = tencentos_critical_enter,
+    .critical_exit = tencentos_critical_exit,
+    .thread_create_ex = tencentos_thread_create_ex
 };
 
 void mqtt_tencentos_tiny_init(void) {
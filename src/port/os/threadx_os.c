@@ -4,6 +4,9 @@
  * 
  * ThreadX (Azure RTOS) is a real-time operating system from Microsoft.
  * This implementation provides OS abstraction for ThreadX kernel.
+ *
+ * ThreadX never allocates control blocks itself; with MQTT_OS_STATIC they
+ * and the thread stacks come from fixed pools instead of malloc().
  */
 
 #include "mqtt_os.h"
@@ -18,15 +21,33 @@ static void threadx_free(void* ptr) {
     free(ptr);
 }
 
+typedef struct {
+    TX_THREAD thread;
+    void* stack;       /* Owned stack, NULL when the caller supplied it */
+} threadx_thread_t;
+
+#ifdef MQTT_OS_STATIC
+
+typedef uint8_t threadx_stack_t[MQTT_OS_STATIC_STACK_SIZE];
+
+MQTT_OS_POOL_DEFINE(threadx_mutex_pool, TX_MUTEX, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(threadx_sem_pool, TX_SEMAPHORE, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(threadx_event_pool, TX_EVENT_FLAGS_GROUP, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(threadx_thread_pool, threadx_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(threadx_stack_pool, threadx_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t threadx_mutex_create(void) {
-    TX_MUTEX* mutex = malloc(sizeof(TX_MUTEX));
+    TX_MUTEX* mutex = MQTT_OS_OBJ_ALLOC(threadx_mutex_pool, malloc, sizeof(TX_MUTEX));
+    if (!mutex) return NULL;
     tx_mutex_create(mutex, "mqtt_mutex", TX_NO_INHERIT);
     return (mqtt_mutex_t)mutex;
 }
 
 static void threadx_mutex_destroy(mqtt_mutex_t mutex) {
     tx_mutex_delete((TX_MUTEX*)mutex);
-    free(mutex);
+    MQTT_OS_OBJ_FREE(threadx_mutex_pool, free, mutex);
 }
 
 static int threadx_mutex_lock(mqtt_mutex_t mutex) {
@@ -38,14 +59,15 @@ static void threadx_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t threadx_sem_create(uint32_t init_count) {
-    TX_SEMAPHORE* sem = malloc(sizeof(TX_SEMAPHORE));
+    TX_SEMAPHORE* sem = MQTT_OS_OBJ_ALLOC(threadx_sem_pool, malloc, sizeof(TX_SEMAPHORE));
+    if (!sem) return NULL;
     tx_semaphore_create(sem, "mqtt_sem", init_count);
     return (mqtt_sem_t)sem;
 }
 
 static void threadx_sem_destroy(mqtt_sem_t sem) {
     tx_semaphore_delete((TX_SEMAPHORE*)sem);
-    free(sem);
+    MQTT_OS_OBJ_FREE(threadx_sem_pool, free, sem);
 }
 
 static int threadx_sem_wait(mqtt_sem_t sem) {
@@ -56,35 +78,127 @@ static void threadx_sem_post(mqtt_sem_t sem) {
     tx_semaphore_put((TX_SEMAPHORE*)sem);
 }
 
-static mqtt_thread_t threadx_thread_create(mqtt_thread_func_t func, void* arg, 
+static int threadx_mutex_trylock(mqtt_mutex_t mutex) {
+    return tx_mutex_get((TX_MUTEX*)mutex, TX_NO_WAIT) == TX_SUCCESS ? 0 : -1;
+}
+
+static ULONG threadx_ms_to_ticks(uint32_t ms) {
+    return (ULONG)(((uint64_t)ms * TX_TIMER_TICKS_PER_SECOND + 999) / 1000);
+}
+
+static int threadx_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return tx_semaphore_get((TX_SEMAPHORE*)sem, threadx_ms_to_ticks(timeout_ms)) == TX_SUCCESS ? 0 : -1;
+}
+
+#define THREADX_EVENT_FLAG 0x01
+
+static mqtt_event_t threadx_event_create(void) {
+    TX_EVENT_FLAGS_GROUP* group = MQTT_OS_OBJ_ALLOC(threadx_event_pool, malloc,
+                                                    sizeof(TX_EVENT_FLAGS_GROUP));
+    if (!group) return NULL;
+    if (tx_event_flags_create(group, "mqtt_event") != TX_SUCCESS) {
+        MQTT_OS_OBJ_FREE(threadx_event_pool, free, group);
+        return NULL;
+    }
+    return (mqtt_event_t)group;
+}
+
+static void threadx_event_destroy(mqtt_event_t event) {
+    tx_event_flags_delete((TX_EVENT_FLAGS_GROUP*)event);
+    MQTT_OS_OBJ_FREE(threadx_event_pool, free, event);
+}
+
+static void threadx_event_set(mqtt_event_t event) {
+    tx_event_flags_set((TX_EVENT_FLAGS_GROUP*)event, THREADX_EVENT_FLAG, TX_OR);
+}
+
+static int threadx_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    ULONG actual;
+    return tx_event_flags_get((TX_EVENT_FLAGS_GROUP*)event, THREADX_EVENT_FLAG, TX_OR_CLEAR,
+                              &actual, threadx_ms_to_ticks(timeout_ms)) == TX_SUCCESS ? 0 : -1;
+}
+
+static uint32_t threadx_critical_enter(void) {
+    return (uint32_t)tx_interrupt_control(TX_INT_DISABLE);
+}
+
+static void threadx_critical_exit(uint32_t state) {
+    tx_interrupt_control((UINT)state);
+}
+
+static mqtt_thread_t threadx_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                              const mqtt_thread_attr_t* attr) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    UINT priority = attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY;
+    threadx_thread_t* t = MQTT_OS_OBJ_ALLOC(threadx_thread_pool, malloc, sizeof(threadx_thread_t));
+    if (!t) return NULL;
+
+#ifdef MQTT_OS_STATIC
+    void* stack = attr->stack;
+    t->stack = NULL;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = t->stack = mqtt_os_pool_alloc(&threadx_stack_pool);
+    }
+#else
+    void* stack = t->stack = malloc(stack_size);
+#endif
+    if (!stack ||
+        tx_thread_create(&t->thread, (CHAR*)(attr->name ? attr->name : "mqtt_thread"),
+                         (VOID (*)(ULONG))func, (ULONG)arg, stack, stack_size,
+                         priority, priority, TX_NO_TIME_SLICE, TX_AUTO_START) != TX_SUCCESS) {
+        MQTT_OS_OBJ_FREE(threadx_stack_pool, free, t->stack);
+        MQTT_OS_OBJ_FREE(threadx_thread_pool, free, t);
+        return NULL;
+    }
+#ifdef TX_THREAD_SMP_MAX_CORES
+    if (attr->affinity) tx_thread_smp_core_exclude(&t->thread, ~(ULONG)attr->affinity);
+#endif
+    return (mqtt_thread_t)t;
+}
+
+static mqtt_thread_t threadx_thread_create(mqtt_thread_func_t func, void* arg,
                                            uint32_t stack_size, uint32_t priority) {
-    TX_THREAD* thread = malloc(sizeof(TX_THREAD));
-    void* stack = malloc(stack_size);
-    tx_thread_create(thread, "mqtt_thread", (VOID (*)(ULONG))func, (ULONG)arg,
-                     stack, stack_size, priority, priority, TX_NO_TIME_SLICE, TX_AUTO_START);
-    return (mqtt_thread_t)thread;
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return threadx_thread_create_ex(func, arg, &attr);
 }
 
 static void threadx_thread_destroy(mqtt_thread_t thread) {
-    /* ThreadX: thread_exit already deleted, no-op */
-    (void)thread;
+    threadx_thread_t* t = (threadx_thread_t*)thread;
+
+    /* A thread cannot delete itself, wait until thread_exit terminated it */
+    while (tx_thread_delete(&t->thread) != TX_SUCCESS) {
+        tx_thread_sleep(1);
+    }
+    MQTT_OS_OBJ_FREE(threadx_stack_pool, free, t->stack);
+    MQTT_OS_OBJ_FREE(threadx_thread_pool, free, t);
 }
 
 static void threadx_thread_exit(void) {
-    TX_THREAD* self = tx_thread_identify();
-    tx_thread_terminate(self);
-    tx_thread_delete(self);
+    tx_thread_terminate(tx_thread_identify());
 }
 
 static uint32_t threadx_get_time_ms(void) {
     return tx_time_get() * 1000 / TX_TIMER_TICKS_PER_SECOND;
 }
 
+static uint64_t threadx_get_time_us(void) {
+    /* Extend the 32-bit tick counter across wraparound */
+    static ULONG last_tick = 0;
+    static uint64_t wraps = 0;
+    UINT posture = tx_interrupt_control(TX_INT_DISABLE);
+    ULONG tick = tx_time_get();
+    if (tick < last_tick) wraps++;
+    last_tick = tick;
+    uint64_t ticks = (wraps << 32) | (uint32_t)tick;
+    tx_interrupt_control(posture);
+    return ticks * 1000000 / TX_TIMER_TICKS_PER_SECOND;
+}
+
 static void threadx_sleep_ms(uint32_t ms) {
     tx_thread_sleep(ms * TX_TIMER_TICKS_PER_SECOND / 1000);
 }
 
-static const mqtt_os_api_t threadx_os_api = {
+MQTT_OS_PORT_API(threadx_os_api) = {
     .malloc = threadx_malloc,
     .free = threadx_free,
     .mutex_create = threadx_mutex_create,
@@ -99,7 +213,17 @@ static const mqtt_os_api_t threadx_os_api = {
     .thread_destroy = threadx_thread_destroy,
     .thread_exit = threadx_thread_exit,
     .get_time_ms = threadx_get_time_ms,
-    .sleep_ms = threadx_sleep_ms
+    .sleep_ms = threadx_sleep_ms,
+    .get_time_us = threadx_get_time_us,
+    .mutex_trylock = threadx_mutex_trylock,
+    .sem_timedwait = threadx_sem_timedwait,
+    .event_create = threadx_event_create,
+    .event_destroy = threadx_event_destroy,
+    .event_set = threadx_event_set,
+    .event_wait = threadx_event_wait,
+    .critical_enter = threadx_critical_enter,
+    .critical_exit = threadx_critical_exit,
+    .thread_create_ex = threadx_thread_create_ex
 };
 
 void mqtt_threadx_init(void) {
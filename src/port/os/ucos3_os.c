@@ -4,6 +4,9 @@
  * 
  * uC/OS-III is a commercial real-time operating system from Micrium.
  * This implementation provides OS abstraction for uC/OS-III kernel.
+ *
+ * uC/OS-III never allocates kernel objects itself; with MQTT_OS_STATIC
+ * they and the task stacks come from fixed pools instead of malloc().
  */
 
 #include "mqtt_os.h"
@@ -18,9 +21,27 @@ static void ucos3_free(void* ptr) {
     free(ptr);
 }
 
+typedef struct {
+    OS_TCB tcb;
+    void* stack;       /* Owned stack, NULL when the caller supplied it */
+} ucos3_thread_t;
+
+#ifdef MQTT_OS_STATIC
+
+typedef CPU_STK ucos3_stack_t[MQTT_OS_STATIC_STACK_SIZE / sizeof(CPU_STK)];
+
+MQTT_OS_POOL_DEFINE(ucos3_mutex_pool, OS_MUTEX, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(ucos3_sem_pool, OS_SEM, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(ucos3_event_pool, OS_FLAG_GRP, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(ucos3_thread_pool, ucos3_thread_t, MQTT_OS_MAX_THREADS);
+MQTT_OS_POOL_DEFINE(ucos3_stack_pool, ucos3_stack_t, MQTT_OS_MAX_THREADS);
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t ucos3_mutex_create(void) {
-    OS_MUTEX* mutex = malloc(sizeof(OS_MUTEX));
+    OS_MUTEX* mutex = MQTT_OS_OBJ_ALLOC(ucos3_mutex_pool, malloc, sizeof(OS_MUTEX));
     OS_ERR err;
+    if (!mutex) return NULL;
     OSMutexCreate(mutex, "mqtt_mutex", &err);
     return (mqtt_mutex_t)mutex;
 }
@@ -28,7 +49,7 @@ static mqtt_mutex_t ucos3_mutex_create(void) {
 static void ucos3_mutex_destroy(mqtt_mutex_t mutex) {
     OS_ERR err;
     OSMutexDel((OS_MUTEX*)mutex, OS_OPT_DEL_ALWAYS, &err);
-    free(mutex);
+    MQTT_OS_OBJ_FREE(ucos3_mutex_pool, free, mutex);
 }
 
 static int ucos3_mutex_lock(mqtt_mutex_t mutex) {
@@ -43,8 +64,9 @@ static void ucos3_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t ucos3_sem_create(uint32_t init_count) {
-    OS_SEM* sem = malloc(sizeof(OS_SEM));
+    OS_SEM* sem = MQTT_OS_OBJ_ALLOC(ucos3_sem_pool, malloc, sizeof(OS_SEM));
     OS_ERR err;
+    if (!sem) return NULL;
     OSSemCreate(sem, "mqtt_sem", init_count, &err);
     return (mqtt_sem_t)sem;
 }
@@ -52,7 +74,7 @@ static mqtt_sem_t ucos3_sem_create(uint32_t init_count) {
 static void ucos3_sem_destroy(mqtt_sem_t sem) {
     OS_ERR err;
     OSSemDel((OS_SEM*)sem, OS_OPT_DEL_ALWAYS, &err);
-    free(sem);
+    MQTT_OS_OBJ_FREE(ucos3_sem_pool, free, sem);
 }
 
 static int ucos3_sem_wait(mqtt_sem_t sem) {
@@ -66,20 +88,118 @@ static void ucos3_sem_post(mqtt_sem_t sem) {
     OSSemPost((OS_SEM*)sem, OS_OPT_POST_1, &err);
 }
 
-static mqtt_thread_t ucos3_thread_create(mqtt_thread_func_t func, void* arg, 
-                                         uint32_t stack_size, uint32_t priority) {
-    OS_TCB* tcb = malloc(sizeof(OS_TCB));
-    CPU_STK* stack = malloc(stack_size);
+static int ucos3_mutex_trylock(mqtt_mutex_t mutex) {
+    OS_ERR err;
+    OSMutexPend((OS_MUTEX*)mutex, 0, OS_OPT_PEND_NON_BLOCKING, NULL, &err);
+    return (err == OS_ERR_NONE) ? 0 : -1;
+}
+
+/* A timeout of 0 ticks means forever in uC/OS-III, so polls must not block */
+static OS_OPT ucos3_pend_opt(uint32_t timeout_ms, OS_TICK* ticks) {
+    *ticks = (OS_TICK)(((uint64_t)timeout_ms * OSCfg_TickRate_Hz + 999) / 1000);
+    return timeout_ms == 0 ? OS_OPT_PEND_NON_BLOCKING : OS_OPT_PEND_BLOCKING;
+}
+
+static int ucos3_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    OS_ERR err;
+    OS_TICK ticks;
+    OS_OPT opt = ucos3_pend_opt(timeout_ms, &ticks);
+    OSSemPend((OS_SEM*)sem, ticks, opt, NULL, &err);
+    return (err == OS_ERR_NONE) ? 0 : -1;
+}
+
+#define UCOS3_EVENT_FLAG ((OS_FLAGS)0x01)
+
+static mqtt_event_t ucos3_event_create(void) {
+    OS_FLAG_GRP* group = MQTT_OS_OBJ_ALLOC(ucos3_event_pool, malloc, sizeof(OS_FLAG_GRP));
+    OS_ERR err;
+    if (!group) return NULL;
+    OSFlagCreate(group, "mqtt_event", 0, &err);
+    if (err != OS_ERR_NONE) {
+        MQTT_OS_OBJ_FREE(ucos3_event_pool, free, group);
+        return NULL;
+    }
+    return (mqtt_event_t)group;
+}
+
+static void ucos3_event_destroy(mqtt_event_t event) {
+    OS_ERR err;
+    OSFlagDel((OS_FLAG_GRP*)event, OS_OPT_DEL_ALWAYS, &err);
+    MQTT_OS_OBJ_FREE(ucos3_event_pool, free, event);
+}
+
+static void ucos3_event_set(mqtt_event_t event) {
+    OS_ERR err;
+    OSFlagPost((OS_FLAG_GRP*)event, UCOS3_EVENT_FLAG, OS_OPT_POST_FLAG_SET, &err);
+}
+
+static int ucos3_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    OS_ERR err;
+    OS_TICK ticks;
+    OS_OPT opt = ucos3_pend_opt(timeout_ms, &ticks);
+    OSFlagPend((OS_FLAG_GRP*)event, UCOS3_EVENT_FLAG, ticks,
+               opt | OS_OPT_PEND_FLAG_SET_ANY | OS_OPT_PEND_FLAG_CONSUME, NULL, &err);
+    return (err == OS_ERR_NONE) ? 0 : -1;
+}
+
+static uint32_t ucos3_critical_enter(void) {
+    return (uint32_t)CPU_SR_Save();
+}
+
+static void ucos3_critical_exit(uint32_t state) {
+    CPU_SR_Restore((CPU_SR)state);
+}
+
+static mqtt_thread_t ucos3_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                            const mqtt_thread_attr_t* attr) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    CPU_STK_SIZE depth = stack_size / sizeof(CPU_STK);  /* OSTaskCreate() counts CPU_STK elements */
     OS_ERR err;
-    OSTaskCreate(tcb, "mqtt_task", (OS_TASK_PTR)func, arg, priority,
-                 stack, stack_size / 10, stack_size, 0, 0, NULL,
+    ucos3_thread_t* t = MQTT_OS_OBJ_ALLOC(ucos3_thread_pool, malloc, sizeof(ucos3_thread_t));
+    if (!t) return NULL;
+
+#ifdef MQTT_OS_STATIC
+    CPU_STK* stack = attr->stack;
+    t->stack = NULL;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = t->stack = mqtt_os_pool_alloc(&ucos3_stack_pool);
+    }
+#else
+    CPU_STK* stack = t->stack = malloc(stack_size);
+#endif
+    if (!stack) {
+        MQTT_OS_OBJ_FREE(ucos3_thread_pool, free, t);
+        return NULL;
+    }
+
+    OSTaskCreate(&t->tcb, (CPU_CHAR*)(attr->name ? attr->name : "mqtt_task"), (OS_TASK_PTR)func, arg,
+                 attr->priority ? attr->priority : MQTT_THREAD_DEFAULT_PRIORITY,
+                 stack, depth / 10, depth, 0, 0, NULL,
                  OS_OPT_TASK_STK_CHK | OS_OPT_TASK_STK_CLR, &err);
-    return (mqtt_thread_t)tcb;
+    if (err != OS_ERR_NONE) {
+        MQTT_OS_OBJ_FREE(ucos3_stack_pool, free, t->stack);
+        MQTT_OS_OBJ_FREE(ucos3_thread_pool, free, t);
+        return NULL;
+    }
+    return (mqtt_thread_t)t;
+}
+
+static mqtt_thread_t ucos3_thread_create(mqtt_thread_func_t func, void* arg,
+                                         uint32_t stack_size, uint32_t priority) {
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return ucos3_thread_create_ex(func, arg, &attr);
 }
 
 static void ucos3_thread_destroy(mqtt_thread_t thread) {
-    /* uC/OS-III thread_exit already deleted, no-op */
-    (void)thread;
+    ucos3_thread_t* t = (ucos3_thread_t*)thread;
+    OS_ERR err;
+
+    /* The TCB and stack stay in use until thread_exit has deleted the task */
+    while (t->tcb.TaskState != OS_TASK_STATE_DEL) {
+        OSTimeDly(1, OS_OPT_TIME_DLY, &err);
+    }
+    MQTT_OS_OBJ_FREE(ucos3_stack_pool, free, t->stack);
+    MQTT_OS_OBJ_FREE(ucos3_thread_pool, free, t);
 }
 
 static void ucos3_thread_exit(void) {
@@ -92,12 +212,36 @@ static uint32_t ucos3_get_time_ms(void) {
     return OSTimeGet(&err);
 }
 
+static uint64_t ucos3_get_time_us(void) {
+#if (CPU_CFG_TS_64_EN == DEF_ENABLED)
+    /* CPU timestamp timer, usually the cycle counter. Divide first: at
+     * hundreds of MHz ts * 1000000 overflows 64 bits within hours */
+    CPU_ERR err;
+    uint64_t ts = CPU_TS_Get64();
+    uint64_t freq = CPU_TS_TmrFreqGet(&err);
+    return (ts / freq) * 1000000 + (ts % freq) * 1000000 / freq;
+#else
+    /* Extend the 32-bit tick counter across wraparound */
+    static OS_TICK last_tick = 0;
+    static uint64_t wraps = 0;
+    OS_ERR err;
+    CPU_SR_ALLOC();
+    CPU_CRITICAL_ENTER();
+    OS_TICK tick = OSTimeGet(&err);
+    if (tick < last_tick) wraps++;
+    last_tick = tick;
+    uint64_t ticks = (wraps << 32) | tick;
+    CPU_CRITICAL_EXIT();
+    return ticks * 1000000 / OSCfg_TickRate_Hz;
+#endif
+}
+
 static void ucos3_sleep_ms(uint32_t ms) {
     OS_ERR err;
     OSTimeDlyHMSM(0, 0, 0, ms, OS_OPT_TIME_HMSM_STRICT, &err);
 }
 
-static const mqtt_os_api_t ucos3_os_api = {
+MQTT_OS_PORT_API(ucos3_os_api) = {
     .malloc = ucos3_malloc,
     .free = ucos3_free,
     .mutex_create = ucos3_mutex_create,
@@ -112,7 +256,17 @@ static const mqtt_os_api_t ucos3_os_api = {
     .thread_destroy = ucos3_thread_destroy,
     .thread_exit = ucos3_thread_exit,
     .get_time_ms = ucos3_get_time_ms,
-    .sleep_ms = ucos3_sleep_ms
+    .sleep_ms = ucos3_sleep_ms,
+    .get_time_us = ucos3_get_time_us,
+    .mutex_trylock = ucos3_mutex_trylock,
+    .sem_timedwait = ucos3_sem_timedwait,
+    .event_create = ucos3_event_create,
+    .event_destroy = ucos3_event_destroy,
+    .event_set = ucos3_event_set,
+    .event_wait = ucos3_event_wait,
+    .critical_enter = ucos3_critical_enter,
+    .critical_exit = ucos3_critical_exit,
+    .thread_create_ex = ucos3_thread_create_ex
 };
 
 void mqtt_ucos3_init(void) {
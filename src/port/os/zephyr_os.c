@@ -4,6 +4,10 @@
  * 
  * Zephyr is a scalable real-time operating system from Linux Foundation.
  * This implementation provides OS abstraction for Zephyr kernel.
+ *
+ * With MQTT_OS_STATIC, kernel objects come from fixed pools and thread
+ * stacks from a K_THREAD_STACK_ARRAY_DEFINE area, so no k_malloc() heap
+ * is needed.
  */
 
 #include "mqtt_os.h"
@@ -17,14 +21,34 @@ static void zephyr_free(void* ptr) {
     k_free(ptr);
 }
 
+typedef struct {
+    struct k_thread thread;
+    void* stack;       /* Owned stack, NULL when the caller supplied it */
+} zephyr_thread_t;
+
+#ifdef MQTT_OS_STATIC
+
+MQTT_OS_POOL_DEFINE(zephyr_mutex_pool, struct k_mutex, MQTT_OS_MAX_MUTEXES);
+MQTT_OS_POOL_DEFINE(zephyr_sem_pool, struct k_sem, MQTT_OS_MAX_SEMS);
+MQTT_OS_POOL_DEFINE(zephyr_event_pool, struct k_sem, MQTT_OS_MAX_EVENTS);
+MQTT_OS_POOL_DEFINE(zephyr_thread_pool, zephyr_thread_t, MQTT_OS_MAX_THREADS);
+
+/* Stacks need the kernel's alignment and guard layout */
+K_THREAD_STACK_ARRAY_DEFINE(zephyr_stacks, MQTT_OS_MAX_THREADS, MQTT_OS_STATIC_STACK_SIZE);
+static mqtt_os_pool_t zephyr_stack_pool = {
+    zephyr_stacks, K_THREAD_STACK_LEN(MQTT_OS_STATIC_STACK_SIZE), MQTT_OS_MAX_THREADS, 0
+};
+
+#endif /* MQTT_OS_STATIC */
+
 static mqtt_mutex_t zephyr_mutex_create(void) {
-    struct k_mutex* mutex = k_malloc(sizeof(struct k_mutex));
-    k_mutex_init(mutex);
+    struct k_mutex* mutex = MQTT_OS_OBJ_ALLOC(zephyr_mutex_pool, k_malloc, sizeof(struct k_mutex));
+    if (mutex) k_mutex_init(mutex);
     return (mqtt_mutex_t)mutex;
 }
 
 static void zephyr_mutex_destroy(mqtt_mutex_t mutex) {
-    k_free(mutex);
+    MQTT_OS_OBJ_FREE(zephyr_mutex_pool, k_free, mutex);
 }
 
 static int zephyr_mutex_lock(mqtt_mutex_t mutex) {
@@ -36,13 +60,13 @@ static void zephyr_mutex_unlock(mqtt_mutex_t mutex) {
 }
 
 static mqtt_sem_t zephyr_sem_create(uint32_t init_count) {
-    struct k_sem* sem = k_malloc(sizeof(struct k_sem));
-    k_sem_init(sem, init_count, UINT_MAX);
+    struct k_sem* sem = MQTT_OS_OBJ_ALLOC(zephyr_sem_pool, k_malloc, sizeof(struct k_sem));
+    if (sem) k_sem_init(sem, init_count, UINT_MAX);
     return (mqtt_sem_t)sem;
 }
 
 static void zephyr_sem_destroy(mqtt_sem_t sem) {
-    k_free(sem);
+    MQTT_OS_OBJ_FREE(zephyr_sem_pool, k_free, sem);
 }
 
 static int zephyr_sem_wait(mqtt_sem_t sem) {
@@ -53,20 +77,93 @@ static void zephyr_sem_post(mqtt_sem_t sem) {
     k_sem_give((struct k_sem*)sem);
 }
 
-static mqtt_thread_t zephyr_thread_create(mqtt_thread_func_t func, void* arg, 
+static int zephyr_mutex_trylock(mqtt_mutex_t mutex) {
+    return k_mutex_lock((struct k_mutex*)mutex, K_NO_WAIT) == 0 ? 0 : -1;
+}
+
+static int zephyr_sem_timedwait(mqtt_sem_t sem, uint32_t timeout_ms) {
+    return k_sem_take((struct k_sem*)sem, K_MSEC(timeout_ms)) == 0 ? 0 : -1;
+}
+
+/* A semaphore limited to one is an auto-reset event */
+static mqtt_event_t zephyr_event_create(void) {
+    struct k_sem* event = MQTT_OS_OBJ_ALLOC(zephyr_event_pool, k_malloc, sizeof(struct k_sem));
+    if (event) k_sem_init(event, 0, 1);
+    return (mqtt_event_t)event;
+}
+
+static void zephyr_event_destroy(mqtt_event_t event) {
+    MQTT_OS_OBJ_FREE(zephyr_event_pool, k_free, event);
+}
+
+static void zephyr_event_set(mqtt_event_t event) {
+    k_sem_give((struct k_sem*)event);
+}
+
+static int zephyr_event_wait(mqtt_event_t event, uint32_t timeout_ms) {
+    return k_sem_take((struct k_sem*)event, K_MSEC(timeout_ms)) == 0 ? 0 : -1;
+}
+
+static uint32_t zephyr_critical_enter(void) {
+    return irq_lock();
+}
+
+static void zephyr_critical_exit(uint32_t state) {
+    irq_unlock(state);
+}
+
+static mqtt_thread_t zephyr_thread_create_ex(mqtt_thread_func_t func, void* arg,
+                                             const mqtt_thread_attr_t* attr) {
+    uint32_t stack_size = attr->stack_size ? attr->stack_size : MQTT_THREAD_DEFAULT_STACK_SIZE;
+    int priority = attr->priority ? (int)attr->priority : MQTT_THREAD_DEFAULT_PRIORITY;
+    zephyr_thread_t* t = MQTT_OS_OBJ_ALLOC(zephyr_thread_pool, k_malloc, sizeof(zephyr_thread_t));
+    if (!t) return NULL;
+
+#ifdef MQTT_OS_STATIC
+    k_thread_stack_t* stack = attr->stack;
+    t->stack = NULL;
+    if (!stack && stack_size <= MQTT_OS_STATIC_STACK_SIZE) {
+        stack = t->stack = mqtt_os_pool_alloc(&zephyr_stack_pool);
+    }
+#else
+    k_thread_stack_t* stack = t->stack = k_malloc(stack_size);
+#endif
+    if (!stack) {
+        MQTT_OS_OBJ_FREE(zephyr_thread_pool, k_free, t);
+        return NULL;
+    }
+
+    /* Created suspended so the CPU mask can be applied before it runs */
+    k_tid_t tid = k_thread_create(&t->thread, stack, stack_size, (k_thread_entry_t)func,
+                                  arg, NULL, NULL, priority, 0, K_FOREVER);
+#ifdef CONFIG_THREAD_NAME
+    if (attr->name) k_thread_name_set(tid, attr->name);
+#endif
+#ifdef CONFIG_SCHED_CPU_MASK
+    if (attr->affinity) {
+        k_thread_cpu_mask_clear(tid);
+        for (int cpu = 0; cpu < CONFIG_MP_MAX_NUM_CPUS; cpu++) {
+            if (attr->affinity & (1u << cpu)) k_thread_cpu_mask_enable(tid, cpu);
+        }
+    }
+#endif
+    k_thread_start(tid);
+    return (mqtt_thread_t)t;
+}
+
+static mqtt_thread_t zephyr_thread_create(mqtt_thread_func_t func, void* arg,
                                           uint32_t stack_size, uint32_t priority) {
-    k_tid_t thread = k_thread_create(k_malloc(sizeof(struct k_thread)),
-                                     k_malloc(stack_size),
-                                     stack_size,
-                                     (k_thread_entry_t)func,
-                                     arg, NULL, NULL,
-                                     priority, 0, K_NO_WAIT);
-    return (mqtt_thread_t)thread;
+    mqtt_thread_attr_t attr = { .stack_size = stack_size, .priority = priority };
+    return zephyr_thread_create_ex(func, arg, &attr);
 }
 
 static void zephyr_thread_destroy(mqtt_thread_t thread) {
-    /* Zephyr k_thread_abort already aborts, no-op */
-    (void)thread;
+    zephyr_thread_t* t = (zephyr_thread_t*)thread;
+
+    /* The stack and thread object stay in use until the thread has aborted */
+    k_thread_join(&t->thread, K_FOREVER);
+    MQTT_OS_OBJ_FREE(zephyr_stack_pool, k_free, t->stack);
+    MQTT_OS_OBJ_FREE(zephyr_thread_pool, k_free, t);
 }
 
 static void zephyr_thread_exit(void) {
@@ -77,11 +174,19 @@ static uint32_t zephyr_get_time_ms(void) {
     return k_uptime_get_32();
 }
 
+static uint64_t zephyr_get_time_us(void) {
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+    return k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
+
 static void zephyr_sleep_ms(uint32_t ms) {
     k_msleep(ms);
 }
 
-static const mqtt_os_api_t zephyr_os_api = {
+MQTT_OS_PORT_API(zephyr_os_api) = {
     .malloc = zephyr_malloc,
     .free = zephyr_free,
     .mutex_create = zephyr_mutex_create,
@@ -96,7 +201,17 @@ static const mqtt_os_api_t zephyr_os_api = {
     .thread_destroy = zephyr_thread_destroy,
     .thread_exit = zephyr_thread_exit,
     .get_time_ms = zephyr_get_time_ms,
-    .sleep_ms = zephyr_sleep_ms
+    .sleep_ms = zephyr_sleep_ms,
+    .get_time_us = zephyr_get_time_us,
+    .mutex_trylock = zephyr_mutex_trylock,
+    .sem_timedwait = zephyr_sem_timedwait,
+    .event_create = zephyr_event_create,
+    .event_destroy = zephyr_event_destroy,
+    .event_set = zephyr_event_set,
+    .event_wait = zephyr_event_wait,
+    .critical_enter = zephyr_critical_enter,
+    .critical_exit = zephyr_critical_exit,
+    .thread_create_ex = zephyr_thread_create_ex
 };
 
 void mqtt_zephyr_init(void) {
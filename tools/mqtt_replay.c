@@ -0,0 +1,163 @@
+/**
+ * @file mqtt_replay.c
+ * @brief Replay a wire capture through the client framer and dispatch
+ *
+ * Reads a capture written by mqtt_capture_start_file() and feeds the
+ * inbound byte stream back through mqtt_client_feed(), either at the
+ * original pace or as fast as possible, then reports dispatch throughput.
+ *
+ * Usage: mqtt_replay [-m] [-c connection] [-n loops] capture.bin
+ *   -m   replay at maximum speed instead of the recorded pace
+ *   -c   only replay the given connection number
+ *   -n   repeat the capture n times (useful with -m for profiling)
+ */
+
+#include "mqtt.h"
+#include "mqtt_capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+void mqtt_posix_init(void);
+
+static uint32_t g_messages = 0;
+static uint64_t g_payload_bytes = 0;
+
+static void on_message(const char* topic, const uint8_t* payload, size_t len, void* user_data) {
+    (void)topic;
+    (void)payload;
+    (void)user_data;
+    g_messages++;
+    g_payload_bytes += len;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-m] [-c connection] [-n loops] capture.bin\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int max_speed = 0;
+    int only_conn = -1;
+    int loops = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "mc:n:")) != -1) {
+        switch (opt) {
+        case 'm': max_speed = 1; break;
+        case 'c': only_conn = atoi(optarg); break;
+        case 'n': loops = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc || loops < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[optind], "rb");
+    if (!file) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    uint8_t file_hdr[MQTT_CAPTURE_FILE_HDR_LEN];
+    if (fread(file_hdr, 1, sizeof(file_hdr), file) != sizeof(file_hdr) ||
+        memcmp(file_hdr, MQTT_CAPTURE_MAGIC, 5) != 0 || file_hdr[5] != MQTT_CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a capture file\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+
+    mqtt_config_t config = {0};
+    config.client_id = "replay";
+    config.msg_cb = on_message;
+
+    mqtt_posix_init();
+    mqtt_client_t* client = mqtt_client_create_detached(&config);
+    if (!client) {
+        fclose(file);
+        return 1;
+    }
+
+    size_t data_cap = 4096;
+    uint8_t* data = malloc(data_cap);
+    uint64_t records = 0, bytes = 0, busy_us = 0;
+    uint64_t start = now_us();
+    int errors = 0;
+
+    for (int loop = 0; loop < loops && data; loop++) {
+        uint64_t first_ts = 0, replay_start = now_us();
+        int have_first = 0;
+
+        fseek(file, MQTT_CAPTURE_FILE_HDR_LEN, SEEK_SET);
+        for (;;) {
+            uint8_t hdr[MQTT_CAPTURE_REC_HDR_LEN];
+            mqtt_capture_record_t rec;
+
+            if (fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) break;
+            mqtt_capture_decode(hdr, &rec);
+
+            if (rec.len > data_cap) {
+                uint8_t* grown = realloc(data, rec.len);
+                if (!grown) break;
+                data = grown;
+                data_cap = rec.len;
+            }
+            if (rec.len > 0 && fread(data, 1, rec.len, file) != rec.len) break;
+            if (only_conn >= 0 && rec.connection != only_conn) continue;
+
+            if (rec.type == MQTT_CAPTURE_CONNECT) {
+                /* Fresh connection: discard any partial packet of the previous one */
+                mqtt_client_feed_reset(client);
+                continue;
+            }
+            if (rec.type != MQTT_CAPTURE_RECV) continue;
+
+            if (!have_first) {
+                first_ts = rec.timestamp_us;
+                have_first = 1;
+            }
+            if (!max_speed) {
+                uint64_t due = replay_start + (rec.timestamp_us - first_ts);
+                uint64_t now = now_us();
+                if (due > now) usleep((useconds_t)(due - now));
+            }
+
+            uint64_t t0 = now_us();
+            if (mqtt_client_feed(client, data, rec.len) != 0) {
+                errors++;
+                mqtt_client_feed_reset(client);
+            }
+            busy_us += now_us() - t0;
+            records++;
+            bytes += rec.len;
+        }
+    }
+
+    uint64_t wall_us = now_us() - start;
+    double busy_s = busy_us > 0 ? busy_us / 1e6 : 1e-6;
+    mqtt_stats_t stats;
+    mqtt_client_get_stats(client, &stats);
+
+    printf("records:        %llu\n", (unsigned long long)records);
+    printf("bytes:          %llu\n", (unsigned long long)bytes);
+    printf("packets:        %u\n", stats.rx_packets);
+    printf("publishes:      %u (%llu payload bytes)\n", g_messages, (unsigned long long)g_payload_bytes);
+    printf("framing errors: %d\n", errors);
+    printf("wall time:      %.3f s\n", wall_us / 1e6);
+    printf("dispatch time:  %.3f s (%.0f packets/s, %.2f MB/s)\n",
+           busy_us / 1e6, stats.rx_packets / busy_s, bytes / busy_s / 1e6);
+
+    free(data);
+    mqtt_client_destroy(client);
+    fclose(file);
+    return 0;
+}